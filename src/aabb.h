@@ -57,6 +57,7 @@ public:
 	const MATHVECTOR <T, 3> & GetPos() const {return pos;}
 	const MATHVECTOR <T, 3> & GetSize() const {return size;}
 	const MATHVECTOR <T, 3> & GetCenter() const {return center;}
+	float GetRadius() const {return radius;}
 
 	void DebugPrint(std::ostream & o) const
 	{
@@ -21,6 +21,7 @@
 #define _AABB_SPACE_PARTITIONING_H
 
 #include "aabb.h"
+#include "frustumcull.h"
 #include "mathvector.h"
 
 #include <list>
@@ -84,6 +85,7 @@ public:
 	void Add(DATATYPE & object, const AABB <float> & newaabb)
 	{
 		objects.push_back(std::pair <DATATYPE, AABB <float> > (object, newaabb));
+		spheres.Add(newaabb.GetCenter(), newaabb.GetRadius());
 		if (objects.size() == 1) //don't combine if this is the first object, otherwise the AABB would be forced to include (0,0,0)
 			bbox = newaabb;
 		else
@@ -109,6 +111,8 @@ public:
 		{
 			objects.erase(*i);
 		}
+		if (!todel.empty())
+			PackSpheres();
 
 		//if we have children, pass it on
 		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
@@ -136,6 +140,8 @@ public:
 		{
 			objects.erase(*i);
 		}
+		if (!todel.empty())
+			PackSpheres();
 
 		//if we have children, pass it on
 		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
@@ -184,9 +190,52 @@ public:
 		}
 	}
 
+	///run a query for objects that intersect the frustum, the objects of a node are tested four at a time
+	template <typename U>
+	void Query(const FRUSTUM & frustum, U &outputlist, bool testChildren=true) const
+	{
+		if (objects.size() > 1 && testChildren)
+		{
+			unsigned char stack_visible[256];
+			std::vector <unsigned char> heap_visible;
+			unsigned char * visible = stack_visible;
+			if (objects.size() > 256)
+			{
+				heap_visible.resize(objects.size());
+				visible = &heap_visible[0];
+			}
+
+			spheres.Cull(frustum, visible);
+			for (unsigned int i = 0; i < objects.size(); ++i)
+			{
+				if (visible[i])
+				{
+					outputlist.push_back(objects[i].first);
+				}
+			}
+		}
+		else
+		{
+			for (typename objectlist_type::const_iterator i = objects.begin(); i != objects.end(); ++i)
+			{
+				outputlist.push_back(i->first);
+			}
+		}
+
+		for (typename childrenlist_type::const_iterator i = children.begin(); i != children.end(); ++i)
+		{
+			AABB<float>::INTERSECTION intersection = i->GetBBOX().Intersect(frustum);
+
+			if (intersection != AABB<float>::OUT)
+			{
+				i->Query(frustum, outputlist, intersection == AABB<float>::INTERSECT);
+			}
+		}
+	}
+
 	bool Empty() const {return (objects.empty() && children.empty());}
 
-	void Clear() {objects.clear(); children.clear();}
+	void Clear() {objects.clear(); spheres.Clear(); children.clear();}
 
 	///traverse the entire tree putting pointers to all DATATYPE objects into the given outputlist
 	void GetContainedObjects(std::list <DATATYPE *> & outputlist)
@@ -208,11 +257,21 @@ private:
 	typedef std::vector <std::pair <DATATYPE, AABB <float> > > objectlist_type;
 	typedef std::vector <AABB_SPACE_PARTITIONING_NODE> childrenlist_type;
 	objectlist_type objects;
+	FRUSTUMCULL spheres; ///< bounding spheres of the objects
 	childrenlist_type children;
 	AABB <float> bbox;
 
 	const AABB <float> & GetBBOX() const {return bbox;}
 
+	void PackSpheres()
+	{
+		spheres.Clear();
+		for (typename objectlist_type::const_iterator i = objects.begin(); i != objects.end(); ++i)
+		{
+			spheres.Add(i->second.GetCenter(), i->second.GetRadius());
+		}
+	}
+
 	///recursively send all objects and all childrens' objects to the target node, clearing out everything else
 	void CollapseTo(AABB_SPACE_PARTITIONING_NODE & collapse_target)
 	{
@@ -223,6 +282,7 @@ private:
 				collapse_target.Add(i->first, i->second);
 			}
 			objects.clear();
+			spheres.Clear();
 		}
 
 		for (typename childrenlist_type::iterator i = children.begin(); i != children.end(); ++i)
@@ -319,6 +379,7 @@ private:
 
 		//we've given away all of our objects; clear them out
 		objects.clear();
+		spheres.Clear();
 
 		//count objects that belong to our children
 		int child1obj = children.front().objects.size();
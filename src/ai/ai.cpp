@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "ai.h"
+#include "jobsystem.h"
 #include <cassert>
 // AI implementations:
 #include "ai_car_standard.h"
@@ -82,12 +83,47 @@ void AI::clear_cars()
 	AI_Cars.clear();
 }
 
-void AI::update(float dt, const std::list <CAR> & othercars)
+struct AI_Update
 {
+	std::vector <AI_Car*> & cars;
+	const AI_Traffic & traffic;
+	float dt;
+
+	AI_Update(std::vector <AI_Car*> & cars, const AI_Traffic & traffic, float dt) :
+		cars(cars), traffic(traffic), dt(dt)
+	{
+		// ctor
+	}
+
+	void operator()(int begin, int end)
+	{
+		for (int i = begin; i < end; i++)
+		{
+			cars[i]->Update(dt, traffic);
+		}
+	}
+};
+
+void AI::update(float dt, const std::list <CAR> & othercars, JobSystem * jobs)
+{
+	// the cars are read through this snapshot only, nothing an update writes is seen by the others
+	traffic.Update(othercars);
+
+	parallel_cars.clear();
 	int size = AI_Cars.size();
 	for (int i = 0; i < size; i++)
 	{
-		AI_Cars[i]->Update(dt, othercars);
+		if (jobs && AI_Cars[i]->IsThreadSafe())
+			parallel_cars.push_back(AI_Cars[i]);
+		else
+			AI_Cars[i]->Update(dt, traffic);
+	}
+
+	// debug visualization only records into the AI cars here, the scene nodes are written by Visualize
+	if (!parallel_cars.empty())
+	{
+		AI_Update body(parallel_cars, traffic, dt);
+		jobs->ParallelFor(0, parallel_cars.size(), 1, body);
 	}
 }
 
@@ -21,19 +21,23 @@
 #define _AI_H
 
 #include "ai_car.h"
+#include "ai_traffic.h"
 #include <string>
 #include <vector>
 #include <map>
 
 class AI_Factory;
+class JobSystem;
 
 /// Manages all AI cars.
 class AI
 {
 private:
 	std::vector <AI_Car*> AI_Cars;
+	std::vector <AI_Car*> parallel_cars; ///< the cars updated on jobs, rebuilt every update
 	std::map <std::string, AI_Factory*> AI_Factories;
 	std::vector <float> empty_input;
+	AI_Traffic traffic; ///< rebuilt every update, shared by all AI cars
 
 public:
 	AI();
@@ -42,12 +46,15 @@ public:
 	void add_car(CAR * car, float difficulty, const std::string & type = default_ai_type);
 	void remove_car(CAR * car);
 	void clear_cars();
-	void update(float dt, const std::list <CAR> & othercars);
+	/// all cars see the snapshot of othercars taken at the start of the update and only write
+	/// their own state, so with jobs they are updated in parallel with the same results
+	void update(float dt, const std::list <CAR> & othercars, JobSystem * jobs = 0);
 	const std::vector <float>& GetInputs(CAR * car) const; ///< Returns an empty vector if the car isn't AI-controlled.
 
 	void AddAIFactory(const std::string& type_name, AI_Factory* factory);
 	std::vector<std::string> ListFactoryTypes();
 
+	/// update the debug drawables from the last update, call from the main thread
 	void Visualize();
 
 	static const std::string default_ai_type;
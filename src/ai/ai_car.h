@@ -26,6 +26,7 @@
 #include <list>
 
 class CAR;
+class AI_Traffic;
 
 /// AI Car controller interface.
 class AI_Car
@@ -48,7 +49,13 @@ public:
 	float						GetDifficulty() { return difficulty; }
 	const std::vector<float>&	GetInputs() { return inputs; }
 
-	virtual void Update(float dt, const std::list<CAR>& othercars) = 0;
+	/// traffic holds the state of all cars at the start of the tick
+	virtual void Update(float dt, const AI_Traffic& traffic) = 0;
+
+	/// Return true if Update may run concurrently with the updates of the other cars,
+	/// that is if it only reads shared state and writes to this object.
+	/// Implementations are updated serially unless they opt in.
+	virtual bool IsThreadSafe() const { return false; }
 
 	/// This is optional for drawing debug stuff.
 	/// It will only be called, when VISUALIZE_AI_DEBUG macro is defined.
@@ -111,13 +111,13 @@ float AI_Car_Experimental::RateLimit(float old_value, float new_value, float rat
 		return new_value;
 }
 
-void AI_Car_Experimental::Update(float dt, const std::list <CAR> & checkcars)
+void AI_Car_Experimental::Update(float dt, const AI_Traffic & traffic)
 {
 	float lastThrottle = inputs[CARINPUT::THROTTLE];
 	float lastBreak = inputs[CARINPUT::BRAKE];
 	fill(inputs.begin(), inputs.end(), 0);
 
-	analyzeOthers(dt, checkcars);
+	analyzeOthers(dt, traffic);
 	updateGasBrake();
 	updateSteer();
 	float rateLimit = THROTTLE_RATE_LIMIT * dt;
@@ -761,14 +761,6 @@ void AI_Car_Experimental::updateSteer()
 
 ///note that carposition must be in patch space
 ///returns distance from left side of the track
-float AI_Car_Experimental::GetHorizontalDistanceAlongPatch(const BEZIER & patch, MATHVECTOR <float, 3> carposition)
-{
-	MATHVECTOR <float, 3> leftside = (patch.GetPoint(0,0) + patch.GetPoint(3,0))*0.5;
-	MATHVECTOR <float, 3> rightside = (patch.GetPoint(0,3) + patch.GetPoint(3,3))*0.5;
-	MATHVECTOR <float, 3> patchwidthvector = rightside - leftside;
-	return patchwidthvector.Normalize().dot(carposition-leftside);
-}
-
 float AI_Car_Experimental::RampBetween(float val, float startat, float endat)
 {
 	assert(endat > startat);
@@ -780,7 +772,7 @@ float AI_Car_Experimental::brakeFromOthers(float speed_diff)
 	const float nobiasdiff = 30;
 	const float fullbiasdiff = 0;
 	const float horizontal_care = 2.5; //meters to left and right which we'll brake for
-	const float startateta = 10.0;
+	const float startateta = AI_Awareness::startateta;
 	const float fullbrakeeta = 1.0;
 	const float startatdistance = 10.0;
 	const float fullbrakedistance = 4.0;
@@ -788,14 +780,16 @@ float AI_Car_Experimental::brakeFromOthers(float speed_diff)
 	float mineta = 1000;
 	float mindistance = 1000;
 
-	for (std::map <const CAR *, AI_Car_Experimental::OTHERCARINFO>::iterator i = othercars.begin(); i != othercars.end(); ++i)
+	const std::vector <int> & nearbycars = awareness.GetNearbyCars();
+	for (std::vector <int>::const_iterator n = nearbycars.begin(); n != nearbycars.end(); ++n)
 	{
-		if (i->second.active && std::abs(i->second.horizontal_distance) < horizontal_care)
+		const AI_Awareness::OTHERCARINFO & info = awareness.GetInfo(*n);
+		if (info.active && std::abs(info.horizontal_distance) < horizontal_care)
 		{
-			if (i->second.fore_distance < mindistance)
+			if (info.fore_distance < mindistance)
 			{
-				mindistance = i->second.fore_distance;
-				mineta = i->second.eta;
+				mindistance = info.fore_distance;
+				mineta = info.eta;
 			}
 		}
 	}
@@ -828,105 +822,9 @@ float AI_Car_Experimental::brakeFromOthers(float speed_diff)
 	return bias;
 }
 
-void AI_Car_Experimental::analyzeOthers(float dt, const std::list <CAR> & checkcars)
+void AI_Car_Experimental::analyzeOthers(float dt, const AI_Traffic & traffic)
 {
-	//const float speed = std::max(1.0f,car->GetVelocity().Magnitude());
-	const float half_carlength = 1.25; //in meters
-
-	//std::cout << speed << ": " << authority << std::endl;
-
-	//const MATHVECTOR <float, 3> steer_right_axis = direction::Right;
-	const MATHVECTOR <float, 3> throttle_axis = direction::Forward;
-
-#ifdef VISUALIZE_AI_DEBUG
-	//avoidancedraw->ClearLine();
-#endif
-
-	for (std::list <CAR>::const_iterator i = checkcars.begin(); i != checkcars.end(); ++i)
-	{
-		if (&(*i) != car)
-		{
-			struct AI_Car_Experimental::OTHERCARINFO & info = othercars[&(*i)];
-
-			//find direction of other cars in our frame
-			MATHVECTOR <float, 3> relative_position = i->GetCenterOfMassPosition() - car->GetCenterOfMassPosition();
-			(-car->GetOrientation()).RotateVector(relative_position);
-
-			//std::cout << relative_position.dot(throttle_axis) << ", " << relative_position.dot(steer_right_axis) << std::endl;
-
-			//only make a move if the other car is within our distance limit
-			float fore_position = relative_position.dot(throttle_axis);
-			//float speed_diff = i->GetVelocity().dot(throttle_axis) - car->GetVelocity().dot(throttle_axis); //positive if other car is faster
-
-			MATHVECTOR <float, 3> myvel = car->GetVelocity();
-			MATHVECTOR <float, 3> othervel = i->GetVelocity();
-			(-car->GetOrientation()).RotateVector(myvel);
-			(-i->GetOrientation()).RotateVector(othervel);
-			float speed_diff = othervel.dot(throttle_axis) - myvel.dot(throttle_axis); //positive if other car is faster
-
-			//std::cout << speed_diff << std::endl;
-			//float distancelimit = clamp(distancelimitcoeff*-speed_diff, distancelimitmin, distancelimitmax);
-			const float fore_position_offset = -half_carlength;
-			if (fore_position > fore_position_offset)// && fore_position < distancelimit) //only pay attention to cars roughly in front of us
-			{
-				//float horizontal_distance = relative_position.dot(steer_right_axis); //fallback method if not on a patch
-				//float orig_horiz = horizontal_distance;
-
-				const BEZIER * othercarpatch = GetCurrentPatch(&(*i));
-				const BEZIER * mycarpatch = GetCurrentPatch(car);
-
-				if (othercarpatch && mycarpatch)
-				{
-					float my_track_placement = GetHorizontalDistanceAlongPatch(*mycarpatch, TransformToPatchspace(car->GetCenterOfMassPosition()));
-					float their_track_placement = GetHorizontalDistanceAlongPatch(*othercarpatch, TransformToPatchspace(i->GetCenterOfMassPosition()));
-
-					float speed_diff_denom = clamp(speed_diff, -100, -0.01);
-					float eta = (fore_position-fore_position_offset)/-speed_diff_denom;
-
-					info.fore_distance = fore_position;
-
-					if (!info.active)
-						info.eta = eta;
-					else
-						info.eta = RateLimit(info.eta, eta, 10.f*dt, 10000.f*dt);
-
-					float horizontal_distance = their_track_placement - my_track_placement;
-					//if (!info.active)
-						info.horizontal_distance = horizontal_distance;
-					/*else
-						info.horizontal_distance = RateLimit(info.horizontal_distance, horizontal_distance, spacingdistance*dt, spacingdistance*dt);*/
-
-					//std::cout << info.horizontal_distance << ", " << info.eta << std::endl;
-
-					info.active = true;
-				}
-				else
-					info.active = false;
-
-				//std::cout << orig_horiz << ", " << horizontal_distance << ",    " << fore_position << ", " << speed_diff << std::endl;
-
-				/*if (!min_horizontal_distance)
-					min_horizontal_distance = optional <float> (horizontal_distance);
-				else if (std::abs(min_horizontal_distance.get()) > std::abs(horizontal_distance))
-					min_horizontal_distance = optional <float> (horizontal_distance);*/
-			}
-			else
-				info.active = false;
-
-/*#ifdef VISUALIZE_AI_DEBUG
-			if (info.active)
-			{
-				avoidancedraw->AddLinePoint(car->GetCenterOfMassPosition());
-				MATHVECTOR <float, 3> feeler1(speed*info.eta,0,0);
-				car->GetOrientation().RotateVector(feeler1);
-				MATHVECTOR <float, 3> feeler2(0,-info.horizontal_distance,0);
-				car->GetOrientation().RotateVector(feeler2);
-				avoidancedraw->AddLinePoint(car->GetCenterOfMassPosition()+feeler1+feeler2);
-				avoidancedraw->AddLinePoint(car->GetCenterOfMassPosition());
-			}
-#endif*/
-		}
-	}
+	awareness.Update(dt, traffic, traffic.GetSlot(car));
 }
 
 /*float AI::steerAwayFromOthers(AI_Car *c, float dt, const std::list <CAR> & othercars, float cursteer)
@@ -1005,12 +903,14 @@ float AI_Car_Experimental::steerAwayFromOthers()
 	float eta = 1000;
 	float min_horizontal_distance = 1000;
 
-	for (std::map <const CAR *, AI_Car_Experimental::OTHERCARINFO>::iterator i = othercars.begin(); i != othercars.end(); ++i)
+	const std::vector <int> & nearbycars = awareness.GetNearbyCars();
+	for (std::vector <int>::const_iterator n = nearbycars.begin(); n != nearbycars.end(); ++n)
 	{
-		if (i->second.active && std::abs(i->second.horizontal_distance) < std::abs(min_horizontal_distance))
+		const AI_Awareness::OTHERCARINFO & info = awareness.GetInfo(*n);
+		if (info.active && std::abs(info.horizontal_distance) < std::abs(min_horizontal_distance))
 		{
-			min_horizontal_distance = i->second.horizontal_distance;
-			eta = i->second.eta;
+			min_horizontal_distance = info.horizontal_distance;
+			eta = info.eta;
 		}
 	}
 
@@ -21,6 +21,7 @@
 #define _AI_CAR_STANDARD_H
 
 #include "ai_car.h"
+#include "ai_traffic.h"
 #include "ai_factory.h"
 #include "carinput.h"
 #include "reseatable_reference.h"
@@ -50,7 +51,7 @@ private:
 	float calcSpeedLimit(const BEZIER* patch, const BEZIER* nextpatch, float friction, float extraradius);
 	float calcBrakeDist(float current_speed, float allowed_speed, float friction);
 	void updateSteer();
-	void analyzeOthers(float dt, const std::list <CAR> & othercars);
+	void analyzeOthers(float dt, const AI_Traffic & traffic);
 	float steerAwayFromOthers(); ///< returns a float that should be added into the steering wheel command
 	float brakeFromOthers(float speed_diff); ///< returns a float that should be added into the brake command. speed_diff is the difference between the desired speed and speed limit of this area of the track
 	double Angle(double x1, double y1); ///< returns the angle in degrees of the normalized 2-vector
@@ -72,17 +73,7 @@ private:
 	std::map <const CAR *, PATH_REVISION> path_revisions;
 	*/
 
-	struct OTHERCARINFO
-	{
-		OTHERCARINFO() : active(false) {}
-
-		float horizontal_distance;
-		float fore_distance;
-		float eta;
-		bool active;
-	};
-
-	std::map <const CAR *, OTHERCARINFO> othercars;
+	AI_Awareness awareness; ///< the cars around us
 
 	float shift_time;
 	float longitude_mu; ///<friction coefficient of the tire - longitude direction
@@ -102,7 +93,6 @@ private:
 	static MATHVECTOR <float, 3> GetPatchWidthVector(const BEZIER & patch);
 	static double GetPatchRadius(const BEZIER & patch);
 	static void TrimPatch(BEZIER & patch, float trimleft_front, float trimright_front, float trimleft_back, float trimright_back);
-	static float GetHorizontalDistanceAlongPatch(const BEZIER & patch, MATHVECTOR <float, 3> carposition);
 	static float RampBetween(float val, float startat, float endat);
 
 #ifdef VISUALIZE_AI_DEBUG
@@ -122,7 +112,10 @@ private:
 public:
 	AI_Car_Standard (CAR * new_car, float newdifficulty);
 	~AI_Car_Standard();
-	void Update(float dt, const std::list <CAR> & checkcars);
+	void Update(float dt, const AI_Traffic & traffic);
+
+	/// reads the other cars from the traffic snapshot and the track patches only
+	bool IsThreadSafe() const { return true; }
 
 #ifdef VISUALIZE_AI_DEBUG
 	void Visualize();
@@ -0,0 +1,334 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "ai_traffic.h"
+#include "car.h"
+#include "bezier.h"
+#include "carwheelposition.h"
+#include "coordinatesystem.h"
+#include "unittest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+const float AI_Traffic::cell_size = 100;
+const float AI_Awareness::startateta = 10.0;
+const float AI_Awareness::max_closing_speed = 100.0;
+const float AI_Awareness::max_distance = 250.0;
+
+// grid cell coordinates are biased so that the signed order matches the unsigned key order
+static unsigned long long CellKey(int x, int y)
+{
+	return ((unsigned long long)((unsigned int)x ^ 0x80000000u) << 32) | ((unsigned int)y ^ 0x80000000u);
+}
+
+static int CellCoordinate(float position)
+{
+	return (int)std::floor(position / AI_Traffic::cell_size);
+}
+
+void AI_Traffic::Update(const std::list <CAR> & cars)
+{
+	states.resize(cars.size());
+	std::vector <CAR_STATE>::iterator s = states.begin();
+	for (std::list <CAR>::const_iterator i = cars.begin(); i != cars.end(); ++i, ++s)
+	{
+		s->car = &*i;
+		s->position = i->GetCenterOfMassPosition();
+		s->orientation = i->GetOrientation();
+		s->velocity = i->GetVelocity();
+		s->patch = GetCurrentPatch(*i);
+		s->track_placement = 0;
+		if (s->patch)
+		{
+			// patch space is the world space with the axes rotated
+			const BEZIER & patch = *s->patch;
+			MATHVECTOR <float, 3> position(s->position[1], s->position[2], s->position[0]);
+			MATHVECTOR <float, 3> leftside = (patch.GetPoint(0,0) + patch.GetPoint(3,0))*0.5;
+			MATHVECTOR <float, 3> rightside = (patch.GetPoint(0,3) + patch.GetPoint(3,3))*0.5;
+			MATHVECTOR <float, 3> patchwidthvector = rightside - leftside;
+			s->track_placement = patchwidthvector.Normalize().dot(position-leftside);
+		}
+	}
+	BuildIndex();
+}
+
+void AI_Traffic::Update(const std::vector <CAR_STATE> & cars)
+{
+	states = cars;
+	BuildIndex();
+}
+
+int AI_Traffic::GetSlot(const CAR * car) const
+{
+	std::vector <std::pair <const CAR *, int> >::const_iterator i =
+		std::lower_bound(slots.begin(), slots.end(), std::make_pair(car, -1));
+	if (i != slots.end() && i->first == car)
+		return i->second;
+	return -1;
+}
+
+void AI_Traffic::GetNearbyCars(const MATHVECTOR <float, 3> & position, float radius, std::vector <int> & nearby) const
+{
+	nearby.clear();
+
+	const float radius2 = radius * radius;
+	const int xmin = CellCoordinate(position[0] - radius);
+	const int xmax = CellCoordinate(position[0] + radius);
+	const int ymin = CellCoordinate(position[1] - radius);
+	const int ymax = CellCoordinate(position[1] + radius);
+	for (int x = xmin; x <= xmax; ++x)
+	{
+		// the cells of a grid column are adjacent in the sorted cell array
+		std::vector <std::pair <unsigned long long, int> >::const_iterator i =
+			std::lower_bound(cells.begin(), cells.end(), std::make_pair(CellKey(x, ymin), -1));
+		const unsigned long long end = CellKey(x, ymax);
+		for (; i != cells.end() && i->first <= end; ++i)
+		{
+			const MATHVECTOR <float, 3> & other = states[i->second].position;
+			const float dx = other[0] - position[0];
+			const float dy = other[1] - position[1];
+			if (dx * dx + dy * dy <= radius2)
+				nearby.push_back(i->second);
+		}
+	}
+	std::sort(nearby.begin(), nearby.end());
+}
+
+const BEZIER * AI_Traffic::GetCurrentPatch(const CAR & car)
+{
+	const BEZIER * patch = car.GetCurPatch(WHEEL_POSITION(0));
+	if (!patch)
+		patch = car.GetCurPatch(WHEEL_POSITION(1)); //let's try the other wheel
+	return patch;
+}
+
+void AI_Traffic::BuildIndex()
+{
+	slots.resize(states.size());
+	cells.resize(states.size());
+	max_speed = 0;
+	for (unsigned int i = 0; i < states.size(); ++i)
+	{
+		const MATHVECTOR <float, 3> & position = states[i].position;
+		slots[i] = std::make_pair(states[i].car, int(i));
+		cells[i] = std::make_pair(CellKey(CellCoordinate(position[0]), CellCoordinate(position[1])), int(i));
+		max_speed = std::max(max_speed, states[i].velocity.Magnitude());
+	}
+	std::sort(slots.begin(), slots.end());
+	std::sort(cells.begin(), cells.end());
+}
+
+static float RateLimit(float old_value, float new_value, float rate_limit_pos, float rate_limit_neg)
+{
+	if (new_value - old_value > rate_limit_pos)
+		return old_value + rate_limit_pos;
+	else if (new_value - old_value < -rate_limit_neg)
+		return old_value - rate_limit_neg;
+	else
+		return new_value;
+}
+
+void AI_Awareness::Update(float dt, const AI_Traffic & traffic, int slot)
+{
+	const float half_carlength = 1.25; //in meters
+	const MATHVECTOR <float, 3> throttle_axis = direction::Forward;
+
+	//the slots change when cars are added or removed
+	if (othercars.size() != traffic.GetCarCount())
+	{
+		othercars.assign(traffic.GetCarCount(), OTHERCARINFO());
+		nearbycars.clear();
+	}
+
+	lastnearbycars.swap(nearbycars);
+	nearbycars.clear();
+	if (slot >= 0)
+	{
+		//cars that can't close in on us within startateta don't make us brake and are skipped,
+		//no car closes in faster than our own speed plus the speed of the fastest car
+		const AI_Traffic::CAR_STATE & me = traffic.GetCar(slot);
+		const float closing_speed = std::min(me.velocity.Magnitude() + traffic.GetMaxSpeed(), max_closing_speed);
+		const float radius = std::min(startateta * closing_speed + half_carlength, max_distance);
+		traffic.GetNearbyCars(me.position, radius, nearbycars);
+	}
+
+	//forget the cars that dropped out, the others keep their info for the rate limit,
+	//both lists are sorted
+	std::vector <int>::const_iterator n = nearbycars.begin();
+	for (std::vector <int>::const_iterator i = lastnearbycars.begin(); i != lastnearbycars.end(); ++i)
+	{
+		while (n != nearbycars.end() && *n < *i)
+			++n;
+		if (n == nearbycars.end() || *n != *i)
+			othercars[*i].active = false;
+	}
+
+	if (slot < 0)
+		return;
+
+	const AI_Traffic::CAR_STATE & me = traffic.GetCar(slot);
+	const QUATERNION <float> inverse_orientation = -me.orientation;
+	MATHVECTOR <float, 3> myvel = me.velocity;
+	inverse_orientation.RotateVector(myvel);
+
+	for (std::vector <int>::const_iterator i = nearbycars.begin(); i != nearbycars.end(); ++i)
+	{
+		if (*i == slot)
+			continue;
+
+		const AI_Traffic::CAR_STATE & other = traffic.GetCar(*i);
+		OTHERCARINFO & info = othercars[*i];
+
+		//find direction of other cars in our frame
+		MATHVECTOR <float, 3> relative_position = other.position - me.position;
+		inverse_orientation.RotateVector(relative_position);
+		float fore_position = relative_position.dot(throttle_axis);
+
+		MATHVECTOR <float, 3> othervel = other.velocity;
+		(-other.orientation).RotateVector(othervel);
+		float speed_diff = othervel.dot(throttle_axis) - myvel.dot(throttle_axis); //positive if other car is faster
+
+		//only pay attention to cars roughly in front of us and on the track
+		const float fore_position_offset = -half_carlength;
+		if (fore_position > fore_position_offset && other.patch && me.patch)
+		{
+			float speed_diff_denom = std::min(std::max(speed_diff, -max_closing_speed), -0.01f);
+			float eta = (fore_position-fore_position_offset)/-speed_diff_denom;
+
+			info.fore_distance = fore_position;
+
+			if (!info.active)
+				info.eta = eta;
+			else
+				info.eta = RateLimit(info.eta, eta, 10.f*dt, 10000.f*dt);
+
+			info.horizontal_distance = other.track_placement - me.track_placement;
+			info.active = true;
+		}
+		else
+			info.active = false;
+	}
+}
+
+namespace
+{
+	// cars spread around a circular track, with a pack at the start line
+	std::vector <AI_Traffic::CAR_STATE> TestField(int count, float radius)
+	{
+		std::vector <AI_Traffic::CAR_STATE> cars(count);
+		for (int i = 0; i < count; ++i)
+		{
+			float angle = (i % 4 == 0) ? i * 0.001f : (std::rand() % 6283) * 0.001f;
+			cars[i].position = MATHVECTOR <float, 3> (radius * std::cos(angle), radius * std::sin(angle), 0);
+			cars[i].velocity = MATHVECTOR <float, 3> (-std::sin(angle), std::cos(angle), 0) * 50;
+		}
+		return cars;
+	}
+}
+
+QT_TEST(ai_traffic_test)
+{
+	std::srand(1);
+	std::vector <AI_Traffic::CAR_STATE> cars = TestField(200, 500);
+	cars[0].position = MATHVECTOR <float, 3> (-0.01, 0, 0); // on a cell boundary
+	cars[1].position = MATHVECTOR <float, 3> (30, 40, 5); // 50 m away on the ground plane
+	AI_Traffic traffic;
+	traffic.Update(cars);
+	QT_CHECK_EQUAL(traffic.GetCarCount(), 200);
+	QT_CHECK_EQUAL(traffic.GetSlot(0), 0); // the first car without a CAR
+	QT_CHECK_EQUAL(traffic.GetSlot((const CAR *)&cars), -1);
+
+	// the grid finds the same cars as a scan of all of them
+	const float radii[] = {0, 50, 100, 250, 1200};
+	std::vector <int> nearby;
+	for (int r = 0; r < 5; ++r)
+	{
+		for (int c = 0; c < 200; c += 7)
+		{
+			const MATHVECTOR <float, 3> & center = cars[c].position;
+			std::vector <int> expected;
+			for (int i = 0; i < 200; ++i)
+			{
+				float dx = cars[i].position[0] - center[0];
+				float dy = cars[i].position[1] - center[1];
+				if (dx * dx + dy * dy <= radii[r] * radii[r])
+					expected.push_back(i);
+			}
+			traffic.GetNearbyCars(center, radii[r], nearby);
+			QT_CHECK(nearby == expected);
+		}
+	}
+
+	traffic.GetNearbyCars(cars[0].position, 51, nearby);
+	QT_CHECK(std::find(nearby.begin(), nearby.end(), 1) != nearby.end());
+
+	// the speed that bounds the query radius of the AI
+	cars[7].velocity = MATHVECTOR <float, 3> (0, 60, 80);
+	traffic.Update(cars);
+	QT_CHECK_CLOSE(traffic.GetMaxSpeed(), 100, 0.001);
+}
+
+QT_TEST(ai_awareness_test)
+{
+	// we drive at 10 m/s towards a car standing 20 m ahead
+	BEZIER patch;
+	std::vector <AI_Traffic::CAR_STATE> cars(3);
+	for (int i = 0; i < 3; ++i)
+		cars[i].patch = &patch;
+	cars[0].velocity = direction::Forward * 10;
+	cars[1].position = direction::Forward * 20;
+	cars[2].position = direction::Forward * 2000; // never nearby
+
+	const float dt = 0.01;
+	AI_Traffic traffic;
+	AI_Awareness awareness;
+	traffic.Update(cars);
+	awareness.Update(dt, traffic, 0);
+	QT_CHECK_EQUAL(awareness.GetNearbyCars().size(), 2);
+	QT_CHECK(awareness.GetInfo(1).active);
+	QT_CHECK(!awareness.GetInfo(2).active);
+	QT_CHECK_CLOSE(awareness.GetInfo(1).eta, 2.125, 0.0001);
+
+	// the car jumps 80 m ahead, its eta grows by at most 10 s per second
+	for (int tick = 1; tick <= 2; ++tick)
+	{
+		cars[1].position = direction::Forward * 100;
+		traffic.Update(cars);
+		awareness.Update(dt, traffic, 0);
+		QT_CHECK(awareness.GetInfo(1).active);
+		QT_CHECK_CLOSE(awareness.GetInfo(1).eta, 2.125 + tick * 10 * dt, 0.0001);
+	}
+
+	// once it drops out of the query its info is inactive, coming back starts over
+	cars[1].position = direction::Forward * 1000;
+	traffic.Update(cars);
+	awareness.Update(dt, traffic, 0);
+	QT_CHECK(!awareness.GetInfo(1).active);
+	cars[1].position = direction::Forward * 100;
+	traffic.Update(cars);
+	awareness.Update(dt, traffic, 0);
+	QT_CHECK_CLOSE(awareness.GetInfo(1).eta, 10.125, 0.0001);
+
+	// without a slot all cars are forgotten
+	awareness.Update(dt, traffic, -1);
+	QT_CHECK(awareness.GetNearbyCars().empty());
+	QT_CHECK(!awareness.GetInfo(1).active);
+}
@@ -0,0 +1,120 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _AI_TRAFFIC_H
+#define _AI_TRAFFIC_H
+
+#include "mathvector.h"
+#include "quaternion.h"
+
+#include <vector>
+#include <list>
+#include <utility>
+
+class CAR;
+class BEZIER;
+
+/// The state of all cars at the start of an AI tick, indexed by car slot
+/// (the position of the car in the car list), with a uniform grid on the
+/// ground plane to find the cars near a position without visiting them all.
+class AI_Traffic
+{
+public:
+	struct CAR_STATE
+	{
+		CAR_STATE() : car(0), patch(0), track_placement(0) {}
+
+		const CAR * car;
+		MATHVECTOR <float, 3> position; ///< center of mass
+		QUATERNION <float> orientation;
+		MATHVECTOR <float, 3> velocity;
+		const BEZIER * patch; ///< track patch under the car, NULL if off track
+		float track_placement; ///< horizontal distance along the patch
+	};
+
+	/// side length of the grid cells in meters, queries within this radius visit at most four cells
+	static const float cell_size;
+
+	AI_Traffic() : max_speed(0) {}
+
+	/// take a snapshot of the cars and rebuild the grid
+	void Update(const std::list <CAR> & cars);
+
+	/// the same for prepared car states, cars without a CAR can't be looked up by GetSlot
+	void Update(const std::vector <CAR_STATE> & cars);
+
+	unsigned int GetCarCount() const {return states.size();}
+
+	const CAR_STATE & GetCar(unsigned int slot) const {return states[slot];}
+
+	/// speed of the fastest car, no two cars close in on each other faster than their speed plus this
+	float GetMaxSpeed() const {return max_speed;}
+
+	/// returns -1 if the car isn't in the snapshot
+	int GetSlot(const CAR * car) const;
+
+	/// slots of the cars within radius of position on the ground plane, in ascending order
+	void GetNearbyCars(const MATHVECTOR <float, 3> & position, float radius, std::vector <int> & slots) const;
+
+	/// the patch under the front wheels, NULL if off track
+	static const BEZIER * GetCurrentPatch(const CAR & car);
+
+private:
+	std::vector <CAR_STATE> states;
+	std::vector <std::pair <const CAR *, int> > slots; ///< sorted by car
+	std::vector <std::pair <unsigned long long, int> > cells; ///< slots sorted by grid cell key
+	float max_speed;
+
+	void BuildIndex();
+};
+
+/// What an AI car knows about the cars around it, kept by car slot from tick
+/// to tick. The eta of a car that stays around is rate limited.
+class AI_Awareness
+{
+public:
+	struct OTHERCARINFO
+	{
+		OTHERCARINFO() : horizontal_distance(0), fore_distance(0), eta(0), active(false) {}
+
+		float horizontal_distance; ///< difference of the track placements, positive if the other car is further right
+		float fore_distance; ///< distance ahead of us
+		float eta; ///< time until we reach the other car
+		bool active; ///< the other car is ahead of us and both are on the track
+	};
+
+	static const float startateta; ///< eta in seconds at which we start braking for a car ahead
+	static const float max_closing_speed; ///< closing speeds above this don't shorten the eta, in m/s
+	static const float max_distance; ///< cars further away are ignored, even if they could close in within startateta
+
+	/// analyze the cars around the car in slot, a negative slot forgets all of them
+	void Update(float dt, const AI_Traffic & traffic, int slot);
+
+	/// slots of the cars around us in ascending order, the info of the others is inactive
+	const std::vector <int> & GetNearbyCars() const {return nearbycars;}
+
+	const OTHERCARINFO & GetInfo(int slot) const {return othercars[slot];}
+
+private:
+	std::vector <OTHERCARINFO> othercars;
+	std::vector <int> nearbycars;
+	std::vector <int> lastnearbycars;
+};
+
+#endif // _AI_TRAFFIC_H
@@ -0,0 +1,161 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "allocationcounter.h"
+#include "definitions.h"
+
+#ifdef ENABLE_ALLOCATION_COUNTER
+
+#include <cstdlib>
+#include <new>
+
+#if defined(_MSC_VER)
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
+// dynamic exception specifications are gone since C++17
+#if __cplusplus < 201103L
+	#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+	#define NO_THROW throw()
+#else
+	#define THROWS_BAD_ALLOC
+	#define NO_THROW noexcept
+#endif
+
+static THREAD_LOCAL unsigned long thread_allocations = 0;
+
+bool ALLOCATION_COUNTER::IsEnabled()
+{
+	return true;
+}
+
+unsigned long ALLOCATION_COUNTER::GetThreadAllocations()
+{
+	return thread_allocations;
+}
+
+static std::new_handler GetNewHandler()
+{
+#if __cplusplus >= 201103L
+	return std::get_new_handler();
+#else
+	std::new_handler handler = std::set_new_handler(0);
+	std::set_new_handler(handler);
+	return handler;
+#endif
+}
+
+// like the standard operator new, give the new handler a chance to free memory before failing
+static void * Allocate(std::size_t size)
+{
+	thread_allocations++;
+	if (size == 0)
+		size = 1;
+	while (true)
+	{
+		void * p = std::malloc(size);
+		if (p)
+			return p;
+
+		std::new_handler handler = GetNewHandler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void * AllocateNoThrow(std::size_t size)
+{
+	try
+	{
+		return Allocate(size);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return 0;
+	}
+}
+
+void * operator new(std::size_t size) THROWS_BAD_ALLOC
+{
+	return Allocate(size);
+}
+
+void * operator new[](std::size_t size) THROWS_BAD_ALLOC
+{
+	return Allocate(size);
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &) NO_THROW
+{
+	return AllocateNoThrow(size);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &) NO_THROW
+{
+	return AllocateNoThrow(size);
+}
+
+void operator delete(void * p) NO_THROW
+{
+	std::free(p);
+}
+
+void operator delete[](void * p) NO_THROW
+{
+	std::free(p);
+}
+
+void operator delete(void * p, const std::nothrow_t &) NO_THROW
+{
+	std::free(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t &) NO_THROW
+{
+	std::free(p);
+}
+
+#if __cplusplus >= 201402L
+void operator delete(void * p, std::size_t) NO_THROW
+{
+	std::free(p);
+}
+
+void operator delete[](void * p, std::size_t) NO_THROW
+{
+	std::free(p);
+}
+#endif
+
+#else // ENABLE_ALLOCATION_COUNTER
+
+bool ALLOCATION_COUNTER::IsEnabled()
+{
+	return false;
+}
+
+unsigned long ALLOCATION_COUNTER::GetThreadAllocations()
+{
+	return 0;
+}
+
+#endif // ENABLE_ALLOCATION_COUNTER
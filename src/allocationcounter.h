@@ -17,10 +17,19 @@
 /*                                                                      */
 /************************************************************************/
 
-#include "parallel_task.h"
+#ifndef _ALLOCATIONCOUNTER_H
+#define _ALLOCATIONCOUNTER_H
 
-int PARALLEL_TASK::Dispatch(void * data)
+/// Counts operator new calls per thread, to check that hot paths don't allocate.
+/// Only profiling builds (scons profiling=1) replace the global operator new,
+/// otherwise nothing is counted.
+namespace ALLOCATION_COUNTER
 {
-	((TASK *) data)->PARALLEL_TASK_RUN();
-	return 0;
+	/// true if allocations are counted in this build
+	bool IsEnabled();
+
+	/// number of allocations made by the calling thread so far
+	unsigned long GetThreadAllocations();
 }
+
+#endif // _ALLOCATIONCOUNTER_H
@@ -0,0 +1,134 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _BENCHMARK_H
+#define _BENCHMARK_H
+
+#include "quickprof.h"
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+// Micro benchmarks register themselves like the unit tests in unittest.h
+// and are run from the command line with "-microbench [NAME]".
+//
+// BENCHMARK(bezier_collide)
+// {
+//     benchmark::Stopwatch timer;
+//     ... work ...
+//     out << "bezier_collide: " << timer.Seconds() << " s" << std::endl;
+// }
+
+namespace benchmark
+{
+	class Benchmark
+	{
+	public:
+		Benchmark(const std::string & name) : name(name) {}
+
+		virtual ~Benchmark() {}
+
+		virtual void Run(std::ostream & out) = 0;
+
+		const std::string & GetName() const {return name;}
+
+	private:
+		std::string name;
+	};
+
+	class Manager
+	{
+	public:
+		static Manager & Instance()
+		{
+			static Manager * self = new Manager;
+			return *self;
+		}
+
+		void Add(Benchmark * b)
+		{
+			benchmarks.push_back(b);
+		}
+
+		/// run all benchmarks whose name contains filter, returns number run
+		int Run(const std::string & filter, std::ostream & out)
+		{
+			int count = 0;
+			out << "[--------------- RUNNING BENCHMARKS ---------------]" << std::endl;
+			for (std::vector<Benchmark*>::iterator i = benchmarks.begin(); i != benchmarks.end(); ++i)
+			{
+				if (!filter.empty() && (*i)->GetName().find(filter) == std::string::npos)
+					continue;
+
+				out << "* " << (*i)->GetName() << std::endl;
+				(*i)->Run(out);
+				++count;
+			}
+			out << "[-------------- BENCHMARKS FINISHED ---------------]" << std::endl;
+			return count;
+		}
+
+	private:
+		std::vector<Benchmark*> benchmarks;
+	};
+
+	/// wall clock stopwatch
+	class Stopwatch
+	{
+	public:
+		Stopwatch() {}
+
+		void Reset() {clock.reset();}
+
+		double Seconds() {return clock.getTimeMicroseconds() * 1E-6;}
+
+		double Microseconds() {return (double)clock.getTimeMicroseconds();}
+
+	private:
+		quickprof::Clock clock;
+	};
+
+	/// prevent the optimizer from discarding a computed value
+	template <typename T>
+	inline void DoNotOptimize(const T & value)
+	{
+		static const volatile T * volatile sink;
+		sink = &value;
+		(void)sink;
+	}
+}
+
+/// Define a benchmark, the body receives the output stream as "out".
+#define BENCHMARK(benchName)\
+	class benchName##Benchmark : public benchmark::Benchmark\
+	{\
+	public:\
+		benchName##Benchmark()\
+		: Benchmark(#benchName)\
+		{\
+			benchmark::Manager::Instance().Add(this);\
+		}\
+		void Run(std::ostream & out);\
+	} benchName##BenchmarkInstance;\
+	void benchName##Benchmark::Run(std::ostream & out)
+
+#define RUN_BENCHMARKS(filter, out) benchmark::Manager::Instance().Run(filter, out)
+
+#endif // _BENCHMARK_H
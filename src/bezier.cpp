@@ -18,9 +18,15 @@
 /************************************************************************/
 
 #include "bezier.h"
+#include "simd4f.h"
 #include "unittest.h"
+#include "benchmark.h"
+#include "macros.h"
 
 #include <cmath>
+#include <sstream>
+#include <vector>
+#include <algorithm>
 
 std::ostream & operator << (std::ostream &os, const BEZIER & b)
 {
@@ -383,6 +389,25 @@ void BEZIER::Attach(BEZIER & other, bool reverse)
 	length = d1.Magnitude();
 }
 
+bool BEZIER::Serialize(joeserialize::Serializer & s)
+{
+	for (int x = 0; x < 4; x++)
+	{
+		for (int y = 0; y < 4; y++)
+		{
+			if (!s.Serialize("point", points[x][y])) return false;
+		}
+	}
+	_SERIALIZE_(s, length);
+	_SERIALIZE_(s, dist_from_start);
+	_SERIALIZE_(s, track_radius);
+	_SERIALIZE_(s, turn);
+	_SERIALIZE_(s, track_curvature);
+	_SERIALIZE_(s, racing_line);
+	_SERIALIZE_(s, have_racingline);
+	return true;
+}
+
 void BEZIER::Reverse()
 {
 	MATHVECTOR <float, 3> oldpoints[4][4];
@@ -597,6 +622,230 @@ bool BEZIER::CollideSubDivQuadSimpleNorm(const MATHVECTOR <float, 3> & origin, c
 	return true;
 }
 
+namespace
+{
+	// structure of arrays vector, one 3d vector per lane
+	struct VEC3X4
+	{
+		simd4f x, y, z;
+
+		VEC3X4() {}
+		VEC3X4(simd4f x, simd4f y, simd4f z) : x(x), y(y), z(z) {}
+
+		VEC3X4 operator+(const VEC3X4 & o) const {return VEC3X4(x + o.x, y + o.y, z + o.z);}
+		VEC3X4 operator-(const VEC3X4 & o) const {return VEC3X4(x - o.x, y - o.y, z - o.z);}
+		VEC3X4 operator*(simd4f s) const {return VEC3X4(x * s, y * s, z * s);}
+		simd4f dot(const VEC3X4 & o) const {return x * o.x + y * o.y + z * o.z;}
+		VEC3X4 cross(const VEC3X4 & o) const
+		{
+			return VEC3X4(y * o.z - z * o.y, z * o.x - x * o.z, x * o.y - y * o.x);
+		}
+	};
+
+	inline VEC3X4 Bernstein4(simd4f u, const VEC3X4 & p0, const VEC3X4 & p1, const VEC3X4 & p2, const VEC3X4 & p3)
+	{
+		const simd4f three(3.0f);
+		simd4f oneminusu = simd4f(1.0f) - u;
+		VEC3X4 a = p0 * (u * u * u);
+		VEC3X4 b = p1 * (three * u * u * oneminusu);
+		VEC3X4 c = p2 * (three * u * oneminusu * oneminusu);
+		VEC3X4 d = p3 * (oneminusu * oneminusu * oneminusu);
+		return a + b + c + d;
+	}
+
+	// cp[x * 4 + y] holds BEZIER::points[x][y] of the four lanes
+	inline VEC3X4 SurfCoord4(const VEC3X4 cp[16], simd4f px, simd4f py)
+	{
+		VEC3X4 temp[4];
+		for (int j = 0; j < 4; ++j)
+		{
+			temp[j] = Bernstein4(px, cp[j * 4 + 0], cp[j * 4 + 1], cp[j * 4 + 2], cp[j * 4 + 3]);
+		}
+		return Bernstein4(py, temp[0], temp[1], temp[2], temp[3]);
+	}
+
+	// branch free IntersectQuadrilateralF, returns the mask of lanes that hit
+	simd4f IntersectQuadrilateral4(
+		const VEC3X4 & orig, const VEC3X4 & dir,
+		const VEC3X4 & v_00, const VEC3X4 & v_10,
+		const VEC3X4 & v_11, const VEC3X4 & v_01,
+		simd4f & u, simd4f & v)
+	{
+		const simd4f epsilon(0.000001f);
+		const simd4f zero(0.0f);
+		const simd4f one(1.0f);
+
+		VEC3X4 E_01 = v_10 - v_00;
+		VEC3X4 E_03 = v_01 - v_00;
+		VEC3X4 P = dir.cross(E_03);
+		simd4f det = E_01.dot(P);
+		simd4f valid = CmpGe(Abs(det), epsilon);
+
+		VEC3X4 T = orig - v_00;
+		simd4f alpha = T.dot(P) / det;
+		valid = valid & CmpGe(alpha, zero);
+
+		VEC3X4 Q = T.cross(E_01);
+		simd4f beta = dir.dot(Q) / det;
+		valid = valid & CmpGe(beta, zero);
+
+		// second triangle test for lanes with alpha + beta > 1
+		VEC3X4 E_23 = v_01 - v_11;
+		VEC3X4 E_21 = v_10 - v_11;
+		VEC3X4 P_prime = dir.cross(E_21);
+		simd4f det_prime = E_23.dot(P_prime);
+		VEC3X4 T_prime = orig - v_11;
+		simd4f alpha_prime = T_prime.dot(P_prime) / det_prime;
+		VEC3X4 Q_prime = T_prime.cross(E_23);
+		simd4f beta_prime = dir.dot(Q_prime) / det_prime;
+		simd4f valid_prime = CmpGe(Abs(det_prime), epsilon) & CmpGe(alpha_prime, zero) & CmpGe(beta_prime, zero);
+		simd4f need_prime = CmpGt(alpha + beta, one);
+		valid = AndNot(AndNot(valid_prime, need_prime), valid);
+
+		simd4f t = E_03.dot(Q) / det;
+		valid = valid & CmpGe(t, zero);
+
+		// barycentric coordinates of the fourth vertex
+		VEC3X4 E_02 = v_11 - v_00;
+		VEC3X4 n = E_01.cross(E_03);
+		simd4f nx = Abs(n.x), ny = Abs(n.y), nz = Abs(n.z);
+		simd4f use_x = CmpGe(nx, ny) & CmpGe(nx, nz);
+		simd4f use_y = AndNot(use_x, CmpGe(ny, nx) & CmpGe(ny, nz));
+		simd4f alpha_11 = Select(use_x, (E_02.y * E_03.z - E_02.z * E_03.y) / n.x,
+			Select(use_y, (E_02.z * E_03.x - E_02.x * E_03.z) / n.y,
+				(E_02.x * E_03.y - E_02.y * E_03.x) / n.z));
+		simd4f beta_11 = Select(use_x, (E_01.y * E_02.z - E_01.z * E_02.y) / n.x,
+			Select(use_y, (E_01.z * E_02.x - E_01.x * E_02.z) / n.y,
+				(E_01.x * E_02.y - E_01.y * E_02.x) / n.z));
+
+		// bilinear coordinates of the intersection point
+		simd4f trapezium_a = CmpLt(Abs(alpha_11 - one), epsilon);
+		simd4f trapezium_b = CmpLt(Abs(beta_11 - one), epsilon);
+
+		// alpha_11 == 1
+		simd4f u_a = alpha;
+		simd4f v_a = Select(trapezium_b, beta, beta / (u_a * (beta_11 - one) + one));
+
+		// beta_11 == 1
+		simd4f v_b = beta;
+		simd4f den_b = v_b * (alpha_11 - one) + one;
+		simd4f u_b = alpha / den_b;
+		simd4f valid_b = AndNot(CmpEq(den_b, zero), trapezium_b);
+
+		// general case
+		simd4f A = one - beta_11;
+		simd4f B = alpha * (beta_11 - one) - beta * (alpha_11 - one) - one;
+		simd4f C = alpha;
+		simd4f D = B * B - simd4f(4.0f) * A * C;
+		simd4f sign = Select(CmpLt(B, zero), simd4f(-1.0f), one);
+		simd4f Qc = simd4f(-0.5f) * (B + sign * Sqrt(Max(D, zero)));
+		simd4f u_c = Qc / A;
+		u_c = Select(CmpLt(u_c, zero) | CmpGt(u_c, one), C / Qc, u_c);
+		simd4f v_c = beta / (u_c * (beta_11 - one) + one);
+		simd4f valid_c = CmpGe(D, zero);
+
+		u = Select(trapezium_a, u_a, Select(trapezium_b, u_b, u_c));
+		v = Select(trapezium_a, v_a, Select(trapezium_b, v_b, v_c));
+		valid = valid & (trapezium_a | Select(trapezium_b, valid_b, valid_c));
+
+		return valid;
+	}
+}
+
+int BEZIER::CollideSubDivQuadSimpleNorm4(
+	const BEZIER * const patch[4],
+	const MATHVECTOR <float, 3> origin[4],
+	const MATHVECTOR <float, 3> direction[4],
+	MATHVECTOR <float, 3> outtri[4],
+	MATHVECTOR <float, 3> normal[4])
+{
+	const int COLLISION_QUAD_DIVS = 6;
+	const simd4f halfareacut(0.5f * 0.5f);
+	const simd4f zero(0.0f);
+	const simd4f one(1.0f);
+
+	// inactive lanes run on a copy of an active lane and get masked out
+	const BEZIER * lane[4];
+	const BEZIER * first = 0;
+	for (int i = 0; i < 4 && !first; ++i) first = patch[i];
+	if (!first) return 0;
+
+	SIMD4F_ALIGN(16) float active[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		lane[i] = patch[i] ? patch[i] : first;
+		active[i] = patch[i] ? 1.0f : 0.0f;
+	}
+
+	// transpose control points and rays into lanes
+	VEC3X4 cp[16];
+	for (int x = 0; x < 4; ++x)
+	{
+		for (int y = 0; y < 4; ++y)
+		{
+			const MATHVECTOR <float, 3> & p0 = lane[0]->points[x][y];
+			const MATHVECTOR <float, 3> & p1 = lane[1]->points[x][y];
+			const MATHVECTOR <float, 3> & p2 = lane[2]->points[x][y];
+			const MATHVECTOR <float, 3> & p3 = lane[3]->points[x][y];
+			cp[x * 4 + y] = VEC3X4(
+				simd4f(p0[0], p1[0], p2[0], p3[0]),
+				simd4f(p0[1], p1[1], p2[1], p3[1]),
+				simd4f(p0[2], p1[2], p2[2], p3[2]));
+		}
+	}
+	VEC3X4 orig(
+		simd4f(origin[0][0], origin[1][0], origin[2][0], origin[3][0]),
+		simd4f(origin[0][1], origin[1][1], origin[2][1], origin[3][1]),
+		simd4f(origin[0][2], origin[1][2], origin[2][2], origin[3][2]));
+	VEC3X4 dir(
+		simd4f(direction[0][0], direction[1][0], direction[2][0], direction[3][0]),
+		simd4f(direction[0][1], direction[1][1], direction[2][1], direction[3][1]),
+		simd4f(direction[0][2], direction[1][2], direction[2][2], direction[3][2]));
+
+	simd4f alive = CmpGt(simd4f::Load(active), zero);
+	simd4f su(0.0f), sv(0.0f);
+	simd4f umin(0.0f), umax(1.0f), vmin(0.0f), vmax(1.0f);
+	for (int i = 0; i < COLLISION_QUAD_DIVS; ++i)
+	{
+		simd4f tu0 = Max(umin, zero);
+		simd4f tu1 = Min(umax, one);
+		simd4f tv0 = Max(vmin, zero);
+		simd4f tv1 = Min(vmax, one);
+
+		VEC3X4 ul = SurfCoord4(cp, tu0, tv0);
+		VEC3X4 ur = SurfCoord4(cp, tu1, tv0);
+		VEC3X4 br = SurfCoord4(cp, tu1, tv1);
+		VEC3X4 bl = SurfCoord4(cp, tu0, tv1);
+
+		simd4f u, v;
+		alive = alive & IntersectQuadrilateral4(orig, dir, ul, ur, br, bl, u, v);
+		if (!Any(alive)) break;
+
+		// expand quad UV to surface UV, place max and min according to area hit
+		su = Select(alive, u * (tu1 - tu0) + tu0, su);
+		sv = Select(alive, v * (tv1 - tv0) + tv0, sv);
+		vmax = Select(alive, sv + halfareacut * (vmax - vmin), vmax);
+		vmin = Select(alive, sv - halfareacut * (vmax - vmin), vmin);
+		umax = Select(alive, su + halfareacut * (umax - umin), umax);
+		umin = Select(alive, su - halfareacut * (umax - umin), umin);
+	}
+
+	int mask = MoveMask(alive);
+	for (int i = 0; i < 4; ++i)
+	{
+		if (mask & (1 << i))
+		{
+			outtri[i] = patch[i]->SurfCoord(su[i], sv[i]);
+			normal[i] = patch[i]->SurfNorm(su[i], sv[i]);
+		}
+		else
+		{
+			outtri[i] = origin[i];
+		}
+	}
+	return mask;
+}
+
 void BEZIER::DeCasteljauHalveCurve(MATHVECTOR <float, 3> * points4, MATHVECTOR <float, 3> * left4, MATHVECTOR <float, 3> * right4) const
 {
 	left4[0] = points4[0];
@@ -796,3 +1045,129 @@ QT_TEST(bezier_test)
 	b.SetFromCorners(MATHVECTOR <float, 3>(1,0,1),MATHVECTOR <float, 3>(-1,0,1),MATHVECTOR <float, 3>(1,0,-1),MATHVECTOR <float, 3>(-1,0,-1));
 	QT_CHECK(!b.CheckForProblems());
 }
+
+namespace
+{
+	// deterministic pseudo random numbers for tests and benchmarks
+	struct LCG
+	{
+		unsigned state;
+		LCG(unsigned seed) : state(seed) {}
+		float operator()(float min, float max)
+		{
+			state = state * 1664525u + 1013904223u;
+			return min + (max - min) * ((state >> 8) / 16777216.0f);
+		}
+	};
+
+	// curved road patch in bezier space (y up), spanning x0..x0+4, z0..z0+4
+	void MakeCurvedPatch(BEZIER & b, float x0, float z0, LCG & rand)
+	{
+		std::stringstream s;
+		for (int x = 0; x < 4; ++x)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				s << x0 + y * 4 / 3.0f << " " << rand(-0.2f, 0.2f) << " " << z0 + x * 4 / 3.0f << " ";
+			}
+		}
+		b.ReadFrom(s);
+	}
+
+	void MakeRay(MATHVECTOR <float, 3> & o, MATHVECTOR <float, 3> & d, float x0, float z0, float margin, LCG & rand)
+	{
+		o.Set(rand(x0 + margin, x0 + 4 - margin), 2.0f, rand(z0 + margin, z0 + 4 - margin));
+		d.Set(rand(-0.1f, 0.1f), -1.0f, rand(-0.1f, 0.1f));
+		d = d.Normalize();
+	}
+}
+
+QT_TEST(bezier_collide4_test)
+{
+	LCG rand(1234);
+	const int count = 64;
+	for (int n = 0; n < count; ++n)
+	{
+		BEZIER b[4];
+		const BEZIER * p[4];
+		MATHVECTOR <float, 3> o[4], d[4], pos4[4], norm4[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			MakeCurvedPatch(b[i], 8.0f * i, 0.0f, rand);
+			// every other lane misses its patch
+			MakeRay(o[i], d[i], 8.0f * i + ((n + i) % 2 ? 0.0f : 5.0f), 0.0f, 0.5f, rand);
+			p[i] = (n % 8 == i) ? 0 : &b[i];
+		}
+
+		int mask = BEZIER::CollideSubDivQuadSimpleNorm4(p, o, d, pos4, norm4);
+		for (int i = 0; i < 4; ++i)
+		{
+			MATHVECTOR <float, 3> pos, norm;
+			bool col = p[i] && p[i]->CollideSubDivQuadSimpleNorm(o[i], d[i], pos, norm);
+			QT_CHECK_EQUAL(col, bool(mask & (1 << i)));
+			if (col && (mask & (1 << i)))
+			{
+				QT_CHECK_CLOSE((pos - pos4[i]).Magnitude(), 0, 0.001);
+				QT_CHECK_CLOSE((norm - norm4[i]).Magnitude(), 0, 0.001);
+			}
+		}
+	}
+}
+
+BENCHMARK(bezier_collide)
+{
+	const int patches = 64;
+	const int rays = 4096;
+	const int repeats = 50;
+
+	LCG rand(4321);
+	std::vector<BEZIER> b(patches);
+	for (int i = 0; i < patches; ++i)
+	{
+		MakeCurvedPatch(b[i], 4.0f * i, 0.0f, rand);
+	}
+
+	std::vector<const BEZIER *> p(rays);
+	std::vector<MATHVECTOR <float, 3> > o(rays), d(rays), pos(rays), norm(rays);
+	for (int i = 0; i < rays; ++i)
+	{
+		int j = i % patches;
+		p[i] = &b[j];
+		MakeRay(o[i], d[i], 4.0f * j, 0.0f, 0.0f, rand);
+	}
+
+	int hits_scalar = 0;
+	benchmark::Stopwatch timer;
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (int i = 0; i < rays; ++i)
+		{
+			hits_scalar += p[i]->CollideSubDivQuadSimpleNorm(o[i], d[i], pos[i], norm[i]);
+		}
+	}
+	double scalar_time = timer.Seconds();
+	std::vector<MATHVECTOR <float, 3> > pos_scalar(pos);
+
+	int hits_simd = 0;
+	timer.Reset();
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (int i = 0; i < rays; i += 4)
+		{
+			int mask = BEZIER::CollideSubDivQuadSimpleNorm4(&p[i], &o[i], &d[i], &pos[i], &norm[i]);
+			hits_simd += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+		}
+	}
+	double simd_time = timer.Seconds();
+
+	float max_error = 0;
+	for (int i = 0; i < rays; ++i)
+	{
+		max_error = std::max(max_error, (pos[i] - pos_scalar[i]).Magnitude());
+	}
+
+	double tests = double(rays) * repeats;
+	out << "scalar: " << tests / scalar_time * 1E-6 << " Mrays/s, hits " << hits_scalar << std::endl;
+	out << "simd4: " << tests / simd_time * 1E-6 << " Mrays/s, hits " << hits_simd << std::endl;
+	out << "speedup: " << scalar_time / simd_time << ", max position error: " << max_error << std::endl;
+}
@@ -45,6 +45,7 @@ public:
 	float GetDistFromStart() const {return dist_from_start;}
 	void ResetDistFromStart() {dist_from_start = 0.0f;}
 	void ResetNextPatch() {next_patch = NULL;}
+	void SetNextPatch(BEZIER * next) {next_patch = next;}
 
 	///initialize this bezier to the quad defined by the given corner points
 	void SetFromCorners(const MATHVECTOR <float, 3> & fl, const MATHVECTOR <float, 3> & fr, const MATHVECTOR <float, 3> & bl, const MATHVECTOR <float, 3> & br);
@@ -67,10 +68,22 @@ public:
 	bool CollideSubDivQuadSimple(const MATHVECTOR <float, 3> & origin, const MATHVECTOR <float, 3> & direction, MATHVECTOR <float, 3> &outtri) const;
 	bool CollideSubDivQuadSimpleNorm(const MATHVECTOR <float, 3> & origin, const MATHVECTOR <float, 3> & direction, MATHVECTOR <float, 3> &outtri, MATHVECTOR <float, 3> & normal) const;
 
+	///4-wide variant of CollideSubDivQuadSimpleNorm, lane i tests ray i against patch[i] (null patches are skipped).
+	/// output the contact points and normals of the hit lanes, returns a bit mask of the lanes that hit.
+	static int CollideSubDivQuadSimpleNorm4(
+		const BEZIER * const patch[4],
+		const MATHVECTOR <float, 3> origin[4],
+		const MATHVECTOR <float, 3> direction[4],
+		MATHVECTOR <float, 3> outtri[4],
+		MATHVECTOR <float, 3> normal[4]);
+
 	///read/write IO operations (ascii format)
 	void ReadFrom(std::istream &openfile);
 	void WriteTo(std::ostream &openfile) const;
 
+	///binary IO, the points and derived values, not the next patch link
+	bool Serialize(joeserialize::Serializer & s);
+
 	///flip points on both axes
 	void Reverse();
 
@@ -25,6 +25,7 @@
 #include "coordinatesystem.h"
 #include "cfg/ptree.h"
 #include "macros.h"
+#include "traceprofiler.h"
 
 template<class T>
 static inline bool isnan(const T & x)
@@ -371,6 +372,7 @@ CARDYNAMICS::CARDYNAMICS() :
 	transform(btTransform::getIdentity()),
 	linear_velocity(0,0,0),
 	angular_velocity(0,0,0),
+	wheel_contacts_queued(false),
 	drive(NONE),
 	driveshaft_rpm(0),
 	tacho_rpm(0),
@@ -418,6 +420,7 @@ CARDYNAMICS::~CARDYNAMICS()
 	// delete body
 	if (world)
 	{
+		world->removeVehicle(this);
 		world->removeAction(this);
 		world->removeRigidBody(body);
 	}
@@ -543,6 +546,7 @@ bool CARDYNAMICS::Load(
 	body->setCollisionFlags(body->getCollisionFlags() | btCollisionObject::CF_CUSTOM_MATERIAL_CALLBACK);
 	world.addRigidBody(body);
 	world.addAction(this);
+	world.addVehicle(this);
 	this->world = &world;
 
 	// position is the center of a 2 x 4 x 1 meter box on track surface
@@ -1007,21 +1011,18 @@ void CARDYNAMICS::DebugPrint ( std::ostream & out, bool p1, bool p2, bool p3, bo
 	}
 }
 
+// the components are contiguous, binary serializers copy them at once,
+// the other formats see the same q[0] ... names as before
 static bool serialize(joeserialize::Serializer & s, btQuaternion & q)
 {
-	_SERIALIZE_(s, q[0]);
-	_SERIALIZE_(s, q[1]);
-	_SERIALIZE_(s, q[2]);
-	_SERIALIZE_(s, q[3]);
-	return true;
+	static const std::string name("q");
+	return s.SerializeArray(name, &q[0], 4);
 }
 
 static bool serialize(joeserialize::Serializer & s, btVector3 & v)
 {
-	_SERIALIZE_(s, v[0]);
-	_SERIALIZE_(s, v[1]);
-	_SERIALIZE_(s, v[2]);
-	return true;
+	static const std::string name("v");
+	return s.SerializeArray(name, &v[0], 3);
 }
 
 static bool serialize(joeserialize::Serializer & s, btMatrix3x3 & m)
@@ -1478,10 +1479,13 @@ void CARDYNAMICS::ApplyForces ( btScalar dt, const btVector3 & ext_force, const
 		}
 	}
 
-	//compute wheel forces
-	for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+	//compute wheel forces, timed on the thread the car is stepped on
 	{
-		ApplyWheelForces ( dt, wheel_drive_torque[i], i, suspension_force[i], force, torque );
+		PROFILE_SCOPE("tire");
+		for ( int i = 0; i < WHEEL_POSITION_SIZE; ++i )
+		{
+			ApplyWheelForces ( dt, wheel_drive_torque[i], i, suspension_force[i], force, torque );
+		}
 	}
 
 	for ( int n = 0; n < 3; ++n ) assert ( !isnan ( force[n] ) );
@@ -1517,7 +1521,12 @@ void CARDYNAMICS::updateAction(btCollisionWorld * collisionWorld, btScalar dt)
 	btVector3 torque = body->getInvInertiaTensorWorld().inverse() * dw / dt;
 	body->setLinearVelocity(linear_velocity);
 	body->setAngularVelocity(angular_velocity);
-	UpdateWheelContacts();
+	if (!wheel_contacts_queued)
+	{
+		PROFILE_SCOPE("raycast");
+		UpdateWheelContacts();
+	}
+	wheel_contacts_queued = false;
 
 	feedback = 0;
 	int repeats = 10;
@@ -1562,6 +1571,33 @@ void CARDYNAMICS::UpdateWheelContacts()
 	}
 }
 
+void CARDYNAMICS::QueueWheelRays(btAlignedObjectArray<DynamicsWorld::Ray> & rays)
+{
+	// updateAction resets the body to transform before casting, so use it here
+	btVector3 raydir = -transform.getBasis().getColumn(2);
+	btScalar raylen = 4;
+	for (int i = 0; i < WHEEL_POSITION_SIZE; ++i)
+	{
+		btVector3 raystart = wheel_position[i] - raydir * tire[i].GetRadius();
+		if (body->getChildBody(i)->isInWorld())
+		{
+			// wheel separated
+			wheel_contact[i] = COLLISION_CONTACT(raystart, raydir, raylen, -1, 0, TRACKSURFACE::None(), 0);
+		}
+		else
+		{
+			DynamicsWorld::Ray ray;
+			ray.origin = raystart;
+			ray.direction = raydir;
+			ray.length = raylen;
+			ray.caster = body;
+			ray.contact = &wheel_contact[i];
+			rays.push_back(ray);
+		}
+	}
+	wheel_contacts_queued = true;
+}
+
 void CARDYNAMICS::InterpolateWheelContacts()
 {
 	btVector3 raydir = GetDownVector();
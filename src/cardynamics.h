@@ -35,12 +35,12 @@
 #include "cartelemetry.h"
 #include "motionstate.h"
 #include "joeserialize.h"
+#include "dynamicsworld.h"
 #include "BulletDynamics/Dynamics/btActionInterface.h"
 
 class btCollisionWorld;
 class btManifoldPoint;
 class btIDebugDraw;
-class DynamicsWorld;
 class FractureBody;
 class PTree;
 
@@ -67,6 +67,9 @@ public:
 	void updateAction(btCollisionWorld * collisionWorld, btScalar dt);
 	void debugDraw(btIDebugDraw * debugDrawer);
 
+	// queue wheel contact rays, the world casts them in one batch before updateAction
+	void QueueWheelRays(btAlignedObjectArray<DynamicsWorld::Ray> & rays);
+
 	// graphics interpolated
 	btVector3 GetEnginePosition() const;
 	const btVector3 & GetPosition() const;
@@ -207,6 +210,7 @@ protected:
 	btAlignedObjectArray<btVector3> wheel_velocity;
 	btAlignedObjectArray<btVector3> wheel_position;
 	btAlignedObjectArray<btQuaternion> wheel_orientation;
+	bool wheel_contacts_queued;
 
 	enum { NONE = 0, FWD = 1, RWD = 2, AWD = 3 } drive;
 	btScalar driveshaft_rpm;
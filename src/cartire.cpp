@@ -20,6 +20,61 @@
 #include "cartire.h"
 #include "cfg/ptree.h"
 
+// pacejka table layout: slip is compressed into (-1, 1) by x / (|x| + scale)
+// which covers the unbounded slip range with most samples around the peak
+static const int TABLE_SLIP_SIZE = 128;
+static const int TABLE_LOAD_SIZE = 31;
+static const int TABLE_CAMBER_SIZE = 13;
+static const btScalar TABLE_LOAD_MAX = 30;	// kN, GetForce load limit
+static const btScalar TABLE_CAMBER_MAX = 30;	// degrees, GetForce inclination limit
+static const btScalar TABLE_SIGMA_SCALE = 0.2;
+static const btScalar TABLE_ALPHA_SCALE = 10;
+
+static inline btScalar CompressSlip(btScalar x, btScalar scale)
+{
+	return x / (btFabs(x) + scale);
+}
+
+static inline btScalar ExpandSlip(btScalar u, btScalar scale)
+{
+	return scale * u / btMax(btScalar(1) - btFabs(u), btScalar(1E-6));
+}
+
+// split a table coordinate into cell index and blend factor
+static inline int TableCell(btScalar t, int size, btScalar & blend)
+{
+	int i = int(t);
+	btClamp(i, 0, size - 2);
+	blend = t - i;
+	return i;
+}
+
+// bilinear lookup in a slip x load slice
+static inline btScalar TableLookup2(const float * slice, int i, btScalar fi, int j, btScalar fj)
+{
+	const float * r0 = slice + j * TABLE_SLIP_SIZE + i;
+	const float * r1 = r0 + TABLE_SLIP_SIZE;
+	btScalar v0 = r0[0] + (r0[1] - r0[0]) * fi;
+	btScalar v1 = r1[0] + (r1[1] - r1[0]) * fi;
+	return v0 + (v1 - v0) * fj;
+}
+
+// bilinear in slip x load, linear in camber
+static inline btScalar TableLookup3(
+	const std::vector<float> & table,
+	btScalar slip, btScalar slip_scale,
+	btScalar Fz, btScalar gamma)
+{
+	btScalar fi, fj, fk;
+	int i = TableCell((CompressSlip(slip, slip_scale) + 1) * btScalar(0.5 * (TABLE_SLIP_SIZE - 1)), TABLE_SLIP_SIZE, fi);
+	int j = TableCell(Fz * btScalar((TABLE_LOAD_SIZE - 1) / TABLE_LOAD_MAX), TABLE_LOAD_SIZE, fj);
+	int k = TableCell((gamma + TABLE_CAMBER_MAX) * btScalar(0.5 * (TABLE_CAMBER_SIZE - 1) / TABLE_CAMBER_MAX), TABLE_CAMBER_SIZE, fk);
+	const float * slice = &table[k * TABLE_LOAD_SIZE * TABLE_SLIP_SIZE];
+	btScalar v0 = TableLookup2(slice, i, fi, j, fj);
+	btScalar v1 = TableLookup2(slice + TABLE_LOAD_SIZE * TABLE_SLIP_SIZE, i, fi, j, fj);
+	return v0 + (v1 - v0) * fk;
+}
+
 CARTIRE::CARTIRE() :
 	radius(0.3),
 	aspect_ratio(0.5),
@@ -94,6 +149,11 @@ bool CARTIRE::Load(
 	if (!LoadParameters(*type, error)) return false;
 	SetDimensions(size[0], size[1], size[2]);
 	CalculateSigmaHatAlphaHat();
+
+	bool table_mode = false;
+	cfg.get("pacejka-table", table_mode);
+	SetTableMode(table_mode);
+
 	return true;
 }
 
@@ -164,8 +224,19 @@ btVector3 CARTIRE::GetForce(
 	btScalar s = sigma / sigma_hat;
 	btScalar a = alpha / alpha_hat;
 	btScalar rho = btMax(btScalar(sqrt(s * s + a * a)), btScalar(1E-4)); // avoid divide-by-zero
-	btScalar Fx = (s / rho) * PacejkaFx(rho * sigma_hat, Fz, friction_coeff, max_Fx);
-	btScalar Fy = (a / rho) * PacejkaFy(rho * alpha_hat, Fz, gamma, friction_coeff, max_Fy);
+	btScalar Fx, Fy, Mz;
+	if (GetTableMode())
+	{
+		Fx = (s / rho) * LookupFx(rho * sigma_hat, Fz) * friction_coeff;
+		Fy = (a / rho) * LookupFy(rho * alpha_hat, Fz, gamma) * friction_coeff;
+		Mz = LookupMz(alpha, Fz, gamma) * friction_coeff;
+	}
+	else
+	{
+		Fx = (s / rho) * PacejkaFx(rho * sigma_hat, Fz, friction_coeff, max_Fx);
+		Fy = (a / rho) * PacejkaFy(rho * alpha_hat, Fz, gamma, friction_coeff, max_Fy);
+		Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
+	}
 
 /*
 	//combining method 2: orangutan
@@ -255,8 +326,6 @@ btVector3 CARTIRE::GetForce(
 	btScalar Fy = Fc * sqrt((1-s) * (1-s) * cosa * cosa * Fy0 * Fy0 + sina * sina * Cs * Cs) / (Cs * cosa);
 */
 
-	btScalar Mz = PacejkaMz(alpha, Fz, gamma, friction_coeff, max_Mz);
-
 	feedback = Mz;
 	camber = inclination;
 	slide = sigma;
@@ -432,6 +501,67 @@ void CARTIRE::SetDimensions(btScalar width_mm, btScalar ratio_percent, btScalar
 	sidewall_width = width_mm * 0.001;
 }
 
+void CARTIRE::SetTableMode(bool enable)
+{
+	if (enable)
+	{
+		BuildTables();
+	}
+	else
+	{
+		std::vector<float>().swap(fx_table);
+		std::vector<float>().swap(fy_table);
+		std::vector<float>().swap(mz_table);
+	}
+}
+
+void CARTIRE::BuildTables()
+{
+	// sample at unit friction, the formulas are linear in the friction coefficient
+	// avoid the zero load singularity (B = BCD / CD) at the first load row
+	const int slice_size = TABLE_SLIP_SIZE * TABLE_LOAD_SIZE;
+	fx_table.resize(slice_size);
+	fy_table.resize(slice_size * TABLE_CAMBER_SIZE);
+	mz_table.resize(slice_size * TABLE_CAMBER_SIZE);
+	btScalar junk;
+	for (int k = 0; k < TABLE_CAMBER_SIZE; ++k)
+	{
+		btScalar gamma = TABLE_CAMBER_MAX * (btScalar(2 * k) / (TABLE_CAMBER_SIZE - 1) - 1);
+		for (int j = 0; j < TABLE_LOAD_SIZE; ++j)
+		{
+			btScalar Fz = btMax(TABLE_LOAD_MAX * j / (TABLE_LOAD_SIZE - 1), btScalar(1E-3));
+			for (int i = 0; i < TABLE_SLIP_SIZE; ++i)
+			{
+				btScalar u = btScalar(2 * i) / (TABLE_SLIP_SIZE - 1) - 1;
+				btScalar sigma = ExpandSlip(u, TABLE_SIGMA_SCALE);
+				btScalar alpha = ExpandSlip(u, TABLE_ALPHA_SCALE);
+				int n = (k * TABLE_LOAD_SIZE + j) * TABLE_SLIP_SIZE + i;
+				if (k == 0) fx_table[n] = PacejkaFx(sigma, Fz, 1, junk);
+				fy_table[n] = PacejkaFy(alpha, Fz, gamma, 1, junk);
+				mz_table[n] = PacejkaMz(alpha, Fz, gamma, 1, junk);
+			}
+		}
+	}
+}
+
+btScalar CARTIRE::LookupFx(btScalar sigma, btScalar Fz) const
+{
+	btScalar fi, fj;
+	int i = TableCell((CompressSlip(sigma, TABLE_SIGMA_SCALE) + 1) * btScalar(0.5 * (TABLE_SLIP_SIZE - 1)), TABLE_SLIP_SIZE, fi);
+	int j = TableCell(Fz * btScalar((TABLE_LOAD_SIZE - 1) / TABLE_LOAD_MAX), TABLE_LOAD_SIZE, fj);
+	return TableLookup2(&fx_table[0], i, fi, j, fj);
+}
+
+btScalar CARTIRE::LookupFy(btScalar alpha, btScalar Fz, btScalar gamma) const
+{
+	return TableLookup3(fy_table, alpha, TABLE_ALPHA_SCALE, Fz, gamma);
+}
+
+btScalar CARTIRE::LookupMz(btScalar alpha, btScalar Fz, btScalar gamma) const
+{
+	return TableLookup3(mz_table, alpha, TABLE_ALPHA_SCALE, Fz, gamma);
+}
+
 void CARTIRE::FindSigmaHatAlphaHat(btScalar load, btScalar & output_sigmahat, btScalar & output_alphahat, int iterations)
 {
 	btScalar x, y, ymax, junk;
@@ -514,3 +644,138 @@ QT_TEST(tire_test)
 	QT_CHECK_GREATER(f1[1], 0);
 	QT_CHECK_LESS(f0[1], f1[1]);
 }
+
+#include "benchmark.h"
+
+namespace
+{
+	// deterministic pseudo random numbers for tests and benchmarks
+	struct LCG
+	{
+		unsigned state;
+		LCG(unsigned seed) : state(seed) {}
+		btScalar operator()(btScalar min, btScalar max)
+		{
+			state = state * 1664525u + 1013904223u;
+			return min + (max - min) * ((state >> 8) / 16777216.0f);
+		}
+	};
+
+	// road tire with touring like parameters, independent of the data tree
+	bool LoadTestTire(CARTIRE & tire, bool table_mode, std::ostream & error)
+	{
+		std::stringstream s;
+		s << "size = 205,55,16\n";
+		s << "pacejka-table = " << table_mode << "\n";
+		s << "[type]\n";
+		s << "a0=1.5\na1=-40\na2=1600\na3=2600\na4=8.7\na5=0.014\na6=-0.24\na7=1.0\n";
+		s << "a8=-0.03\na9=-0.0013\na10=-0.15\na111=-8.5\na112=-0.29\na12=17.8\na13=-2.4\n";
+		s << "b0=1.5\nb1=-40\nb2=1600\nb3=23.3\nb4=410\nb5=0.075\nb6=0\nb7=0.055\n";
+		s << "b8=-0.024\nb9=0\nb10=0\n";
+		s << "c0=2.2\nc1=-3.9\nc2=-3.9\nc3=-1.26\nc4=-8.2\nc5=0.025\nc6=0\nc7=0.044\n";
+		s << "c8=-0.58\nc9=0.18\nc10=0.043\nc11=0.048\nc12=-0.0035\nc13=-0.18\n";
+		s << "c14=0.14\nc15=-1.029\nc16=0.27\nc17=-1.1\n";
+		s << "rolling-resistance = 1.3e-2, 6.5e-6\ntread = 0\n";
+		PTree cfg;
+		read_ini(s, cfg);
+		return tire.Load(cfg, error);
+	}
+
+	struct TIREINPUT
+	{
+		btScalar normal_force, friction_coeff, inclination;
+		btScalar ang_velocity, lon_velocity, lat_velocity;
+	};
+
+	void MakeTireInputs(std::vector<TIREINPUT> & inputs, btScalar radius, LCG & rand)
+	{
+		for (size_t i = 0; i < inputs.size(); ++i)
+		{
+			TIREINPUT & t = inputs[i];
+			t.normal_force = rand(100, 12000);
+			t.friction_coeff = rand(0.5, 1.1);
+			t.inclination = rand(-10, 10);
+			t.lon_velocity = rand(0.5, 60);
+			t.lat_velocity = rand(-0.2, 0.2) * t.lon_velocity;
+			t.ang_velocity = (1 + rand(-0.3, 0.3)) * t.lon_velocity / radius;
+		}
+	}
+}
+
+QT_TEST(tire_table_test)
+{
+	std::stringbuf log;
+	std::ostream error(&log);
+
+	CARTIRE analytic, table;
+	QT_CHECK(LoadTestTire(analytic, false, error));
+	QT_CHECK(LoadTestTire(table, true, error));
+	QT_CHECK(!analytic.GetTableMode());
+	QT_CHECK(table.GetTableMode());
+
+	// error bound relative to the full scale force/moment of the sample set
+	LCG rand(1234);
+	std::vector<TIREINPUT> inputs(4096);
+	MakeTireInputs(inputs, analytic.GetRadius(), rand);
+	btScalar max_error[3] = {0, 0, 0};
+	btScalar max_value[3] = {0, 0, 0};
+	for (size_t i = 0; i < inputs.size(); ++i)
+	{
+		const TIREINPUT & t = inputs[i];
+		btVector3 fa = analytic.GetForce(t.normal_force, t.friction_coeff, t.inclination, t.ang_velocity, t.lon_velocity, t.lat_velocity);
+		btVector3 ft = table.GetForce(t.normal_force, t.friction_coeff, t.inclination, t.ang_velocity, t.lon_velocity, t.lat_velocity);
+		for (int n = 0; n < 3; ++n)
+		{
+			max_error[n] = btMax(max_error[n], btFabs(ft[n] - fa[n]));
+			max_value[n] = btMax(max_value[n], btFabs(fa[n]));
+		}
+	}
+	QT_CHECK_LESS(max_error[0], 0.005 * max_value[0]);
+	QT_CHECK_LESS(max_error[1], 0.01 * max_value[1]);
+	QT_CHECK_LESS(max_error[2], 0.02 * max_value[2]);
+
+	// switching back releases the tables
+	table.SetTableMode(false);
+	QT_CHECK(!table.GetTableMode());
+}
+
+BENCHMARK(tire_force)
+{
+	std::stringbuf log;
+	std::ostream error(&log);
+
+	CARTIRE tire;
+	if (!LoadTestTire(tire, false, error))
+	{
+		out << log.str();
+		return;
+	}
+
+	LCG rand(4321);
+	std::vector<TIREINPUT> inputs(4096);
+	MakeTireInputs(inputs, tire.GetRadius(), rand);
+	const int repeats = 200;
+
+	double time[2];
+	for (int mode = 0; mode < 2; ++mode)
+	{
+		tire.SetTableMode(mode == 1);
+		btVector3 sum(0, 0, 0);
+		benchmark::Stopwatch timer;
+		for (int r = 0; r < repeats; ++r)
+		{
+			for (size_t i = 0; i < inputs.size(); ++i)
+			{
+				const TIREINPUT & t = inputs[i];
+				sum += tire.GetForce(t.normal_force, t.friction_coeff, t.inclination, t.ang_velocity, t.lon_velocity, t.lat_velocity);
+			}
+		}
+		time[mode] = timer.Seconds();
+		benchmark::DoNotOptimize(sum);
+	}
+
+	double evals = double(inputs.size()) * repeats;
+	out << "analytic: " << evals / time[0] * 1E-6 << " Mevals/s" << std::endl;
+	out << "table: " << evals / time[1] * 1E-6 << " Mevals/s" << std::endl;
+	out << "speedup: " << time[0] / time[1] << std::endl;
+}
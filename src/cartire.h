@@ -65,6 +65,13 @@ public:
 		btScalar lon_velocty,
 		btScalar lat_velocity);
 
+	/// switch between sampled pacejka tables and the analytic formulas
+	/// tables are baked on enable and released on disable
+	void SetTableMode(bool enable);
+
+	/// true if GetForce evaluates the sampled pacejka tables
+	bool GetTableMode() const	{return !fx_table.empty();}
+
 	/// get rolling resistance
 	btScalar GetRollingResistance(const btScalar velocity, const btScalar rolling_resistance_factor) const;
 
@@ -107,6 +114,9 @@ private:
 	std::vector<btScalar> aligning; ///< the parameters of the aligning moment pacejka equation.  this is series c
 	std::vector<btScalar> sigma_hat; ///< maximum grip in the longitudinal direction
 	std::vector<btScalar> alpha_hat; ///< maximum grip in the lateral direction
+	std::vector<float> fx_table; ///< Fx over slip x load at unit friction, empty in analytic mode
+	std::vector<float> fy_table; ///< Fy over slip x load x camber at unit friction
+	std::vector<float> mz_table; ///< Mz over slip x load x camber at unit friction
 
 	// variables
 	btScalar feedback; ///< the force feedback effect value
@@ -128,6 +138,17 @@ private:
 	/// pacejka magic formula function, aligning
 	btScalar PacejkaMz(btScalar alpha, btScalar Fz, btScalar gamma, btScalar friction_coeff, btScalar & max_Mz) const;
 
+	/// bilinear lookup of the sampled PacejkaFx, unit friction
+	btScalar LookupFx(btScalar sigma, btScalar Fz) const;
+
+	/// bilinear lookup of the sampled PacejkaFy, linear in camber, unit friction
+	btScalar LookupFy(btScalar alpha, btScalar Fz, btScalar gamma) const;
+
+	/// bilinear lookup of the sampled PacejkaMz, linear in camber, unit friction
+	btScalar LookupMz(btScalar alpha, btScalar Fz, btScalar gamma) const;
+
+	void BuildTables();
+
 	bool LoadParameters(const PTree & cfg, std::ostream & error);
 
 	void SetDimensions(btScalar width_mm, btScalar ratio_percent, btScalar diameter_in);
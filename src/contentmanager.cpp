@@ -21,8 +21,11 @@
 #include "texture.h"
 #include "model_joe03.h"
 #include "soundbuffer.h"
+#include "unittest.h"
 
 #include <fstream>
+#include <algorithm>
+#include <cstdio>
 
 template <class key, class value>
 static void printLeak(const std::map<key, value>& cache, std::ostream& out)
@@ -36,16 +39,30 @@ static void printLeak(const std::map<key, value>& cache, std::ostream& out)
 
 ContentManager::ContentManager(std::ostream & error) :
 	sound_info(0, 0, 0, 0),
+	sound_stream_size(0),
 	texture_size(TEXTUREINFO::LARGE),
 	texture_srgb(false),
 	model_vbo(false),
-	error(error)
+	headless(false),
+	memory_budget(0),
+	use_clock(0),
+	error(error),
+	loader_lock(SDL_CreateMutex()),
+	loader_wake(SDL_CreateSemaphore(0)),
+	loader_order(0),
+	loader_threads(2),
+	loader_quit(false)
 {
 	//ctor
 }
 
 ContentManager::~ContentManager()
 {
+	stopLoaders();
+	SDL_DestroySemaphore(loader_wake);
+	SDL_DestroyMutex(loader_lock);
+
+	memory_budget = 0;
 	sweep();
 	printLeak(textures, error);
 	printLeak(models, error);
@@ -67,6 +84,11 @@ void ContentManager::setSound(const SOUNDINFO& info)
 	sound_info = info;
 }
 
+void ContentManager::setSoundStreamSize(unsigned int bytes)
+{
+	sound_stream_size = bytes;
+}
+
 void ContentManager::setTexSize(int value)
 {
 	texture_size = TEXTUREINFO::Size(value);
@@ -82,16 +104,238 @@ void ContentManager::setVBO(bool value)
 	model_vbo = value;
 }
 
+void ContentManager::setHeadless(bool value)
+{
+	headless = value;
+}
+
+void ContentManager::setLoaderThreads(int value)
+{
+	loader_threads = std::max(value, 1);
+}
+
+void ContentManager::setMemoryBudget(unsigned long long bytes)
+{
+	memory_budget = bytes;
+	trim();
+}
+
+void ContentManager::update()
+{
+	if (loaders.empty())
+		return;
+
+	std::vector<std::tr1::shared_ptr<Request> > decoded;
+	SDL_mutexP(loader_lock);
+	decoded.swap(loader_decoded);
+	SDL_mutexV(loader_lock);
+
+	for (size_t i = 0; i < decoded.size(); ++i)
+	{
+		decoded[i]->complete(*this);
+	}
+}
+
+unsigned int ContentManager::getPending() const
+{
+	return textures.pending.size() + models.pending.size() + sounds.pending.size();
+}
+
+void ContentManager::startLoaders()
+{
+	loader_quit = false;
+	for (int i = 0; i < loader_threads; ++i)
+	{
+#if SDL_VERSION_ATLEAST(2,0,0)
+		loaders.push_back(SDL_CreateThread(LoaderMain, "content", this));
+#else
+		loaders.push_back(SDL_CreateThread(LoaderMain, this));
+#endif
+	}
+}
+
+void ContentManager::stopLoaders()
+{
+	if (loaders.empty())
+		return;
+
+	SDL_mutexP(loader_lock);
+	loader_quit = true;
+	SDL_mutexV(loader_lock);
+
+	for (size_t i = 0; i < loaders.size(); ++i)
+	{
+		SDL_SemPost(loader_wake);
+	}
+	for (size_t i = 0; i < loaders.size(); ++i)
+	{
+		SDL_WaitThread(loaders[i], NULL);
+	}
+	loaders.clear();
+
+	// unfinished requests are dropped, their futures never become ready
+	loader_queue.clear();
+	loader_decoded.clear();
+}
+
+void ContentManager::queue(const std::tr1::shared_ptr<Request> & request)
+{
+	if (loaders.empty())
+		startLoaders();
+
+	SDL_mutexP(loader_lock);
+	loader_queue.push_back(request);
+	std::push_heap(loader_queue.begin(), loader_queue.end(), RequestOrder());
+	SDL_mutexV(loader_lock);
+
+	SDL_SemPost(loader_wake);
+}
+
+void ContentManager::reprioritize(Request & request, int priority)
+{
+	SDL_mutexP(loader_lock);
+	if (request.priority < priority)
+	{
+		// requests being decoded are not in the queue, the heap order still holds
+		request.priority = priority;
+		std::make_heap(loader_queue.begin(), loader_queue.end(), RequestOrder());
+	}
+	SDL_mutexV(loader_lock);
+}
+
+int ContentManager::LoaderMain(void * data)
+{
+	ContentManager & content = *static_cast<ContentManager*>(data);
+	while (true)
+	{
+		// one post per queued request and per thread on quit
+		SDL_SemWait(content.loader_wake);
+
+		SDL_mutexP(content.loader_lock);
+		if (content.loader_quit)
+		{
+			SDL_mutexV(content.loader_lock);
+			break;
+		}
+		assert(!content.loader_queue.empty());
+		std::pop_heap(content.loader_queue.begin(), content.loader_queue.end(), RequestOrder());
+		std::tr1::shared_ptr<Request> request = content.loader_queue.back();
+		content.loader_queue.pop_back();
+		SDL_mutexV(content.loader_lock);
+
+		request->decode(content);
+
+		SDL_mutexP(content.loader_lock);
+		content.loader_decoded.push_back(request);
+		SDL_mutexV(content.loader_lock);
+	}
+	return 0;
+}
+
+void ContentManager::find(
+	const std::string & path,
+	const std::string & name,
+	std::string & abspath,
+	std::string & key) const
+{
+	const std::string relpath = path.empty() ? name : path + '/' + name;
+	for (size_t i = 0; i < basepaths.size(); ++i)
+	{
+		abspath = basepaths[i] + '/' + relpath;
+		if (std::ifstream(abspath.c_str()))
+		{
+			key = relpath;
+			return;
+		}
+	}
+	for (size_t i = 0; i < sharedpaths.size(); ++i)
+	{
+		abspath = sharedpaths[i] + '/' + name;
+		if (std::ifstream(abspath.c_str()))
+		{
+			key = name;
+			return;
+		}
+	}
+	abspath.clear();
+	key = basepaths.empty() ? name : relpath;
+}
+
+void ContentManager::add(const std::string & key, const std::tr1::shared_ptr<MODEL>& model)
+{
+	generate(*model);
+	store(key, model);
+}
+
+void ContentManager::generate(MODEL & model)
+{
+	if (!headless)
+	{
+		if (model_vbo)
+			model.GenerateVertexArrayObject(error);
+		else
+			model.GenerateListID(error);
+	}
+}
+
+void ContentManager::trim()
+{
+	unsigned long long bytes = textures.bytes + models.bytes + sounds.bytes;
+	if (!memory_budget || bytes <= memory_budget)
+		return;
+
+	std::vector<Unused> unused;
+	collect(textures, 0, unused);
+	collect(models, 1, unused);
+	collect(sounds, 2, unused);
+	std::sort(unused.begin(), unused.end());
+
+	for (size_t i = 0; i < unused.size() && bytes > memory_budget; ++i)
+	{
+		const Unused & u = unused[i];
+		if (u.type == 0)
+			bytes -= evict(textures, u.key);
+		else if (u.type == 1)
+			bytes -= evict(models, u.key);
+		else
+			bytes -= evict(sounds, u.key);
+	}
+}
+
+static void printCacheStats(const char * type, const ContentManager::Stats & stats, std::ostream & out)
+{
+	out << type << ": " << stats.resident << ", " << stats.bytes / 1024 << " KB, " <<
+		stats.hits << " hits, " << stats.misses << " misses, " <<
+		stats.evictions << " evictions, " <<
+		stats.decode_time * 1E3 << " ms decoding\n";
+}
+
+void ContentManager::printStats(std::ostream & out)
+{
+	printCacheStats("Textures", getStats<TEXTURE>(), out);
+	printCacheStats("Models", getStats<MODEL>(), out);
+	printCacheStats("Sounds", getStats<SOUNDBUFFER>(), out);
+	if (memory_budget)
+	{
+		const unsigned long long bytes = textures.bytes + models.bytes + sounds.bytes;
+		out << "Budget: " << bytes / (1024 * 1024) << " of " << memory_budget / (1024 * 1024) << " MB\n";
+	}
+}
+
 void ContentManager::sweep(std::ostream & info)
 {
 	sweep();
-	info << "Textures: " << textures.size() << "\n";
-	info << "Models: " << models.size() << "\n";
-	info << "Sounds: " << sounds.size() << std::endl;
+	printStats(info);
+	info.flush();
 }
 
 void ContentManager::sweep()
 {
+	if (memory_budget)
+	{
+		trim();
+		return;
+	}
 	textures.sweep();
 	models.sweep();
 	sounds.sweep();
@@ -109,7 +353,7 @@ bool ContentManager::load(
 		info_temp.srgb = texture_srgb;
 		info_temp.maxsize = texture_size;
 		std::tr1::shared_ptr<TEXTURE> temp(new TEXTURE());
-		if (temp->Load(abspath, info_temp, error))
+		if (headless || temp->Load(abspath, info_temp, error))
 		{
 			sptr = temp;
 			return true;
@@ -132,7 +376,7 @@ bool ContentManager::load(
 	if (std::ifstream(filepath.c_str()))
 	{
 		std::tr1::shared_ptr<SOUNDBUFFER> temp(new SOUNDBUFFER());
-		if (temp->Load(filepath, sound_info, error))
+		if (temp->Load(filepath, sound_info, error, sound_stream_size))
 		{
 			sptr = temp;
 			return true;
@@ -150,7 +394,7 @@ bool ContentManager::load(
 	if (std::ifstream(abspath.c_str()))
 	{
 		std::tr1::shared_ptr<MODEL_JOE03> temp(new MODEL_JOE03());
-		if (temp->Load(abspath, error, !model_vbo))
+		if (headless ? temp->LoadMesh(abspath, error) : temp->Load(abspath, error, !model_vbo))
 		{
 			sptr = temp;
 			return true;
@@ -167,7 +411,7 @@ bool ContentManager::load(
 {
 	std::tr1::shared_ptr<MODEL_JOE03> temp(new MODEL_JOE03());
 	std::string name = abspath.substr(abspath.rfind('/')+1); // doesn't look very efficient
-	if (temp->Load(name, error, !model_vbo, &pack))
+	if (headless ? temp->LoadMesh(name, error, &pack) : temp->Load(name, error, !model_vbo, &pack))
 	{
 		sptr = temp;
 		return true;
@@ -182,6 +426,12 @@ bool ContentManager::load(
 	const VERTEXARRAY& varray)
 {
 	std::tr1::shared_ptr<MODEL> temp(new MODEL());
+	if (headless)
+	{
+		temp->BuildFromVertexArray(varray);
+		sptr = temp;
+		return true;
+	}
 	if (temp->Load(varray, error, !model_vbo))
 	{
 		sptr = temp;
@@ -189,3 +439,228 @@ bool ContentManager::load(
 	}
 	return false;
 }
+
+bool ContentManager::decode(ContentRequest<TEXTURE> & request, const TEXTUREINFO & info, std::ostream & error)
+{
+	find(request.path, request.name, request.abspath, request.key);
+	if (request.abspath.empty() && !info.data)
+	{
+		return false;
+	}
+
+	request.content.reset(new TEXTURE());
+	if (headless || info.cube || info.data)
+	{
+		// cube maps and in memory images are loaded by finish
+		return true;
+	}
+
+	TEXTUREINFO info_temp = info;
+	info_temp.srgb = texture_srgb;
+	info_temp.maxsize = texture_size;
+	return request.content->Decode(request.abspath, info_temp, error);
+}
+
+bool ContentManager::finish(ContentRequest<TEXTURE> & request, const TEXTUREINFO & info, std::ostream & error)
+{
+	if (headless)
+	{
+		return true;
+	}
+
+	TEXTUREINFO info_temp = info;
+	info_temp.srgb = texture_srgb;
+	info_temp.maxsize = texture_size;
+	if (info.cube || info.data)
+	{
+		return request.content->Load(request.abspath, info_temp, error);
+	}
+	return request.content->Upload(info_temp, error);
+}
+
+bool ContentManager::decode(ContentRequest<MODEL> & request, const empty &, std::ostream & error)
+{
+	find(request.path, request.name, request.abspath, request.key);
+	if (request.abspath.empty())
+	{
+		return false;
+	}
+
+	std::tr1::shared_ptr<MODEL_JOE03> temp(new MODEL_JOE03());
+	if (!temp->LoadMesh(request.abspath, error))
+	{
+		return false;
+	}
+	request.content = temp;
+	return true;
+}
+
+bool ContentManager::finish(ContentRequest<MODEL> & request, const empty &, std::ostream &)
+{
+	generate(*request.content);
+	return true;
+}
+
+bool ContentManager::decode(ContentRequest<SOUNDBUFFER> & request, const empty &, std::ostream & error)
+{
+	find(request.path, request.name + ".ogg", request.abspath, request.key);
+	if (request.abspath.empty())
+	{
+		find(request.path, request.name + ".wav", request.abspath, request.key);
+	}
+	if (request.abspath.empty())
+	{
+		return false;
+	}
+
+	// the sounds are cached without extension
+	request.key.erase(request.key.length() - 4);
+
+	request.content.reset(new SOUNDBUFFER());
+	return request.content->Load(request.abspath, sound_info, error, sound_stream_size);
+}
+
+bool ContentManager::finish(ContentRequest<SOUNDBUFFER> &, const empty &, std::ostream &)
+{
+	return true;
+}
+
+unsigned long long ContentManager::getSize(const TEXTURE & texture)
+{
+	return texture.GetSize();
+}
+
+unsigned long long ContentManager::getSize(const MODEL & model)
+{
+	const VERTEXARRAY & varray = model.GetVertexArray();
+	const float * floats;
+	const int * ints;
+	int vertices, normals, faces;
+	varray.GetVertices(floats, vertices);
+	varray.GetNormals(floats, normals);
+	varray.GetFaces(ints, faces);
+	unsigned long long size = (vertices + normals) * sizeof(float) + faces * sizeof(int);
+	for (int i = 0; i < varray.GetTexCoordSets(); ++i)
+	{
+		int texcoords;
+		varray.GetTexCoords(i, floats, texcoords);
+		size += texcoords * sizeof(float);
+	}
+	return size;
+}
+
+unsigned long long ContentManager::getSize(const SOUNDBUFFER & sound)
+{
+	return sound.GetSize();
+}
+
+QT_TEST(contentmanager_async_test)
+{
+	const std::string texture = "contentmanager_test.png";
+	{
+		std::ofstream file(texture.c_str());
+		file << "png";
+	}
+
+	std::stringstream error;
+	ContentManager content(error);
+	content.setHeadless(true);
+	content.addPath(".");
+
+	// concurrent requests share one load
+	TEXTUREINFO info;
+	ContentManager::Future<TEXTURE> a = content.loadAsync<TEXTURE>("", texture, info, ContentManager::LOW);
+	ContentManager::Future<TEXTURE> b = content.loadAsync<TEXTURE>("", texture, info, ContentManager::HIGH);
+	ContentManager::Future<TEXTURE> missing = content.loadAsync<TEXTURE>("", "contentmanager_missing.png", info);
+	QT_CHECK(a.valid() && b.valid() && missing.valid());
+	QT_CHECK_EQUAL(content.getPending(), 2);
+
+	for (int i = 0; i < 1000 && content.getPending(); ++i)
+	{
+		SDL_Delay(1);
+		content.update();
+	}
+	QT_CHECK_EQUAL(content.getPending(), 0);
+	QT_CHECK(a.ready() && b.ready() && missing.ready());
+	QT_CHECK(!a.failed() && a.get() && a.get() == b.get());
+	QT_CHECK(missing.failed() && !missing.get());
+
+	// cached content is ready immediately
+	ContentManager::Future<TEXTURE> c = content.loadAsync<TEXTURE>("", texture, info);
+	QT_CHECK(c.ready() && c.get() == a.get());
+
+	std::tr1::shared_ptr<TEXTURE> sptr;
+	QT_CHECK(content.load("", texture, info, sptr) && sptr == a.get());
+
+	ContentManager::Stats stats = content.getStats<TEXTURE>();
+	QT_CHECK_EQUAL(stats.hits, 3);
+	QT_CHECK_EQUAL(stats.misses, 2);
+	QT_CHECK_EQUAL(stats.resident, 1);
+
+	a = b = c = missing = ContentManager::Future<TEXTURE>();
+	sptr.reset();
+	content.sweep();
+	QT_CHECK_EQUAL(content.getStats<TEXTURE>().resident, 0);
+
+	std::remove(texture.c_str());
+}
+
+QT_TEST(contentmanager_budget_test)
+{
+	std::stringstream error;
+	ContentManager content(error);
+	content.setHeadless(true);
+
+	VERTEXARRAY cube;
+	cube.SetToUnitCube();
+	std::tr1::shared_ptr<MODEL> model(new MODEL());
+	model->SetVertexArray(cube);
+	content.add("a", model);
+	const unsigned long long size = content.getStats<MODEL>().bytes;
+	QT_CHECK(size > 0);
+
+	// room for two models, "c" stays referenced
+	content.setMemoryBudget(2 * size);
+	std::tr1::shared_ptr<MODEL> held;
+	for (int i = 0; i < 2; ++i)
+	{
+		model.reset(new MODEL());
+		model->SetVertexArray(cube);
+		content.add(i ? "c" : "b", model);
+	}
+	held = model;
+	model.reset();
+
+	// "a" is the least recently used
+	std::tr1::shared_ptr<MODEL> sptr;
+	QT_CHECK(!content.get("", "a", sptr));
+	QT_CHECK(content.get("", "b", sptr));
+	sptr.reset();
+
+	// three models exceed the budget, "b" is the only unreferenced one
+	model.reset(new MODEL());
+	model->SetVertexArray(cube);
+	content.add("d", model);
+	QT_CHECK(!content.get("", "b", sptr));
+	QT_CHECK(content.get("", "c", sptr));
+	QT_CHECK(content.get("", "d", sptr));
+	sptr.reset();
+
+	// "c" has been released, both fit into the budget
+	held.reset();
+	model.reset();
+	content.sweep();
+	QT_CHECK(content.get("", "c", sptr));
+	QT_CHECK(content.get("", "d", sptr));
+	sptr.reset();
+
+	// a smaller budget drops the least recently used first
+	content.setMemoryBudget(size);
+	QT_CHECK(!content.get("", "c", sptr));
+	QT_CHECK(content.get("", "d", sptr));
+
+	ContentManager::Stats stats = content.getStats<MODEL>();
+	QT_CHECK_EQUAL(stats.evictions, 3);
+	QT_CHECK_EQUAL(stats.resident, 1);
+	QT_CHECK_EQUAL(stats.bytes, size);
+}
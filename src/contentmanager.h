@@ -23,10 +23,16 @@
 #include "soundinfo.h"
 #include "textureinfo.h"
 #include "memory.h"
+#include "quickprof.h"
+
+#include <SDL/SDL_thread.h>
+
 #include <map>
 #include <string>
 #include <vector>
 #include <iostream>
+#include <sstream>
+#include <cassert>
 
 class SOUNDBUFFER;
 class TEXTURE;
@@ -34,7 +40,54 @@ class MODEL;
 
 class ContentManager
 {
+	class Request;
+
+	template <class T>
+	class ContentRequest;
+
 public:
+	/// decode order of asynchronous loads
+	enum Priority
+	{
+		LOW,
+		NORMAL,
+		HIGH
+	};
+
+	/// handle to content requested with loadAsync, only valid on the main thread
+	template <class T>
+	class Future
+	{
+	public:
+		/// false for default constructed handles
+		bool valid() const {return request.get();}
+
+		/// the content has been loaded or failed to load
+		bool ready() const {return request->done;}
+
+		bool failed() const {return request->failed;}
+
+		/// the content once ready, null if it failed to load
+		const std::tr1::shared_ptr<T> & get() const {return request->content;}
+
+	private:
+		friend class ContentManager;
+		std::tr1::shared_ptr<ContentRequest<T> > request;
+	};
+
+	/// content statistics of one content type
+	struct Stats
+	{
+		unsigned int hits; ///< requests served from the cache
+		unsigned int misses; ///< requests which had to read a file
+		unsigned int resident; ///< number of cached items
+		unsigned int evictions; ///< unreferenced items dropped to stay within the budget
+		unsigned long long bytes; ///< approximate memory used by the cached items
+		double decode_time; ///< seconds spent reading and decoding files
+
+		Stats() : hits(0), misses(0), resident(0), evictions(0), bytes(0), decode_time(0) {}
+	};
+
 	ContentManager(std::ostream & error);
 
 	~ContentManager();
@@ -48,6 +101,35 @@ public:
 	template <class T, class P>
 	bool load(const std::string & path, const std::string & name, const P& param, std::tr1::shared_ptr<T>& sptr);
 
+	/// load content on a loader thread, concurrent requests for the same content share
+	/// one load, higher priorities are decoded first, GL objects are created by update,
+	/// supported for textures, models and sounds loaded from files
+	template <class T>
+	Future<T> loadAsync(const std::string & path, const std::string & name, Priority priority = NORMAL);
+
+	template <class T, class P>
+	Future<T> loadAsync(const std::string & path, const std::string & name, const P& param, Priority priority = NORMAL);
+
+	/// finish the asynchronous loads decoded since the last call, creates their GL objects
+	/// and adds them to the caches, to be called once per frame on the main thread
+	void update();
+
+	/// number of asynchronous loads which have not been finished by update yet
+	unsigned int getPending() const;
+
+	/// cache statistics of a content type (TEXTURE, MODEL, SOUNDBUFFER)
+	template <class T>
+	Stats getStats();
+
+	/// file load(path, name) reads and the cache key it stores the content under,
+	/// abspath is empty and key is the first candidate if there is no such file,
+	/// only reads the content paths so it can be called from worker threads
+	void find(const std::string & path, const std::string & name, std::string & abspath, std::string & key) const;
+
+	/// cache a model mesh which has been loaded elsewhere (worker thread),
+	/// creates its draw list or vertex array object unless headless
+	void add(const std::string & key, const std::tr1::shared_ptr<MODEL>& model);
+
 	/// shared content directory path
 	void addSharedPath(const std::string & path);
 
@@ -57,6 +139,10 @@ public:
 	/// sound device setting
 	void setSound(const SOUNDINFO& info);
 
+	/// sounds with more than bytes of samples are streamed from disk while playing
+	/// instead of being loaded into memory, 0 loads all sounds into memory
+	void setSoundStreamSize(unsigned int bytes);
+
 	/// textures size setting
 	void setTexSize(int value);
 
@@ -67,16 +153,133 @@ public:
 	/// use VBOs instead of draw lists for models
 	void setVBO(bool value);
 
-	/// purge unused content
+	/// load content without creating GL objects, for runs without a video context
+	void setHeadless(bool value);
+
+	/// number of loader threads used by loadAsync, they are started by the first request
+	void setLoaderThreads(int value);
+
+	/// memory budget of all caches in bytes, 0 for no budget, unreferenced content
+	/// is kept within the budget and the least recently used content is dropped first
+	void setMemoryBudget(unsigned long long bytes);
+
+	/// purge unused content, only the content exceeding the memory budget if there is one
 	void sweep(std::ostream & info);
 	void sweep();
 
+	/// resident bytes and hit rates of the caches
+	void printStats(std::ostream & out);
+
 private:
+	struct empty {};
+
+	/// asynchronous load, shared by all futures of the same content
+	class Request
+	{
+	public:
+		Request(const std::string & path, const std::string & name, int priority, unsigned int order) :
+			path(path), name(name), priority(priority), order(order),
+			decoded(false), done(false), failed(false), decode_time(0)
+		{
+			// ctor
+		}
+
+		virtual ~Request() {}
+
+		/// find and decode the file, runs on a loader thread
+		virtual void decode(ContentManager & content) = 0;
+
+		/// create GL objects and cache the content, runs on the main thread
+		virtual void complete(ContentManager & content) = 0;
+
+		/// higher priority first, then first come first served
+		bool operator<(const Request & other) const
+		{
+			return priority < other.priority || (priority == other.priority && order > other.order);
+		}
+
+		std::string path;
+		std::string name;
+		std::string abspath; ///< path of the found file
+		std::string key; ///< cache key of the found file
+		std::string errors; ///< error output of the loader thread
+		int priority;
+		unsigned int order;
+		bool decoded;
+		bool done;
+		bool failed;
+		double decode_time;
+	};
+
+	template <class T>
+	class ContentRequest : public Request
+	{
+	public:
+		ContentRequest(const std::string & path, const std::string & name, int priority, unsigned int order) :
+			Request(path, name, priority, order)
+		{
+			// ctor
+		}
+
+		std::tr1::shared_ptr<T> content;
+	};
+
+	template <class T, class P>
+	class LoadRequest : public ContentRequest<T>
+	{
+	public:
+		LoadRequest(const std::string & path, const std::string & name, const P & param, int priority, unsigned int order) :
+			ContentRequest<T>(path, name, priority, order),
+			param(param)
+		{
+			// ctor
+		}
+
+		void decode(ContentManager & content);
+
+		void complete(ContentManager & content);
+
+		P param;
+	};
+
+	struct RequestOrder
+	{
+		bool operator()(const std::tr1::shared_ptr<Request> & a, const std::tr1::shared_ptr<Request> & b) const
+		{
+			return *a < *b;
+		}
+	};
+
+	template <class T>
+	struct Entry
+	{
+		std::tr1::shared_ptr<T> content;
+		unsigned long long size; ///< approximate size in bytes
+		unsigned int used; ///< use clock of the last request
+	};
+
 	template <class T>
-	class Cache : public std::map<std::string, std::tr1::shared_ptr<T> >
+	class Cache : public std::map<std::string, Entry<T> >
 	{
 	public:
+		Cache() : bytes(0) {}
+
+		/// add or replace content
+		void add(const std::string & key, const std::tr1::shared_ptr<T> & content, unsigned long long size, unsigned int used);
+
+		/// drop an entry
+		void remove(typename Cache::iterator i);
+
+		/// drop all unreferenced entries
 		void sweep();
+
+		/// size of all entries in bytes
+		unsigned long long bytes;
+
+		/// asynchronous loads in flight by relative path
+		std::map<std::string, std::tr1::shared_ptr<ContentRequest<T> > > pending;
+
+		Stats stats;
 	};
 
 	// content caches
@@ -86,16 +289,78 @@ private:
 
 	// content settings
 	SOUNDINFO sound_info;
+	unsigned int sound_stream_size;
 	TEXTUREINFO::Size texture_size;
 	bool texture_srgb;
 	bool model_vbo;
+	bool headless;
+
+	// memory budget in bytes, the use clock orders the cache entries by last use
+	unsigned long long memory_budget;
+	unsigned int use_clock;
 
 	// content paths
 	std::vector<std::string> sharedpaths;
 	std::vector<std::string> basepaths;
 	std::ostream & error;
 
-	struct empty {};
+	// loader threads, the queue is a heap ordered by priority
+	std::vector<SDL_Thread*> loaders;
+	SDL_mutex * loader_lock;
+	SDL_sem * loader_wake;
+	std::vector<std::tr1::shared_ptr<Request> > loader_queue;
+	std::vector<std::tr1::shared_ptr<Request> > loader_decoded;
+	unsigned int loader_order;
+	int loader_threads;
+	bool loader_quit;
+
+	static int LoaderMain(void * data);
+
+	void startLoaders();
+
+	void stopLoaders();
+
+	void queue(const std::tr1::shared_ptr<Request> & request);
+
+	void reprioritize(Request & request, int priority);
+
+	// per content type parts of the asynchronous loads
+	bool decode(ContentRequest<TEXTURE> & request, const TEXTUREINFO & info, std::ostream & error);
+	bool decode(ContentRequest<MODEL> & request, const empty & param, std::ostream & error);
+	bool decode(ContentRequest<SOUNDBUFFER> & request, const empty & param, std::ostream & error);
+	bool finish(ContentRequest<TEXTURE> & request, const TEXTUREINFO & info, std::ostream & error);
+	bool finish(ContentRequest<MODEL> & request, const empty & param, std::ostream & error);
+	bool finish(ContentRequest<SOUNDBUFFER> & request, const empty & param, std::ostream & error);
+
+	/// create the draw list or vertex array object of a model unless headless
+	void generate(MODEL & model);
+
+	/// add content to its cache and drop unreferenced content exceeding the budget
+	template <class T>
+	void store(const std::string & key, const std::tr1::shared_ptr<T> & content);
+
+	/// drop the least recently used unreferenced content until within the budget
+	void trim();
+
+	struct Unused
+	{
+		unsigned int used;
+		int type;
+		std::string key;
+
+		bool operator<(const Unused & other) const {return used < other.used;}
+	};
+
+	template <class T>
+	static void collect(Cache<T> & cache, int type, std::vector<Unused> & unused);
+
+	/// drop an entry, returns its size
+	template <class T>
+	static unsigned long long evict(Cache<T> & cache, const std::string & key);
+
+	static unsigned long long getSize(const TEXTURE & texture);
+	static unsigned long long getSize(const MODEL & model);
+	static unsigned long long getSize(const SOUNDBUFFER & sound);
 
 	template <class T>
 	Cache<T>& getCache();
@@ -132,15 +397,40 @@ inline ContentManager::Cache<SOUNDBUFFER>& ContentManager::getCache()
 	return sounds;
 }
 
+template <class T>
+inline void ContentManager::Cache<T>::add(
+	const std::string & key,
+	const std::tr1::shared_ptr<T> & content,
+	unsigned long long size,
+	unsigned int used)
+{
+	Entry<T> & entry = (*this)[key];
+	if (entry.content)
+	{
+		bytes -= entry.size;
+	}
+	entry.content = content;
+	entry.size = size;
+	entry.used = used;
+	bytes += size;
+}
+
+template <class T>
+inline void ContentManager::Cache<T>::remove(typename Cache::iterator i)
+{
+	bytes -= i->second.size;
+	this->erase(i);
+}
+
 template <class T>
 inline void ContentManager::Cache<T>::sweep()
 {
 	typename Cache::iterator it = this->begin();
 	while (it != this->end())
 	{
-		if (it->second.unique())
+		if (it->second.content.unique())
 		{
-			this->erase(it++);
+			remove(it++);
 		}
 		else
 		{
@@ -149,6 +439,40 @@ inline void ContentManager::Cache<T>::sweep()
 	}
 }
 
+template <class T>
+inline void ContentManager::collect(Cache<T> & cache, int type, std::vector<Unused> & unused)
+{
+	for (typename Cache<T>::const_iterator i = cache.begin(); i != cache.end(); ++i)
+	{
+		if (i->second.content.unique())
+		{
+			Unused u;
+			u.used = i->second.used;
+			u.type = type;
+			u.key = i->first;
+			unused.push_back(u);
+		}
+	}
+}
+
+template <class T>
+inline unsigned long long ContentManager::evict(Cache<T> & cache, const std::string & key)
+{
+	typename Cache<T>::iterator i = cache.find(key);
+	assert(i != cache.end());
+	const unsigned long long size = i->second.size;
+	cache.remove(i);
+	cache.stats.evictions++;
+	return size;
+}
+
+template <class T>
+inline void ContentManager::store(const std::string & key, const std::tr1::shared_ptr<T> & content)
+{
+	getCache<T>().add(key, content, getSize(*content), ++use_clock);
+	trim();
+}
+
 template <class T, class P>
 inline bool ContentManager::load(
 	std::tr1::shared_ptr<T>& sptr,
@@ -157,17 +481,18 @@ inline bool ContentManager::load(
 	const P& param)
 {
 	Cache<T>& cache = getCache<T>();
-	typename Cache<T>::const_iterator i = cache.find(relpath);
+	typename Cache<T>::iterator i = cache.find(relpath);
 	if (i != cache.end())
 	{
-		sptr = i->second;
+		sptr = i->second.content;
+		i->second.used = ++use_clock;
 		return true;
 	}
 	for (size_t i = 0; i < paths.size(); ++i)
 	{
 		if (load(sptr, paths[i] + '/' + relpath, param))
 		{
-			cache[relpath] = sptr;
+			store(relpath, sptr);
 			return true;
 		}
 	}
@@ -181,22 +506,23 @@ inline bool ContentManager::load(
 	const P& param,
 	std::tr1::shared_ptr<T>& sptr)
 {
-	if (!path.empty())
+	Cache<T>& cache = getCache<T>();
+	if (get(path, name, sptr))
 	{
-		if (load(sptr, basepaths, path + '/' + name, param) ||
-			load(sptr, sharedpaths, name, param))
-		{
-			return true;
-		}
+		cache.stats.hits++;
+		return true;
 	}
-	else
+	cache.stats.misses++;
+
+	quickprof::Clock clock;
+	const std::string relpath = path.empty() ? name : path + '/' + name;
+	const bool loaded = load(sptr, basepaths, relpath, param) || load(sptr, sharedpaths, name, param);
+	cache.stats.decode_time += clock.getTimeMicroseconds() * 1E-6;
+	if (loaded)
 	{
-		if (load(sptr, basepaths, name, param) ||
-			load(sptr, sharedpaths, name, param))
-		{
-			return true;
-		}
+		return true;
 	}
+
 	error << "Failed to load " << name << " from:";
 	for (size_t i = 0; i < basepaths.size(); ++i)
 	{
@@ -219,6 +545,91 @@ inline bool ContentManager::load(
 	return load(path, name, empty(), sptr);
 }
 
+template <class T>
+inline ContentManager::Future<T> ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	Priority priority)
+{
+	return loadAsync<T>(path, name, empty(), priority);
+}
+
+template <class T, class P>
+inline ContentManager::Future<T> ContentManager::loadAsync(
+	const std::string & path,
+	const std::string & name,
+	const P& param,
+	Priority priority)
+{
+	Future<T> future;
+	Cache<T>& cache = getCache<T>();
+	const std::string relpath = path.empty() ? name : path + '/' + name;
+
+	// share a load in flight, it might have to be decoded earlier now
+	typename std::map<std::string, std::tr1::shared_ptr<ContentRequest<T> > >::iterator i = cache.pending.find(relpath);
+	if (i != cache.pending.end())
+	{
+		cache.stats.hits++;
+		reprioritize(*i->second, priority);
+		future.request = i->second;
+		return future;
+	}
+
+	future.request.reset(new LoadRequest<T, P>(path, name, param, priority, loader_order++));
+	if (get(path, name, future.request->content))
+	{
+		cache.stats.hits++;
+		future.request->done = true;
+		return future;
+	}
+
+	cache.stats.misses++;
+	cache.pending[relpath] = future.request;
+	queue(future.request);
+	return future;
+}
+
+template <class T, class P>
+inline void ContentManager::LoadRequest<T, P>::decode(ContentManager & content)
+{
+	std::ostringstream error;
+	quickprof::Clock clock;
+	this->decoded = content.decode(*this, param, error);
+	this->decode_time = clock.getTimeMicroseconds() * 1E-6;
+	this->errors = error.str();
+}
+
+template <class T, class P>
+inline void ContentManager::LoadRequest<T, P>::complete(ContentManager & content)
+{
+	Cache<T>& cache = content.getCache<T>();
+	cache.pending.erase(this->path.empty() ? this->name : this->path + '/' + this->name);
+	cache.stats.decode_time += this->decode_time;
+
+	content.error << this->errors;
+	this->failed = !this->decoded || !content.finish(*this, param, content.error);
+	if (this->failed)
+	{
+		content.error << "Failed to load " << this->name << " from " << this->path << std::endl;
+		this->content.reset();
+	}
+	else
+	{
+		content.store(this->key, this->content);
+	}
+	this->done = true;
+}
+
+template <class T>
+inline ContentManager::Stats ContentManager::getStats()
+{
+	Cache<T>& cache = getCache<T>();
+	Stats stats = cache.stats;
+	stats.resident = cache.size();
+	stats.bytes = cache.bytes;
+	return stats;
+}
+
 template <class T>
 inline bool ContentManager::get(
 	const std::string & path,
@@ -226,20 +637,22 @@ inline bool ContentManager::get(
 	std::tr1::shared_ptr<T>& sptr)
 {
 	Cache<T>& cache = getCache<T>();
-	typename Cache<T>::const_iterator i;
+	typename Cache<T>::iterator i;
 	if (!path.empty())
 	{
 		i = cache.find(path + '/' + name);
 		if (i != cache.end())
 		{
-			sptr = i->second;
+			sptr = i->second.content;
+			i->second.used = ++use_clock;
 			return true;
 		}
 	}
 	i = cache.find(name);
 	if (i != cache.end())
 	{
-		sptr = i->second;
+		sptr = i->second.content;
+		i->second.used = ++use_clock;
 		return true;
 	}
 	return false;
@@ -146,6 +146,15 @@ struct DRAWABLE_CONTAINER
 		#undef X
 	}
 
+	/// appends the drawable pointers of a PTRVECTOR container to the second container
+	template <template <typename UU> class CONTAINERU>
+	void AppendPointersTo(DRAWABLE_CONTAINER <CONTAINERU> & dest) const
+	{
+		#define X(Y) dest.Y.insert(dest.Y.end(), Y.begin(), Y.end());
+		#include "drawables.def"
+		#undef X
+	}
+
 	/// this is slow, don't do it often
 	reseatable_reference <CONTAINER <DRAWABLE> > GetByName(const std::string & name)
 	{
@@ -23,6 +23,11 @@
 #include "tobullet.h"
 #include "model.h"
 #include "track.h"
+#include "cardynamics.h"
+#include "traceprofiler.h"
+#include "jobsystem.h"
+
+#include <vector>
 
 #define EXTBULLET
 
@@ -86,6 +91,66 @@ struct MyRayResultCallback : public btCollisionWorld::RayResultCallback
 	}
 };
 
+// collect the broadphase proxies overlapping an aabb, excluding the caster
+struct MyAabbCallback : public btBroadphaseAabbCallback
+{
+	MyAabbCallback(
+		btAlignedObjectArray<btCollisionObject*> & objects,
+		const btCollisionObject * exclude) :
+		m_objects(objects),
+		m_exclude(exclude)
+	{
+		// ctor
+	}
+
+	btAlignedObjectArray<btCollisionObject*> & m_objects;
+	const btCollisionObject * m_exclude;
+
+	virtual bool process(const btBroadphaseProxy* proxy)
+	{
+		btCollisionObject* object = static_cast<btCollisionObject*>(proxy->m_clientObject);
+		if (object != m_exclude) m_objects.push_back(object);
+		return true;
+	}
+};
+
+// fill in contact geometry and surface from a ray test result
+static void GetGeometryContact(
+	const MyRayResultCallback & ray,
+	const btScalar length,
+	const TRACK * track,
+	btVector3 & p,
+	btVector3 & n,
+	btScalar & d,
+	const TRACKSURFACE * & s,
+	btCollisionObject * & c)
+{
+	p = ray.m_hitPointWorld;
+	n = ray.m_hitNormalWorld;
+	d = ray.m_closestHitFraction * length;
+	c = ray.m_collisionObject;
+	if (c->isStaticObject())
+	{
+		TRACKSURFACE* tsc = static_cast<TRACKSURFACE*>(c->getUserPointer());
+		const std::vector<TRACKSURFACE> & surfaces = track->GetSurfaces();
+		if (tsc >= &surfaces[0] && tsc <= &surfaces[surfaces.size()-1])
+		{
+			s = tsc;
+		}
+#ifndef EXTBULLET
+		else if (c->getCollisionShape()->isCompound())
+		{
+			TRACKSURFACE* tss = static_cast<TRACKSURFACE*>(ray.m_shape->getUserPointer());
+			if (tss >= &surfaces[0] && tss <= &surfaces[surfaces.size()-1])
+			{
+				s = tss;
+			}
+		}
+#endif
+		//std::cerr << "static object without surface" << std::endl;
+	}
+}
+
 DynamicsWorld::DynamicsWorld(
 	btDispatcher* dispatcher,
 	btBroadphaseInterface* broadphase,
@@ -96,7 +161,9 @@ DynamicsWorld::DynamicsWorld(
 	btDiscreteDynamicsWorld(dispatcher, broadphase, constraintSolver, collisionConfig),
 	track(0),
 	timeStep(timeStep),
-	maxSubSteps(maxSubSteps)
+	maxSubSteps(maxSubSteps),
+	batchRayCasts(true),
+	jobs(0)
 {
 	setGravity(btVector3(0.0, 0.0, -9.81));
 	setForceUpdateAllAabbs(false);
@@ -133,30 +200,7 @@ bool DynamicsWorld::castRay(
 	bool geometryHit = ray.hasHit();
 	if (geometryHit)
 	{
-		p = ray.m_hitPointWorld;
-		n = ray.m_hitNormalWorld;
-		d = ray.m_closestHitFraction * length;
-		c = ray.m_collisionObject;
-		if (c->isStaticObject())
-		{
-			TRACKSURFACE* tsc = static_cast<TRACKSURFACE*>(c->getUserPointer());
-			const std::vector<TRACKSURFACE> & surfaces = track->GetSurfaces();
-			if (tsc >= &surfaces[0] && tsc <= &surfaces[surfaces.size()-1])
-			{
-				s = tsc;
-			}
-#ifndef EXTBULLET
-			else if (c->getCollisionShape()->isCompound())
-			{
-				TRACKSURFACE* tss = static_cast<TRACKSURFACE*>(ray.m_shape->getUserPointer());
-				if (tss >= &surfaces[0] && tss <= &surfaces[surfaces.size()-1])
-				{
-					s = tss;
-				}
-			}
-#endif
-			//std::cerr << "static object without surface" << std::endl;
-		}
+		GetGeometryContact(ray, length, track, p, n, d, s, c);
 
 		// track bezierpatch collision
 		if (track)
@@ -183,6 +227,198 @@ bool DynamicsWorld::castRay(
 	return false;
 }
 
+int DynamicsWorld::castRays(btAlignedObjectArray<Ray> & rays) const
+{
+	btAlignedObjectArray<btCollisionObject*> objects;
+	std::vector<TRACK::RAYCAST> roadrays;
+	std::vector<int> roadray_index;
+	int hits = 0;
+
+	for (int i = 0, e = rays.size(); i < e;)
+	{
+		// rays of one caster are close to each other, query their bounds once
+		const btCollisionObject * caster = rays[i].caster;
+		int end = i;
+		btVector3 aabbMin = rays[i].origin;
+		btVector3 aabbMax = rays[i].origin;
+		for (; end < e && rays[end].caster == caster; ++end)
+		{
+			btVector3 to = rays[end].origin + rays[end].direction * rays[end].length;
+			aabbMin.setMin(rays[end].origin);
+			aabbMax.setMax(rays[end].origin);
+			aabbMin.setMin(to);
+			aabbMax.setMax(to);
+		}
+
+		objects.resize(0);
+		MyAabbCallback aabbCallback(objects, caster);
+		m_broadphasePairCache->aabbTest(aabbMin, aabbMax, aabbCallback);
+
+		for (; i < end; ++i)
+		{
+			const Ray & r = rays[i];
+			btVector3 p = r.origin + r.direction * r.length;
+			btVector3 n = -r.direction;
+			btScalar d = r.length;
+			const TRACKSURFACE * s = TRACKSURFACE::None();
+			btCollisionObject * c = 0;
+
+			btTransform rayFrom, rayTo;
+			rayFrom.setIdentity();
+			rayFrom.setOrigin(r.origin);
+			rayTo.setIdentity();
+			rayTo.setOrigin(p);
+
+			MyRayResultCallback ray(r.origin, p, caster);
+			for (int j = 0; j < objects.size(); ++j)
+			{
+				btCollisionObject * object = objects[j];
+				if (!ray.needsCollision(object->getBroadphaseHandle()))
+					continue;
+
+				btVector3 objectMin, objectMax;
+				object->getCollisionShape()->getAabb(object->getWorldTransform(), objectMin, objectMax);
+				btScalar hitLambda = ray.m_closestHitFraction;
+				btVector3 hitNormal;
+				if (btRayAabb(r.origin, p, objectMin, objectMax, hitLambda, hitNormal))
+				{
+					rayTestSingle(rayFrom, rayTo, object,
+						object->getCollisionShape(), object->getWorldTransform(), ray);
+				}
+			}
+
+			if (!ray.hasHit())
+			{
+				// should only happen on vehicle rollover
+				*r.contact = COLLISION_CONTACT(p, n, d, -1, 0, s, c);
+				continue;
+			}
+
+			GetGeometryContact(ray, r.length, track, p, n, d, s, c);
+			*r.contact = COLLISION_CONTACT(p, n, d, track ? r.contact->GetPatchId() : -1, 0, s, c);
+			++hits;
+
+			// defer bezier patch collision
+			if (track)
+			{
+				TRACK::RAYCAST roadray;
+				roadray.origin = ToMathVector<float>(r.origin);
+				roadray.direction = ToMathVector<float>(r.direction);
+				roadray.seglen = r.length;
+				roadray.patch_id = r.contact->GetPatchId();
+				roadray.colpatch = 0;
+				roadray.hit = false;
+				roadrays.push_back(roadray);
+				roadray_index.push_back(i);
+			}
+		}
+	}
+
+	if (roadrays.empty())
+		return hits;
+
+	// track bezierpatch collision, all rays at once
+	track->CastRays(&roadrays[0], roadrays.size());
+	for (int i = 0, e = roadrays.size(); i < e; ++i)
+	{
+		const TRACK::RAYCAST & roadray = roadrays[i];
+		COLLISION_CONTACT & contact = *rays[roadray_index[i]].contact;
+		btVector3 p = contact.GetPosition();
+		btVector3 n = contact.GetNormal();
+		btScalar d = contact.GetDepth();
+		const BEZIER * b = 0;
+		if (roadray.hit)
+		{
+			p = ToBulletVector(roadray.outtri);
+			n = ToBulletVector(roadray.normal);
+			d = (roadray.outtri - roadray.origin).Magnitude();
+			b = roadray.colpatch;
+		}
+		contact = COLLISION_CONTACT(p, n, d, roadray.patch_id, b,
+			&contact.GetSurface(), contact.GetObject());
+	}
+
+	return hits;
+}
+
+void DynamicsWorld::addVehicle(CARDYNAMICS * vehicle)
+{
+	m_vehicles.push_back(vehicle);
+}
+
+void DynamicsWorld::removeVehicle(CARDYNAMICS * vehicle)
+{
+	m_vehicles.remove(vehicle);
+}
+
+void DynamicsWorld::setBatchRayCasts(bool value)
+{
+	batchRayCasts = value;
+}
+
+void DynamicsWorld::setJobSystem(JobSystem * value)
+{
+	jobs = value;
+}
+
+struct VehicleActions
+{
+	btAlignedObjectArray<CARDYNAMICS*> & vehicles;
+	btCollisionWorld * world;
+	btScalar dt;
+
+	VehicleActions(btAlignedObjectArray<CARDYNAMICS*> & vehicles, btCollisionWorld * world, btScalar dt) :
+		vehicles(vehicles), world(world), dt(dt)
+	{
+		// ctor
+	}
+
+	void operator()(int begin, int end)
+	{
+		for (int i = begin; i < end; ++i)
+		{
+			static_cast<btActionInterface*>(vehicles[i])->updateAction(world, dt);
+		}
+	}
+};
+
+void DynamicsWorld::updateActions(btScalar timeStep)
+{
+	if (batchRayCasts && m_vehicles.size())
+	{
+		m_wheelRays.resize(0);
+		for (int i = 0; i < m_vehicles.size(); ++i)
+		{
+			m_vehicles[i]->QueueWheelRays(m_wheelRays);
+		}
+		PROFILE_SCOPE("raycast");
+		castRays(m_wheelRays);
+	}
+
+	if (!jobs || jobs->GetNumThreads() < 2 || !batchRayCasts || m_vehicles.size() < 2)
+	{
+		btDiscreteDynamicsWorld::updateActions(timeStep);
+		return;
+	}
+
+	// a vehicle action only writes its own bodies and reads the wheel contacts
+	// cast above, nothing is shared between cars, so the results don't depend
+	// on the order or the thread a car is stepped on
+	VehicleActions body(m_vehicles, this, timeStep);
+	jobs->ParallelFor(0, m_vehicles.size(), 1, body);
+
+	// remaining actions in registration order
+	for (int i = 0; i < m_actions.size(); ++i)
+	{
+		int j = 0;
+		while (j < m_vehicles.size() && static_cast<btActionInterface*>(m_vehicles[j]) != m_actions[i]) ++j;
+		if (j == m_vehicles.size())
+		{
+			m_actions[i]->updateAction(this, timeStep);
+		}
+	}
+}
+
 void DynamicsWorld::update(btScalar dt)
 {
 	stepSimulation(dt, maxSubSteps, timeStep);
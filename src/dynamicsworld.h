@@ -29,6 +29,8 @@ class TRACK;
 class COLLISION_CONTACT;
 class FractureBody;
 class BEZIER;
+class CARDYNAMICS;
+class JobSystem;
 
 class DynamicsWorld  : public btDiscreteDynamicsWorld
 {
@@ -48,6 +50,9 @@ public:
 	// reset collision world (unloads previous track)
 	void reset(const TRACK & t);
 
+	// reset collision world, drops the track reference
+	void reset();
+
 	// set custon contact callback
 	void setContactAddedCallback(ContactAddedCallback cb);
 
@@ -61,6 +66,35 @@ public:
 		const btCollisionObject * caster,
 		COLLISION_CONTACT & contact) const;
 
+	// batched ray cast request, contact holds the patch hint on input
+	struct Ray
+	{
+		btVector3 origin;
+		btVector3 direction;
+		btScalar length;
+		const btCollisionObject * caster;
+		COLLISION_CONTACT * contact;
+	};
+
+	// cast a batch of rays, same hits as castRay for each of them
+	// road patches are tested 4 at a time in simd, contact positions and
+	// normals may differ from castRay by up to 1e-3 (checked by the bezier
+	// test, -tracktest reports the largest position difference)
+	// consecutive rays of the same caster share one broadphase query
+	// returns number of hits
+	int castRays(btAlignedObjectArray<Ray> & rays) const;
+
+	// vehicles get their wheel contacts from one castRays batch per step
+	void addVehicle(CARDYNAMICS * vehicle);
+	void removeVehicle(CARDYNAMICS * vehicle);
+
+	// enable batched wheel ray casts (default), otherwise one castRay per wheel
+	void setBatchRayCasts(bool value);
+
+	// step vehicle actions on the jobs if they have more than one thread, NULL (default) is serial
+	// requires batched ray casts, results are identical to serial stepping
+	void setJobSystem(JobSystem * value);
+
 	void update(btScalar dt);
 
 	void draw();
@@ -76,11 +110,15 @@ protected:
 		int id;
 	};
 	btAlignedObjectArray<ActiveCon> m_activeConnections;
+	btAlignedObjectArray<CARDYNAMICS*> m_vehicles;
+	btAlignedObjectArray<Ray> m_wheelRays;
 	const TRACK * track;
 	btScalar timeStep;
 	int maxSubSteps;
+	bool batchRayCasts;
+	JobSystem * jobs;
 
-	void reset();
+	void updateActions(btScalar timeStep);
 
 	void solveConstraints(btContactSolverInfo& solverInfo);
 
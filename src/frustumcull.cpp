@@ -0,0 +1,314 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "frustumcull.h"
+#include "simd4f.h"
+#include "aabb_space_partitioning.h"
+#include "unittest.h"
+#include "benchmark.h"
+
+#include <cstdlib>
+
+// radius of spheres which are never culled, squares stay finite
+static const float unbounded_radius = 1E18f;
+
+void FRUSTUMCULL::Clear()
+{
+	x.clear();
+	y.clear();
+	z.clear();
+	r.clear();
+	count = 0;
+}
+
+void FRUSTUMCULL::Reserve(unsigned int spheres)
+{
+	unsigned int padded = (spheres + 3) & ~3u;
+	x.reserve(padded);
+	y.reserve(padded);
+	z.reserve(padded);
+	r.reserve(padded);
+}
+
+void FRUSTUMCULL::Add(const MATHVECTOR <float, 3> & center, float radius)
+{
+	if (count % 4 == 0)
+	{
+		x.resize(count + 4, 0.0f);
+		y.resize(count + 4, 0.0f);
+		z.resize(count + 4, 0.0f);
+		r.resize(count + 4, 0.0f);
+	}
+	x[count] = center[0];
+	y[count] = center[1];
+	z[count] = center[2];
+	r[count] = radius;
+	count++;
+}
+
+void FRUSTUMCULL::AddUnbounded()
+{
+	Add(MATHVECTOR <float, 3> (0), unbounded_radius);
+}
+
+template <bool distance_cull>
+static void CullSpheres(
+	const FRUSTUM & frustum,
+	const MATHVECTOR <float, 3> & campos,
+	float max_distance,
+	const float * x,
+	const float * y,
+	const float * z,
+	const float * r,
+	unsigned int count,
+	unsigned char * visible)
+{
+	simd4f planes[6][4];
+	for (int p = 0; p < 6; ++p)
+		for (int n = 0; n < 4; ++n)
+			planes[p][n] = simd4f(frustum.frustum[p][n]);
+
+	const simd4f camx(campos[0]), camy(campos[1]), camz(campos[2]);
+	const simd4f maxdist(max_distance);
+
+	for (unsigned int i = 0; i < count; i += 4)
+	{
+		simd4f px = simd4f::Load(x + i);
+		simd4f py = simd4f::Load(y + i);
+		simd4f pz = simd4f::Load(z + i);
+		simd4f pr = simd4f::Load(r + i);
+		simd4f bound = -pr;
+
+		// completely behind one of the planes
+		simd4f culled = CmpLe(planes[0][0] * px + planes[0][1] * py + planes[0][2] * pz + planes[0][3], bound);
+		for (int p = 1; p < 6; ++p)
+		{
+			simd4f rd = planes[p][0] * px + planes[p][1] * py + planes[p][2] * pz + planes[p][3];
+			culled = culled | CmpLe(rd, bound);
+		}
+
+		if (distance_cull)
+		{
+			simd4f dx = px - camx, dy = py - camy, dz = pz - camz;
+			simd4f rc = dx * dx + dy * dy + dz * dz;
+			simd4f far = maxdist + pr;
+			simd4f inside = CmpLt(rc, pr * pr);
+			culled = CmpGt(rc, far * far) | AndNot(inside, culled);
+		}
+
+		int mask = MoveMask(culled);
+		unsigned int lanes = (count - i < 4) ? count - i : 4;
+		for (unsigned int n = 0; n < lanes; ++n)
+			visible[i + n] = !((mask >> n) & 1);
+	}
+}
+
+void FRUSTUMCULL::Cull(const FRUSTUM & frustum, unsigned char * visible) const
+{
+	if (count == 0)
+		return;
+
+	CullSpheres<false>(frustum, MATHVECTOR <float, 3> (), 0, &x[0], &y[0], &z[0], &r[0], count, visible);
+}
+
+void FRUSTUMCULL::Cull(
+	const FRUSTUM & frustum,
+	const MATHVECTOR <float, 3> & campos,
+	float max_distance,
+	unsigned char * visible) const
+{
+	if (count == 0)
+		return;
+
+	CullSpheres<true>(frustum, campos, max_distance, &x[0], &y[0], &z[0], &r[0], count, visible);
+}
+
+struct FRUSTUMCULL_TEST
+{
+	// perspective camera at the origin looking down -z
+	static FRUSTUM Camera(float fov, float aspect, float znear, float zfar)
+	{
+		float f = 1 / tan(fov * 0.5 * 3.141593 / 180);
+		float proj[16] = {0};
+		proj[0] = f / aspect;
+		proj[5] = f;
+		proj[10] = (zfar + znear) / (znear - zfar);
+		proj[11] = -1;
+		proj[14] = 2 * zfar * znear / (znear - zfar);
+		float view[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+
+		FRUSTUM frustum;
+		frustum.Extract(proj, view);
+		return frustum;
+	}
+
+	static MATHVECTOR <float, 3> RandomPoint(float range)
+	{
+		return MATHVECTOR <float, 3> (
+			(rand() / float(RAND_MAX) - 0.5f) * 2 * range,
+			(rand() / float(RAND_MAX) - 0.5f) * 2 * range,
+			(rand() / float(RAND_MAX) - 0.5f) * 2 * range);
+	}
+
+	// per sphere test of RENDER_INPUT_SCENE
+	static bool Cull(
+		const FRUSTUM & frustum,
+		const MATHVECTOR <float, 3> & campos,
+		float lod_far,
+		const MATHVECTOR <float, 3> & objpos,
+		float radius)
+	{
+		float dx=objpos[0]-campos[0]; float dy=objpos[1]-campos[1]; float dz=objpos[2]-campos[2];
+		float rc=dx*dx+dy*dy+dz*dz;
+		float temp_lod_far = lod_far + radius;
+		if (rc > temp_lod_far*temp_lod_far)
+			return true;
+		else if (rc < radius*radius)
+			return false;
+
+		for (int i=0; i<6; i++)
+		{
+			float rd=frustum.frustum[i][0]*objpos[0]+
+					frustum.frustum[i][1]*objpos[1]+
+					frustum.frustum[i][2]*objpos[2]+
+					frustum.frustum[i][3];
+			if (rd <= -radius)
+				return true;
+		}
+		return false;
+	}
+};
+
+QT_TEST(frustumcull_test)
+{
+	FRUSTUM frustum = FRUSTUMCULL_TEST::Camera(60, 4 / 3.0, 0.1, 1000);
+	MATHVECTOR <float, 3> campos;
+
+	FRUSTUMCULL spheres;
+	spheres.Add(MATHVECTOR <float, 3> (0, 0, -10), 1); // in front
+	spheres.Add(MATHVECTOR <float, 3> (0, 0, 10), 1); // behind
+	spheres.Add(MATHVECTOR <float, 3> (0, 0, 0.5), 1); // contains the camera
+	spheres.Add(MATHVECTOR <float, 3> (0, 0, -500), 1); // too far
+	spheres.Add(MATHVECTOR <float, 3> (100, 0, -10), 1); // right of the frustum
+	spheres.Add(MATHVECTOR <float, 3> (100, 0, -10), 95); // intersects the right plane
+	spheres.AddUnbounded();
+	QT_CHECK_EQUAL(spheres.Size(), 7);
+
+	unsigned char visible[7];
+	spheres.Cull(frustum, campos, 100, visible);
+	QT_CHECK_EQUAL(visible[0], 1);
+	QT_CHECK_EQUAL(visible[1], 0);
+	QT_CHECK_EQUAL(visible[2], 1);
+	QT_CHECK_EQUAL(visible[3], 0);
+	QT_CHECK_EQUAL(visible[4], 0);
+	QT_CHECK_EQUAL(visible[5], 1);
+	QT_CHECK_EQUAL(visible[6], 1);
+
+	// without distance culling only the planes count
+	spheres.Cull(frustum, visible);
+	QT_CHECK_EQUAL(visible[1], 0);
+	QT_CHECK_EQUAL(visible[3], 1);
+	QT_CHECK_EQUAL(visible[6], 1);
+
+	// the batches give the same results as the per sphere test
+	srand(1);
+	campos = MATHVECTOR <float, 3> (0.5, -1, 2);
+	spheres.Clear();
+	std::vector <MATHVECTOR <float, 3> > centers;
+	std::vector <float> radii;
+	for (int i = 0; i < 1001; ++i)
+	{
+		centers.push_back(FRUSTUMCULL_TEST::RandomPoint(200));
+		radii.push_back(rand() % 20 * 0.5f);
+		spheres.Add(centers.back(), radii.back());
+	}
+	std::vector <unsigned char> batch_visible(spheres.Size());
+	spheres.Cull(frustum, campos, 150, &batch_visible[0]);
+	int mismatches = 0, count = 0;
+	for (unsigned int i = 0; i < centers.size(); ++i)
+	{
+		bool cull = FRUSTUMCULL_TEST::Cull(frustum, campos, 150, centers[i], radii[i]);
+		mismatches += (batch_visible[i] == cull);
+		count += !cull;
+	}
+	QT_CHECK_EQUAL(mismatches, 0);
+	QT_CHECK(count > 0 && count < 1001);
+}
+
+BENCHMARK(frustum_cull)
+{
+	// static track objects scattered around a camera
+	const int objects = 20000;
+	const int repeats = 200;
+	FRUSTUM frustum = FRUSTUMCULL_TEST::Camera(45, 4 / 3.0, 0.1, 1000);
+	MATHVECTOR <float, 3> campos;
+	srand(1);
+	std::vector <MATHVECTOR <float, 3> > centers(objects);
+	std::vector <float> radii(objects);
+	FRUSTUMCULL spheres;
+	AABB_SPACE_PARTITIONING_NODE <int, 64> tree;
+	for (int i = 0; i < objects; ++i)
+	{
+		centers[i] = FRUSTUMCULL_TEST::RandomPoint(1000);
+		centers[i][1] *= 0.02f;
+		radii[i] = 1 + rand() % 10;
+		spheres.Add(centers[i], radii[i]);
+
+		AABB <float> box;
+		box.SetFromSphere(centers[i], radii[i]);
+		tree.Add(i, box);
+	}
+	tree.Optimize();
+
+	benchmark::Stopwatch timer;
+	int visible_scalar = 0;
+	timer.Reset();
+	for (int n = 0; n < repeats; ++n)
+	{
+		for (int i = 0; i < objects; ++i)
+			visible_scalar += !FRUSTUMCULL_TEST::Cull(frustum, campos, 1000, centers[i], radii[i]);
+	}
+	double scalar_time = timer.Seconds();
+
+	std::vector <int> query;
+	timer.Reset();
+	for (int n = 0; n < repeats; ++n)
+	{
+		query.clear();
+		tree.Query(frustum, query);
+	}
+	double tree_time = timer.Seconds();
+
+	std::vector <unsigned char> visible(objects);
+	int visible_batch = 0;
+	timer.Reset();
+	for (int n = 0; n < repeats; ++n)
+	{
+		spheres.Cull(frustum, &visible[0]);
+		for (int i = 0; i < objects; ++i)
+			visible_batch += visible[i];
+	}
+	double batch_time = timer.Seconds();
+	benchmark::DoNotOptimize(visible_scalar);
+
+	out << "frustum_cull: " << objects << " spheres, " << visible_batch / repeats << " visible" << std::endl;
+	out << "per sphere: " << scalar_time / repeats * 1E6 << " us" << std::endl;
+	out << "aabb tree query: " << tree_time / repeats * 1E6 << " us, " << query.size() << " visible" << std::endl;
+	out << "batch: " << batch_time / repeats * 1E6 << " us" << std::endl;
+}
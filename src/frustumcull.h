@@ -0,0 +1,64 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _FRUSTUMCULL_H
+#define _FRUSTUMCULL_H
+
+#include "frustum.h"
+#include "mathvector.h"
+
+#include <vector>
+
+/// Bounding spheres packed into arrays of x, y, z and radius which are culled
+/// against the frustum planes four spheres at a time.
+class FRUSTUMCULL
+{
+public:
+	FRUSTUMCULL() : count(0) {}
+
+	void Clear();
+
+	void Reserve(unsigned int spheres);
+
+	void Add(const MATHVECTOR <float, 3> & center, float radius);
+
+	/// add a sphere which is never culled
+	void AddUnbounded();
+
+	unsigned int Size() const {return count;}
+
+	/// visible[i] is set to 0 if sphere i is completely outside of one of the
+	/// frustum planes, otherwise to 1. visible needs room for Size() entries.
+	void Cull(const FRUSTUM & frustum, unsigned char * visible) const;
+
+	/// spheres farther than max_distance plus their radius from the camera are
+	/// culled too, spheres containing the camera are always visible
+	void Cull(
+		const FRUSTUM & frustum,
+		const MATHVECTOR <float, 3> & campos,
+		float max_distance,
+		unsigned char * visible) const;
+
+private:
+	// padded to a multiple of four
+	std::vector <float> x, y, z, r;
+	unsigned int count;
+};
+
+#endif // _FRUSTUMCULL_H
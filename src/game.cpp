@@ -19,13 +19,16 @@
 
 #include "game.h"
 #include "unittest.h"
+#include "benchmark.h"
 #include "definitions.h"
+#include "allocationcounter.h"
 #include "joepack.h"
 #include "matrix4.h"
 #include "carwheelposition.h"
 #include "numprocessors.h"
 #include "performance_testing.h"
 #include "quickprof.h"
+#include "traceprofiler.h"
 #include "tracksurface.h"
 #include "utils.h"
 #include "graphics_gl2.h"
@@ -132,6 +135,7 @@ GAME::GAME(std::ostream & info_out, std::ostream & error_out) :
 {
 	carcontrols_local.first = 0;
 	dynamics.setContactAddedCallback(&CARDYNAMICS::WheelContactCallback);
+	dynamics.setJobSystem(&jobs);
 	RegisterActions();
 }
 
@@ -320,7 +324,21 @@ void GAME::End()
 	}
 
 	if (profilingmode)
-		info_output << "Profiling summary:\n" << PROFILER.getSummary(quickprof::PERCENT) << std::endl;
+	{
+		info_output << "Profiling summary:\n";
+		TraceProfiler::WriteSummary(info_output);
+		info_output << PROFILER.getSummary(quickprof::PERCENT) << std::endl;
+	}
+
+	if (!tracefile.empty())
+	{
+		std::ofstream trace(tracefile.c_str());
+		TraceProfiler::WriteChromeTrace(trace);
+		if (trace)
+			info_output << "Wrote profiling trace to " << tracefile << std::endl;
+		else
+			error_output << "Unable to write profiling trace to " << tracefile << std::endl;
+	}
 
 	info_output << "Shutting down..." << std::endl;
 
@@ -358,6 +376,7 @@ void GAME::InitCoreSubsystems()
 	content.addSharedPath(pathmanager.GetCarPartsPath());
 	content.addSharedPath(pathmanager.GetTrackPartsPath());
 	content.setTexSize(texturesize);
+	content.setMemoryBudget(settings.GetContentBudget() * 1024ULL * 1024ULL);
 
 	if (!LastStartWasSuccessful())
 	{
@@ -519,6 +538,9 @@ bool GAME::InitSound()
 	{
 		sound.SetVolume(settings.GetSoundVolume());
 		content.setSound(sound.GetDeviceInfo());
+
+		// stream sounds longer than about 6 seconds of 44.1kHz stereo
+		content.setSoundStreamSize(1024 * 1024);
 	}
 	else
 	{
@@ -562,6 +584,13 @@ bool GAME::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-test"] = "Run unit tests.";
 
+	if (argmap.find("-microbench") != argmap.end())
+	{
+		RUN_BENCHMARKS(argmap["-microbench"], info_output);
+		continue_game = false;
+	}
+	arghelp["-microbench [NAME]"] = "Run micro benchmarks, optionally only those matching NAME.";
+
 	if (argmap.find("-debug") != argmap.end())
 	{
 		debugmode = true;
@@ -590,6 +619,64 @@ bool GAME::ParseArguments(std::list <std::string> & args)
 	}
 	arghelp["-cartest CAR"] = "Run car performance testing on given CAR.";
 
+	if (!argmap["-tracktest"].empty())
+	{
+		std::vector <std::string> params = Tokenize(argmap["-tracktest"], ",");
+		if (params.size() < 2)
+		{
+			error_output << "Expected track test parameters in the form TRACK,CAR[,AI[,TICKS[,THREADS]]]" << std::endl;
+		}
+		else
+		{
+			pathmanager.Init(info_output, error_output);
+			std::string aitype = (params.size() > 2) ? params[2] : AI::default_ai_type;
+			int ticks = (params.size() > 3) ? cast<int>(params[3]) : 900;
+			int threads = (params.size() > 4) ? cast<int>(params[4]) : 1;
+			std::string jsonfile = argmap["-tracktestout"];
+			if (jsonfile.empty()) jsonfile = "tracktest.json";
+			std::ofstream json(jsonfile.c_str());
+			PERFORMANCE_TESTING perftest(dynamics);
+			if (perftest.TestTrack(pathmanager, params[0], params[1], aitype,
+				128, threads, ticks, TickPeriod(), json, info_output, error_output))
+			{
+				info_output << "Track test results written to " << jsonfile << std::endl;
+			}
+		}
+		continue_game = false;
+	}
+	arghelp["-tracktest TRACK,CAR[,AI[,TICKS[,THREADS]]]"] = "Run headless physics and AI benchmark with 1 to 128 AI cars on TRACK, using 1 to THREADS threads.";
+	arghelp["-tracktestout FILE"] = "Write track test results as json to FILE (default tracktest.json).";
+
+	if (argmap.find("-loadtest") != argmap.end())
+	{
+		std::vector <std::string> params = Tokenize(argmap["-loadtest"], ",");
+		std::string trackname = (params.size() > 0) ? params[0] : "";
+		int threads = (params.size() > 1) ? cast<int>(params[1]) : NUMPROCESSORS::GetNumProcessors();
+		pathmanager.Init(info_output, error_output);
+		PERFORMANCE_TESTING perftest(dynamics);
+		perftest.TestTrackLoad(pathmanager, trackname, threads, info_output, error_output);
+		continue_game = false;
+	}
+	arghelp["-loadtest [TRACK][,THREADS]"] = "Run headless track load benchmark on TRACK (all tracks if empty) with 1 to THREADS threads and a cold and warm track cache.";
+
+	if (argmap.find("-meshtest") != argmap.end())
+	{
+		pathmanager.Init(info_output, error_output);
+		PERFORMANCE_TESTING perftest(dynamics);
+		perftest.TestMeshes(pathmanager, info_output, error_output);
+		continue_game = false;
+	}
+	arghelp["-meshtest"] = "Run mesh build benchmark on the largest car and track meshes, reporting weld time and vertex cache miss ratio.";
+
+	if (!argmap["-replayconvert"].empty())
+	{
+		std::vector <std::string> params = Tokenize(argmap["-replayconvert"], ",");
+		std::string outfile = (params.size() > 1) ? params[1] : params[0] + ".converted";
+		replay.Convert(params[0], outfile, info_output, error_output);
+		continue_game = false;
+	}
+	arghelp["-replayconvert FILE[,OUTFILE]"] = "Convert replay FILE to the current compressed format, reporting size ratio and decode speed.";
+
 	if (!argmap["-profile"].empty())
 	{
 		pathmanager.SetProfile(argmap["-profile"]);
@@ -599,10 +686,20 @@ bool GAME::ParseArguments(std::list <std::string> & args)
 	if (argmap.find("-profiling") != argmap.end() || argmap.find("-benchmark") != argmap.end())
 	{
 		PROFILER.init(20);
+		TraceProfiler::SetEnabled(true);
+		TraceProfiler::SetThreadName("main");
 		profilingmode = true;
 	}
 	arghelp["-profiling"] = "Display game performance data.";
 
+	if (!argmap["-trace"].empty())
+	{
+		TraceProfiler::SetEnabled(true);
+		TraceProfiler::SetThreadName("main");
+		tracefile = argmap["-trace"];
+	}
+	arghelp["-trace FILE"] = "Write the profiled scopes of the last frames to FILE on exit, in Chrome trace event format.";
+
 	if (argmap.find("-dumpfps") != argmap.end())
 	{
 		info_output << "Dumping the frame-rate to log." << std::endl;
@@ -636,6 +733,7 @@ bool GAME::ParseArguments(std::list <std::string> & args)
 	if (argmap.find("-multithreaded") != argmap.end())
 	{
 		multithreaded = true;
+		jobs.Init(processors);
 
 		if (processors > 1)
 		{
@@ -722,60 +820,61 @@ void GAME::Test()
 
 void GAME::BeginDraw()
 {
-	PROFILER.beginBlock("render");
-	// Send scene information to the graphics subsystem.
-	if (active_camera)
 	{
-		float fov = active_camera->GetFOV() > 0 ? active_camera->GetFOV() : settings.GetFOV();
+		PROFILE_SCOPE("render");
+		// Send scene information to the graphics subsystem.
+		if (active_camera)
+		{
+			float fov = active_camera->GetFOV() > 0 ? active_camera->GetFOV() : settings.GetFOV();
 
-		MATHVECTOR <float, 3> reflection_sample_location = active_camera->GetPosition();
-		if (carcontrols_local.first)
-			reflection_sample_location = carcontrols_local.first->GetCenterOfMassPosition();
+			MATHVECTOR <float, 3> reflection_sample_location = active_camera->GetPosition();
+			if (carcontrols_local.first)
+				reflection_sample_location = carcontrols_local.first->GetCenterOfMassPosition();
 
-		QUATERNION <float> camlook;
-		camlook.Rotate(M_PI_2, 1, 0, 0);
-		QUATERNION <float> camorient = -(active_camera->GetOrientation() * camlook);
-		graphics_interface->SetupScene(fov, settings.GetViewDistance(), active_camera->GetPosition(), camorient, reflection_sample_location);
-	}
-	else
-		graphics_interface->SetupScene(settings.GetFOV(), settings.GetViewDistance(), MATHVECTOR <float, 3> (), QUATERNION <float> (), MATHVECTOR <float, 3> ());
+			QUATERNION <float> camlook;
+			camlook.Rotate(M_PI_2, 1, 0, 0);
+			QUATERNION <float> camorient = -(active_camera->GetOrientation() * camlook);
+			graphics_interface->SetupScene(fov, settings.GetViewDistance(), active_camera->GetPosition(), camorient, reflection_sample_location);
+		}
+		else
+			graphics_interface->SetupScene(settings.GetFOV(), settings.GetViewDistance(), MATHVECTOR <float, 3> (), QUATERNION <float> (), MATHVECTOR <float, 3> ());
 
-	graphics_interface->SetContrast(settings.GetContrast());
-	graphics_interface->BeginScene(error_output);
-	PROFILER.endBlock("render");
+		graphics_interface->SetContrast(settings.GetContrast());
+		graphics_interface->BeginScene(error_output);
+	}
 
-	PROFILER.beginBlock("scenegraph");
+	{
+		PROFILE_SCOPE("scenegraph");
 
-	TraverseScene<true>(debugnode, graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(gui.GetNode(), graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(track.GetRacinglineNode(), graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(dynamicsdraw.getNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<true>(debugnode, graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(gui.GetNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(track.GetRacinglineNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(dynamicsdraw.getNode(), graphics_interface->GetDynamicDrawlist());
 #ifndef USE_STATIC_OPTIMIZATION_FOR_TRACK
-	TraverseScene<false>(track.GetTrackNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(track.GetTrackNode(), graphics_interface->GetDynamicDrawlist());
 #endif
-	TraverseScene<false>(track.GetBodyNode(), graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(hud.GetNode(), graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(trackmap.GetNode(), graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(inputgraph.GetNode(), graphics_interface->GetDynamicDrawlist());
-	TraverseScene<false>(tire_smoke.GetNode(), graphics_interface->GetDynamicDrawlist());
-	for (std::list <CAR>::iterator i = cars.begin(); i != cars.end(); ++i)
-	{
-		TraverseScene<false>(i->GetNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(track.GetBodyNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(hud.GetNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(trackmap.GetNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(inputgraph.GetNode(), graphics_interface->GetDynamicDrawlist());
+		TraverseScene<false>(tire_smoke.GetNode(), graphics_interface->GetDynamicDrawlist());
+		for (std::list <CAR>::iterator i = cars.begin(); i != cars.end(); ++i)
+		{
+			TraverseScene<false>(i->GetNode(), graphics_interface->GetDynamicDrawlist());
+		}
+
+		//gui.GetNode().DebugPrint(info_output);
 	}
 
-	//gui.GetNode().DebugPrint(info_output);
-	PROFILER.endBlock("scenegraph");
-	PROFILER.beginBlock("render");
+	PROFILE_SCOPE("render");
 	graphics_interface->DrawScene(error_output);
-	PROFILER.endBlock("render");
 }
 
 void GAME::FinishDraw()
 {
-	PROFILER.beginBlock("render");
+	PROFILE_SCOPE("render");
 	graphics_interface->EndScene(error_output);
 	window.SwapBuffers();
-	PROFILER.endBlock("render");
 }
 
 /* The main game loop... */
@@ -792,6 +891,9 @@ void GAME::MainLoop()
 		// Do CPU intensive stuff in parallel with the GPU...
 		Tick(eventsystem.Get_dt());
 
+		// Finish content loaded in the background.
+		content.update();
+
 		gui.Update(eventsystem.Get_dt());
 
 		// Sync CPU and GPU (flip the page).
@@ -801,6 +903,7 @@ void GAME::MainLoop()
 		eventsystem.EndFrame();
 
 		PROFILER.endCycle();
+		TraceProfiler::EndFrame();
 
 		displayframe++;
 	}
@@ -883,21 +986,24 @@ void GAME::AdvanceGameLogic()
 
 	if (track.Loaded() && !pause && !gui.Active())
 	{
-		PROFILER.beginBlock("ai");
-		ai.Visualize();
-		ai.update(TickPeriod(), cars);
-		PROFILER.endBlock("ai");
+		{
+			PROFILE_SCOPE("ai");
+			ai.update(TickPeriod(), cars, &jobs);
+			ai.Visualize();
+		}
 
-		PROFILER.beginBlock("physics");
-		dynamics.update(TickPeriod());
-		PROFILER.endBlock("physics");
+		{
+			PROFILE_SCOPE("physics");
+			dynamics.update(TickPeriod());
+		}
 
-		PROFILER.beginBlock("car");
-		for (std::list <CAR>::iterator i = cars.begin(); i != cars.end(); ++i)
 		{
-			UpdateCar(*i, TickPeriod());
+			PROFILE_SCOPE("car");
+			for (std::list <CAR>::iterator i = cars.begin(); i != cars.end(); ++i)
+			{
+				UpdateCar(*i, TickPeriod());
+			}
 		}
-		PROFILER.endBlock("car");
 
 		// Update dynamic track objects.
 		track.Update();
@@ -917,8 +1023,8 @@ void GAME::AdvanceGameLogic()
 
 	if (sound.Enabled())
 	{
+		PROFILE_SCOPE("sound");
 		bool pause_sound = pause || gui.Active();
-		PROFILER.beginBlock("sound");
 		MATHVECTOR <float, 3> pos;
 		QUATERNION <float> rot;
 		if (active_camera)
@@ -928,8 +1034,7 @@ void GAME::AdvanceGameLogic()
 		}
 		sound.SetListenerPosition(pos[0], pos[1], pos[2]);
 		sound.SetListenerRotation(rot[0], rot[1], rot[2], rot[3]);
-		sound.Update(pause_sound);
-		PROFILER.endBlock("sound");
+		sound.Update(pause_sound, &jobs);
 	}
 
 	//PROFILER.beginBlock("force-feedback");
@@ -997,6 +1102,15 @@ void GAME::ProcessGameInputs()
 		{
 			pause = !pause;
 		}
+
+		if (replay.GetPlaying())
+		{
+			const int seek_frames = 5.0 / TickPeriod();
+			if (carcontrols_local.second.GetInput(CARINPUT::REPLAY_FF) == 1.0)
+				SeekReplay(seek_frames);
+			if (carcontrols_local.second.GetInput(CARINPUT::REPLAY_RW) == 1.0)
+				SeekReplay(-seek_frames);
+		}
 	}
 }
 
@@ -1258,6 +1372,24 @@ void GAME::UpdateCar(CAR & car, double dt)
 	UpdateDriftScore(car, dt);
 }
 
+void GAME::SeekReplay(int frames)
+{
+	CAR * car = carcontrols_local.first;
+	if (!car || !replay.GetPlaying())
+		return;
+
+	int target = std::max(replay.GetFrame() + frames, 0);
+	replay.Seek(target, *car);
+
+	// Re-simulate from the keyframe, skipping sound, particles and timing.
+	while (replay.GetPlaying() && replay.GetFrame() < target)
+	{
+		dynamics.update(TickPeriod());
+		car->Update(TickPeriod());
+		UpdateCarInputs(*car);
+	}
+}
+
 void GAME::UpdateCarInputs(CAR & car)
 {
 	std::vector <float> carinputs(CARINPUT::INVALID, 0.0f);
@@ -1537,6 +1669,7 @@ bool GAME::NewGame(bool playreplay, bool addopponents, int num_laps)
 			cars_color_hsv[0],
 			carconfig,
 			settings.GetTrack(),
+			pathmanager.GetReplayPath() + "/recording.tmp",
 			error_output);
 	}
 
@@ -1655,7 +1788,9 @@ bool GAME::LoadTrack(const std::string & trackname)
 			settings.GetTrackReverse(),
 			settings.GetTrackDynamic(),
 			graphics_interface->GetShadows(),
-			settings.GetBatchGeometry()))
+			settings.GetBatchGeometry(),
+			&jobs,
+			pathmanager.GetTrackCachePath()))
 	{
 		error_output << "Error loading track: " << trackname << std::endl;
 		return false;
@@ -1738,7 +1873,9 @@ void GAME::LoadGarage()
 			settings.GetAnisotropy(),
 			track_reverse, track_dynamic,
 			graphics_interface->GetShadows(),
-			settings.GetBatchGeometry()))
+			settings.GetBatchGeometry(),
+			&jobs,
+			pathmanager.GetTrackCachePath()))
 	{
 		error_output << "Error loading track: " << trackname << std::endl;
 		return;
@@ -1903,7 +2040,14 @@ void GAME::CalculateFPS()
 	{
 		std::string cpuProfile = PROFILER.getAvgSummary(quickprof::MICROSECONDS);
 		std::stringstream summary;
-		summary << "CPU:\n" << cpuProfile << "\n\nGPU:\n";
+		summary << "CPU:\n";
+		TraceProfiler::WriteSummary(summary);
+		summary << cpuProfile << "\n";
+		if (replay.GetRecording() && ALLOCATION_COUNTER::IsEnabled())
+			summary << "replay record allocations/frame: " << replay.GetRecordAllocationsPerFrame() << "\n";
+		summary << "\nContent:\n";
+		content.printStats(summary);
+		summary << "\nGPU:\n";
 		graphics_interface->printProfilingInfo(summary);
 		profiling_text.Revise(summary.str());
 	}
@@ -2276,7 +2420,7 @@ void GAME::UpdateParticleSystems(float dt)
 		camlook.Rotate(3.141593*0.5, 1, 0, 0);
 		QUATERNION <float> camorient = -(active_camera->GetOrientation() * camlook);
 
-		tire_smoke.Update(dt, camorient, active_camera->GetPosition());
+		tire_smoke.Update(dt, camorient, active_camera->GetPosition(), &jobs);
 	}
 
 	particle_timer++;
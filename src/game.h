@@ -48,6 +48,7 @@
 #include "particle.h"
 #include "ai/ai.h"
 #include "quickmp.h"
+#include "jobsystem.h"
 #include "contentmanager.h"
 #include "http.h"
 #include "gl3v/stringidmap.h"
@@ -102,6 +103,9 @@ private:
 
 	void UpdateCarInputs(CAR & car);
 
+	///< Jump frames forward or back in the replay, re-simulating from the nearest keyframe
+	void SeekReplay(int frames);
+
 	void UpdateTimer();
 
 	///< Check eventsystem state and update GUI
@@ -270,11 +274,13 @@ private:
 	float fps_min;
 	float fps_max;
 
+	JobSystem jobs;
 	bool multithreaded;
 	bool profilingmode;
 	bool debugmode;
 	bool benchmode;
 	bool dumpfps;
+	std::string tracefile;
 	bool pause;
 
 	std::vector <EVENTSYSTEM_SDL::JOYSTICK> controlgrab_joystick_state;
@@ -0,0 +1,686 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "glrecorder.h"
+#include <algorithm>
+
+#define RECORD(name,args) record(name, args, sizeof(args)/sizeof(args[0]))
+#define RECORD_STATE(name,stateName,key,args) recordState(name, stateName, key, args, sizeof(args)/sizeof(args[0]))
+
+GLRecorder::GLRecorder() : redundantCount(0), drawCount(0), nextName(1), currentTextureUnit(0), currentProgram(0)
+{
+	// Constructor.
+}
+
+void GLRecorder::clear()
+{
+	commands.clear();
+	arguments.clear();
+	redundantCount = 0;
+	drawCount = 0;
+}
+
+unsigned int GLRecorder::getCallCount(const std::string & name) const
+{
+	unsigned int count = 0;
+	for (std::vector <Command>::const_iterator i = commands.begin(); i != commands.end(); i++)
+		if (name == i->name)
+			count++;
+	return count;
+}
+
+void GLRecorder::write(std::ostream & out) const
+{
+	for (std::vector <Command>::const_iterator i = commands.begin(); i != commands.end(); i++)
+	{
+		out << i->name << "(";
+		for (unsigned int n = 0; n < i->argumentCount; n++)
+			out << (n ? ", " : "") << arguments[i->firstArgument + n];
+		out << ")";
+		if (i->redundant)
+			out << " // redundant";
+		out << "\n";
+	}
+}
+
+void GLRecorder::ActiveTexture(GLenum texture)
+{
+	const double args[] = {(double)texture};
+	RECORD_STATE("glActiveTexture", "active texture", 0, args);
+	currentTextureUnit = texture - GL_TEXTURE0;
+}
+
+void GLRecorder::AttachShader(GLuint program, GLuint shader)
+{
+	const double args[] = {(double)program, (double)shader};
+	RECORD("glAttachShader", args);
+}
+
+void GLRecorder::BeginQuery(GLenum target, GLuint id)
+{
+	const double args[] = {(double)target, (double)id};
+	RECORD("glBeginQuery", args);
+}
+
+void GLRecorder::BindAttribLocation(GLuint program, GLuint index, const GLchar * name)
+{
+	const double args[] = {(double)program, (double)index};
+	RECORD("glBindAttribLocation", args);
+}
+
+void GLRecorder::BindFragDataLocation(GLuint program, GLuint color, const GLchar * name)
+{
+	const double args[] = {(double)program, (double)color};
+	RECORD("glBindFragDataLocation", args);
+}
+
+void GLRecorder::BindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	const double args[] = {(double)target, (double)framebuffer};
+	RECORD_STATE("glBindFramebuffer", "framebuffer", target, args);
+}
+
+void GLRecorder::BindRenderbuffer(GLenum target, GLuint renderbuffer)
+{
+	const double args[] = {(double)target, (double)renderbuffer};
+	RECORD_STATE("glBindRenderbuffer", "renderbuffer", target, args);
+}
+
+void GLRecorder::BindSampler(GLuint unit, GLuint sampler)
+{
+	const double args[] = {(double)unit, (double)sampler};
+	RECORD_STATE("glBindSampler", "sampler", unit, args);
+}
+
+void GLRecorder::BindTexture(GLenum target, GLuint texture)
+{
+	const double args[] = {(double)target, (double)texture};
+	RECORD_STATE("glBindTexture", "texture", ((unsigned long long)currentTextureUnit << 32) | target, args);
+}
+
+void GLRecorder::BindVertexArray(GLuint array)
+{
+	const double args[] = {(double)array};
+	RECORD_STATE("glBindVertexArray", "vertex array", 0, args);
+}
+
+void GLRecorder::BlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha)
+{
+	const double args[] = {(double)modeRGB, (double)modeAlpha};
+	RECORD_STATE("glBlendEquationSeparate", "blend equation", 0, args);
+}
+
+void GLRecorder::BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+	const double args[] = {(double)srcRGB, (double)dstRGB, (double)srcAlpha, (double)dstAlpha};
+	RECORD_STATE("glBlendFuncSeparate", "blend function", 0, args);
+}
+
+GLenum GLRecorder::CheckFramebufferStatus(GLenum target)
+{
+	const double args[] = {(double)target};
+	RECORD("glCheckFramebufferStatus", args);
+	return GL_FRAMEBUFFER_COMPLETE;
+}
+
+void GLRecorder::Clear(GLbitfield mask)
+{
+	const double args[] = {(double)mask};
+	RECORD("glClear", args);
+}
+
+void GLRecorder::ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
+{
+	const double args[] = {r, g, b, a};
+	RECORD_STATE("glClearColor", "clear color", 0, args);
+}
+
+void GLRecorder::ClearDepth(GLclampd depth)
+{
+	const double args[] = {depth};
+	RECORD_STATE("glClearDepth", "clear depth", 0, args);
+}
+
+void GLRecorder::ClearStencil(GLint s)
+{
+	const double args[] = {(double)s};
+	RECORD_STATE("glClearStencil", "clear stencil", 0, args);
+}
+
+void GLRecorder::CompileShader(GLuint shader)
+{
+	const double args[] = {(double)shader};
+	RECORD("glCompileShader", args);
+}
+
+GLuint GLRecorder::CreateProgram()
+{
+	GLuint name = nextName++;
+	const double args[] = {(double)name};
+	RECORD("glCreateProgram", args);
+	return name;
+}
+
+GLuint GLRecorder::CreateShader(GLenum type)
+{
+	GLuint name = nextName++;
+	const double args[] = {(double)type, (double)name};
+	RECORD("glCreateShader", args);
+	return name;
+}
+
+void GLRecorder::CullFace(GLenum mode)
+{
+	const double args[] = {(double)mode};
+	RECORD_STATE("glCullFace", "cull face", 0, args);
+}
+
+void GLRecorder::DeleteFramebuffers(GLsizei n, const GLuint * framebuffers)
+{
+	remove("glDeleteFramebuffers", n, framebuffers);
+}
+
+void GLRecorder::DeleteProgram(GLuint program)
+{
+	const double args[] = {(double)program};
+	RECORD("glDeleteProgram", args);
+}
+
+void GLRecorder::DeleteQueries(GLsizei n, const GLuint * ids)
+{
+	remove("glDeleteQueries", n, ids);
+}
+
+void GLRecorder::DeleteRenderbuffers(GLsizei n, const GLuint * renderbuffers)
+{
+	remove("glDeleteRenderbuffers", n, renderbuffers);
+}
+
+void GLRecorder::DeleteSamplers(GLsizei n, const GLuint * samplers)
+{
+	remove("glDeleteSamplers", n, samplers);
+}
+
+void GLRecorder::DeleteShader(GLuint shader)
+{
+	const double args[] = {(double)shader};
+	RECORD("glDeleteShader", args);
+}
+
+void GLRecorder::DeleteTextures(GLsizei n, const GLuint * textures)
+{
+	remove("glDeleteTextures", n, textures);
+}
+
+void GLRecorder::DeleteVertexArrays(GLsizei n, const GLuint * arrays)
+{
+	remove("glDeleteVertexArrays", n, arrays);
+}
+
+void GLRecorder::DepthFunc(GLenum func)
+{
+	const double args[] = {(double)func};
+	RECORD_STATE("glDepthFunc", "depth function", 0, args);
+}
+
+void GLRecorder::DepthMask(GLboolean flag)
+{
+	const double args[] = {(double)flag};
+	RECORD_STATE("glDepthMask", "depth mask", 0, args);
+}
+
+void GLRecorder::Disable(GLenum cap)
+{
+	const double args[] = {(double)cap, 0};
+	RECORD_STATE("glDisable", "capability", cap, args);
+}
+
+void GLRecorder::DisableVertexAttribArray(GLuint index)
+{
+	const double args[] = {(double)index};
+	RECORD("glDisableVertexAttribArray", args);
+}
+
+void GLRecorder::Disablei(GLenum cap, GLuint index)
+{
+	const double args[] = {(double)cap, (double)index, 0};
+	RECORD_STATE("glDisablei", "indexed capability", ((unsigned long long)index << 32) | cap, args);
+}
+
+void GLRecorder::DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	const double args[] = {(double)mode, (double)first, (double)count};
+	RECORD("glDrawArrays", args);
+	drawCount++;
+}
+
+void GLRecorder::DrawBuffers(GLsizei n, const GLenum * bufs)
+{
+	std::vector <double> args(bufs, bufs + n);
+	args.insert(args.begin(), n);
+	recordState("glDrawBuffers", "draw buffers", 0, &args[0], args.size());
+}
+
+void GLRecorder::DrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid * indices)
+{
+	const double args[] = {(double)mode, (double)count, (double)type, (double)(size_t)indices};
+	RECORD("glDrawElements", args);
+	drawCount++;
+}
+
+void GLRecorder::Enable(GLenum cap)
+{
+	const double args[] = {(double)cap, 1};
+	RECORD_STATE("glEnable", "capability", cap, args);
+}
+
+void GLRecorder::EnableVertexAttribArray(GLuint index)
+{
+	const double args[] = {(double)index};
+	RECORD("glEnableVertexAttribArray", args);
+}
+
+void GLRecorder::Enablei(GLenum cap, GLuint index)
+{
+	const double args[] = {(double)cap, (double)index, 1};
+	RECORD_STATE("glEnablei", "indexed capability", ((unsigned long long)index << 32) | cap, args);
+}
+
+void GLRecorder::EndQuery(GLenum target)
+{
+	const double args[] = {(double)target};
+	RECORD("glEndQuery", args);
+}
+
+void GLRecorder::FramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer)
+{
+	const double args[] = {(double)target, (double)attachment, (double)renderbuffertarget, (double)renderbuffer};
+	RECORD("glFramebufferRenderbuffer", args);
+}
+
+void GLRecorder::FramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
+{
+	const double args[] = {(double)target, (double)attachment, (double)textarget, (double)texture, (double)level};
+	RECORD("glFramebufferTexture2D", args);
+}
+
+void GLRecorder::FrontFace(GLenum mode)
+{
+	const double args[] = {(double)mode};
+	RECORD_STATE("glFrontFace", "front face", 0, args);
+}
+
+void GLRecorder::GenFramebuffers(GLsizei n, GLuint * framebuffers)
+{
+	generate("glGenFramebuffers", n, framebuffers);
+}
+
+void GLRecorder::GenQueries(GLsizei n, GLuint * ids)
+{
+	generate("glGenQueries", n, ids);
+}
+
+void GLRecorder::GenRenderbuffers(GLsizei n, GLuint * renderbuffers)
+{
+	generate("glGenRenderbuffers", n, renderbuffers);
+}
+
+void GLRecorder::GenSamplers(GLsizei n, GLuint * samplers)
+{
+	generate("glGenSamplers", n, samplers);
+}
+
+void GLRecorder::GenTextures(GLsizei n, GLuint * textures)
+{
+	generate("glGenTextures", n, textures);
+}
+
+void GLRecorder::GenVertexArrays(GLsizei n, GLuint * arrays)
+{
+	generate("glGenVertexArrays", n, arrays);
+}
+
+void GLRecorder::GenerateMipmap(GLenum target)
+{
+	const double args[] = {(double)target};
+	RECORD("glGenerateMipmap", args);
+}
+
+void GLRecorder::GetIntegerv(GLenum pname, GLint * params)
+{
+	const double args[] = {(double)pname};
+	RECORD("glGetIntegerv", args);
+
+	// The minimum the GL 3.3 specification allows.
+	if (pname == GL_MAX_TEXTURE_IMAGE_UNITS)
+		*params = 16;
+	else
+		*params = 0;
+}
+
+void GLRecorder::GetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei * length, GLchar * infoLog)
+{
+	const double args[] = {(double)program};
+	RECORD("glGetProgramInfoLog", args);
+	if (length)
+		*length = 0;
+	if (bufSize > 0)
+		infoLog[0] = '\0';
+}
+
+void GLRecorder::GetProgramiv(GLuint program, GLenum pname, GLint * params)
+{
+	const double args[] = {(double)program, (double)pname};
+	RECORD("glGetProgramiv", args);
+	*params = (pname == GL_LINK_STATUS) ? GL_TRUE : 0;
+}
+
+void GLRecorder::GetQueryObjectuiv(GLuint id, GLenum pname, GLuint * params)
+{
+	const double args[] = {(double)id, (double)pname};
+	RECORD("glGetQueryObjectuiv", args);
+	*params = (pname == GL_QUERY_RESULT_AVAILABLE) ? GL_TRUE : 0;
+}
+
+void GLRecorder::GetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei * length, GLchar * infoLog)
+{
+	const double args[] = {(double)shader};
+	RECORD("glGetShaderInfoLog", args);
+	if (length)
+		*length = 0;
+	if (bufSize > 0)
+		infoLog[0] = '\0';
+}
+
+void GLRecorder::GetShaderiv(GLuint shader, GLenum pname, GLint * params)
+{
+	const double args[] = {(double)shader, (double)pname};
+	RECORD("glGetShaderiv", args);
+	*params = (pname == GL_COMPILE_STATUS) ? GL_TRUE : 0;
+}
+
+GLint GLRecorder::GetUniformLocation(GLuint program, const GLchar * name)
+{
+	// Every uniform name gets its own location, shared by all programs.
+	std::tr1::unordered_map <std::string, GLint>::iterator i = uniformLocations.find(name);
+	if (i == uniformLocations.end())
+		i = uniformLocations.insert(std::make_pair(std::string(name), (GLint)uniformLocations.size())).first;
+
+	const double args[] = {(double)program, (double)i->second};
+	RECORD("glGetUniformLocation", args);
+	return i->second;
+}
+
+void GLRecorder::Hint(GLenum target, GLenum mode)
+{
+	const double args[] = {(double)target, (double)mode};
+	RECORD_STATE("glHint", "hint", target, args);
+}
+
+void GLRecorder::LineWidth(GLfloat width)
+{
+	const double args[] = {width};
+	RECORD_STATE("glLineWidth", "line width", 0, args);
+}
+
+void GLRecorder::LinkProgram(GLuint program)
+{
+	const double args[] = {(double)program};
+	RECORD("glLinkProgram", args);
+}
+
+void GLRecorder::PolygonMode(GLenum face, GLenum mode)
+{
+	const double args[] = {(double)face, (double)mode};
+	RECORD_STATE("glPolygonMode", "polygon mode", face, args);
+}
+
+void GLRecorder::PolygonOffset(GLfloat factor, GLfloat units)
+{
+	const double args[] = {factor, units};
+	RECORD_STATE("glPolygonOffset", "polygon offset", 0, args);
+}
+
+void GLRecorder::RenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height)
+{
+	const double args[] = {(double)target, (double)internalformat, (double)width, (double)height};
+	RECORD("glRenderbufferStorage", args);
+}
+
+void GLRecorder::SampleCoverage(GLfloat value, GLboolean invert)
+{
+	const double args[] = {value, (double)invert};
+	RECORD_STATE("glSampleCoverage", "sample coverage", 0, args);
+}
+
+void GLRecorder::SampleMaski(GLuint index, GLbitfield mask)
+{
+	const double args[] = {(double)index, (double)mask};
+	RECORD_STATE("glSampleMaski", "sample mask", index, args);
+}
+
+void GLRecorder::SamplerParameterf(GLuint sampler, GLenum pname, GLfloat param)
+{
+	const double args[] = {(double)sampler, (double)pname, param};
+	RECORD("glSamplerParameterf", args);
+}
+
+void GLRecorder::SamplerParameterfv(GLuint sampler, GLenum pname, const GLfloat * params)
+{
+	const double args[] = {(double)sampler, (double)pname, params[0]};
+	RECORD("glSamplerParameterfv", args);
+}
+
+void GLRecorder::SamplerParameteri(GLuint sampler, GLenum pname, GLint param)
+{
+	const double args[] = {(double)sampler, (double)pname, (double)param};
+	RECORD("glSamplerParameteri", args);
+}
+
+void GLRecorder::ShaderSource(GLuint shader, GLsizei count, const GLchar ** string, const GLint * length)
+{
+	const double args[] = {(double)shader, (double)count};
+	RECORD("glShaderSource", args);
+}
+
+void GLRecorder::TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid * data)
+{
+	const double args[] = {(double)target, (double)level, (double)internalFormat, (double)width, (double)height, (double)border, (double)format, (double)type};
+	RECORD("glTexImage2D", args);
+}
+
+void GLRecorder::TexParameterf(GLenum target, GLenum pname, GLfloat param)
+{
+	const double args[] = {(double)target, (double)pname, param};
+	RECORD("glTexParameterf", args);
+}
+
+void GLRecorder::TexParameterfv(GLenum target, GLenum pname, const GLfloat * params)
+{
+	const double args[] = {(double)target, (double)pname, params[0]};
+	RECORD("glTexParameterfv", args);
+}
+
+void GLRecorder::TexParameteri(GLenum target, GLenum pname, GLint param)
+{
+	const double args[] = {(double)target, (double)pname, (double)param};
+	RECORD("glTexParameteri", args);
+}
+
+void GLRecorder::Uniform1f(GLint location, GLfloat v0)
+{
+	const double args[] = {(double)location, v0};
+	RECORD_STATE("glUniform1f", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+	const double args[] = {(double)location, v0, v1};
+	RECORD_STATE("glUniform2f", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	const double args[] = {(double)location, v0, v1, v2};
+	RECORD_STATE("glUniform3f", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3)
+{
+	const double args[] = {(double)location, v0, v1, v2, v3};
+	RECORD_STATE("glUniform4f", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform1i(GLint location, GLint v0)
+{
+	const double args[] = {(double)location, (double)v0};
+	RECORD_STATE("glUniform1i", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform2i(GLint location, GLint v0, GLint v1)
+{
+	const double args[] = {(double)location, (double)v0, (double)v1};
+	RECORD_STATE("glUniform2i", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform3i(GLint location, GLint v0, GLint v1, GLint v2)
+{
+	const double args[] = {(double)location, (double)v0, (double)v1, (double)v2};
+	RECORD_STATE("glUniform3i", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::Uniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3)
+{
+	const double args[] = {(double)location, (double)v0, (double)v1, (double)v2, (double)v3};
+	RECORD_STATE("glUniform4i", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat * value)
+{
+	double args[19] = {(double)location, (double)count, (double)transpose};
+	for (int i = 0; i < 16; i++)
+		args[3 + i] = value[i];
+	RECORD_STATE("glUniformMatrix4fv", "uniform", ((unsigned long long)currentProgram << 32) | location, args);
+}
+
+void GLRecorder::UseProgram(GLuint program)
+{
+	const double args[] = {(double)program};
+	RECORD_STATE("glUseProgram", "program", 0, args);
+	currentProgram = program;
+}
+
+void GLRecorder::VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid * pointer)
+{
+	const double args[] = {(double)index, (double)size, (double)type, (double)normalized, (double)stride, (double)(size_t)pointer};
+	RECORD("glVertexAttribPointer", args);
+}
+
+void GLRecorder::Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	const double args[] = {(double)x, (double)y, (double)width, (double)height};
+	RECORD_STATE("glViewport", "viewport", 0, args);
+}
+
+void GLRecorder::record(const char * name, const double * args, unsigned int count)
+{
+	Command command;
+	command.name = name;
+	command.firstArgument = arguments.size();
+	command.argumentCount = count;
+	command.redundant = false;
+	commands.push_back(command);
+	arguments.insert(arguments.end(), args, args + count);
+}
+
+void GLRecorder::recordState(const char * name, const char * stateName, unsigned long long key, const double * args, unsigned int count)
+{
+	record(name, args, count);
+
+	StateKey stateKey = {stateName, key};
+	std::vector <double> & value = state[stateKey];
+	if (value.size() == count && std::equal(args, args + count, value.begin()))
+	{
+		commands.back().redundant = true;
+		redundantCount++;
+	}
+	else
+		value.assign(args, args + count);
+}
+
+void GLRecorder::generate(const char * name, GLsizei n, GLuint * names)
+{
+	for (GLsizei i = 0; i < n; i++)
+		names[i] = nextName++;
+	std::vector <double> args(names, names + n);
+	args.insert(args.begin(), n);
+	record(name, &args[0], args.size());
+}
+
+void GLRecorder::remove(const char * name, GLsizei n, const GLuint * names)
+{
+	std::vector <double> args(names, names + n);
+	args.insert(args.begin(), n);
+	record(name, &args[0], args.size());
+}
+
+#undef RECORD
+#undef RECORD_STATE
+
+#include "glwrapper.h"
+#include "unittest.h"
+#include <sstream>
+
+QT_TEST(glrecorder_test)
+{
+	GLRecorder recorder;
+	GLWrapper gl;
+	gl.setRecorder(&recorder);
+	QT_CHECK(gl.initialize());
+
+	// Names are handed out without a context and status queries succeed.
+	GLuint program = gl.CreateProgram();
+	GLuint texture = gl.GenTexture();
+	QT_CHECK(program != 0 && texture != 0 && program != texture);
+	QT_CHECK(gl.BindFramebuffer(0));
+
+	// Setting state to the value it already has is redundant, the values
+	// are compared per program and per texture unit.
+	recorder.clear();
+	const float color[] = {1, 0, 0, 1};
+	gl.UseProgram(program);
+	gl.applyUniform(3, RenderUniformVector <float> (color, 4));
+	gl.applyUniform(3, RenderUniformVector <float> (color, 4));
+	gl.applyUniform(4, RenderUniformVector <float> (color, 4));
+	gl.UseProgram(program);
+	gl.Enable(GL_DEPTH_TEST);
+	gl.Disable(GL_DEPTH_TEST);
+	gl.Disable(GL_DEPTH_TEST);
+	gl.drawGeometry(7, 36);
+	gl.drawGeometry(7, 36);
+	QT_CHECK_EQUAL(recorder.getCallCount(), 12);
+	QT_CHECK_EQUAL(recorder.getCallCount("glUniform4f"), 3);
+	QT_CHECK_EQUAL(recorder.getDrawCount(), 2);
+	QT_CHECK_EQUAL(recorder.getRedundantCount(), 4);
+
+	std::stringstream stream;
+	recorder.write(stream);
+	QT_CHECK(stream.str().find("glUniform4f(3, 1, 0, 0, 1) // redundant\n") != std::string::npos);
+	QT_CHECK(stream.str().find("glBindVertexArray(7) // redundant\n") != std::string::npos);
+}
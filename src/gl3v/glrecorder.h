@@ -0,0 +1,186 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _GLRECORDER
+#define _GLRECORDER
+
+#include "glew.h"
+#include "unordered_map.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// A null OpenGL backend for GLWrapper.
+/// Every call is appended to an in-memory command stream instead of being sent to a driver, so the CPU side of the renderer can be tested and measured without a context.
+/// Object names are handed out sequentially and all status queries report success.
+/// State setting calls that leave the state unchanged are flagged as redundant.
+class GLRecorder
+{
+public:
+	struct Command
+	{
+		const char * name;
+		unsigned int firstArgument; ///< index into getArguments()
+		unsigned int argumentCount;
+		bool redundant;
+	};
+
+	GLRecorder();
+
+	/// Forget the recorded commands and counters. The tracked GL state and object names are kept, as they would be by a context.
+	void clear();
+
+	const std::vector <Command> & getCommands() const {return commands;}
+	const std::vector <double> & getArguments() const {return arguments;}
+
+	/// Counters since the last clear.
+	unsigned int getCallCount() const {return commands.size();}
+	unsigned int getRedundantCount() const {return redundantCount;}
+	unsigned int getDrawCount() const {return drawCount;}
+
+	/// Number of recorded calls to the named GL function, for example "glBindTexture".
+	unsigned int getCallCount(const std::string & name) const;
+
+	/// Write the command stream, one call per line.
+	void write(std::ostream & out) const;
+
+	// The GL functions used by GLWrapper, without the gl prefix.
+	void ActiveTexture(GLenum texture);
+	void AttachShader(GLuint program, GLuint shader);
+	void BeginQuery(GLenum target, GLuint id);
+	void BindAttribLocation(GLuint program, GLuint index, const GLchar * name);
+	void BindFragDataLocation(GLuint program, GLuint color, const GLchar * name);
+	void BindFramebuffer(GLenum target, GLuint framebuffer);
+	void BindRenderbuffer(GLenum target, GLuint renderbuffer);
+	void BindSampler(GLuint unit, GLuint sampler);
+	void BindTexture(GLenum target, GLuint texture);
+	void BindVertexArray(GLuint array);
+	void BlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha);
+	void BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+	GLenum CheckFramebufferStatus(GLenum target);
+	void Clear(GLbitfield mask);
+	void ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a);
+	void ClearDepth(GLclampd depth);
+	void ClearStencil(GLint s);
+	void CompileShader(GLuint shader);
+	GLuint CreateProgram();
+	GLuint CreateShader(GLenum type);
+	void CullFace(GLenum mode);
+	void DeleteFramebuffers(GLsizei n, const GLuint * framebuffers);
+	void DeleteProgram(GLuint program);
+	void DeleteQueries(GLsizei n, const GLuint * ids);
+	void DeleteRenderbuffers(GLsizei n, const GLuint * renderbuffers);
+	void DeleteSamplers(GLsizei n, const GLuint * samplers);
+	void DeleteShader(GLuint shader);
+	void DeleteTextures(GLsizei n, const GLuint * textures);
+	void DeleteVertexArrays(GLsizei n, const GLuint * arrays);
+	void DepthFunc(GLenum func);
+	void DepthMask(GLboolean flag);
+	void Disable(GLenum cap);
+	void DisableVertexAttribArray(GLuint index);
+	void Disablei(GLenum cap, GLuint index);
+	void DrawArrays(GLenum mode, GLint first, GLsizei count);
+	void DrawBuffers(GLsizei n, const GLenum * bufs);
+	void DrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid * indices);
+	void Enable(GLenum cap);
+	void EnableVertexAttribArray(GLuint index);
+	void Enablei(GLenum cap, GLuint index);
+	void EndQuery(GLenum target);
+	void FramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbuffertarget, GLuint renderbuffer);
+	void FramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+	void FrontFace(GLenum mode);
+	void GenFramebuffers(GLsizei n, GLuint * framebuffers);
+	void GenQueries(GLsizei n, GLuint * ids);
+	void GenRenderbuffers(GLsizei n, GLuint * renderbuffers);
+	void GenSamplers(GLsizei n, GLuint * samplers);
+	void GenTextures(GLsizei n, GLuint * textures);
+	void GenVertexArrays(GLsizei n, GLuint * arrays);
+	void GenerateMipmap(GLenum target);
+	void GetIntegerv(GLenum pname, GLint * params);
+	void GetProgramInfoLog(GLuint program, GLsizei bufSize, GLsizei * length, GLchar * infoLog);
+	void GetProgramiv(GLuint program, GLenum pname, GLint * params);
+	void GetQueryObjectuiv(GLuint id, GLenum pname, GLuint * params);
+	void GetShaderInfoLog(GLuint shader, GLsizei bufSize, GLsizei * length, GLchar * infoLog);
+	void GetShaderiv(GLuint shader, GLenum pname, GLint * params);
+	GLint GetUniformLocation(GLuint program, const GLchar * name);
+	void Hint(GLenum target, GLenum mode);
+	void LineWidth(GLfloat width);
+	void LinkProgram(GLuint program);
+	void PolygonMode(GLenum face, GLenum mode);
+	void PolygonOffset(GLfloat factor, GLfloat units);
+	void RenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height);
+	void SampleCoverage(GLfloat value, GLboolean invert);
+	void SampleMaski(GLuint index, GLbitfield mask);
+	void SamplerParameterf(GLuint sampler, GLenum pname, GLfloat param);
+	void SamplerParameterfv(GLuint sampler, GLenum pname, const GLfloat * params);
+	void SamplerParameteri(GLuint sampler, GLenum pname, GLint param);
+	void ShaderSource(GLuint shader, GLsizei count, const GLchar ** string, const GLint * length);
+	void TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid * data);
+	void TexParameterf(GLenum target, GLenum pname, GLfloat param);
+	void TexParameterfv(GLenum target, GLenum pname, const GLfloat * params);
+	void TexParameteri(GLenum target, GLenum pname, GLint param);
+	void Uniform1f(GLint location, GLfloat v0);
+	void Uniform2f(GLint location, GLfloat v0, GLfloat v1);
+	void Uniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
+	void Uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+	void Uniform1i(GLint location, GLint v0);
+	void Uniform2i(GLint location, GLint v0, GLint v1);
+	void Uniform3i(GLint location, GLint v0, GLint v1, GLint v2);
+	void Uniform4i(GLint location, GLint v0, GLint v1, GLint v2, GLint v3);
+	void UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat * value);
+	void UseProgram(GLuint program);
+	void VertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const GLvoid * pointer);
+	void Viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+private:
+	struct StateKey
+	{
+		const char * state;
+		unsigned long long key;
+
+		bool operator==(const StateKey & other) const {return state == other.state && key == other.key;}
+
+		struct hash
+		{
+			std::size_t operator()(const StateKey & k) const {return std::tr1::hash<unsigned long long>()(k.key * 31 + (std::size_t)k.state);}
+		};
+	};
+
+	std::vector <Command> commands;
+	std::vector <double> arguments;
+	unsigned int redundantCount;
+	unsigned int drawCount;
+
+	/// Last values set for every piece of state seen so far.
+	std::tr1::unordered_map <StateKey, std::vector <double>, StateKey::hash> state;
+	std::tr1::unordered_map <std::string, GLint> uniformLocations;
+	GLuint nextName;
+	GLuint currentTextureUnit;
+	GLuint currentProgram;
+
+	void record(const char * name, const double * args, unsigned int count);
+
+	/// Record a call that sets the state identified by stateName and key to args.
+	void recordState(const char * name, const char * stateName, unsigned long long key, const double * args, unsigned int count);
+
+	void generate(const char * name, GLsizei n, GLuint * names);
+	void remove(const char * name, GLsizei n, const GLuint * names);
+};
+
+#endif
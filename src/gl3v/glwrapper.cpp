@@ -18,6 +18,7 @@
 /************************************************************************/
 
 #include "glwrapper.h"
+#include "glrecorder.h"
 #include "glenums.h"
 #include "utils.h"
 #include <limits.h>
@@ -25,7 +26,8 @@
 #define ERROR_CHECK checkForOpenGLErrors(__PRETTY_FUNCTION__,__FILE__,__LINE__)
 #define ERROR_CHECK1(x) checkForOpenGLErrors(__PRETTY_FUNCTION__,__FILE__,__LINE__)
 #define ERROR_CHECK2(x1,x2) checkForOpenGLErrors(__PRETTY_FUNCTION__,__FILE__,__LINE__)
-#define GLLOG(x) (logGlCall(#x),x)
+// GL calls are made as GLCALL(Uniform1f, (location, value)) so they can be routed to the recorder.
+#define GLCALL(name,args) (logGlCall("gl" #name #args), recorder ? recorder->name args : gl##name args)
 #define CACHED(cachedValue,newValue,statement) {if (cachedValue != newValue) {cachedValue = newValue;statement}}
 
 #define breakOnError false
@@ -35,13 +37,19 @@
 const char * REQUIRED_GL_VERSION = "GL_VERSION_3_3";
 const GLEnums GLEnumHelper;
 
-GLWrapper::GLWrapper() : initialized(false), infoOutput(NULL), errorOutput(NULL), logEnable(false)
+GLWrapper::GLWrapper() : initialized(false), infoOutput(NULL), errorOutput(NULL), logEnable(false), recorder(NULL)
 {
 	clearCaches();
 }
 
 bool GLWrapper::initialize()
 {
+	if (recorder)
+	{
+		logOutput("Recording GL calls without a context");
+		return true;
+	}
+
 	GLenum glew_err = glewInit();
 	if (glew_err != GLEW_OK)
 	{
@@ -75,28 +83,34 @@ void GLWrapper::setInfoOutput(std::ostream & newOutput)
 	infoOutput = &newOutput;
 }
 
+void GLWrapper::setRecorder(GLRecorder * newRecorder)
+{
+	recorder = newRecorder;
+	clearCaches();
+}
+
 void GLWrapper::applyUniform(GLint location, const RenderUniformVector <float> & data)
 {
 	switch(data.size())
 	{
 	case 1:
-		GLLOG(glUniform1f(location, data[0]));ERROR_CHECK;
+		GLCALL(Uniform1f, (location, data[0]));ERROR_CHECK;
 		break;
 
 	case 2:
-		GLLOG(glUniform2f(location, data[0], data[1]));ERROR_CHECK;
+		GLCALL(Uniform2f, (location, data[0], data[1]));ERROR_CHECK;
 		break;
 
 	case 3:
-		GLLOG(glUniform3f(location, data[0], data[1], data[2]));ERROR_CHECK;
+		GLCALL(Uniform3f, (location, data[0], data[1], data[2]));ERROR_CHECK;
 		break;
 
 	case 4:
-		GLLOG(glUniform4f(location, data[0], data[1], data[2], data[3]));ERROR_CHECK;
+		GLCALL(Uniform4f, (location, data[0], data[1], data[2], data[3]));ERROR_CHECK;
 		break;
 
 	case 16:
-		GLLOG(glUniformMatrix4fv(location, 1, false, &data[0]));ERROR_CHECK;
+		GLCALL(UniformMatrix4fv, (location, 1, false, &data[0]));ERROR_CHECK;
 		break;
 
 	default:
@@ -110,19 +124,19 @@ void GLWrapper::applyUniform(GLint location, const RenderUniformVector <int> & d
 	switch(data.size())
 	{
 	case 1:
-		GLLOG(glUniform1i(location, data[0]));ERROR_CHECK;
+		GLCALL(Uniform1i, (location, data[0]));ERROR_CHECK;
 		break;
 
 	case 2:
-		GLLOG(glUniform2i(location, data[0], data[1]));ERROR_CHECK;
+		GLCALL(Uniform2i, (location, data[0], data[1]));ERROR_CHECK;
 		break;
 
 	case 3:
-		GLLOG(glUniform3i(location, data[0], data[1], data[2]));ERROR_CHECK;
+		GLCALL(Uniform3i, (location, data[0], data[1], data[2]));ERROR_CHECK;
 		break;
 
 	case 4:
-		GLLOG(glUniform4i(location, data[0], data[1], data[2], data[3]));ERROR_CHECK;
+		GLCALL(Uniform4i, (location, data[0], data[1], data[2], data[3]));ERROR_CHECK;
 		break;
 
 	default:
@@ -147,13 +161,13 @@ void GLWrapper::applyUniformDelayed(GLint location, const RenderUniformVector <T
 
 void GLWrapper::drawGeometry(GLuint vao, GLuint elementCount)
 {
-	GLLOG(glBindVertexArray(vao));ERROR_CHECK1(vao);
-	GLLOG(glDrawElements(GL_TRIANGLES, elementCount, GL_UNSIGNED_INT, 0));ERROR_CHECK2(vao,elementCount);
+	GLCALL(BindVertexArray, (vao));ERROR_CHECK1(vao);
+	GLCALL(DrawElements, (GL_TRIANGLES, elementCount, GL_UNSIGNED_INT, 0));ERROR_CHECK2(vao,elementCount);
 }
 
 void GLWrapper::unbindFramebuffer()
 {
-	GLLOG(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0));ERROR_CHECK;
+	GLCALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, 0));ERROR_CHECK;
 }
 
 void GLWrapper::unbindTexture(GLenum target)
@@ -164,31 +178,31 @@ void GLWrapper::unbindTexture(GLenum target)
 void GLWrapper::generateMipmaps(GLenum target, GLuint handle)
 {
 	BindTexture(target, handle);ERROR_CHECK;
-	GLLOG(glGenerateMipmap(target));ERROR_CHECK;
+	GLCALL(GenerateMipmap, (target));ERROR_CHECK;
 	unbindTexture(target);ERROR_CHECK;
 }
 
 bool GLWrapper::createAndCompileShader(const std::string & shaderSource, GLenum shaderType, GLuint & handle, std::ostream & shaderErrorOutput)
 {
 	const GLchar * shaderSourcePointer = shaderSource.c_str();
-	handle = GLLOG(glCreateShader(shaderType));ERROR_CHECK;
-	GLLOG(glShaderSource(handle, 1, &shaderSourcePointer, NULL));ERROR_CHECK;
-	GLLOG(glCompileShader(handle));ERROR_CHECK;
+	handle = GLCALL(CreateShader, (shaderType));ERROR_CHECK;
+	GLCALL(ShaderSource, (handle, 1, &shaderSourcePointer, NULL));ERROR_CHECK;
+	GLCALL(CompileShader, (handle));ERROR_CHECK;
 	GLint compileStatus(0);
-	GLLOG(glGetShaderiv(handle, GL_COMPILE_STATUS, &compileStatus));ERROR_CHECK;
+	GLCALL(GetShaderiv, (handle, GL_COMPILE_STATUS, &compileStatus));ERROR_CHECK;
 
 	GLint bufferSize(0);
-	GLLOG(glGetShaderiv(handle, GL_INFO_LOG_LENGTH, &bufferSize));ERROR_CHECK;
+	GLCALL(GetShaderiv, (handle, GL_INFO_LOG_LENGTH, &bufferSize));ERROR_CHECK;
 	GLchar* infoLog = new GLchar[bufferSize+1];
 	GLsizei infoLogLength;
-	GLLOG(glGetShaderInfoLog(handle, bufferSize, &infoLogLength, infoLog));ERROR_CHECK;
+	GLCALL(GetShaderInfoLog, (handle, bufferSize, &infoLogLength, infoLog));ERROR_CHECK;
 	infoLog[bufferSize] = '\0';
 	shaderErrorOutput << infoLog;
 	delete[] infoLog;
 
 	if (!compileStatus)
 	{
-		GLLOG(glDeleteShader(handle));ERROR_CHECK;
+		GLCALL(DeleteShader, (handle));ERROR_CHECK;
 		handle = 0;
 		return false;
 	}
@@ -198,37 +212,37 @@ bool GLWrapper::createAndCompileShader(const std::string & shaderSource, GLenum
 
 bool GLWrapper::linkShaderProgram(const std::vector <std::string> & shaderAttributeBindings, const std::vector <GLuint> & shaderHandles, GLuint & handle, const std::map <GLuint, std::string> & fragDataLocations, std::ostream & shaderErrorOutput)
 {
-	handle = GLLOG(glCreateProgram());ERROR_CHECK;
+	handle = GLCALL(CreateProgram, ());ERROR_CHECK;
 
 	// Attach all shaders that we got (hopefully a vertex and fragment shader are in here).
 	for (unsigned int i = 0; i < shaderHandles.size(); i++)
-		GLLOG(glAttachShader(handle, shaderHandles[i]));ERROR_CHECK;
+		GLCALL(AttachShader, (handle, shaderHandles[i]));ERROR_CHECK;
 
 	// Make sure we get our vertex attributes bound to the proper names.
 	for (unsigned int i = 0; i < shaderAttributeBindings.size(); i++)
 		if (!shaderAttributeBindings[i].empty())
-			GLLOG(glBindAttribLocation(handle, i, shaderAttributeBindings[i].c_str()));ERROR_CHECK;
+			GLCALL(BindAttribLocation, (handle, i, shaderAttributeBindings[i].c_str()));ERROR_CHECK;
 
 	// Make sure color outputs are bound to the proper names.
 	for (std::map <GLuint, std::string>::const_iterator i = fragDataLocations.begin(); i != fragDataLocations.end(); i++)
-		GLLOG(glBindFragDataLocation(handle, i->first, i->second.c_str()));ERROR_CHECK;
+		GLCALL(BindFragDataLocation, (handle, i->first, i->second.c_str()));ERROR_CHECK;
 
 	// Attempt to link the program.
-	GLLOG(glLinkProgram(handle));ERROR_CHECK;
+	GLCALL(LinkProgram, (handle));ERROR_CHECK;
 
 	// Handle the result.
 	GLint linkStatus;
-	GLLOG(glGetProgramiv(handle, GL_LINK_STATUS, &linkStatus));
+	GLCALL(GetProgramiv, (handle, GL_LINK_STATUS, &linkStatus));
 	if (!linkStatus)
 	{
 		GLint bufferSize(0);
-		GLLOG(glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &bufferSize));
+		GLCALL(GetProgramiv, (handle, GL_INFO_LOG_LENGTH, &bufferSize));
 		GLchar* infoLog = new GLchar[bufferSize+1];
 		GLsizei infoLogLength;
-		GLLOG(glGetProgramInfoLog(handle, bufferSize, &infoLogLength, infoLog));
+		GLCALL(GetProgramInfoLog, (handle, bufferSize, &infoLogLength, infoLog));
 		infoLog[bufferSize] = '\0';
 		shaderErrorOutput << "Linking of shader program failed:\n" << infoLog << std::endl;
-		GLLOG(glDeleteProgram(handle));ERROR_CHECK;
+		GLCALL(DeleteProgram, (handle));ERROR_CHECK;
 		delete[] infoLog;
 		handle = 0;
 		return false;
@@ -243,21 +257,21 @@ bool GLWrapper::relinkShaderProgram(GLuint handle, std::ostream & shaderErrorOut
 		return false;
 
 	// Attempt to link the program.
-	GLLOG(glLinkProgram(handle));ERROR_CHECK;
+	GLCALL(LinkProgram, (handle));ERROR_CHECK;
 
 	// Handle the result.
 	GLint linkStatus;
-	GLLOG(glGetProgramiv(handle, GL_LINK_STATUS, &linkStatus));
+	GLCALL(GetProgramiv, (handle, GL_LINK_STATUS, &linkStatus));
 	if (!linkStatus)
 	{
 		GLint bufferSize(0);
-		GLLOG(glGetProgramiv(handle, GL_INFO_LOG_LENGTH, &bufferSize));
+		GLCALL(GetProgramiv, (handle, GL_INFO_LOG_LENGTH, &bufferSize));
 		GLchar* infoLog = new GLchar[bufferSize+1];
 		GLsizei infoLogLength;
-		GLLOG(glGetProgramInfoLog(handle, bufferSize, &infoLogLength, infoLog));
+		GLCALL(GetProgramInfoLog, (handle, bufferSize, &infoLogLength, infoLog));
 		infoLog[bufferSize] = '\0';
 		shaderErrorOutput << "Linking of shader program failed:\n" << infoLog << std::endl;
-		GLLOG(glDeleteProgram(handle));ERROR_CHECK;
+		GLCALL(DeleteProgram, (handle));ERROR_CHECK;
 		delete[] infoLog;
 		return false;
 	}
@@ -267,8 +281,8 @@ bool GLWrapper::relinkShaderProgram(GLuint handle, std::ostream & shaderErrorOut
 
 bool GLWrapper::BindFramebuffer(GLuint fbo)
 {
-	GLLOG(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo));ERROR_CHECK;
-	GLenum status = GLLOG(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER));ERROR_CHECK;
+	GLCALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, fbo));ERROR_CHECK;
+	GLenum status = GLCALL(CheckFramebufferStatus, (GL_DRAW_FRAMEBUFFER));ERROR_CHECK;
 	if (status != GL_FRAMEBUFFER_COMPLETE)
 	{
 		logError("Incomplete framebuffer: "+GLEnumHelper.getEnum(status));
@@ -280,98 +294,98 @@ bool GLWrapper::BindFramebuffer(GLuint fbo)
 
 void GLWrapper::BindFramebufferWithoutValidation(GLuint fbo)
 {
-	GLLOG(glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo));ERROR_CHECK;
+	GLCALL(BindFramebuffer, (GL_DRAW_FRAMEBUFFER, fbo));ERROR_CHECK;
 }
 
 void GLWrapper::Viewport(GLuint w, GLuint h)
 {
-	GLLOG(glViewport(0,0,w,h));ERROR_CHECK;
+	GLCALL(Viewport, (0,0,w,h));ERROR_CHECK;
 }
 
 void GLWrapper::Clear(GLbitfield mask)
 {
-	GLLOG(glClear(mask));ERROR_CHECK;
+	GLCALL(Clear, (mask));ERROR_CHECK;
 }
 
 void GLWrapper::UseProgram(GLuint program)
 {
-	GLLOG(glUseProgram(program));ERROR_CHECK;
+	GLCALL(UseProgram, (program));ERROR_CHECK;
 	clearCaches();
 }
 
 void GLWrapper::Enable(GLenum cap)
 {
-	GLLOG(glEnable(cap));ERROR_CHECK;
+	GLCALL(Enable, (cap));ERROR_CHECK;
 }
 
 void GLWrapper::Disable(GLenum cap)
 {
-	GLLOG(glDisable(cap));ERROR_CHECK;
+	GLCALL(Disable, (cap));ERROR_CHECK;
 }
 
 void GLWrapper::Enablei(GLenum cap, GLuint index)
 {
-	GLLOG(glEnablei(cap,index));ERROR_CHECK;
+	GLCALL(Enablei, (cap,index));ERROR_CHECK;
 }
 
 void GLWrapper::Disablei(GLenum cap, GLuint index)
 {
-	GLLOG(glDisablei(cap,index));ERROR_CHECK;
+	GLCALL(Disablei, (cap,index));ERROR_CHECK;
 }
 
 void GLWrapper::DepthFunc(GLenum param)
 {
-	GLLOG(glDepthFunc(param));ERROR_CHECK;
+	GLCALL(DepthFunc, (param));ERROR_CHECK;
 }
 
 void GLWrapper::DepthMask(GLboolean mask)
 {
-	GLLOG(glDepthMask(mask));ERROR_CHECK;
+	GLCALL(DepthMask, (mask));ERROR_CHECK;
 }
 
 void GLWrapper::CullFace(GLenum param)
 {
-	GLLOG(glCullFace(param));ERROR_CHECK;
+	GLCALL(CullFace, (param));ERROR_CHECK;
 }
 
 void GLWrapper::FrontFace(GLenum param)
 {
-	GLLOG(glFrontFace(param));ERROR_CHECK;
+	GLCALL(FrontFace, (param));ERROR_CHECK;
 }
 
 void GLWrapper::PolygonMode(GLenum param)
 {
-	GLLOG(glPolygonMode(GL_FRONT_AND_BACK, param));ERROR_CHECK;
+	GLCALL(PolygonMode, (GL_FRONT_AND_BACK, param));ERROR_CHECK;
 }
 
 void GLWrapper::PolygonOffset(GLfloat param0, GLfloat param1)
 {
-	GLLOG(glPolygonOffset(param0, param1));ERROR_CHECK;
+	GLCALL(PolygonOffset, (param0, param1));ERROR_CHECK;
 }
 
 void GLWrapper::SampleCoverage(GLfloat param0, GLboolean param1)
 {
-	GLLOG(glSampleCoverage(param0, param1));ERROR_CHECK;
+	GLCALL(SampleCoverage, (param0, param1));ERROR_CHECK;
 }
 
 void GLWrapper::SampleMaski(GLuint param0, GLbitfield param1)
 {
-	GLLOG(glSampleMaski(param0, param1));ERROR_CHECK;
+	GLCALL(SampleMaski, (param0, param1));ERROR_CHECK;
 }
 
 void GLWrapper::Hint(GLenum param0, GLenum param1)
 {
-	GLLOG(glHint(param0, param1));ERROR_CHECK;
+	GLCALL(Hint, (param0, param1));ERROR_CHECK;
 }
 
 void GLWrapper::BlendEquationSeparate(GLenum param0, GLenum param1)
 {
-	GLLOG(glBlendEquationSeparate(param0,param1));ERROR_CHECK;
+	GLCALL(BlendEquationSeparate, (param0,param1));ERROR_CHECK;
 }
 
 void GLWrapper::BlendFuncSeparate(GLenum param0, GLenum param1, GLenum param2, GLenum param3)
 {
-	GLLOG(glBlendFuncSeparate(param0, param1, param2, param3));ERROR_CHECK;
+	GLCALL(BlendFuncSeparate, (param0, param1, param2, param3));ERROR_CHECK;
 }
 
 void GLWrapper::BindTexture(GLenum target, GLuint handle)
@@ -380,7 +394,7 @@ void GLWrapper::BindTexture(GLenum target, GLuint handle)
 	// If we don't know what TU is active, then we can't do cache either.
 	if (target != GL_TEXTURE_2D || curActiveTexture == UINT_MAX)
 	{
-		GLLOG(glBindTexture(target,handle));ERROR_CHECK;
+		GLCALL(BindTexture, (target,handle));ERROR_CHECK;
 		return;
 	}
 
@@ -399,259 +413,259 @@ void GLWrapper::BindTexture(GLenum target, GLuint handle)
 
 	if (send)
 	{
-		GLLOG(glBindTexture(target,handle));ERROR_CHECK;
+		GLCALL(BindTexture, (target,handle));ERROR_CHECK;
 		boundTextures[curActiveTexture] = handle;
 	}
 }
 
 void GLWrapper::TexParameteri(GLenum target, GLenum pname, GLint param)
 {
-	GLLOG(glTexParameteri(target, pname, param));ERROR_CHECK;
+	GLCALL(TexParameteri, (target, pname, param));ERROR_CHECK;
 }
 
 void GLWrapper::TexParameterf(GLenum target, GLenum pname, GLfloat param)
 {
-	GLLOG(glTexParameterf(target, pname, param));ERROR_CHECK;
+	GLCALL(TexParameterf, (target, pname, param));ERROR_CHECK;
 }
 
 void GLWrapper::TexParameterfv(GLenum target, GLenum pname, const GLfloat * params)
 {
-	GLLOG(glTexParameterfv(target, pname, params));ERROR_CHECK;
+	GLCALL(TexParameterfv, (target, pname, params));ERROR_CHECK;
 }
 
 void GLWrapper::SamplerParameteri(GLuint samplerHandle, GLenum pname, GLint param)
 {
-	GLLOG(glSamplerParameteri(samplerHandle, pname, param));ERROR_CHECK;
+	GLCALL(SamplerParameteri, (samplerHandle, pname, param));ERROR_CHECK;
 }
 
 void GLWrapper::SamplerParameterf(GLuint samplerHandle, GLenum pname, GLfloat param)
 {
-	GLLOG(glSamplerParameterf(samplerHandle, pname, param));ERROR_CHECK;
+	GLCALL(SamplerParameterf, (samplerHandle, pname, param));ERROR_CHECK;
 }
 
 void GLWrapper::SamplerParameterfv(GLuint samplerHandle, GLenum pname, const GLfloat * params)
 {
-	GLLOG(glSamplerParameterfv(samplerHandle, pname, params));ERROR_CHECK;
+	GLCALL(SamplerParameterfv, (samplerHandle, pname, params));ERROR_CHECK;
 }
 
 void GLWrapper::ActiveTexture(unsigned int tu)
 {
-	CACHED(curActiveTexture,tu,GLLOG(glActiveTexture(GL_TEXTURE0+tu));ERROR_CHECK;)
+	CACHED(curActiveTexture,tu,GLCALL(ActiveTexture, (GL_TEXTURE0+tu));ERROR_CHECK;)
 }
 
 void GLWrapper::deleteFramebufferObject(GLuint handle)
 {
-	GLLOG(glDeleteFramebuffers(1, &handle));ERROR_CHECK;
+	GLCALL(DeleteFramebuffers, (1, &handle));ERROR_CHECK;
 }
 
 void GLWrapper::deleteRenderbuffer(GLuint handle)
 {
-	GLLOG(glDeleteRenderbuffers(1, &handle));ERROR_CHECK;
+	GLCALL(DeleteRenderbuffers, (1, &handle));ERROR_CHECK;
 }
 
 void GLWrapper::DeleteProgram(GLuint handle)
 {
-	GLLOG(glDeleteProgram(handle));ERROR_CHECK;
+	GLCALL(DeleteProgram, (handle));ERROR_CHECK;
 }
 
 GLuint GLWrapper::CreateProgram()
 {
-	GLuint result = GLLOG(glCreateProgram());ERROR_CHECK;
+	GLuint result = GLCALL(CreateProgram, ());ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::DeleteShader(GLuint handle)
 {
-	GLLOG(glDeleteShader(handle));ERROR_CHECK;
+	GLCALL(DeleteShader, (handle));ERROR_CHECK;
 }
 
 GLint GLWrapper::GetUniformLocation(GLuint shaderProgram, const std::string & uniformName)
 {
-	GLuint result = GLLOG(glGetUniformLocation(shaderProgram, uniformName.c_str()));ERROR_CHECK;
+	GLuint result = GLCALL(GetUniformLocation, (shaderProgram, uniformName.c_str()));ERROR_CHECK;
 	return result;
 }
 
 GLuint GLWrapper::GenFramebuffer()
 {
 	GLuint result(0);
-	GLLOG(glGenFramebuffers(1,&result));ERROR_CHECK;
+	GLCALL(GenFramebuffers, (1,&result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::GetIntegerv(GLenum pname, GLint * params) const
 {
-	GLLOG(glGetIntegerv(pname, params));ERROR_CHECK;
+	GLCALL(GetIntegerv, (pname, params));ERROR_CHECK;
 }
 
 void GLWrapper::DrawBuffers(GLsizei n, const GLenum * bufs)
 {
-	GLLOG(glDrawBuffers(n, bufs));ERROR_CHECK;
+	GLCALL(DrawBuffers, (n, bufs));ERROR_CHECK;
 }
 
 GLuint GLWrapper::GenRenderbuffer()
 {
 	GLuint result;
-	GLLOG(glGenRenderbuffers(1, &result));ERROR_CHECK;
+	GLCALL(GenRenderbuffers, (1, &result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::BindRenderbuffer(GLenum target,GLuint renderbuffer)
 {
-	GLLOG(glBindRenderbuffer(target, renderbuffer));ERROR_CHECK;
+	GLCALL(BindRenderbuffer, (target, renderbuffer));ERROR_CHECK;
 }
 
 void GLWrapper::RenderbufferStorage(GLenum target, GLenum internalformat, GLsizei width, GLsizei height)
 {
-	GLLOG(glRenderbufferStorage(target, internalformat, width, height));ERROR_CHECK;
+	GLCALL(RenderbufferStorage, (target, internalformat, width, height));ERROR_CHECK;
 }
 
 void GLWrapper::FramebufferRenderbuffer(GLenum target,GLenum attachment,GLenum renderbuffertarget,GLuint renderbuffer)
 {
-	GLLOG(glFramebufferRenderbuffer(target,attachment,renderbuffertarget,renderbuffer));ERROR_CHECK;
+	GLCALL(FramebufferRenderbuffer, (target,attachment,renderbuffertarget,renderbuffer));ERROR_CHECK;
 }
 
 GLuint GLWrapper::GenTexture()
 {
 	GLuint result;
-	GLLOG(glGenTextures(1, &result));ERROR_CHECK;
+	GLCALL(GenTextures, (1, &result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::DeleteTexture(GLuint handle)
 {
-	GLLOG(glDeleteTextures(1, &handle));ERROR_CHECK;
+	GLCALL(DeleteTextures, (1, &handle));ERROR_CHECK;
 }
 
 void GLWrapper::TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const GLvoid * data)
 {
-	GLLOG(glTexImage2D(target, level, internalFormat, width, height, border, format, type, data));ERROR_CHECK;
+	GLCALL(TexImage2D, (target, level, internalFormat, width, height, border, format, type, data));ERROR_CHECK;
 }
 
 void GLWrapper::FramebufferTexture2D(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level)
 {
-	GLLOG(glFramebufferTexture2D(target, attachment, textarget, texture, level));ERROR_CHECK;
+	GLCALL(FramebufferTexture2D, (target, attachment, textarget, texture, level));ERROR_CHECK;
 }
 
 GLuint GLWrapper::GenSampler() {
 	GLuint result;
-	GLLOG(glGenSamplers(1, &result));ERROR_CHECK;
+	GLCALL(GenSamplers, (1, &result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::DeleteSampler(GLuint handle)
 {
-	GLLOG(glDeleteSamplers(1, &handle));ERROR_CHECK;
+	GLCALL(DeleteSamplers, (1, &handle));ERROR_CHECK;
 }
 
 void GLWrapper::BindSampler(GLuint unit, GLuint sampler)
 {
-	GLLOG(glBindSampler(unit,sampler));ERROR_CHECK2(unit,sampler);
+	GLCALL(BindSampler, (unit,sampler));ERROR_CHECK2(unit,sampler);
 }
 
 void GLWrapper::unbindSampler(GLuint unit)
 {
-	GLLOG(glBindSampler(unit,0));ERROR_CHECK;
+	GLCALL(BindSampler, (unit,0));ERROR_CHECK;
 }
 
 GLuint GLWrapper::GenVertexArray()
 {
 	GLuint result;
-	GLLOG(glGenVertexArrays(1, &result));ERROR_CHECK;
+	GLCALL(GenVertexArrays, (1, &result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::BindVertexArray(GLuint handle)
 {
-	GLLOG(glBindVertexArray(handle));ERROR_CHECK;
+	GLCALL(BindVertexArray, (handle));ERROR_CHECK;
 }
 
 void GLWrapper::unbindVertexArray()
 {
-	GLLOG(glBindVertexArray(0));ERROR_CHECK;
+	GLCALL(BindVertexArray, (0));ERROR_CHECK;
 }
 
 void GLWrapper::DeleteVertexArray(GLuint handle)
 {
-	GLLOG(glDeleteVertexArrays(1, &handle));ERROR_CHECK;
+	GLCALL(DeleteVertexArrays, (1, &handle));ERROR_CHECK;
 }
 
 void GLWrapper::VertexAttribPointer(GLuint i, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void * pointer)
 {
-	GLLOG(glVertexAttribPointer(i, size, type, normalized, stride, pointer));ERROR_CHECK;
+	GLCALL(VertexAttribPointer, (i, size, type, normalized, stride, pointer));ERROR_CHECK;
 }
 
 void GLWrapper::EnableVertexAttribArray(GLuint i)
 {
-	GLLOG(glEnableVertexAttribArray(i));ERROR_CHECK;
+	GLCALL(EnableVertexAttribArray, (i));ERROR_CHECK;
 }
 
 void GLWrapper::DisableVertexAttribArray(GLuint i)
 {
-	GLLOG(glDisableVertexAttribArray(i));ERROR_CHECK;
+	GLCALL(DisableVertexAttribArray, (i));ERROR_CHECK;
 }
 
 void GLWrapper::DrawElements(GLenum mode, GLsizei count, GLenum type, const void * indices)
 {
-	GLLOG(glDrawElements(mode, count, type, indices));ERROR_CHECK;
+	GLCALL(DrawElements, (mode, count, type, indices));ERROR_CHECK;
 }
 
 void GLWrapper::DrawArrays(GLenum mode, GLint first, GLsizei count)
 {
-	GLLOG(glDrawArrays(mode, first, count));ERROR_CHECK;
+	GLCALL(DrawArrays, (mode, first, count));ERROR_CHECK;
 }
 
 void GLWrapper::DeleteQuery(GLuint handle)
 {
-	GLLOG(glDeleteQueries(1, &handle));ERROR_CHECK;
+	GLCALL(DeleteQueries, (1, &handle));ERROR_CHECK;
 }
 
 GLuint GLWrapper::GenQuery()
 {
 	GLuint result;
-	GLLOG(glGenQueries(1, &result));ERROR_CHECK;
+	GLCALL(GenQueries, (1, &result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::BeginQuery(GLenum target, GLuint handle)
 {
-	GLLOG(glBeginQuery(target, handle));ERROR_CHECK;
+	GLCALL(BeginQuery, (target, handle));ERROR_CHECK;
 }
 
 void GLWrapper::EndQuery(GLenum target)
 {
-	GLLOG(glEndQuery(target));ERROR_CHECK;
+	GLCALL(EndQuery, (target));ERROR_CHECK;
 }
 
 GLuint GLWrapper::GetQueryObjectuiv(GLuint id, GLenum pname)
 {
 	GLuint result;
-	GLLOG(glGetQueryObjectuiv(id, pname, &result));ERROR_CHECK;
+	GLCALL(GetQueryObjectuiv, (id, pname, &result));ERROR_CHECK;
 	return result;
 }
 
 void GLWrapper::ClearColor(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
 {
-	GLLOG(glClearColor(r,g,b,a));ERROR_CHECK;
+	GLCALL(ClearColor, (r,g,b,a));ERROR_CHECK;
 }
 
 void GLWrapper::ClearDepth(GLfloat d)
 {
-	GLLOG(glClearDepth(d));ERROR_CHECK;
+	GLCALL(ClearDepth, (d));ERROR_CHECK;
 }
 
 void GLWrapper::ClearStencil(GLint s)
 {
-	GLLOG(glClearStencil(s));ERROR_CHECK;
+	GLCALL(ClearStencil, (s));ERROR_CHECK;
 }
 
 void GLWrapper::LineWidth(GLfloat width)
 {
-	GLLOG(glLineWidth(width));ERROR_CHECK;
+	GLCALL(LineWidth, (width));ERROR_CHECK;
 }
 
 bool GLWrapper::checkForOpenGLErrors(const char * function, const char * file, int line) const
 {
-	if (enableErrorChecking)
+	if (enableErrorChecking && !recorder)
 	{
 		GLenum gl_error = glGetError();
 		if (gl_error != GL_NO_ERROR)
@@ -740,5 +754,5 @@ void GLWrapper::logGlCall(const char * msg) const
 #undef ERROR_CHECK
 #undef ERROR_CHECK1
 #undef ERROR_CHECK2
-#undef GLLOG
+#undef GLCALL
 #undef CACHED
@@ -26,6 +26,8 @@
 #include <vector>
 #include <map>
 
+class GLRecorder;
+
 /// A wrapper around all OpenGL functions.
 /// All GL functions should go through this class only; this allows it to cache state changes and perform other optimizations.
 class GLWrapper
@@ -45,6 +47,10 @@ public:
 	/// This allows specification of a stream to send miscellaneous logging messages to a pointer to the passed value will be kept, and must be valid for the lifetime of the object.
 	void setInfoOutput(std::ostream & newOutput);
 
+	/// Send all GL calls to the provided recorder instead of the driver, no context is needed while recording.
+	/// A pointer to the recorder will be kept; NULL switches back to the driver.
+	void setRecorder(GLRecorder * newRecorder);
+
 	/// Calls the appropriate glUniform* function immediately.
 	void applyUniform(GLint location, const RenderUniformVector <float> & data);
 	void applyUniform(GLint location, const RenderUniformVector <int> & data);
@@ -164,6 +170,7 @@ private:
 	std::ostream * infoOutput;
 	std::ostream * errorOutput;
 	bool logEnable; // Only does anything if logEveryGlCall in glwrapper.cpp is true.
+	GLRecorder * recorder;
 
 	// Cached state.
 	unsigned int curActiveTexture;
@@ -191,7 +198,7 @@ private:
 #undef ERROR_CHECK
 #undef ERROR_CHECK1
 #undef ERROR_CHECK2
-#undef GLLOG
+#undef GLCALL
 #undef CACHED
 
 #endif
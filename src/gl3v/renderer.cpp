@@ -496,3 +496,331 @@ bool Renderer::loadShader(const std::string & path, const std::string & name, co
 
 	return success;
 }
+
+#include "glrecorder.h"
+#include "benchmark.h"
+#include "unittest.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+
+/// Synthetic external model with a diffuse texture, an optional normal map, a transform and a tint.
+class BenchmarkRenderModel : public RenderModelExternal
+{
+public:
+	BenchmarkRenderModel(GLuint vao, const RenderTextureEntry & diffuse, const RenderTextureEntry * normal, const RenderUniformEntry & transform, const RenderUniformEntry & tint)
+	{
+		setVertexArrayObject(vao, 36);
+		textures.push_back(diffuse);
+		if (normal)
+			textures.push_back(*normal);
+		uniforms.push_back(transform);
+		uniforms.push_back(tint);
+	}
+};
+
+static RealtimeExportPassInfo BenchmarkPassInfo(const std::string & name, const std::string & shader, bool textured)
+{
+	RealtimeExportPassInfo pass;
+	pass.name = name;
+	pass.clearColor = true;
+	pass.clearDepth = true;
+	pass.clearStencil = false;
+	pass.clearDepthValue = 1;
+	pass.clearStencilValue = 0;
+	pass.drawGroups.push_back("normal_noblend");
+	pass.vertexShader = shader;
+	pass.fragmentShader = shader;
+	pass.shaderAttributeBindings.push_back("vertexPosition");
+	pass.stateEnable.push_back("GL_DEPTH_TEST");
+	pass.stateEnable.push_back("GL_CULL_FACE");
+	pass.stateEnum["GL_DEPTH_FUNC"].type = "enum";
+	pass.stateEnum["GL_DEPTH_FUNC"].enumdata = "GL_LEQUAL";
+	pass.stateEnum["GL_DEPTH_WRITEMASK"].type = "int";
+	pass.stateEnum["GL_DEPTH_WRITEMASK"].intdata.push_back(1);
+	pass.uniforms["modelViewMatrix"] = RealtimeExportPassInfo::UniformData();
+	if (textured)
+	{
+		pass.uniforms["colorTint"].data.assign(4, 1.0f);
+		pass.samplers["diffuseSampler"].textureName = "diffuseTexture";
+		pass.samplers["normalSampler"].textureName = "normalMap";
+	}
+	return pass;
+}
+
+/// Follows the texture bindings and uniform values of a recorded command stream and takes a snapshot of them at every draw.
+struct RecordedDrawState
+{
+	double textureUnit;
+	double program;
+	double vao;
+	std::map <double, double> textures; ///< handle by TU
+	std::map <std::pair <double, double>, std::vector <double> > uniforms; ///< values by program and location
+
+	std::vector <double> order; ///< VAOs in draw order
+	std::map <double, std::string> state; ///< snapshot by VAO
+
+	RecordedDrawState() : textureUnit(0), program(0), vao(0) {}
+
+	/// Continue with the commands recorded since the last clear.
+	void replay(const GLRecorder & recorder)
+	{
+		order.clear();
+		state.clear();
+		const std::vector <GLRecorder::Command> & commands = recorder.getCommands();
+		for (std::vector <GLRecorder::Command>::const_iterator c = commands.begin(); c != commands.end(); c++)
+		{
+			const std::string name = c->name;
+			std::vector <double>::const_iterator args = recorder.getArguments().begin() + c->firstArgument;
+			if (name == "glActiveTexture")
+				textureUnit = args[0] - GL_TEXTURE0;
+			else if (name == "glBindTexture")
+				textures[textureUnit] = args[1];
+			else if (name == "glUseProgram")
+				program = args[0];
+			else if (name == "glBindVertexArray")
+				vao = args[0];
+			else if (name.compare(0, 9, "glUniform") == 0)
+				uniforms[std::make_pair(program, args[0])].assign(args + 1, args + c->argumentCount);
+			else if (name == "glDrawElements")
+			{
+				std::ostringstream s;
+				for (std::map <double, double>::const_iterator t = textures.begin(); t != textures.end(); t++)
+					s << "tu " << t->first << ": " << t->second << "\n";
+				for (std::map <std::pair <double, double>, std::vector <double> >::const_iterator u = uniforms.begin(); u != uniforms.end(); u++)
+				{
+					if (u->first.first != program)
+						continue;
+					s << "location " << u->first.second << ":";
+					for (size_t i = 0; i < u->second.size(); i++)
+						s << " " << u->second[i];
+					s << "\n";
+				}
+				order.push_back(vao);
+				state[vao] = s.str();
+			}
+		}
+	}
+};
+
+QT_TEST(renderpass_sort_test)
+{
+	const std::string shader = "renderpass_sort_test.glsl";
+	{
+		std::ofstream shaderFile(shader.c_str());
+		shaderFile << "#version 330\n";
+	}
+
+	GLRecorder recorder;
+	GLWrapper gl;
+	gl.setRecorder(&recorder);
+	gl.initialize();
+
+	// Only the depth state differs, the first pass is sorted, the others keep the submission order.
+	std::vector <RealtimeExportPassInfo> config;
+	config.push_back(BenchmarkPassInfo("sorted", shader, true));
+	config.push_back(BenchmarkPassInfo("nowrite", shader, true));
+	config.back().stateEnum["GL_DEPTH_WRITEMASK"].intdata[0] = 0;
+	config.push_back(BenchmarkPassInfo("greater", shader, true));
+	config.back().stateEnum["GL_DEPTH_FUNC"].enumdata = "GL_GREATER";
+
+	std::stringstream errors;
+	StringIdMap stringMap;
+	Renderer renderer(gl);
+	bool initialized = renderer.initialize(config, stringMap, "", 640, 480, std::set <std::string>(), errors);
+	std::remove(shader.c_str());
+	QT_CHECK(initialized);
+	if (!initialized)
+		return;
+
+	StringId diffuseName = stringMap.addStringId("diffuseTexture");
+	StringId normalName = stringMap.addStringId("normalMap");
+	StringId transformName = stringMap.addStringId("modelViewMatrix");
+	StringId tintName = stringMap.addStringId("colorTint");
+	renderer.setGlobalTexture(normalName, RenderTextureEntry(normalName, gl.GenTexture(), GL_TEXTURE_2D));
+
+	// Three texture sets in turn and two tints, all at the same depth, so models with the same texture set have equal sort keys.
+	std::vector <GLuint> diffuseTextures;
+	for (int i = 0; i < 3; i++)
+		diffuseTextures.push_back(gl.GenTexture());
+	RenderTextureEntry normalMap(normalName, gl.GenTexture(), GL_TEXTURE_2D);
+	const float tints[2][4] = {{1, 0, 0, 1}, {0, 0, 1, 1}};
+	const int modelCount = 12;
+	std::vector <BenchmarkRenderModel> models;
+	std::vector <double> submission;
+	models.reserve(modelCount);
+	for (int i = 0; i < modelCount; i++)
+	{
+		float transform[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, float(i), 0, 0, 1};
+		GLuint vao = gl.GenVertexArray();
+		submission.push_back(vao);
+		models.push_back(BenchmarkRenderModel(
+			vao,
+			RenderTextureEntry(diffuseName, diffuseTextures[i % 3], GL_TEXTURE_2D),
+			(i % 3 == 2) ? &normalMap : NULL,
+			RenderUniformEntry(transformName, transform, 16),
+			RenderUniformEntry(tintName, tints[i % 2], 4)));
+		models.back().setSortDepth(10);
+	}
+
+	std::map <StringId, std::vector <RenderModelExternal*> > drawGroups;
+	std::vector <RenderModelExternal*> & drawList = drawGroups[stringMap.addStringId("normal_noblend")];
+	for (int i = 0; i < modelCount; i++)
+		drawList.push_back(&models[i]);
+
+	// One pass at a time, following the GL state from initialization on.
+	RecordedDrawState replay;
+	replay.replay(recorder);
+	std::vector <StringId> passNames = renderer.getPassNames();
+	QT_CHECK_EQUAL(passNames.size(), 3);
+	std::vector <std::vector <double> > orders;
+	std::vector <std::map <double, std::string> > states;
+	std::vector <unsigned int> binds;
+	for (size_t p = 0; p < passNames.size(); p++)
+	{
+		for (size_t n = 0; n < passNames.size(); n++)
+			renderer.setPassEnabled(passNames[n], n == p);
+
+		recorder.clear();
+		renderer.render(640, 480, stringMap, drawGroups, errors);
+		replay.replay(recorder);
+		orders.push_back(replay.order);
+		states.push_back(replay.state);
+		binds.push_back(recorder.getCallCount("glBindTexture"));
+	}
+	if (orders.size() != 3)
+		return;
+
+	// Without depth writes or with another depth function the models are drawn in submission order.
+	QT_CHECK(orders[1] == submission);
+	QT_CHECK(orders[2] == submission);
+
+	// The sorted pass draws the models with equal keys one after another, in submission order.
+	QT_CHECK_EQUAL(orders[0].size(), submission.size());
+	int groupChanges = 0;
+	std::vector <int> lastDrawn(3, -1);
+	for (size_t d = 0; d < orders[0].size() && d < submission.size(); d++)
+	{
+		int i = std::find(submission.begin(), submission.end(), orders[0][d]) - submission.begin();
+		QT_CHECK(i > lastDrawn[i % 3]);
+		lastDrawn[i % 3] = i;
+		if (d > 0)
+		{
+			int previous = std::find(submission.begin(), submission.end(), orders[0][d - 1]) - submission.begin();
+			if (previous % 3 != i % 3)
+				groupChanges++;
+		}
+	}
+	QT_CHECK_EQUAL(groupChanges, 2);
+
+	// Every model is drawn with the same textures and uniforms either way, with fewer texture binds when sorted.
+	QT_CHECK(states[0] == states[1]);
+	QT_CHECK_EQUAL(states[0].size(), submission.size());
+	QT_CHECK(binds[0] < binds[1]);
+
+	renderer.clear();
+}
+
+BENCHMARK(renderer)
+{
+	// Any readable file will do, the recorder does not compile shaders.
+	const std::string shader = "renderer_benchmark.glsl";
+	{
+		std::ofstream shaderFile(shader.c_str());
+		shaderFile << "#version 330\n";
+	}
+
+	GLRecorder recorder;
+	GLWrapper gl;
+	gl.setRecorder(&recorder);
+	gl.initialize();
+
+	std::vector <RealtimeExportPassInfo> config;
+	config.push_back(BenchmarkPassInfo("shadow", shader, false));
+	config.push_back(BenchmarkPassInfo("opaque", shader, true));
+
+	std::stringstream errors;
+	StringIdMap stringMap;
+	Renderer renderer(gl);
+	bool initialized = renderer.initialize(config, stringMap, "", 1280, 720, std::set <std::string>(), errors);
+	std::remove(shader.c_str());
+	if (!initialized)
+	{
+		out << "renderer: initialization failed: " << errors.str() << std::endl;
+		return;
+	}
+
+	StringId diffuseName = stringMap.addStringId("diffuseTexture");
+	StringId normalName = stringMap.addStringId("normalMap");
+	StringId transformName = stringMap.addStringId("modelViewMatrix");
+	StringId tintName = stringMap.addStringId("colorTint");
+	renderer.setGlobalTexture(normalName, RenderTextureEntry(normalName, gl.GenTexture(), GL_TEXTURE_2D));
+
+	// Shared resources as a scene would have them: a few hundred meshes and
+	// textures, a handful of tints, a transform per model.
+	std::vector <GLuint> vaos(256), diffuseTextures(64);
+	std::vector <RenderTextureEntry> normalMaps;
+	for (size_t i = 0; i < vaos.size(); i++)
+		vaos[i] = gl.GenVertexArray();
+	for (size_t i = 0; i < diffuseTextures.size(); i++)
+		diffuseTextures[i] = gl.GenTexture();
+	for (size_t i = 0; i < 16; i++)
+		normalMaps.push_back(RenderTextureEntry(normalName, gl.GenTexture(), GL_TEXTURE_2D));
+	const float tints[4][4] = {{1, 1, 1, 1}, {1, 0, 0, 1}, {0.5, 0.5, 0.5, 1}, {0, 0, 1, 0.5}};
+
+	std::vector <StringId> passNames = renderer.getPassNames();
+	const int modelCounts[] = {10000, 30000, 100000};
+	for (int c = 0; c < 3; c++)
+	{
+		int modelCount = modelCounts[c];
+		std::srand(1);
+		std::vector <BenchmarkRenderModel> models;
+		models.reserve(modelCount);
+		for (int i = 0; i < modelCount; i++)
+		{
+			float transform[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, float(i % 100), float(i / 100), 0, 1};
+			const RenderTextureEntry * normal = (std::rand() % 4 == 0) ? &normalMaps[std::rand() % normalMaps.size()] : NULL;
+			models.push_back(BenchmarkRenderModel(
+				vaos[std::rand() % vaos.size()],
+				RenderTextureEntry(diffuseName, diffuseTextures[std::rand() % diffuseTextures.size()], GL_TEXTURE_2D),
+				normal,
+				RenderUniformEntry(transformName, transform, 16),
+				RenderUniformEntry(tintName, tints[std::rand() % 4], 4)));
+			models.back().setSortDepth(std::sqrt(transform[12] * transform[12] + transform[13] * transform[13]));
+		}
+
+		std::map <StringId, std::vector <RenderModelExternal*> > drawGroups;
+		std::vector <RenderModelExternal*> & drawList = drawGroups[stringMap.addStringId("normal_noblend")];
+		for (int i = 0; i < modelCount; i++)
+			drawList.push_back(&models[i]);
+
+		// One pass at a time, the counts are from the last frame.
+		for (size_t p = 0; p < passNames.size(); p++)
+		{
+			for (size_t n = 0; n < passNames.size(); n++)
+				renderer.setPassEnabled(passNames[n], n == p);
+
+			const int frames = 4;
+			double seconds = 0;
+			for (int f = 0; f < frames; f++)
+			{
+				recorder.clear();
+				benchmark::Stopwatch timer;
+				renderer.render(1280, 720, stringMap, drawGroups, errors);
+				seconds += timer.Seconds();
+			}
+
+			out << "renderer " << modelCount << " models, pass " << stringMap.getString(passNames[p]) << ": "
+				<< seconds / frames * 1E3 << " ms, "
+				<< recorder.getCallCount() << " GL calls, "
+				<< recorder.getDrawCount() << " draws, "
+				<< recorder.getCallCount("glBindTexture") << " texture binds, "
+				<< recorder.getCallCount("glUniform4f") + recorder.getCallCount("glUniformMatrix4fv") << " uniform uploads, "
+				<< recorder.getRedundantCount() << " redundant state changes" << std::endl;
+		}
+	}
+
+	renderer.clear();
+}
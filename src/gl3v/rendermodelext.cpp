@@ -19,12 +19,12 @@
 
 #include "rendermodelext.h"
 
-RenderModelExternal::RenderModelExternal() : vao(0), elementCount(0), enabled(false)
+RenderModelExternal::RenderModelExternal() : vao(0), elementCount(0), enabled(false), sortDepth(0)
 {
 	// Constructor.
 }
 
-RenderModelExternal::RenderModelExternal(const RenderModelEntry & m) : vao(m.vao), elementCount(m.elementCount)
+RenderModelExternal::RenderModelExternal(const RenderModelEntry & m) : vao(m.vao), elementCount(m.elementCount), enabled(false), sortDepth(0)
 {
 	if (elementCount > 0)
 		enabled = true;
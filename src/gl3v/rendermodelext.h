@@ -45,10 +45,15 @@ public:
 	bool drawEnabled() const;
 	void setVertexArrayObject(GLuint newVao, unsigned int newElementCount);
 
+	/// Distance from the camera, passes that can reorder their draws draw models sharing textures front to back.
+	void setSortDepth(float newSortDepth) {sortDepth = newSortDepth;}
+	float getSortDepth() const {return sortDepth;}
+
 protected:
 	GLuint vao;
 	int elementCount;
 	bool enabled;
+	float sortDepth;
 
 	std::vector <RenderTextureEntry> textures;
 	std::vector <RenderUniformEntry> uniforms;
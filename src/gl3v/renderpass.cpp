@@ -21,17 +21,79 @@
 #include <tr1/unordered_set>
 #endif
 #include <cassert>
+#include <cstring>
+#include <algorithm>
 #include "utils.h"
 #include "renderpass.h"
 #include "glenums.h"
 
 //#define USE_EXTERNAL_MODEL_CACHE
 
+// Sorted external models are visited out of memory order, this starts loading a model's data before it is drawn.
+#if defined(__GNUC__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address)
+#endif
+
 #define WAIT_ON_TIMER_QUERY true
 
 const GLEnums GLEnumHelper;
 
-RenderPass::RenderPass() : configured(false), enabled(true), shaderProgram(0), framebufferObject(0), renderbuffer(0), passIndex(0), timerQuery(0), lastTime(-1)
+/// Builds the draw order key of an external model, from the most to the least significant bits: pass, shader, texture set and depth bucket.
+static unsigned long long getSortKey(unsigned int pass, GLuint program, const std::vector <RenderTexture> & textures, unsigned int texturesBegin, unsigned int texturesEnd, float depth)
+{
+	// FNV-1a hash of the TU and texture handle pairs, models that bind the same textures get the same hash.
+	unsigned int textureSet = 2166136261u;
+	for (unsigned int t = texturesBegin; t < texturesEnd; t++)
+	{
+		textureSet = (textureSet ^ textures[t].tu) * 16777619u;
+		textureSet = (textureSet ^ textures[t].handle) * 16777619u;
+	}
+
+	// The bits of a positive float grow with its value, so the top 16 bits are a logarithmic depth bucket.
+	unsigned int depthBits = 0;
+	if (depth > 0)
+		std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	return ((unsigned long long)(pass & 0xFF) << 56) |
+		((unsigned long long)(program & 0xFF) << 48) |
+		((unsigned long long)textureSet << 16) |
+		(depthBits >> 16);
+}
+
+/// Binds the texture to the TU unless it is bound there already. A NULL texture unbinds the TU.
+static void bindTexture(GLWrapper & gl, std::vector <RenderTextureBase> & boundTextures, GLuint tu, const RenderTextureBase * texture)
+{
+	RenderTextureBase & bound = boundTextures[tu];
+	GLuint handle = texture ? texture->handle : 0;
+	GLenum target = texture ? texture->target : GL_TEXTURE_2D; //TODO: Determine target from sampler.
+	if (bound.handle == handle && bound.target == target)
+		return;
+
+	gl.ActiveTexture(tu);
+	gl.BindTexture(target, handle);
+	bound = RenderTextureBase(handle, target);
+}
+
+/// Uploads the uniform to the location unless the location already holds the same values.
+static void uploadUniform(GLWrapper & gl, std::vector <const RenderUniformBase*> & appliedUniforms, GLuint location, const RenderUniformBase * uniform)
+{
+	if (!uniform)
+		return;
+
+	const RenderUniformBase * applied = appliedUniforms[location];
+	if (applied == uniform)
+		return;
+	if (applied && applied->data.size() == uniform->data.size() &&
+		std::memcmp(applied->data.begin(), uniform->data.begin(), uniform->data.size() * sizeof(float)) == 0)
+		return;
+
+	gl.applyUniform(location, uniform->data);
+	appliedUniforms[location] = uniform;
+}
+
+RenderPass::RenderPass() : configured(false), enabled(true), shaderProgram(0), framebufferObject(0), renderbuffer(0), passIndex(0), sortExternalModels(false), timerQuery(0), lastTime(-1)
 {
 	// Constructor.
 }
@@ -101,6 +163,23 @@ bool RenderPass::initialize(int passCount, const RealtimeExportPassInfo & config
 	for (std::map <std::string, RealtimeExportPassInfo::RenderState>::const_iterator i = config.stateEnum.begin(); i != config.stateEnum.end(); i++)
 		stateEnum.push_back(RenderState(GLEnumHelper.getEnum(i->first), i->second, GLEnumHelper));
 
+	// With depth testing and writes, a less or lequal depth function and no blending the nearest fragment wins whatever the draw order, so external models can be sorted to save state changes.
+	// The depth state carries over from the previous pass, so it has to be set by this one.
+	bool blend = std::find(stateEnable.begin(), stateEnable.end(), GLenum(GL_BLEND)) != stateEnable.end();
+	for (unsigned int i = 0; i < stateEnablei.size(); i++)
+		blend = blend || stateEnablei[i].first == GL_BLEND;
+	bool depthTest = std::find(stateEnable.begin(), stateEnable.end(), GLenum(GL_DEPTH_TEST)) != stateEnable.end();
+	bool depthWrite = false;
+	bool depthLess = false;
+	for (std::vector <RenderState>::const_iterator s = stateEnum.begin(); s != stateEnum.end(); s++)
+	{
+		if (s->getParameter() == GL_DEPTH_WRITEMASK)
+			depthWrite = s->getValue() != GL_FALSE;
+		else if (s->getParameter() == GL_DEPTH_FUNC)
+			depthLess = s->getValue() == GL_LESS || s->getValue() == GL_LEQUAL;
+	}
+	sortExternalModels = depthTest && depthWrite && depthLess && !blend;
+
 	// We must get the uniform location for the sampler name, then upload a uniform corresponding to the TU we want to use.
 	for (std::map <std::string, RealtimeExportPassInfo::Sampler>::const_iterator i = config.samplers.begin(); i != config.samplers.end(); i++)
 	{
@@ -210,6 +289,7 @@ void RenderPass::clear(GLWrapper & gl)
 	stateEnablei.clear();
 	stateDisablei.clear();
 	stateEnum.clear();
+	sortExternalModels = false;
 
 	drawGroups.clear();
 
@@ -317,6 +397,15 @@ bool RenderPass::render(GLWrapper & gl, unsigned int w, unsigned int h, StringId
 	std::vector <const RenderTextureBase*> textureState(defaultTextures.begin(), defaultTextures.end()); //Indexed by tu.
 	textureState.resize(std::max(textureState.size(),samplers.size()),NULL);
 	std::vector <const RenderUniformBase*> uniformState(defaultUniforms.begin(), defaultUniforms.end()); //Indexed by location.
+	for (std::tr1::unordered_map <StringId, GLuint, StringId::hash>::const_iterator loc = variableNameToUniformLocation.begin(); loc != variableNameToUniformLocation.end(); loc++)
+		uniformState.resize(std::max(uniformState.size(),(size_t)(loc->second+1)),NULL); // Models can override uniforms that have no default.
+
+	// What the GL has bound and which uniforms it was last given, so external models only change what differs.
+	std::vector <RenderTextureBase> boundTextures(textureState.size(), RenderTextureBase(0, GL_TEXTURE_2D)); // Indexed by tu.
+	for (unsigned int tu = 0; tu < defaultTextures.size(); tu++)
+		if (defaultTextures[tu])
+			boundTextures[tu] = *defaultTextures[tu];
+	std::vector <const RenderUniformBase*> appliedUniforms(uniformState); // Indexed by location, NULL if unknown.
 
 	override_tracking_type overriddenTextures;
 	override_tracking_type lastOverriddenTextures;
@@ -333,6 +422,7 @@ bool RenderPass::render(GLWrapper & gl, unsigned int w, unsigned int h, StringId
 			overriddenTextures.push_back(t->tu);
 
 			applyTexture(gl, *t);
+			boundTextures[t->tu] = *t;
 		}
 
 		// Apply uniform overrides, keeping track of which locations we've overridden.
@@ -342,6 +432,7 @@ bool RenderPass::render(GLWrapper & gl, unsigned int w, unsigned int h, StringId
 			overriddenUniforms.push_back(u->location);
 
 			gl.applyUniform(u->location, u->data);
+			appliedUniforms[u->location] = &*u;
 		}
 
 		// Draw geometry.
@@ -354,7 +445,10 @@ bool RenderPass::render(GLWrapper & gl, unsigned int w, unsigned int h, StringId
 			{
 				const RenderUniform * u = defaultUniforms[*location];
 				if (u)
+				{
 					gl.applyUniform(u->location, u->data);
+					appliedUniforms[u->location] = u;
+				}
 			}
 		}
 
@@ -365,12 +459,18 @@ bool RenderPass::render(GLWrapper & gl, unsigned int w, unsigned int h, StringId
 			{
 				const RenderTexture * t = defaultTextures[*tu];
 				if (t)
+				{
 					applyTexture(gl, *t);
+					boundTextures[*tu] = *t;
+				}
 			}
 		}
 	}
 
-	// For each external model.
+	// Queue the external models, resolving their texture and uniform overrides for this pass.
+	drawQueue.clear();
+	drawTextures.clear();
+	drawUniforms.clear();
 	for (std::vector <const std::vector <RenderModelExternal*>*>::const_iterator i = externalModels.begin(); i != externalModels.end(); i++)
 	{
 		// Loop through all models in the draw group.
@@ -379,133 +479,141 @@ bool RenderPass::render(GLWrapper & gl, unsigned int w, unsigned int h, StringId
 			RenderModelExternal * m = *n;
 			assert(m);
 
-			if (m->drawEnabled())
-			{
-				// Restore textures that were overridden the by the previous model.
-				for (override_tracking_type::const_iterator tu = lastOverriddenTextures.begin(); tu != lastOverriddenTextures.end(); tu++)
-					if (*tu < defaultTextures.size()) // Sometimes we override sampler TUs that don't have defaults defined (think of diffuse textures).
-						textureState[*tu] = defaultTextures[*tu];
-					else
-						textureState[*tu] = NULL;
+			if (!m->drawEnabled())
+				continue;
 
-				// Apply texture overrides, keeping track of which TUs we've overridden.
-				overriddenTextures.clear();
+			ExternalDraw draw;
+			draw.model = m;
 
-				// Check if we have cached information and if so use that.
+			// Check if we have cached information and if so use that.
+			draw.texturesBegin = drawTextures.size();
 #ifdef USE_EXTERNAL_MODEL_CACHE
-				if (m->perPassTextureCache.size() > passIndex)
-				{
-					const std::vector <RenderTexture> & cache = m->perPassTextureCache[passIndex];
-					for (std::vector <RenderTexture>::const_iterator t = cache.begin(); t != cache.end(); t++)
-					{
-						// Get the TU associated with this texture name id.
-						GLuint tu = t->tu;
-						overriddenTextures.push_back(tu);
-						textureState[tu] = &*t;
-					}
-				}
-				else
+			if (m->perPassTextureCache.size() > passIndex)
+			{
+				const std::vector <RenderTexture> & cache = m->perPassTextureCache[passIndex];
+				for (std::vector <RenderTexture>::const_iterator t = cache.begin(); t != cache.end(); t++)
+					drawTextures.push_back(*t);
+			}
+			else
 #endif
+			{
+				for (std::vector <RenderTextureEntry>::const_iterator t = m->textures.begin(); t != m->textures.end(); t++)
 				{
-					for (std::vector <RenderTextureEntry>::const_iterator t = m->textures.begin(); t != m->textures.end(); t++)
+					// Get the TU associated with this texture name id.
+					std::tr1::unordered_map <StringId, GLuint>::iterator tui = textureNameToTextureUnit.find(t->name);
+					if (tui != textureNameToTextureUnit.end()) // if the texture isn't used in this pass, it might not be in textureNameToTextureUnit.
 					{
-						// Get the TU associated with this texture name id.
-						std::tr1::unordered_map <StringId, GLuint>::iterator tui = textureNameToTextureUnit.find(t->name);
-						if (tui != textureNameToTextureUnit.end()) // if the texture isn't used in this pass, it might not be in textureNameToTextureUnit.
-						{
-							GLuint tu = tui->second;
-							overriddenTextures.push_back(tu);
-							textureState[tu] = &*t;
+						drawTextures.push_back(RenderTexture(tui->second, *t));
 #ifdef USE_EXTERNAL_MODEL_CACHE
-							m->perPassTextureCache[passIndex].push_back(RenderTexture(tu, *t)); // Make cache entry.
+						m->perPassTextureCache[passIndex].push_back(RenderTexture(tui->second, *t)); // Make cache entry.
 #endif
-						}
 					}
 				}
+			}
+			draw.texturesEnd = drawTextures.size();
 
-				// Go through and actually apply the textures to the GL.
-				for (override_tracking_type::const_iterator tu = lastOverriddenTextures.begin(); tu != lastOverriddenTextures.end(); tu++)
-				{
-					const RenderTextureBase * texture = textureState[*tu];
-					if (texture)
-						applyTexture(gl, *tu, texture->target, texture->handle);
-					else
-					{
-						gl.ActiveTexture(*tu);
-						gl.unbindTexture(GL_TEXTURE_2D); //TODO: Determine target from sampler.
-					}
-				}
-				for (override_tracking_type::const_iterator tu = overriddenTextures.begin(); tu != overriddenTextures.end(); tu++)
-				{
-					const RenderTextureBase * texture = textureState[*tu];
-
-					// We shouldn't need to null-check texture.
-					applyTexture(gl, *tu, texture->target, texture->handle);
-				}
-
-				lastOverriddenTextures.swap(overriddenTextures);
-
-				// Restore uniforms that were overridden the by the previous model.
-				for (override_tracking_type::const_iterator location = lastOverriddenUniforms.begin(); location != lastOverriddenUniforms.end(); location++)
-					if (*location < defaultUniforms.size())
-					{
-						const RenderUniform * u = defaultUniforms[*location];
-						uniformState[u->location] = u;
-					}
-
-				// Apply uniform overrides, keeping track of which locations we've overridden.
-				overriddenUniforms.clear();
-
-				// Check if we have cached information and if so use that.
+			draw.uniformsBegin = drawUniforms.size();
 #ifdef USE_EXTERNAL_MODEL_CACHE
-				if (m->perPassUniformCache.size() > passIndex)
-				{
-					const std::vector <RenderUniform> & cache = m->perPassUniformCache[passIndex];
-					for (std::vector <RenderUniform>::const_iterator u = cache.begin(); u != cache.end(); u++)
-					{
-						GLuint location = u->location;
-						overriddenUniforms.push_back(location);
-						uniformState[location] = &*u;
-					}
-				}
-				else
+			if (m->perPassUniformCache.size() > passIndex)
+			{
+				const std::vector <RenderUniform> & cache = m->perPassUniformCache[passIndex];
+				for (std::vector <RenderUniform>::const_iterator u = cache.begin(); u != cache.end(); u++)
+					drawUniforms.push_back(std::make_pair(u->location, static_cast <const RenderUniformBase*> (&*u)));
+			}
+			else
 #endif
+			{
+				for (std::vector <RenderUniformEntry>::const_iterator u = m->uniforms.begin(); u != m->uniforms.end(); u++)
 				{
-					for (std::vector <RenderUniformEntry>::const_iterator u = m->uniforms.begin(); u != m->uniforms.end(); u++)
+					std::tr1::unordered_map <StringId, GLuint>::iterator loci = variableNameToUniformLocation.find(u->name);
+					if (loci != variableNameToUniformLocation.end()) // If the texture isn't used in this pass, it might not be in variableNameToUniformLocation.
 					{
-						std::tr1::unordered_map <StringId, GLuint>::iterator loci = variableNameToUniformLocation.find(u->name);
-						if (loci != variableNameToUniformLocation.end()) // If the texture isn't used in this pass, it might not be in variableNameToUniformLocation.
-						{
-							GLuint location = loci->second;
-							overriddenUniforms.push_back(location);
-							uniformState[location] = &*u;
+						drawUniforms.push_back(std::make_pair(loci->second, static_cast <const RenderUniformBase*> (&*u)));
 #ifdef USE_EXTERNAL_MODEL_CACHE
-							m->perPassUniformCache[passIndex].push_back(RenderUniform(location, *u)); // Make cache entry.
+						m->perPassUniformCache[passIndex].push_back(RenderUniform(loci->second, *u)); // Make cache entry.
 #endif
-						}
 					}
 				}
+			}
+			draw.uniformsEnd = drawUniforms.size();
 
-				// Go through and actually apply the uniforms to the GL.
-				for (override_tracking_type::const_iterator location = lastOverriddenUniforms.begin(); location != lastOverriddenUniforms.end(); location++)
-				{
-					const RenderUniformBase * uniform = uniformState[*location];
-					if (uniform)
-						gl.applyUniform(*location, uniform->data);
-				}
-				for (override_tracking_type::const_iterator location = overriddenUniforms.begin(); location != overriddenUniforms.end(); location++)
-				{
-					const RenderUniformBase * uniform = uniformState[*location];
-					//if (uniform) // TODO: Review this...
-						gl.applyUniform(*location, uniform->data);
-				}
+			draw.key = 0;
+			if (sortExternalModels)
+				draw.key = getSortKey(passIndex, shaderProgram, drawTextures, draw.texturesBegin, draw.texturesEnd, m->sortDepth);
 
-				lastOverriddenUniforms.swap(overriddenUniforms);
+			drawQueue.push_back(draw);
+		}
+	}
 
-				// Draw geometry.
-				m->draw(gl);
+	// Group models that share textures, the order doesn't matter when depth testing without blending.
+	if (sortExternalModels)
+		sortDrawQueue(drawQueue, drawQueueScratch);
+
+	// For each external model.
+	const unsigned int prefetchDistance = 8;
+	for (std::vector <ExternalDraw>::const_iterator d = drawQueue.begin(); d != drawQueue.end(); d++)
+	{
+		if (sortExternalModels && (unsigned int)(drawQueue.end() - d) > prefetchDistance)
+		{
+			const ExternalDraw & next = d[prefetchDistance];
+			PREFETCH(next.model);
+			for (unsigned int u = next.uniformsBegin; u < next.uniformsEnd; u++)
+			{
+				PREFETCH(drawUniforms[u].second->data.begin());
+				PREFETCH(drawUniforms[u].second->data.begin() + 15);
 			}
 		}
+
+		// Restore textures that were overridden the by the previous model.
+		for (override_tracking_type::const_iterator tu = lastOverriddenTextures.begin(); tu != lastOverriddenTextures.end(); tu++)
+			if (*tu < defaultTextures.size()) // Sometimes we override sampler TUs that don't have defaults defined (think of diffuse textures).
+				textureState[*tu] = defaultTextures[*tu];
+			else
+				textureState[*tu] = NULL;
+
+		// Apply texture overrides, keeping track of which TUs we've overridden.
+		overriddenTextures.clear();
+		for (unsigned int t = d->texturesBegin; t < d->texturesEnd; t++)
+		{
+			GLuint tu = drawTextures[t].tu;
+			overriddenTextures.push_back(tu);
+			textureState[tu] = &drawTextures[t];
+		}
+
+		// Go through and actually apply the textures to the GL, skipping the ones that are already bound.
+		for (override_tracking_type::const_iterator tu = lastOverriddenTextures.begin(); tu != lastOverriddenTextures.end(); tu++)
+			bindTexture(gl, boundTextures, *tu, textureState[*tu]);
+		for (override_tracking_type::const_iterator tu = overriddenTextures.begin(); tu != overriddenTextures.end(); tu++)
+			bindTexture(gl, boundTextures, *tu, textureState[*tu]);
+
+		lastOverriddenTextures.swap(overriddenTextures);
+
+		// Restore uniforms that were overridden the by the previous model.
+		for (override_tracking_type::const_iterator location = lastOverriddenUniforms.begin(); location != lastOverriddenUniforms.end(); location++)
+			if (*location < defaultUniforms.size())
+				uniformState[*location] = defaultUniforms[*location];
+			else
+				uniformState[*location] = NULL;
+
+		// Apply uniform overrides, keeping track of which locations we've overridden.
+		overriddenUniforms.clear();
+		for (unsigned int u = d->uniformsBegin; u < d->uniformsEnd; u++)
+		{
+			GLuint location = drawUniforms[u].first;
+			overriddenUniforms.push_back(location);
+			uniformState[location] = drawUniforms[u].second;
+		}
+
+		// Go through and actually apply the uniforms to the GL, skipping the ones that hold the same values already.
+		for (override_tracking_type::const_iterator location = lastOverriddenUniforms.begin(); location != lastOverriddenUniforms.end(); location++)
+			uploadUniform(gl, appliedUniforms, *location, uniformState[*location]);
+		for (override_tracking_type::const_iterator location = overriddenUniforms.begin(); location != overriddenUniforms.end(); location++)
+			uploadUniform(gl, appliedUniforms, *location, uniformState[*location]);
+
+		lastOverriddenUniforms.swap(overriddenUniforms);
+
+		// Draw geometry.
+		d->model->draw(gl);
 	}
 
 	// Unbind framebuffer.
@@ -1165,10 +1273,10 @@ bool RenderPass::createFramebufferObject(GLWrapper & gl, unsigned int w, unsigne
 			// Set some default texture parameters for now.
 			// When we actually sample the texture we should set parameters that match what we want in our texture, however...
 			// This is only here to work around a problem with my geforce 7 drivers, where they will say the framebuffer setup is unsupported unless they know some texture parameters from when we originally create the texture.
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+			gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+			gl.TexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
 
 			gl.unbindTexture(texture.target);
 
@@ -1259,3 +1367,35 @@ void RenderPass::applyTexture(GLWrapper & gl, GLuint tu, GLenum target, GLuint h
 	gl.ActiveTexture(tu);
 	gl.BindTexture(target, handle);
 }
+
+void RenderPass::sortDrawQueue(std::vector <ExternalDraw> & queue, std::vector <ExternalDraw> & scratch)
+{
+	if (queue.size() < 2)
+		return;
+
+	// Only sort by the bytes in which the keys differ, usually the pass and shader bytes are all the same.
+	unsigned long long differing = 0;
+	for (std::vector <ExternalDraw>::const_iterator d = queue.begin(); d != queue.end(); d++)
+		differing |= d->key ^ queue.front().key;
+
+	// Stable least significant digit radix sort, a byte at a time.
+	scratch.resize(queue.size());
+	for (unsigned int shift = 0; shift < 64; shift += 8)
+	{
+		if (((differing >> shift) & 0xFF) == 0)
+			continue;
+
+		unsigned int offsets[256] = {0};
+		for (std::vector <ExternalDraw>::const_iterator d = queue.begin(); d != queue.end(); d++)
+			offsets[(d->key >> shift) & 0xFF]++;
+		for (unsigned int i = 0, sum = 0; i < 256; i++)
+		{
+			unsigned int count = offsets[i];
+			offsets[i] = sum;
+			sum += count;
+		}
+		for (std::vector <ExternalDraw>::const_iterator d = queue.begin(); d != queue.end(); d++)
+			scratch[offsets[(d->key >> shift) & 0xFF]++] = *d;
+		queue.swap(scratch);
+	}
+}
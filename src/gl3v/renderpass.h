@@ -113,6 +113,18 @@ private:
 	/// Switches to the texture's TU and binds the texture.
 	void applyTexture(GLWrapper & gl, GLuint tu, GLenum target, GLuint handle);
 
+	/// An external model queued for drawing, with its overrides resolved to TUs and uniform locations.
+	struct ExternalDraw
+	{
+		unsigned long long key;
+		RenderModelExternal * model;
+		unsigned int texturesBegin, texturesEnd; ///< Range in drawTextures.
+		unsigned int uniformsBegin, uniformsEnd; ///< Range in drawUniforms.
+	};
+
+	/// Sorts the queue by key, keeping the submission order of equal keys.
+	static void sortDrawQueue(std::vector <ExternalDraw> & queue, std::vector <ExternalDraw> & scratch);
+
 	bool configured;
 	bool enabled;
 
@@ -174,6 +186,15 @@ private:
 	/// Our stringId-ified name.
 	StringId passName;
 
+	/// True if external models are drawn in sort key order instead of submission order.
+	bool sortExternalModels;
+
+	// The external model draw queue, kept between frames to avoid reallocations.
+	std::vector <ExternalDraw> drawQueue;
+	std::vector <ExternalDraw> drawQueueScratch;
+	std::vector <RenderTexture> drawTextures;
+	std::vector <std::pair <GLuint, const RenderUniformBase*> > drawUniforms; // Location and uniform.
+
 	/// Timing query object.
 	GLuint timerQuery;
 	/// Timing query object.
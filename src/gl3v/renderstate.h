@@ -33,6 +33,8 @@ class RenderState
 
 		RenderState() {}
 		RenderState(GLenum parameter, RealtimeExportPassInfo::RenderState s, const GLEnums & GLEnumHelper);
+		GLenum getParameter() const {return pname;}
+		GLint getValue() const {return param[0];} ///< enum and int states only
 
 	private:
 		GLenum pname;
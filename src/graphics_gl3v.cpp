@@ -352,45 +352,49 @@ static bool contributionCull(const DRAWABLE * d, const MATHVECTOR <float, 3> & c
 		return false;
 }
 
-// returns true for cull, false for don't-cull
-static bool frustumCull(const DRAWABLE * d, const FRUSTUM & frustum)
+// sets visible to 0 for the drawables outside of the frustum
+static void frustumCull(const std::vector <DRAWABLE*> & drawables, const FRUSTUM & frustum, FRUSTUMCULL & spheres, std::vector <unsigned char> & visible)
 {
-	float rd;
-	const float bound = d->GetRadius();
-	const MATHVECTOR <float, 3> & center = d->GetObjectCenter();
-
-	for (int i=0; i<6; i++)
+	// gather the world space bounding spheres, then cull them in batches
+	spheres.Clear();
+	spheres.Reserve(drawables.size());
+	for (std::vector <DRAWABLE*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
 	{
-		rd=frustum.frustum[i][0]*center[0]+
-				frustum.frustum[i][1]*center[1]+
-				frustum.frustum[i][2]*center[2]+
-				frustum.frustum[i][3];
-		if (rd < -bound)
+		DRAWABLE * d = *i;
+		if (d->GetRadius() != 0 && !d->GetSkybox() && d->GetCameraTransformEnable())
+		{
+			MATHVECTOR <float, 3> center(d->GetObjectCenter());
+			d->GetTransform().TransformVectorOut(center[0], center[1], center[2]);
+			spheres.Add(center, d->GetRadius());
+		}
+		else
 		{
-			return true;
+			spheres.AddUnbounded();
 		}
 	}
 
-	return false;
+	visible.resize(drawables.size());
+	if (!drawables.empty())
+		spheres.Cull(frustum, &visible[0]);
 }
 
 // if frustum is NULL, don't do frustum or contribution culling
 void GRAPHICS_GL3V::assembleDrawList(const std::vector <DRAWABLE*> & drawables, std::vector <RenderModelExternal*> & out, FRUSTUM * frustum, const MATHVECTOR <float, 3> & camPos)
 {
-	if (frustum && enableContributionCull)
-	{
-		for (std::vector <DRAWABLE*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
-		{
-			if (!frustumCull(*i, *frustum) && !contributionCull(*i, camPos))
-				out.push_back(&(*i)->generateRenderModelData(stringMap));
-		}
-	}
-	else if (frustum)
+	if (frustum)
 	{
-		for (std::vector <DRAWABLE*>::const_iterator i = drawables.begin(); i != drawables.end(); i++)
+		frustumCull(drawables, *frustum, cullSpheres, cullVisible);
+		for (unsigned int i = 0; i < drawables.size(); i++)
 		{
-			if (!frustumCull(*i, *frustum))
-				out.push_back(&(*i)->generateRenderModelData(stringMap));
+			if (cullVisible[i] && !(enableContributionCull && contributionCull(drawables[i], camPos)))
+			{
+				DRAWABLE * d = drawables[i];
+				MATHVECTOR <float, 3> center(d->GetObjectCenter());
+				d->GetTransform().TransformVectorOut(center[0], center[1], center[2]);
+				RenderModelExternal & model = d->generateRenderModelData(stringMap);
+				model.setSortDepth((center - camPos).Magnitude());
+				out.push_back(&model);
+			}
 		}
 	}
 	else
@@ -522,8 +526,7 @@ void GRAPHICS_GL3V::DrawScene(std::ostream & error_output)
 					if (dynamicDrawablesPtr)
 					{
 						const std::vector <DRAWABLE*> & dynamicDrawables = *dynamicDrawablesPtr;
-						//assembleDrawList(dynamicDrawables, outDrawList, frustumPtr, lastCameraPosition);
-						assembleDrawList(dynamicDrawables, outDrawList, NULL, lastCameraPosition); // TODO: the above line is commented out because frustum culling dynamic drawables doesen't work at the moment; is the object center in the drawable for the car in the correct space??
+						assembleDrawList(dynamicDrawables, outDrawList, frustumPtr, lastCameraPosition);
 					}
 
 					// assemble static entries
@@ -27,6 +27,7 @@
 #include "texture.h"
 #include "graphics.h"
 #include "frustum.h"
+#include "frustumcull.h"
 #include "graphics_config_condition.h"
 #include "gl3v/glwrapper.h"
 #include "gl3v/renderer.h"
@@ -130,6 +131,10 @@ private:
 	void assembleDrawList(const std::vector <DRAWABLE*> & drawables, std::vector <RenderModelExternal*> & out, FRUSTUM * frustum, const MATHVECTOR <float, 3> & camPos);
 	void assembleDrawList(const AABB_SPACE_PARTITIONING_NODE_ADAPTER <DRAWABLE> & adapter, std::vector <RenderModelExternal*> & out, FRUSTUM * frustum, const MATHVECTOR <float, 3> & camPos);
 
+	// frustum culling scratch space
+	FRUSTUMCULL cullSpheres;
+	std::vector <unsigned char> cullVisible;
+
 	// a map that stores which camera each pass uses
 	std::map <std::string, std::string> passNameToCameraName;
 
@@ -39,12 +39,18 @@ void GUIIMAGE::Update(SCENENODE & scene, float dt)
 		texinfo.mipmap = false;
 		texinfo.repeatu = false;
 		texinfo.repeatv = false;
-		std::tr1::shared_ptr<TEXTURE> texture;
-		if (m_content->load(m_imagepath, m_imagename, texinfo, texture))
-			GetDrawable(scene).SetDiffuseMap(texture);
-		
+		m_texture = m_content->loadAsync<TEXTURE>(m_imagepath, m_imagename, texinfo, ContentManager::HIGH);
+
 		GUIWIDGET::Update(scene, dt);
 	}
+
+	// keep showing the previous image until the new one has been loaded
+	if (m_texture.valid() && m_texture.ready())
+	{
+		if (!m_texture.failed())
+			GetDrawable(scene).SetDiffuseMap(m_texture.get());
+		m_texture = ContentManager::Future<TEXTURE>();
+	}
 }
 
 void GUIIMAGE::SetupDrawable(
@@ -23,9 +23,9 @@
 #include "gui/guiwidget.h"
 #include "scenenode.h"
 #include "vertexarray.h"
+#include "contentmanager.h"
 
 class TEXTURE;
-class ContentManager;
 
 class GUIIMAGE : public GUIWIDGET
 {
@@ -46,6 +46,7 @@ public:
 
 private:
 	ContentManager * m_content;
+	ContentManager::Future<TEXTURE> m_texture;
 	std::string m_imagepath, m_imagename;
 	keyed_container <DRAWABLE>::handle m_draw;
 	VERTEXARRAY m_varray;
@@ -0,0 +1,577 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "jobsystem.h"
+#include "traceprofiler.h"
+
+#include <cassert>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static inline int AtomicAdd(volatile int * value, int amount)
+{
+	return _InterlockedExchangeAdd((volatile long *)value, amount) + amount;
+}
+#else
+static inline int AtomicAdd(volatile int * value, int amount)
+{
+	return __sync_add_and_fetch(value, amount);
+}
+#endif
+
+static inline int AtomicLoad(volatile int * value)
+{
+	return AtomicAdd(value, 0);
+}
+
+JobSystem::Job::Job(Function function, void * data) :
+	function(function),
+	data(data),
+	parent(0),
+	unfinished(1),
+	pending(1),
+	finished(0)
+{
+	// ctor
+}
+
+JobSystem::JobSystem() :
+	wake(0),
+	sleeping(0),
+	wait_lock(0),
+	wait_cond(0),
+	waiting(0),
+	signals(0),
+	started(0),
+	quit(0)
+{
+	Init(1);
+}
+
+JobSystem::~JobSystem()
+{
+	Deinit();
+	SDL_DestroySemaphore(wake);
+	SDL_DestroyCond(wait_cond);
+	SDL_DestroyMutex(wait_lock);
+	SDL_DestroyMutex(workers[0]->lock);
+	delete workers[0];
+}
+
+void JobSystem::Init(int num_threads)
+{
+	if (num_threads < 1)
+		num_threads = 1;
+
+	if (workers.empty())
+	{
+		Worker * first = new Worker();
+		first->system = this;
+		first->thread = 0;
+		first->lock = SDL_CreateMutex();
+		first->index = 0;
+		workers.push_back(first);
+		wake = SDL_CreateSemaphore(0);
+		wait_lock = SDL_CreateMutex();
+		wait_cond = SDL_CreateCond();
+	}
+	else
+	{
+		Deinit();
+	}
+	workers[0]->thread_id = SDL_ThreadID();
+
+	quit = 0;
+	started = 0;
+	for (int i = 1; i < num_threads; ++i)
+	{
+		Worker * worker = new Worker();
+		worker->system = this;
+		worker->lock = SDL_CreateMutex();
+		worker->thread_id = 0;
+		worker->index = i;
+		workers.push_back(worker);
+	}
+	for (int i = 1; i < num_threads; ++i)
+	{
+#if SDL_VERSION_ATLEAST(2,0,0)
+		workers[i]->thread = SDL_CreateThread(WorkerMain, "job", workers[i]);
+#else
+		workers[i]->thread = SDL_CreateThread(WorkerMain, workers[i]);
+#endif
+	}
+
+	// thread ids have to be known before the first job is pushed
+	while (AtomicLoad(&started) < num_threads - 1)
+		SDL_Delay(0);
+}
+
+void JobSystem::Deinit()
+{
+	// set quit and wake every sleeping worker, they leave their loop
+	// without looking for more jobs
+	AtomicAdd(&quit, 1);
+	for (size_t i = 1; i < workers.size(); ++i)
+	{
+		SDL_SemPost(wake);
+	}
+	for (size_t i = 1; i < workers.size(); ++i)
+	{
+		SDL_WaitThread(workers[i]->thread, NULL);
+	}
+	// the workers are joined, queued jobs would be dropped, so all of them
+	// have to be waited for before Deinit
+	for (size_t i = 1; i < workers.size(); ++i)
+	{
+		assert(workers[i]->jobs.empty());
+		SDL_DestroyMutex(workers[i]->lock);
+		delete workers[i];
+	}
+	workers.resize(1);
+
+	// drop wake ups nobody consumed
+	while (SDL_SemTryWait(wake) == 0) {}
+	sleeping = 0;
+}
+
+void JobSystem::AddDependency(Job & job, Job & dependency)
+{
+	assert(&job != &dependency);
+	AtomicAdd(&job.pending, 1);
+	dependency.dependents.push_back(&job);
+}
+
+void JobSystem::Submit(Job & job, Job * parent)
+{
+	job.parent = parent;
+	job.finished = 0;
+	if (parent)
+		AtomicAdd(&parent->unfinished, 1);
+
+	if (AtomicAdd(&job.pending, -1) == 0)
+		Push(job);
+}
+
+void JobSystem::Wait(Job & job)
+{
+	int index = GetWorkerIndex();
+	while (!AtomicLoad(&job.finished))
+	{
+		// read the signal count before the look, a push or finish after
+		// that look changes it and keeps us from sleeping through it
+		int signal = AtomicLoad(&signals);
+		Job * next = GetJob(index);
+		if (next)
+		{
+			Execute(*next);
+			continue;
+		}
+
+		// nothing to steal, the job runs on another thread
+		SDL_mutexP(wait_lock);
+		AtomicAdd(&waiting, 1);
+		while (!AtomicLoad(&job.finished) && AtomicLoad(&signals) == signal)
+			SDL_CondWait(wait_cond, wait_lock);
+		AtomicAdd(&waiting, -1);
+		SDL_mutexV(wait_lock);
+	}
+}
+
+struct JobRange
+{
+	JobSystem::RangeFunction function;
+	void * data;
+	int begin;
+	int end;
+};
+
+static void RunRange(void * data)
+{
+	JobRange & range = *static_cast<JobRange*>(data);
+	range.function(range.data, range.begin, range.end);
+}
+
+void JobSystem::ParallelFor(int begin, int end, int grain, RangeFunction function, void * data)
+{
+	int count = end - begin;
+	if (count <= 0)
+		return;
+
+	if (grain < 1)
+		grain = 1;
+
+	// a few chunks per thread to even out the load
+	int chunks = (count + grain - 1) / grain;
+	int max_chunks = 4 * GetNumThreads();
+	if (chunks > max_chunks)
+		chunks = max_chunks;
+
+	if (chunks == 1 || GetNumThreads() == 1)
+	{
+		function(data, begin, end);
+		return;
+	}
+
+	std::vector<JobRange> ranges(chunks);
+	std::vector<Job> jobs(chunks);
+	Job root;
+	for (int i = 0; i < chunks; ++i)
+	{
+		ranges[i].function = function;
+		ranges[i].data = data;
+		ranges[i].begin = begin + (long long)count * i / chunks;
+		ranges[i].end = begin + (long long)count * (i + 1) / chunks;
+		jobs[i].function = &RunRange;
+		jobs[i].data = &ranges[i];
+		Submit(jobs[i], &root);
+	}
+	Submit(root);
+	Wait(root);
+}
+
+int JobSystem::WorkerMain(void * data)
+{
+	Worker & worker = *static_cast<Worker*>(data);
+	JobSystem & system = *worker.system;
+	worker.thread_id = SDL_ThreadID();
+	TraceProfiler::SetThreadName("job worker");
+	AtomicAdd(&system.started, 1);
+
+	while (!AtomicLoad(&system.quit))
+	{
+		Job * job = system.GetJob(worker.index);
+		if (job)
+		{
+			system.Execute(*job);
+			continue;
+		}
+
+		// register as sleeper before the last look, a job pushed after
+		// that look sees the sleeper and posts a wake up
+		AtomicAdd(&system.sleeping, 1);
+		job = system.GetJob(worker.index);
+		if (job)
+		{
+			AtomicAdd(&system.sleeping, -1);
+			system.Execute(*job);
+			continue;
+		}
+		SDL_SemWait(system.wake);
+		AtomicAdd(&system.sleeping, -1);
+	}
+	return 0;
+}
+
+int JobSystem::GetWorkerIndex() const
+{
+	unsigned long id = SDL_ThreadID();
+	for (size_t i = 1; i < workers.size(); ++i)
+	{
+		if (workers[i]->thread_id == id)
+			return i;
+	}
+	// main thread and foreign threads share deque 0
+	return 0;
+}
+
+void JobSystem::Push(Job & job)
+{
+	Worker & worker = *workers[GetWorkerIndex()];
+	SDL_mutexP(worker.lock);
+	worker.jobs.push_back(&job);
+	SDL_mutexV(worker.lock);
+
+	if (AtomicLoad(&sleeping) > 0)
+		SDL_SemPost(wake);
+
+	Signal();
+}
+
+JobSystem::Job * JobSystem::GetJob(int index)
+{
+	// newest job of our own, it is the most likely to be in cache
+	Job * job = 0;
+	Worker & worker = *workers[index];
+	SDL_mutexP(worker.lock);
+	if (!worker.jobs.empty())
+	{
+		job = worker.jobs.back();
+		worker.jobs.pop_back();
+	}
+	SDL_mutexV(worker.lock);
+	if (job)
+		return job;
+
+	// oldest job of somebody else, it tends to be the largest
+	for (size_t i = 1; i < workers.size(); ++i)
+	{
+		Worker & victim = *workers[(index + i) % workers.size()];
+		SDL_mutexP(victim.lock);
+		if (!victim.jobs.empty())
+		{
+			job = victim.jobs.front();
+			victim.jobs.pop_front();
+		}
+		SDL_mutexV(victim.lock);
+		if (job)
+			return job;
+	}
+	return 0;
+}
+
+void JobSystem::Execute(Job & job)
+{
+	PROFILE_SCOPE("job");
+	job.pending = 1;
+	if (job.function)
+		job.function(job.data);
+	Finish(job);
+}
+
+void JobSystem::Finish(Job & job)
+{
+	if (AtomicAdd(&job.unfinished, -1) != 0)
+		return;
+
+	// the job storage may be released as soon as finished is set,
+	// dependents and parent are still waiting for us, they are valid
+	Job * parent = job.parent;
+	std::vector<Job*> dependents;
+	dependents.swap(job.dependents);
+	job.unfinished = 1;
+	AtomicAdd(&job.finished, 1);
+	Signal();
+
+	for (size_t i = 0; i < dependents.size(); ++i)
+	{
+		Job & dependent = *dependents[i];
+		if (AtomicAdd(&dependent.pending, -1) == 0)
+			Push(dependent);
+	}
+
+	if (parent)
+		Finish(*parent);
+}
+
+void JobSystem::Signal()
+{
+	// waiters register under the lock before they check the count, the
+	// broadcast under the lock can't fall between their check and sleep
+	AtomicAdd(&signals, 1);
+	if (AtomicLoad(&waiting) > 0)
+	{
+		SDL_mutexP(wait_lock);
+		SDL_CondBroadcast(wait_cond);
+		SDL_mutexV(wait_lock);
+	}
+}
+
+#include "unittest.h"
+#include "benchmark.h"
+
+namespace
+{
+	struct SumBody
+	{
+		std::vector<int> & values;
+		volatile int sum;
+		SumBody(std::vector<int> & values) : values(values), sum(0) {}
+		void operator()(int begin, int end)
+		{
+			int partial = 0;
+			for (int i = begin; i < end; ++i)
+			{
+				values[i] = i;
+				partial += i;
+			}
+			AtomicAdd(&sum, partial);
+		}
+	};
+
+	// records the order jobs ran in
+	struct OrderLog
+	{
+		volatile int next;
+		int order[4];
+		OrderLog() : next(0) {}
+	};
+
+	struct OrderEntry
+	{
+		OrderLog * log;
+		int id;
+	};
+
+	void LogOrder(void * data)
+	{
+		OrderEntry & entry = *static_cast<OrderEntry*>(data);
+		entry.log->order[AtomicAdd(&entry.log->next, 1) - 1] = entry.id;
+	}
+
+	void EmptyJob(void *)
+	{
+		// nop
+	}
+
+	void CountJob(void * data)
+	{
+		AtomicAdd(static_cast<volatile int *>(data), 1);
+	}
+}
+
+QT_TEST(jobsystem_test)
+{
+	JobSystem jobs;
+	jobs.Init(4);
+	QT_CHECK_EQUAL(jobs.GetNumThreads(), 4);
+
+	// parallel for covers every index exactly once
+	std::vector<int> values(10000, -1);
+	SumBody body(values);
+	jobs.ParallelFor(0, values.size(), 64, body);
+	QT_CHECK_EQUAL(body.sum, 10000 * 9999 / 2);
+	bool all = true;
+	for (int i = 0; i < (int)values.size(); ++i)
+		all = all && values[i] == i;
+	QT_CHECK(all);
+
+	// diamond: 0 before 1 and 2, both before 3, run it twice
+	for (int run = 0; run < 2; ++run)
+	{
+		OrderLog log;
+		OrderEntry entries[4];
+		JobSystem::Job job[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			entries[i].log = &log;
+			entries[i].id = i;
+			job[i] = JobSystem::Job(&LogOrder, &entries[i]);
+		}
+		jobs.AddDependency(job[1], job[0]);
+		jobs.AddDependency(job[2], job[0]);
+		jobs.AddDependency(job[3], job[1]);
+		jobs.AddDependency(job[3], job[2]);
+		for (int i = 3; i >= 0; --i)
+			jobs.Submit(job[i]);
+		jobs.Wait(job[3]);
+		QT_CHECK_EQUAL(log.next, 4);
+		QT_CHECK_EQUAL(log.order[0], 0);
+		QT_CHECK_EQUAL(log.order[3], 3);
+	}
+
+	// parent waits for children submitted before and during its run
+	volatile int count = 0;
+	JobSystem::Job root;
+	std::vector<JobSystem::Job> children(100, JobSystem::Job(&CountJob, (void*)&count));
+	for (size_t i = 0; i < children.size(); ++i)
+		jobs.Submit(children[i], &root);
+	jobs.Submit(root);
+	jobs.Wait(root);
+	QT_CHECK_EQUAL(count, 100);
+
+	// fall back to the calling thread
+	jobs.Init(1);
+	QT_CHECK_EQUAL(jobs.GetNumThreads(), 1);
+	JobSystem::Job single(&CountJob, (void*)&count);
+	jobs.Submit(single);
+	jobs.Wait(single);
+	QT_CHECK_EQUAL(count, 101);
+}
+
+namespace
+{
+	// the per frame handoff of the old one thread per task model
+	struct SemaphoreHandoff
+	{
+		SDL_sem * start;
+		SDL_sem * end;
+		volatile int quit;
+
+		static int Run(void * data)
+		{
+			SemaphoreHandoff & h = *static_cast<SemaphoreHandoff*>(data);
+			while (true)
+			{
+				SDL_SemWait(h.start);
+				if (h.quit) break;
+				SDL_SemPost(h.end);
+			}
+			return 0;
+		}
+	};
+}
+
+BENCHMARK(job_overhead)
+{
+	const int handoffs = 20000;
+	const int batch = 100000;
+	benchmark::Stopwatch timer;
+
+	SemaphoreHandoff handoff;
+	handoff.start = SDL_CreateSemaphore(0);
+	handoff.end = SDL_CreateSemaphore(0);
+	handoff.quit = 0;
+#if SDL_VERSION_ATLEAST(2,0,0)
+	SDL_Thread * thread = SDL_CreateThread(&SemaphoreHandoff::Run, "handoff", &handoff);
+#else
+	SDL_Thread * thread = SDL_CreateThread(&SemaphoreHandoff::Run, &handoff);
+#endif
+	timer.Reset();
+	for (int i = 0; i < handoffs; ++i)
+	{
+		SDL_SemPost(handoff.start);
+		SDL_SemWait(handoff.end);
+	}
+	double semaphore_ns = timer.Microseconds() * 1E3 / handoffs;
+	handoff.quit = 1;
+	SDL_SemPost(handoff.start);
+	SDL_WaitThread(thread, NULL);
+	SDL_DestroySemaphore(handoff.start);
+	SDL_DestroySemaphore(handoff.end);
+	out << "semaphore handoff: " << semaphore_ns << " ns per task" << std::endl;
+
+	std::vector<JobSystem::Job> jobs(batch, JobSystem::Job(&EmptyJob));
+	for (int threads = 1; threads <= 8; threads *= 2)
+	{
+		JobSystem system;
+		system.Init(threads);
+
+		// submit and wait for a single job, the old model's use case
+		JobSystem::Job job(&EmptyJob);
+		timer.Reset();
+		for (int i = 0; i < handoffs; ++i)
+		{
+			system.Submit(job);
+			system.Wait(job);
+		}
+		double single_ns = timer.Microseconds() * 1E3 / handoffs;
+
+		// many small jobs under one parent
+		JobSystem::Job root;
+		timer.Reset();
+		for (int i = 0; i < batch; ++i)
+			system.Submit(jobs[i], &root);
+		system.Submit(root);
+		system.Wait(root);
+		double batch_ns = timer.Microseconds() * 1E3 / batch;
+
+		out << threads << " threads: " << single_ns << " ns per single job, ";
+		out << batch_ns << " ns per batched job" << std::endl;
+	}
+}
@@ -0,0 +1,146 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _JOBSYSTEM_H
+#define _JOBSYSTEM_H
+
+#include <SDL/SDL_thread.h>
+
+#include <vector>
+#include <deque>
+
+/// Work stealing job scheduler. Every thread owns a deque of ready jobs, it
+/// pops its own work from the back and steals from the front of the other
+/// deques when it runs dry. Thread 0 is the thread that created the system,
+/// it executes jobs while it waits for them.
+///
+/// Job storage belongs to the caller and has to stay valid until the job
+/// has finished. A finished job can be submitted again, its dependencies
+/// have to be added again before that.
+class JobSystem
+{
+public:
+	typedef void (*Function)(void * data);
+	typedef void (*RangeFunction)(void * data, int begin, int end);
+
+	class Job
+	{
+	public:
+		/// function can be null for jobs that only group children
+		Job(Function function = 0, void * data = 0);
+
+		Function function;
+		void * data;
+
+	private:
+		friend class JobSystem;
+		Job * parent;
+		std::vector<Job*> dependents;
+		volatile int unfinished; ///< self plus unfinished children
+		volatile int pending; ///< unfinished dependencies plus one until submitted
+		volatile int finished;
+	};
+
+	/// creates a system with the calling thread only
+	JobSystem();
+
+	~JobSystem();
+
+	/// (re)start with num_threads threads including the calling thread,
+	/// all submitted jobs have to be finished
+	void Init(int num_threads);
+
+	/// stop the worker threads, the calling thread is kept
+	/// all submitted jobs have to be finished
+	void Deinit();
+
+	int GetNumThreads() const {return workers.size();}
+
+	/// index of the calling thread in [0, GetNumThreads()), 0 for the
+	/// creating thread and threads not owned by the system
+	int GetThreadIndex() const {return GetWorkerIndex();}
+
+	/// job will not run before dependency has finished, both jobs must not
+	/// have been submitted yet
+	void AddDependency(Job & job, Job & dependency);
+
+	/// queue job on the calling thread, parent (if any) finishes after job,
+	/// children have to be submitted before the parent finishes
+	void Submit(Job & job, Job * parent = 0);
+
+	/// execute other jobs until job has finished
+	void Wait(Job & job);
+
+	/// split [begin, end) into chunks of at least grain items, call function
+	/// for every chunk in parallel and wait for all of them
+	void ParallelFor(int begin, int end, int grain, RangeFunction function, void * data);
+
+	/// ParallelFor with body(begin, end) called for every chunk
+	template <class Body>
+	void ParallelFor(int begin, int end, int grain, Body & body)
+	{
+		ParallelFor(begin, end, grain, &RunBody<Body>, &body);
+	}
+
+private:
+	struct Worker
+	{
+		JobSystem * system;
+		SDL_Thread * thread;
+		SDL_mutex * lock;
+		std::deque<Job*> jobs;
+		unsigned long thread_id;
+		int index;
+	};
+	std::vector<Worker*> workers;
+	SDL_sem * wake;
+	volatile int sleeping;
+	SDL_mutex * wait_lock;
+	SDL_cond * wait_cond;
+	volatile int waiting; ///< threads blocked in Wait
+	volatile int signals; ///< bumped on every push and finish
+	volatile int started;
+	volatile int quit;
+
+	static int WorkerMain(void * data);
+
+	int GetWorkerIndex() const;
+
+	void Push(Job & job);
+
+	Job * GetJob(int index);
+
+	void Execute(Job & job);
+
+	void Finish(Job & job);
+
+	/// wake threads blocked in Wait, there is new work or a finished job
+	void Signal();
+
+	template <class Body>
+	static void RunBody(void * data, int begin, int end)
+	{
+		(*static_cast<Body*>(data))(begin, end);
+	}
+
+	JobSystem(const JobSystem & other);
+	JobSystem & operator=(const JobSystem & other);
+};
+
+#endif // _JOBSYSTEM_H
@@ -199,6 +199,14 @@ void JOEPACK::fclose() const
 	impl->fclose();
 }
 
+void JOEPACK::GetFileList(std::list <std::string> & filelist) const
+{
+	for (std::map <std::string, IMPL::FADATA>::const_iterator i = impl->fat.begin(); i != impl->fat.end(); ++i)
+	{
+		filelist.push_back(i->first);
+	}
+}
+
 bool JOEPACK::fopen(const string & fn) const
 {
 	string newfn;
@@ -21,6 +21,7 @@
 #define _JOEPACK_H
 
 #include <string>
+#include <list>
 
 class JOEPACK
 {
@@ -41,6 +42,9 @@ public:
 
 	int fread(void * buffer, const unsigned size, const unsigned count) const;
 
+	/// append the names of the packed files to filelist
+	void GetFileList(std::list <std::string> & filelist) const;
+
 private:
 	std::string packpath;
 	struct IMPL;
@@ -19,6 +19,7 @@
 
 #include "joeserialize.h"
 #include "unittest.h"
+#include "benchmark.h"
 
 #include <list>
 #include <map>
@@ -614,6 +615,192 @@ QT_TEST(serialization_vector_bugs_test)
 	}
 }
 
+class TEST_ARRAYS
+{
+	friend class ::Serializer;
+	public:
+		std::vector <float> floats;
+		std::vector <int> ints;
+		std::vector <double> doubles;
+		float position[3];
+		TEST_VERTEX vertex;
+
+		TEST_ARRAYS() : vertex(1, 2, 3) {position[0] = position[1] = position[2] = 0;}
+
+		void Fill(int count)
+		{
+			floats.resize(count);
+			ints.resize(count);
+			doubles.resize(count);
+			for (int i = 0; i < count; i++)
+			{
+				floats[i] = i * 0.5f;
+				ints[i] = i - count / 2;
+				doubles[i] = i * 0.25;
+			}
+			position[0] = 1.5f;
+			position[1] = -2.5f;
+			position[2] = 3.5f;
+		}
+
+		bool Serialize(joeserialize::Serializer & s)
+		{
+			_SERIALIZE_(s, floats);
+			_SERIALIZE_(s, ints);
+			_SERIALIZE_(s, doubles);
+			if (!s.SerializeArray("position", position, 3)) return false;
+			_SERIALIZE_(s, vertex);
+			return true;
+		}
+};
+
+// binary output one element at a time with item names, the way containers were serialized before the array fast paths
+class ELEMENTWISE_OUTPUT_SERIALIZER : public BinaryOutputSerializer
+{
+	public:
+		ELEMENTWISE_OUTPUT_SERIALIZER(ostream & out) : BinaryOutputSerializer(out) {}
+		virtual bool IgnoresNames() const {return false;}
+		virtual bool SerializeArray(const string & name, int * t, unsigned count) {return SerializeElements(name, t, count);}
+		virtual bool SerializeArray(const string & name, unsigned int * t, unsigned count) {return SerializeElements(name, t, count);}
+		virtual bool SerializeArray(const string & name, float * t, unsigned count) {return SerializeElements(name, t, count);}
+		virtual bool SerializeArray(const string & name, double * t, unsigned count) {return SerializeElements(name, t, count);}
+};
+
+QT_TEST(serialization_array_test)
+{
+	TEST_ARRAYS arrays;
+	arrays.Fill(100);
+
+	//the array fast paths write the same bytes as the element by element path
+	stringstream elementstream, bulkstream;
+	{
+		ELEMENTWISE_OUTPUT_SERIALIZER out(elementstream);
+		QT_CHECK(arrays.Serialize(out));
+		BinaryOutputSerializer bulkout(bulkstream);
+		QT_CHECK(arrays.Serialize(bulkout));
+	}
+	QT_CHECK(elementstream.str() == bulkstream.str());
+
+	std::vector <char> buffer(elementstream.str().size());
+	{
+		BinarySpanOutputSerializer out(&buffer[0], buffer.size());
+		QT_CHECK(arrays.Serialize(out));
+		QT_CHECK_EQUAL(out.GetSize(), buffer.size());
+		QT_CHECK(string(&buffer[0], buffer.size()) == elementstream.str());
+
+		//a full buffer makes serialization fail
+		BinarySpanOutputSerializer smallout(&buffer[0], buffer.size() - 1);
+		QT_CHECK(!arrays.Serialize(smallout));
+	}
+
+	{
+		TEST_ARRAYS streamed, spanned, truncated;
+		BinaryInputSerializer in(bulkstream);
+		QT_CHECK(streamed.Serialize(in));
+		BinarySpanInputSerializer spanin(&buffer[0], buffer.size());
+		QT_CHECK(spanned.Serialize(spanin));
+		QT_CHECK_EQUAL(spanin.GetRemaining(), 0);
+		BinarySpanInputSerializer truncatedin(&buffer[0], buffer.size() - 1);
+		QT_CHECK(!truncated.Serialize(truncatedin));
+
+		QT_CHECK(streamed.floats == arrays.floats && spanned.floats == arrays.floats);
+		QT_CHECK(streamed.ints == arrays.ints && spanned.ints == arrays.ints);
+		QT_CHECK(streamed.doubles == arrays.doubles && spanned.doubles == arrays.doubles);
+		QT_CHECK_EQUAL(spanned.position[1], -2.5f);
+		QT_CHECK_EQUAL(spanned.vertex, TEST_VERTEX(1,2,3));
+	}
+
+	//a size larger than the remaining input fails before the vector is allocated
+	{
+		char sizebuffer[3 * sizeof(int)];
+		BinarySpanOutputSerializer out(sizebuffer, sizeof(sizebuffer));
+		int sizes[3] = {0x7fffffff, 1, 2};
+		QT_CHECK(out.SerializeArray("sizes", sizes, 3));
+
+		vector <float> floats;
+		BinarySpanInputSerializer spanin(sizebuffer, sizeof(sizebuffer));
+		QT_CHECK(!static_cast<Serializer &>(spanin).Serialize("floats", floats));
+		QT_CHECK(floats.empty());
+
+		stringstream sizestream(string(sizebuffer, sizeof(sizebuffer)));
+		BinaryInputSerializer in(sizestream);
+		QT_CHECK(!static_cast<Serializer &>(in).Serialize("floats", floats));
+		QT_CHECK(floats.empty());
+
+		//two ints fit
+		sizes[0] = 2;
+		BinarySpanOutputSerializer fitout(sizebuffer, sizeof(sizebuffer));
+		QT_CHECK(fitout.SerializeArray("sizes", sizes, 3));
+		vector <int> ints;
+		BinarySpanInputSerializer fitin(sizebuffer, sizeof(sizebuffer));
+		QT_CHECK(static_cast<Serializer &>(fitin).Serialize("ints", ints));
+		QT_CHECK_EQUAL(ints.size(), 2);
+		stringstream fitstream(string(sizebuffer, sizeof(sizebuffer)));
+		BinaryInputSerializer fitstreamin(fitstream);
+		QT_CHECK(static_cast<Serializer &>(fitstreamin).Serialize("ints", ints));
+		QT_CHECK_EQUAL(ints.size(), 2);
+	}
+
+	//text keeps the element names
+	{
+		stringstream textstream;
+		TextOutputSerializer out(textstream);
+		QT_CHECK(arrays.Serialize(out));
+		QT_CHECK(textstream.str().find("position[2]") != string::npos);
+		QT_CHECK(textstream.str().find("*item") != string::npos);
+	}
+}
+
+BENCHMARK(joeserialize_binary)
+{
+	TEST_ARRAYS arrays;
+	arrays.Fill(256);
+	const int runs = 20000;
+
+	stringstream stream;
+	benchmark::Stopwatch timer;
+	for (int i = 0; i < runs; i++)
+	{
+		stream.str(string());
+		ELEMENTWISE_OUTPUT_SERIALIZER out(stream);
+		arrays.Serialize(out);
+	}
+	double element_time = timer.Seconds();
+	const unsigned size = stream.str().size();
+
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+	{
+		stream.str(string());
+		BinaryOutputSerializer out(stream);
+		arrays.Serialize(out);
+	}
+	double bulk_time = timer.Seconds();
+
+	std::vector <char> buffer(size);
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+	{
+		BinarySpanOutputSerializer out(&buffer[0], buffer.size());
+		arrays.Serialize(out);
+	}
+	double span_time = timer.Seconds();
+
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+	{
+		BinarySpanInputSerializer in(&buffer[0], buffer.size());
+		arrays.Serialize(in);
+	}
+	double span_in_time = timer.Seconds();
+	benchmark::DoNotOptimize(arrays);
+
+	double mb = double(runs) * size / (1 << 20);
+	out << "joeserialize_binary: " << size << " bytes, write element by element " << mb / element_time <<
+		" MB/s, bulk stream " << mb / bulk_time << " MB/s, span " << mb / span_time <<
+		" MB/s, span read " << mb / span_in_time << " MB/s" << endl;
+}
+
 class TEST_SETTINGS
 {
 	public:
@@ -30,6 +30,8 @@
 #include <vector>
 #include <iomanip>
 #include <fstream>
+#include <algorithm>
+#include <cstring>
 
 #ifdef USE_TR1
 #include <tr1/unordered_map>
@@ -84,6 +86,20 @@ class Serializer
 			return true;
 		}
 
+		///serialization of a contiguous array of simple types, the elements are named name[0], name[1], ...
+		///binary serializers override these to copy the whole array at once. returns true on success
+		virtual bool SerializeArray(const std::string & name, int * t, unsigned count) {return SerializeElements(name, t, count);}
+		virtual bool SerializeArray(const std::string & name, unsigned int * t, unsigned count) {return SerializeElements(name, t, count);}
+		virtual bool SerializeArray(const std::string & name, float * t, unsigned count) {return SerializeElements(name, t, count);}
+		virtual bool SerializeArray(const std::string & name, double * t, unsigned count) {return SerializeElements(name, t, count);}
+
+		///returns true if the format doesn't store names, containers skip building item names then
+		virtual bool IgnoresNames() const {return false;}
+
+		///returns false if the input can't hold count items of at least size bytes each.
+		///containers check this before allocating, so a corrupt size fails instead of exhausting memory
+		virtual bool CanRead(int count, unsigned size) {(void) size; return count >= 0;}
+
 		///serialization overload for a complex type that we don't have the ability to change,
 		/// so we explicitly define the serialization process here. returns true on success
 		template <typename U, typename T>
@@ -110,9 +126,7 @@ class Serializer
 				int count = 1;
 				for (typename std::list <T>::iterator i = t.begin(); i != t.end(); ++i, ++count)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << count;
-					if (!this->Serialize(itemname.str(), *i)) return false;
+					if (!this->Serialize(ItemName(count), *i)) return false;
 				}
 			}
 			else //input
@@ -124,10 +138,8 @@ class Serializer
 
 				for (int i = 0; i < listsize; i++)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << i+1;
 					t.push_back(T());
-					if (!this->Serialize(itemname.str(), t.back())) return false;
+					if (!this->Serialize(ItemName(i+1), t.back())) return false;
 				}
 			}
 			ComplexTypeEnd(name);
@@ -148,9 +160,7 @@ class Serializer
 				int count = 1;
 				for (typename std::set <T>::iterator i = t.begin(); i != t.end(); ++i, ++count)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << count;
-					if (!this->Serialize(itemname.str(), const_cast<T&>(*i))) return false;
+					if (!this->Serialize(ItemName(count), const_cast<T&>(*i))) return false;
 				}
 			}
 			else //input
@@ -162,12 +172,10 @@ class Serializer
 
 				for (int i = 0; i < listsize; i++)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << i+1;
 					//t.push_back(T());
-					//if (!this->Serialize(itemname.str(), t.back())) return false;
+					//if (!this->Serialize(ItemName(i+1), t.back())) return false;
 					T prototype;
-					if (!this->Serialize(itemname.str(), prototype)) return false;
+					if (!this->Serialize(ItemName(i+1), prototype)) return false;
 					t.insert(prototype);
 				}
 			}
@@ -189,9 +197,7 @@ class Serializer
 				int count = 1;
 				for (typename std::vector <T>::iterator i = t.begin(); i != t.end(); ++i, ++count)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << count;
-					if (!this->Serialize(itemname.str(), *i)) return false;
+					if (!this->Serialize(ItemName(count), *i)) return false;
 				}
 			}
 			else //input
@@ -199,21 +205,26 @@ class Serializer
 				//t.clear();
 				int listsize;
 				if (!this->Serialize("*size", listsize)) return false;
+				if (!this->CanRead(listsize, 1)) return false; //every item takes at least a byte
 				t.resize(listsize); //only resize, don't clear; we don't want to throw away information
 
 				for (int i = 0; i < listsize; i++)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << i+1;
 					//t.push_back(T());
-					//if (!this->Serialize(itemname.str(), t.back())) return false;
-					if (!this->Serialize(itemname.str(), t[i])) return false;
+					//if (!this->Serialize(ItemName(i+1), t.back())) return false;
+					if (!this->Serialize(ItemName(i+1), t[i])) return false;
 				}
 			}
 			ComplexTypeEnd(name);
 			return true;
 		}
 
+		///vectors of simple types are serialized as one array if the format ignores names
+		bool Serialize(const std::string & name, std::vector <int> & t) {return SerializeSimpleVector(name, t);}
+		bool Serialize(const std::string & name, std::vector <unsigned int> & t) {return SerializeSimpleVector(name, t);}
+		bool Serialize(const std::string & name, std::vector <float> & t) {return SerializeSimpleVector(name, t);}
+		bool Serialize(const std::string & name, std::vector <double> & t) {return SerializeSimpleVector(name, t);}
+
 		/// \verbatim vector <bool> is special \endverbatim
 		bool Serialize(const std::string & name, std::vector <bool> & t)
 		{
@@ -226,10 +237,8 @@ class Serializer
 				int count = 1;
 				for (std::vector <bool>::iterator i = t.begin(); i != t.end(); ++i, ++count)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << count;
 					bool booli = *i;
-					if (!this->Serialize(itemname.str(), booli)) return false;
+					if (!this->Serialize(ItemName(count), booli)) return false;
 				}
 			}
 			else //input
@@ -237,16 +246,15 @@ class Serializer
 				//t.clear();
 				int listsize;
 				if (!this->Serialize("*size", listsize)) return false;
+				if (!this->CanRead(listsize, sizeof(int))) return false; //bools are stored as ints
 				t.resize(listsize); //only resize, don't clear; we don't want to throw away information
 
 				for (int i = 0; i < listsize; i++)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << i+1;
 					//t.push_back(T());
-					//if (!this->Serialize(itemname.str(), t.back())) return false;
+					//if (!this->Serialize(ItemName(i+1), t.back())) return false;
 					bool booli;
-					if (!this->Serialize(itemname.str(), booli)) return false;
+					if (!this->Serialize(ItemName(i+1), booli)) return false;
 					t[i] = booli;
 				}
 			}
@@ -268,9 +276,7 @@ class Serializer
 				int count = 1;
 				for (typename std::deque <T>::iterator i = t.begin(); i != t.end(); ++i, ++count)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << count;
-					if (!this->Serialize(itemname.str(), *i)) return false;
+					if (!this->Serialize(ItemName(count), *i)) return false;
 				}
 			}
 			else //input
@@ -278,15 +284,14 @@ class Serializer
 				//t.clear();
 				int listsize;
 				if (!this->Serialize("*size", listsize)) return false;
+				if (!this->CanRead(listsize, 1)) return false; //every item takes at least a byte
 				t.resize(listsize); //only resize, don't clear; we don't want to throw away information
 
 				for (int i = 0; i < listsize; i++)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << i+1;
 					//t.push_back(T());
-					//if (!this->Serialize(itemname.str(), t.back())) return false;
-					if (!this->Serialize(itemname.str(), t[i])) return false;
+					//if (!this->Serialize(ItemName(i+1), t.back())) return false;
+					if (!this->Serialize(ItemName(i+1), t[i])) return false;
 				}
 			}
 			ComplexTypeEnd(name);
@@ -406,9 +411,7 @@ class Serializer
 				int count = 1;
 				for (typename std::tr1::unordered_set <T>::iterator i = t.begin(); i != t.end(); ++i, ++count)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << count;
-					if (!this->Serialize(itemname.str(), const_cast<T&>(*i))) return false;
+					if (!this->Serialize(ItemName(count), const_cast<T&>(*i))) return false;
 				}
 			}
 			else //input
@@ -420,12 +423,10 @@ class Serializer
 
 				for (int i = 0; i < listsize; i++)
 				{
-					std::stringstream itemname;
-					itemname << "*item" << i+1;
 					//t.push_back(T());
-					//if (!this->Serialize(itemname.str(), t.back())) return false;
+					//if (!this->Serialize(ItemName(i+1), t.back())) return false;
 					T prototype;
-					if (!this->Serialize(itemname.str(), prototype)) return false;
+					if (!this->Serialize(ItemName(i+1), prototype)) return false;
 					t.insert(prototype);
 				}
 			}
@@ -440,6 +441,56 @@ class Serializer
    			DIRECTION_OUTPUT
 		};
 		virtual Direction GetIODirection() = 0;
+
+	protected:
+		///name of the count-th container item, empty if the format ignores names
+		std::string ItemName(int count)
+		{
+			if (IgnoresNames()) return std::string();
+			std::stringstream itemname;
+			itemname << "*item" << count;
+			return itemname.str();
+		}
+
+		///default array serialization, one element at a time
+		template <typename T>
+		bool SerializeElements(const std::string & name, T * t, unsigned count)
+		{
+			for (unsigned i = 0; i < count; i++)
+			{
+				std::stringstream elementname;
+				elementname << name << "[" << i << "]";
+				if (!this->Serialize(elementname.str(), t[i])) return false;
+			}
+			return true;
+		}
+
+		template <typename T>
+		bool SerializeSimpleVector(const std::string & name, std::vector <T> & t)
+		{
+			ComplexTypeStart(name);
+			int listsize = t.size();
+			if (!this->Serialize("*size", listsize)) return false;
+			if (this->GetIODirection() == DIRECTION_INPUT)
+			{
+				if (!CanRead(listsize, sizeof(T))) return false;
+				t.resize(listsize); //only resize, don't clear; we don't want to throw away information
+			}
+
+			if (IgnoresNames())
+			{
+				if (listsize > 0 && !SerializeArray("*items", &t[0], listsize)) return false;
+			}
+			else
+			{
+				for (int i = 0; i < listsize; i++)
+				{
+					if (!this->Serialize(ItemName(i+1), t[i])) return false;
+				}
+			}
+			ComplexTypeEnd(name);
+			return true;
+		}
 };
 
 class SerializerOutput : public Serializer
@@ -1095,6 +1146,58 @@ class TextInputSerializer : public SerializerInput
 		}
 };
 
+///byte order helpers for the binary formats, which store data in big-endian format
+struct BinaryHelpers
+{
+	static bool IsBigEndian()
+	{
+		short word = 0x4321;
+		return (*(char *)& word) != 0x21;
+	}
+
+	template <typename T>
+	static void ByteSwap(T & value)
+	{
+		unsigned char * b = reinterpret_cast<unsigned char *>(&value);
+		for (unsigned i = 0, j = sizeof(T) - 1; i < j; i++, j--)
+		{
+			std::swap(b[i], b[j]);
+		}
+	}
+
+	///copy count values to or from big-endian bytes, the bytes don't need to be aligned
+	template <typename T>
+	static void Store(const T * values, unsigned count, char * bytes, bool bigendian)
+	{
+		if (bigendian)
+		{
+			std::memcpy(bytes, values, count * sizeof(T));
+			return;
+		}
+		ReverseBytes(reinterpret_cast<const unsigned char *>(values), count, sizeof(T), reinterpret_cast<unsigned char *>(bytes));
+	}
+
+	template <typename T>
+	static void Load(const char * bytes, unsigned count, T * values, bool bigendian)
+	{
+		if (bigendian)
+		{
+			std::memcpy(values, bytes, count * sizeof(T));
+			return;
+		}
+		ReverseBytes(reinterpret_cast<const unsigned char *>(bytes), count, sizeof(T), reinterpret_cast<unsigned char *>(values));
+	}
+
+	static void ReverseBytes(const unsigned char * src, unsigned count, unsigned size, unsigned char * dst)
+	{
+		for (unsigned i = 0; i < count; i++, src += size, dst += size)
+		{
+			for (unsigned b = 0; b < size; b++)
+				dst[b] = src[size - 1 - b];
+		}
+	}
+};
+
 ///space efficient, very simple binary format with no provisions for validity checks. data is always written in big-endian format.
 class BinaryOutputSerializer : public SerializerOutput
 {
@@ -1147,9 +1250,37 @@ class BinaryOutputSerializer : public SerializerOutput
 			return !out_.bad();
 		}
 
+		///writes the same bytes as WriteData per element, in blocks
+		template <typename T>
+		bool WriteArray(const T * t, unsigned count)
+		{
+			if (bigendian_)
+			{
+				out_.write(reinterpret_cast<const char *>(t), count * sizeof(T));
+				return !out_.bad();
+			}
+
+			const unsigned block = 64;
+			char temp[block * sizeof(T)];
+			for (unsigned i = 0; i < count; i += block)
+			{
+				unsigned n = std::min(block, count - i);
+				BinaryHelpers::Store(t + i, n, temp, bigendian_);
+				out_.write(temp, n * sizeof(T));
+			}
+			return !out_.bad();
+		}
+
 	public:
 		BinaryOutputSerializer(std::ostream & newout) : out_(newout),bigendian_(IsBigEndian()) {}
 
+		virtual bool IgnoresNames() const {return true;}
+
+		virtual bool SerializeArray(const std::string & name, int * t, unsigned count) {(void) name; return WriteArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, unsigned int * t, unsigned count) {(void) name; return WriteArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, float * t, unsigned count) {(void) name; return WriteArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, double * t, unsigned count) {(void) name; return WriteArray(t, count);}
+
 		virtual bool Serialize(const std::string & name, int & i)
 		{
 			return WriteData(name, i);
@@ -1241,9 +1372,52 @@ class BinaryInputSerializer : public SerializerInput
 			return true;
 		}
 
+		template <typename T>
+		bool ReadArray(T * t, unsigned count)
+		{
+			if (count == 0) return true;
+			if (in_.eof()) return false;
+			in_.read(reinterpret_cast<char *>(t), count * sizeof(T));
+			if (in_.fail() || in_.gcount() != std::streamsize(count * sizeof(T))) return false;
+
+			if (!bigendian_)
+			{
+				for (unsigned i = 0; i < count; i++)
+					BinaryHelpers::ByteSwap(t[i]);
+			}
+
+			return true;
+		}
+
 	public:
 		BinaryInputSerializer(std::istream & newin) : in_(newin),bigendian_(IsBigEndian()) {}
 
+		virtual bool IgnoresNames() const {return true;}
+
+		virtual bool CanRead(int count, unsigned size)
+		{
+			if (count < 0) return false;
+
+			//streams that can't seek are only checked while reading
+			std::streampos pos = in_.tellg();
+			if (pos == std::streampos(-1)) return true;
+			in_.seekg(0, std::ios::end);
+			std::streampos end = in_.tellg();
+			if (end == std::streampos(-1))
+			{
+				in_.clear();
+				in_.seekg(pos);
+				return true;
+			}
+			in_.seekg(pos);
+			return (end - pos) / std::streamoff(size) >= count;
+		}
+
+		virtual bool SerializeArray(const std::string & name, int * t, unsigned count) {(void) name; return ReadArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, unsigned int * t, unsigned count) {(void) name; return ReadArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, float * t, unsigned count) {(void) name; return ReadArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, double * t, unsigned count) {(void) name; return ReadArray(t, count);}
+
 		virtual bool Serialize(const std::string & name, int & i)
 		{
 			return ReadData(name, i);
@@ -1270,6 +1444,104 @@ class BinaryInputSerializer : public SerializerInput
 		}
 };
 
+///binary format writing into a caller provided buffer, the output is identical to BinaryOutputSerializer.
+///serialization fails when the buffer is full.
+class BinarySpanOutputSerializer : public SerializerOutput
+{
+	private:
+		char * const begin_;
+		char * const end_;
+		char * cur_;
+		const bool bigendian_;
+
+		template <typename T>
+		bool WriteArray(const T * t, unsigned count)
+		{
+			if (unsigned(end_ - cur_) / sizeof(T) < count) return false;
+			BinaryHelpers::Store(t, count, cur_, bigendian_);
+			cur_ += count * sizeof(T);
+			return true;
+		}
+
+	public:
+		BinarySpanOutputSerializer(char * buffer, unsigned size) :
+			begin_(buffer), end_(buffer + size), cur_(buffer), bigendian_(BinaryHelpers::IsBigEndian()) {}
+
+		///number of bytes written
+		unsigned GetSize() const {return cur_ - begin_;}
+
+		virtual bool IgnoresNames() const {return true;}
+
+		virtual bool Serialize(const std::string & name, int & i) {(void) name; return WriteArray(&i, 1);}
+		virtual bool Serialize(const std::string & name, unsigned int & i) {(void) name; return WriteArray(&i, 1);}
+		virtual bool Serialize(const std::string & name, float & i) {(void) name; return WriteArray(&i, 1);}
+		virtual bool Serialize(const std::string & name, double & i) {(void) name; return WriteArray(&i, 1);}
+
+		virtual bool Serialize(const std::string & name, std::string & i)
+		{
+			(void) name;
+			int strlen = i.length();
+			if (!WriteArray(&strlen, 1)) return false;
+			return WriteArray(i.data(), strlen);
+		}
+
+		virtual bool SerializeArray(const std::string & name, int * t, unsigned count) {(void) name; return WriteArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, unsigned int * t, unsigned count) {(void) name; return WriteArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, float * t, unsigned count) {(void) name; return WriteArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, double * t, unsigned count) {(void) name; return WriteArray(t, count);}
+};
+
+///binary format reading from a caller provided buffer, the counterpart of BinarySpanOutputSerializer.
+///unlike BinaryInputSerializer reads never go past the end of the buffer.
+class BinarySpanInputSerializer : public SerializerInput
+{
+	private:
+		const char * cur_;
+		const char * const end_;
+		const bool bigendian_;
+
+		template <typename T>
+		bool ReadArray(T * t, unsigned count)
+		{
+			if (unsigned(end_ - cur_) / sizeof(T) < count) return false;
+			BinaryHelpers::Load(cur_, count, t, bigendian_);
+			cur_ += count * sizeof(T);
+			return true;
+		}
+
+	public:
+		BinarySpanInputSerializer(const char * buffer, unsigned size) :
+			cur_(buffer), end_(buffer + size), bigendian_(BinaryHelpers::IsBigEndian()) {}
+
+		///number of bytes not read yet
+		unsigned GetRemaining() const {return end_ - cur_;}
+
+		virtual bool IgnoresNames() const {return true;}
+
+		virtual bool CanRead(int count, unsigned size) {return count >= 0 && GetRemaining() / size >= unsigned(count);}
+
+		virtual bool Serialize(const std::string & name, int & i) {(void) name; return ReadArray(&i, 1);}
+		virtual bool Serialize(const std::string & name, unsigned int & i) {(void) name; return ReadArray(&i, 1);}
+		virtual bool Serialize(const std::string & name, float & i) {(void) name; return ReadArray(&i, 1);}
+		virtual bool Serialize(const std::string & name, double & i) {(void) name; return ReadArray(&i, 1);}
+
+		virtual bool Serialize(const std::string & name, std::string & i)
+		{
+			(void) name;
+			int strlen = 0;
+			if (!ReadArray(&strlen, 1)) return false;
+			if (strlen < 0 || unsigned(end_ - cur_) < unsigned(strlen)) return false;
+			i.assign(cur_, strlen);
+			cur_ += strlen;
+			return true;
+		}
+
+		virtual bool SerializeArray(const std::string & name, int * t, unsigned count) {(void) name; return ReadArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, unsigned int * t, unsigned count) {(void) name; return ReadArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, float * t, unsigned count) {(void) name; return ReadArray(t, count);}
+		virtual bool SerializeArray(const std::string & name, double * t, unsigned count) {(void) name; return ReadArray(t, count);}
+};
+
 ///serializer that provides a reflection interface so the application can use dynamic programming techniques.  the treemap class is used to store data.  this can be either an output or input serializer depending on its mode.  note that internally all data is stored as strings.  this class should not be used via the normal serialization method, but instead use the ReadFromObject and WriteToObject functions.
 class ReflectionSerializer : public Serializer
 {
@@ -0,0 +1,290 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "lzcompressor.h"
+#include "unittest.h"
+#include "benchmark.h"
+
+#include <cstring>
+#include <cstdlib>
+
+// The stream is a varint uncompressed size followed by sequences of a token
+// byte (literal count in the high nibble, match length - MIN_MATCH in the low
+// nibble, 15 means more length bytes follow), the literals and a 16 bit match
+// offset. The last sequence has literals only.
+static const unsigned MIN_MATCH = 4;
+static const unsigned MAX_OFFSET = 65535;
+static const unsigned HASH_BITS = 13;
+
+static inline unsigned Read32(const unsigned char * p)
+{
+	unsigned v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline unsigned Hash(unsigned v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline void PutLength(std::string & output, unsigned length)
+{
+	for (; length >= 255; length -= 255)
+		output.push_back(char(255));
+	output.push_back(char(length));
+}
+
+static inline bool GetLength(const unsigned char * & p, const unsigned char * end, unsigned & length)
+{
+	unsigned char c;
+	do
+	{
+		if (p == end) return false;
+		c = *p++;
+		length += c;
+	} while (c == 255);
+	return true;
+}
+
+static void PutSequence(
+	std::string & output,
+	const unsigned char * literals,
+	unsigned literal_count,
+	unsigned match_length,
+	unsigned offset)
+{
+	unsigned match_code = match_length ? match_length - MIN_MATCH : 0;
+	unsigned char token = ((literal_count < 15 ? literal_count : 15) << 4) | (match_code < 15 ? match_code : 15);
+	output.push_back(char(token));
+	if (literal_count >= 15)
+		PutLength(output, literal_count - 15);
+	output.append((const char *)literals, literal_count);
+	if (match_length)
+	{
+		output.push_back(char(offset & 0xff));
+		output.push_back(char(offset >> 8));
+		if (match_code >= 15)
+			PutLength(output, match_code - 15);
+	}
+}
+
+namespace LZCOMPRESSOR
+{
+
+void Compress(const char * input, unsigned size, std::string & output)
+{
+	output.clear();
+	output.reserve(size + size / 255 + 16);
+	for (unsigned n = size; ; n >>= 7)
+	{
+		if (n < 128)
+		{
+			output.push_back(char(n));
+			break;
+		}
+		output.push_back(char((n & 127) | 128));
+	}
+
+	const unsigned char * in = (const unsigned char *)input;
+	unsigned table[1 << HASH_BITS];
+	std::memset(table, 0xff, sizeof(table));
+
+	unsigned anchor = 0;
+	unsigned pos = 0;
+	while (pos + MIN_MATCH <= size)
+	{
+		unsigned v = Read32(in + pos);
+		unsigned h = Hash(v);
+		unsigned candidate = table[h];
+		table[h] = pos;
+
+		if (candidate == 0xffffffff || pos - candidate > MAX_OFFSET || Read32(in + candidate) != v)
+		{
+			pos++;
+			continue;
+		}
+
+		unsigned length = MIN_MATCH;
+		while (pos + length < size && in[candidate + length] == in[pos + length])
+			length++;
+
+		PutSequence(output, in + anchor, pos - anchor, length, pos - candidate);
+		pos += length;
+		anchor = pos;
+	}
+
+	PutSequence(output, in + anchor, size - anchor, 0, 0);
+}
+
+bool Decompress(const char * input, unsigned size, std::string & output, unsigned max_size)
+{
+	const unsigned char * p = (const unsigned char *)input;
+	const unsigned char * end = p + size;
+
+	unsigned out_size = 0;
+	for (unsigned shift = 0; ; shift += 7)
+	{
+		if (p == end || shift > 28) return false;
+		unsigned char c = *p++;
+		out_size |= unsigned(c & 127) << shift;
+		if (!(c & 128)) break;
+	}
+
+	// the size is not trusted until the data is, a token byte yields at most
+	// 15 literals and a length byte at most 255 bytes of output
+	if (out_size > max_size || out_size / 255 > unsigned(end - p))
+		return false;
+
+	output.resize(out_size);
+	if (out_size == 0) return p + 1 == end;
+	char * out = &output[0];
+	unsigned out_pos = 0;
+
+	while (p != end)
+	{
+		unsigned char token = *p++;
+
+		unsigned literal_count = token >> 4;
+		if (literal_count == 15 && !GetLength(p, end, literal_count))
+			return false;
+		if (literal_count > unsigned(end - p) || literal_count > out_size - out_pos)
+			return false;
+		std::memcpy(out + out_pos, p, literal_count);
+		p += literal_count;
+		out_pos += literal_count;
+
+		// the last sequence has no match
+		if (p == end)
+			break;
+
+		if (end - p < 2)
+			return false;
+		unsigned offset = p[0] | (p[1] << 8);
+		p += 2;
+		unsigned length = token & 15;
+		if (length == 15 && !GetLength(p, end, length))
+			return false;
+		length += MIN_MATCH;
+
+		// back-references have to stay within the output written so far
+		if (offset == 0 || offset > out_pos || length > out_size - out_pos)
+			return false;
+
+		// matches may overlap their own output, those are copied bytewise
+		const char * match = out + out_pos - offset;
+		if (offset >= length)
+		{
+			std::memcpy(out + out_pos, match, length);
+		}
+		else
+		{
+			for (unsigned i = 0; i < length; i++)
+				out[out_pos + i] = match[i];
+		}
+		out_pos += length;
+	}
+
+	return out_pos == out_size;
+}
+
+}
+
+QT_TEST(lzcompressor_test)
+{
+	std::string data;
+	for (int i = 0; i < 10000; i++)
+	{
+		float f = (i % 100) * 0.25f;
+		data.append((const char *)&f, sizeof(f));
+		if (i % 7 == 0)
+			data.push_back(char(rand()));
+	}
+
+	std::string packed, unpacked;
+	LZCOMPRESSOR::Compress(data, packed);
+	QT_CHECK_LESS(packed.size(), data.size() / 4);
+	QT_CHECK(LZCOMPRESSOR::Decompress(packed, unpacked, data.size()));
+	QT_CHECK(unpacked == data);
+
+	// incompressible, empty and tiny inputs
+	std::string noise;
+	for (int i = 0; i < 5000; i++)
+		noise.push_back(char(rand()));
+	LZCOMPRESSOR::Compress(noise, packed);
+	QT_CHECK(LZCOMPRESSOR::Decompress(packed, unpacked, data.size()));
+	QT_CHECK(unpacked == noise);
+
+	const char * small[] = {"", "a", "abc", "abcd", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"};
+	for (unsigned i = 0; i < sizeof(small) / sizeof(small[0]); i++)
+	{
+		LZCOMPRESSOR::Compress(std::string(small[i]), packed);
+		QT_CHECK(LZCOMPRESSOR::Decompress(packed, unpacked, data.size()));
+		QT_CHECK_EQUAL(unpacked, std::string(small[i]));
+	}
+
+	// corrupt input is rejected without reading out of bounds
+	LZCOMPRESSOR::Compress(data, packed);
+	for (unsigned i = 1; i < packed.size(); i += packed.size() / 50 + 1)
+	{
+		std::string corrupt = packed;
+		corrupt[i] = char(~corrupt[i]);
+		LZCOMPRESSOR::Decompress(corrupt, unpacked, data.size());
+		QT_CHECK(LZCOMPRESSOR::Decompress(packed.substr(0, i), unpacked, data.size()) == false);
+	}
+
+	// sizes above the limit are rejected before any allocation
+	QT_CHECK(!LZCOMPRESSOR::Decompress(packed, unpacked, data.size() - 1));
+	const char huge[] = {char(0xff), char(0xff), char(0xff), char(0xff), char(0x0f), char(0x10), 'a'};
+	QT_CHECK(!LZCOMPRESSOR::Decompress(huge, sizeof(huge), unpacked, 0xffffffff));
+
+	// a match reaching back before the start of the output
+	const char before[] = {char(6), char(0x10), 'a', char(2), char(0), char(0x10), 'b'};
+	QT_CHECK(!LZCOMPRESSOR::Decompress(before, sizeof(before), unpacked, 6));
+	const char inside[] = {char(6), char(0x10), 'a', char(1), char(0), char(0x10), 'b'};
+	QT_CHECK(LZCOMPRESSOR::Decompress(inside, sizeof(inside), unpacked, 6));
+	QT_CHECK_EQUAL(unpacked, "aaaaab");
+}
+
+BENCHMARK(lzcompressor)
+{
+	// xor deltas of similar car states are mostly zero bytes with some noise
+	std::string data(1 << 20, '\0');
+	srand(1);
+	for (unsigned i = 0; i < data.size(); i += 1 + rand() % 16)
+		data[i] = char(rand());
+
+	std::string packed, unpacked;
+	const int runs = 20;
+	benchmark::Stopwatch timer;
+	for (int i = 0; i < runs; i++)
+		LZCOMPRESSOR::Compress(data, packed);
+	double compress_time = timer.Seconds();
+
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+		LZCOMPRESSOR::Decompress(packed, unpacked, data.size());
+	double decompress_time = timer.Seconds();
+	benchmark::DoNotOptimize(unpacked);
+
+	double mb = runs * data.size() / double(1 << 20);
+	out << "lzcompressor: ratio " << double(packed.size()) / data.size() <<
+		", compress " << mb / compress_time << " MB/s" <<
+		", decompress " << mb / decompress_time << " MB/s" << std::endl;
+}
@@ -0,0 +1,47 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _LZCOMPRESSOR_H
+#define _LZCOMPRESSOR_H
+
+#include <string>
+
+/// Fast byte oriented LZ77 compressor for replay chunks and other small blobs.
+/// Favors speed over ratio, the output starts with the uncompressed size.
+namespace LZCOMPRESSOR
+{
+	/// compress input, replacing the contents of output
+	void Compress(const char * input, unsigned size, std::string & output);
+
+	/// decompress input, replacing the contents of output, returns false if input is corrupt
+	/// or would decompress to more than max_size bytes
+	bool Decompress(const char * input, unsigned size, std::string & output, unsigned max_size);
+
+	inline void Compress(const std::string & input, std::string & output)
+	{
+		Compress(input.data(), input.size(), output);
+	}
+
+	inline bool Decompress(const std::string & input, std::string & output, unsigned max_size)
+	{
+		return Decompress(input.data(), input.size(), output, max_size);
+	}
+}
+
+#endif // _LZCOMPRESSOR_H
@@ -20,7 +20,8 @@
 #ifndef _MACROS_H
 #define _MACROS_H
 
-#define _SERIALIZE_(ser,varname) if (!ser.Serialize(#varname,varname)) return false
+// the name string is built once, serializing in a loop doesn't allocate
+#define _SERIALIZE_(ser,varname) do {static const std::string _name(#varname); if (!ser.Serialize(_name,varname)) return false;} while (0)
 #define _SERIALIZEENUM_(ser,varname,type) if (ser.GetIODirection() == joeserialize::Serializer::DIRECTION_INPUT) {int _enumint(0);if (!ser.Serialize(#varname,_enumint)) return false;varname=(type)_enumint;} else {int _enumint = varname;if (!ser.Serialize(#varname,_enumint)) return false;}
 
 ///break up the input into a vector of strings using the token characters given
@@ -179,6 +179,25 @@ static bool NeedsNormalSwap(JOEObject & Object)
 }
 
 bool MODEL_JOE03::Load ( const std::string & filename, std::ostream & err_output, bool genlist, const JOEPACK * pack)
+{
+	if (!LoadMesh(filename, err_output, pack))
+		return false;
+
+	if (genlist)
+	{
+		//optimize into a static display list
+		GenerateListID(err_output);
+	}
+	else
+	{
+		//optimize into vertex array/buffers
+		GenerateVertexArrayObject(err_output);
+	}
+
+	return true;
+}
+
+bool MODEL_JOE03::LoadMesh ( const std::string & filename, std::ostream & err_output, const JOEPACK * pack, bool optimize)
 {
 	Clear();
 
@@ -211,22 +230,13 @@ bool MODEL_JOE03::Load ( const std::string & filename, std::ostream & err_output
 	else
 		pack->fclose();
 
-	if (val)
+	if (!val)
 	{
-		if (genlist)
-		{
-			//optimize into a static display list
-			GenerateListID(err_output);
-		}
-		else
-		{
-			//optimize into vertex array/buffers
-			GenerateVertexArrayObject(err_output);
-		}
+		err_output << "in " << filename << std::endl;
 	}
-	else
+	else if (optimize)
 	{
-		err_output << "in " << filename << std::endl;
+		m_mesh.OptimizeVertexCache();
 	}
 
 	return val;
@@ -49,6 +49,10 @@ public:
 
 	bool Load(const std::string & strFileName, std::ostream & error_output, bool genlist, const JOEPACK * pack);
 
+	/// load the mesh data only, no display list or vertex buffers are created
+	/// optimize reorders the faces and vertices for vertex cache locality
+	bool LoadMesh(const std::string & strFileName, std::ostream & error_output, const JOEPACK * pack = 0, bool optimize = true);
+
 
 
 private:
@@ -20,7 +20,27 @@
 #include "particle.h"
 #include "contentmanager.h"
 #include "textureinfo.h"
+#include "jobsystem.h"
 #include "unittest.h"
+#include "benchmark.h"
+
+#include <cmath>
+
+PARTICLE_SYSTEM::PARTICLE_SYSTEM() :
+	slots_num(0),
+	particles_num(0),
+	max_particles(8*128),
+	last_slot(0),
+	cur_texture(0),
+	visible_num(0),
+	transparency_range(0.5,1),
+	longevity_range(5,14),
+	speed_range(0.3,1),
+	size_range(0.5,1),
+	direction(0,1,0)
+{
+	Resize(128);
+}
 
 bool PARTICLE_SYSTEM::Load(
 	const std::list <std::string> & texlist,
@@ -28,6 +48,12 @@ bool PARTICLE_SYSTEM::Load(
 	int anisotropy,
 	ContentManager & content)
 {
+	Clear();
+	for (unsigned int i = 0; i < batches.size(); ++i)
+		node.GetDrawlist().particle.erase(batches[i].draw);
+	batches.clear();
+	textures.clear();
+
 	TEXTUREINFO texinfo;
 	texinfo.anisotropy = anisotropy;
 	for (std::list <std::string>::const_iterator i = texlist.begin(); i != texlist.end(); ++i)
@@ -36,65 +62,233 @@ bool PARTICLE_SYSTEM::Load(
 		content.load(texpath, *i, texinfo, tex);
 		textures.push_back(tex);
 	}
-	cur_texture = textures.end();
+	cur_texture = 0;
+
+	// the drawables point to the vertex arrays, the batches are not resized after this
+	batches.resize(textures.size());
+	for (unsigned int i = 0; i < batches.size(); ++i)
+	{
+		BATCH & batch = batches[i];
+		batch.quads = 0;
+		batch.varray.SetTexCoordSets(1);
+		batch.draw = node.GetDrawlist().particle.insert(DRAWABLE());
+		DRAWABLE & drawref = node.GetDrawlist().particle.get(batch.draw);
+		drawref.SetDrawEnable(false);
+		drawref.SetVertArray(&batch.varray);
+		drawref.SetDiffuseMap(textures[i]);
+		drawref.SetCull(false,false);
+	}
+
 	return !textures.empty();
 }
 
-bool inverseorder(int i1, int i2)
+struct PARTICLE_UPDATE
 {
-	return i2 < i1;
-}
+	PARTICLE_SYSTEM & ps;
+	float dt;
+	const MATHVECTOR <float, 3> & campos;
+
+	PARTICLE_UPDATE(
+		PARTICLE_SYSTEM & ps,
+		float dt,
+		const MATHVECTOR <float, 3> & campos) :
+		ps(ps), dt(dt), campos(campos)
+	{
+		// ctor
+	}
+
+	// slots are independent, the loop has no branches so that it can be vectorized,
+	// dead slots are updated too and skipped when the vertex arrays are built
+	void operator()(int begin, int end)
+	{
+		const float * start_x = &ps.start_x[0];
+		const float * start_y = &ps.start_y[0];
+		const float * start_z = &ps.start_z[0];
+		const float * velocity_x = &ps.velocity_x[0];
+		const float * velocity_y = &ps.velocity_y[0];
+		const float * velocity_z = &ps.velocity_z[0];
+		const float * transparency = &ps.transparency[0];
+		const float * longevity = &ps.longevity[0];
+		float * time = &ps.time[0];
+		float * position_x = &ps.position_x[0];
+		float * position_y = &ps.position_y[0];
+		float * position_z = &ps.position_z[0];
+		float * alpha = &ps.alpha[0];
+		float * scale = &ps.scale[0];
+
+		// scale the alpha by the closeness to the camera
+		// if we get too close, don't draw
+		// this prevents major slowdown when there are a lot of particles right next to the camera
+		const float camdist_off = 3.0;
+		const float camdist_full = 4.0;
+		const float camdist_scale = 1 / (camdist_full - camdist_off);
+		const float cx = campos[0], cy = campos[1], cz = campos[2];
+
+		for (int i = begin; i < end; i++)
+		{
+			float t = time[i] + dt;
+			time[i] = t;
+
+			float px = start_x[i] + velocity_x[i] * t;
+			float py = start_y[i] + velocity_y[i] * t;
+			float pz = start_z[i] + velocity_z[i] * t;
+			position_x[i] = px;
+			position_y[i] = py;
+			position_z[i] = pz;
+
+			float age = t / longevity[i];
+			float fade = 1 - age;
+			fade = fade * fade;
+			float trans = transparency[i] * fade * fade;
+			trans = std::min(std::max(trans, 0.0f), 1.0f);
+
+			float dx = px - cx, dy = py - cy, dz = pz - cz;
+			float camdist = std::sqrt(dx * dx + dy * dy + dz * dz);
+			float camfade = std::min(std::max((camdist - camdist_off) * camdist_scale, 0.0f), 1.0f);
 
-void PARTICLE_SYSTEM::Update(float dt, const QUATERNION <float> & camdir, const MATHVECTOR <float, 3> & campos)
+			alpha[i] = trans * camfade;
+			scale[i] = 0.2f * age + 0.4f;
+		}
+	}
+};
+
+void PARTICLE_SYSTEM::Update(float dt, const QUATERNION <float> & camdir, const MATHVECTOR <float, 3> & campos, JobSystem * jobs)
 {
 	QUATERNION <float> camdir_conj = -camdir;
 
-	std::vector <int> expired_list;
+	PARTICLE_UPDATE body(*this, dt, campos);
+	if (jobs)
+		jobs->ParallelFor(0, slots_num, 1024, body);
+	else
+		body(0, slots_num);
+
+	Expire();
+
+	BuildBatches(camdir_conj);
+}
+
+void PARTICLE_SYSTEM::Expire()
+{
+	for (unsigned int i = 0; i < slots_num; ++i)
+	{
+		if (alive[i] && time[i] > longevity[i])
+		{
+			alive[i] = 0;
+			free_slots.push_back(i);
+			--particles_num;
+		}
+	}
 
-	for (unsigned int i = 0; i < particles.size(); i++)
+	if (particles_num == 0)
 	{
-		particles[i].Update(node, dt, camdir_conj, campos);
-		if (particles[i].Expired())
-			expired_list.push_back(i);
+		slots_num = 0;
+		free_slots.clear();
 	}
+}
+
+void PARTICLE_SYSTEM::BuildBatches(const QUATERNION <float> & camdir_conj)
+{
+	// billboard axes, the quads face the camera
+	MATHVECTOR <float, 3> right(1, 0, 0), up(0, 1, 0), normal(0, 0, 1);
+	camdir_conj.RotateVector(right);
+	camdir_conj.RotateVector(up);
+	camdir_conj.RotateVector(normal);
+
+	// count the visible particles per texture
+	for (unsigned int b = 0; b < batches.size(); ++b)
+		batches[b].quads = 0;
 
-	//must sort our expired list so highest numbers come first or swap & pop won't work
-	std::sort(expired_list.begin(), expired_list.end(), inverseorder);
+	visible_num = 0;
+	if (batches.empty())
+		return;
 
-	if (expired_list.size() == particles.size() && !particles.empty())
+	for (unsigned int i = 0; i < slots_num; ++i)
 	{
-		//std::cout << "Clearing all nodes" << std::endl;
-		Clear();
+		if (alive[i] && alpha[i] > 0)
+			batches[texture[i]].quads++;
 	}
-	else if (!expired_list.empty())
-	{
-		assert(expired_list.size() < particles.size());
 
-		//std::cout << "Getting ready to delete " << expired_list.size() << "/" << particles.size() << std::endl;
+	for (unsigned int b = 0; b < batches.size(); ++b)
+	{
+		BATCH & batch = batches[b];
+		unsigned int quads = batch.quads;
+		visible_num += quads;
 
-		//do the old swap & pop trick to remove expired particles quickly.
-		//all swaps must be done before the popping starts, because popping invalidates iterators
-		int newback = particles.size()-1;
-		for (std::vector <int>::iterator i = expired_list.begin(); i != expired_list.end(); ++i)
+		// faces and texture coordinates only depend on the number of quads
+		unsigned int faces_quads = batch.faces.size() / 6;
+		if (faces_quads != quads)
 		{
-			//only bother to swap if it's not already at the end
-			if (*i != newback)
+			batch.faces.resize(quads * 6);
+			batch.texcoords.resize(quads * 8);
+			for (unsigned int q = faces_quads; q < quads; ++q)
 			{
-				std::swap(particles[*i], particles[newback]);
+				int * f = &batch.faces[q * 6];
+				f[0] = q * 4; f[1] = q * 4 + 1; f[2] = q * 4 + 2;
+				f[3] = q * 4; f[4] = q * 4 + 2; f[5] = q * 4 + 3;
+
+				float * tc = &batch.texcoords[q * 8];
+				tc[0] = 0; tc[1] = 0; tc[2] = 1; tc[3] = 0;
+				tc[4] = 1; tc[5] = 1; tc[6] = 0; tc[7] = 1;
 			}
+		}
 
-			//std::cout << "Deleted node: " << &particles[newback].GetNode() << endl;
-			node.Delete(particles[newback].GetNode());
+		batch.vertices.resize(quads * 12);
+		batch.normals.resize(quads * 12);
+		batch.colors.resize(quads * 16);
+		batch.quads = 0;
+	}
+
+	// write a camera facing quad per visible particle
+	for (unsigned int i = 0; i < slots_num; ++i)
+	{
+		if (!alive[i] || alpha[i] <= 0)
+			continue;
+
+		BATCH & batch = batches[texture[i]];
+		unsigned int q = batch.quads++;
 
-			newback--;
+		float s = scale[i];
+		MATHVECTOR <float, 3> pos(position_x[i], position_y[i], position_z[i]);
+		MATHVECTOR <float, 3> r = right * s, u = up * s;
+		MATHVECTOR <float, 3> corners[4] = {pos - r - u, pos + r - u, pos + r + u, pos - r + u};
+
+		float * v = &batch.vertices[q * 12];
+		float * n = &batch.normals[q * 12];
+		float * c = &batch.colors[q * 16];
+		for (int k = 0; k < 4; ++k)
+		{
+			v[k * 3] = corners[k][0];
+			v[k * 3 + 1] = corners[k][1];
+			v[k * 3 + 2] = corners[k][2];
+			n[k * 3] = normal[0];
+			n[k * 3 + 1] = normal[1];
+			n[k * 3 + 2] = normal[2];
+			c[k * 4] = 1;
+			c[k * 4 + 1] = 1;
+			c[k * 4 + 2] = 1;
+			c[k * 4 + 3] = alpha[i];
 		}
+	}
 
-		//do all of the pops
-		//std::cout << expired_list.size() << ", " << particles.size() << ", " << newback << std::endl;
-		assert((int)particles.size() - (int)expired_list.size() == newback + 1);
-		for (unsigned int i = 0; i < expired_list.size(); i++)
-			particles.pop_back();
-		//assert((int)expired_list.size() == (int)particles.size() - newback);
+	for (unsigned int b = 0; b < batches.size(); ++b)
+	{
+		BATCH & batch = batches[b];
+		DRAWABLE & drawref = node.GetDrawlist().particle.get(batch.draw);
+		drawref.SetDrawEnable(batch.quads > 0);
+		if (batch.quads == 0)
+			continue;
+
+		int faces_num;
+		const int * faces;
+		batch.varray.GetFaces(faces, faces_num);
+		if (faces_num != int(batch.faces.size()))
+		{
+			batch.varray.SetFaces(&batch.faces[0], batch.faces.size());
+			batch.varray.SetTexCoords(0, &batch.texcoords[0], batch.texcoords.size());
+		}
+		batch.varray.SetVertices(&batch.vertices[0], batch.vertices.size());
+		batch.varray.SetNormals(&batch.normals[0], batch.normals.size());
+		batch.varray.SetColors(&batch.colors[0], batch.colors.size());
 	}
 }
 
@@ -103,40 +297,58 @@ void PARTICLE_SYSTEM::AddParticle(
 	float newspeed,
 	bool testonly)
 {
-	if (cur_texture == textures.end())
-		cur_texture = textures.begin();
+	//the textures array should only be empty if we're doing a unit test
+	assert(testonly || !textures.empty());
 
-	std::tr1::shared_ptr<TEXTURE> tex;
-	if (!testonly)
+	unsigned int slot;
+	if (particles_num >= max_particles)
 	{
-		assert(cur_texture != textures.end()); //this should only happen if the textures array is empty, which should never happen unless we're doing a unit test
-		tex = *cur_texture;
+		slot = last_slot;
+	}
+	else if (!free_slots.empty())
+	{
+		slot = free_slots.back();
+		free_slots.pop_back();
+		particles_num++;
+	}
+	else
+	{
+		if (slots_num == start_x.size())
+			Resize(std::min(slots_num * 2, max_particles));
+		slot = slots_num++;
+		particles_num++;
 	}
 
-	const unsigned int max_particles = 8*128;
-
-	while (particles.size() >= max_particles)
-		particles.pop_back();
-
-	particles.push_back(PARTICLE(node, position, direction,
-			    speed_range.first+newspeed*(speed_range.second-speed_range.first),
-			    transparency_range.first+newspeed*(transparency_range.second-transparency_range.first),
-			    longevity_range.first+newspeed*(longevity_range.second-longevity_range.first),
-			    size_range.first+newspeed*(size_range.second-size_range.first),
-				tex));
+	float speed = speed_range.first+newspeed*(speed_range.second-speed_range.first);
+	start_x[slot] = position[0];
+	start_y[slot] = position[1];
+	start_z[slot] = position[2];
+	velocity_x[slot] = direction[0] * speed;
+	velocity_y[slot] = direction[1] * speed;
+	velocity_z[slot] = direction[2] * speed;
+	transparency[slot] = transparency_range.first+newspeed*(transparency_range.second-transparency_range.first);
+	longevity[slot] = longevity_range.first+newspeed*(longevity_range.second-longevity_range.first);
+	time[slot] = 0;
+	alive[slot] = 1;
+	texture[slot] = cur_texture;
+	last_slot = slot;
 
-	if (cur_texture != textures.end())
-		cur_texture++;
+	if (!textures.empty())
+		cur_texture = (cur_texture + 1) % textures.size();
 }
 
 void PARTICLE_SYSTEM::Clear()
 {
-	for (std::vector <PARTICLE>::iterator i = particles.begin(); i != particles.end(); ++i)
+	slots_num = 0;
+	particles_num = 0;
+	free_slots.clear();
+
+	visible_num = 0;
+	for (unsigned int b = 0; b < batches.size(); ++b)
 	{
-		node.Delete(i->GetNode());
+		batches[b].quads = 0;
+		node.GetDrawlist().particle.get(batches[b].draw).SetDrawEnable(false);
 	}
-
-	particles.clear();
 }
 
 void PARTICLE_SYSTEM::SetParameters(float transmin, float transmax, float longmin, float longmax,
@@ -154,6 +366,38 @@ void PARTICLE_SYSTEM::SetParameters(float transmin, float transmax, float longmi
 	direction = newdir;
 }
 
+void PARTICLE_SYSTEM::SetMaxParticles(unsigned int value)
+{
+	assert(value > 0);
+	// live and freed slots above the new limit would be cut off
+	if (slots_num > value)
+		Clear();
+	max_particles = value;
+	if (start_x.size() > max_particles)
+		Resize(max_particles);
+}
+
+void PARTICLE_SYSTEM::Resize(unsigned int slots)
+{
+	start_x.resize(slots);
+	start_y.resize(slots);
+	start_z.resize(slots);
+	velocity_x.resize(slots);
+	velocity_y.resize(slots);
+	velocity_z.resize(slots);
+	transparency.resize(slots);
+	longevity.resize(slots, 1);
+	time.resize(slots);
+	alive.resize(slots);
+	texture.resize(slots);
+	position_x.resize(slots);
+	position_y.resize(slots);
+	position_z.resize(slots);
+	alpha.resize(slots);
+	scale.resize(slots);
+	free_slots.reserve(slots);
+}
+
 QT_TEST(particle_test)
 {
 	std::stringstream out;
@@ -174,6 +418,120 @@ QT_TEST(particle_test)
 	QT_CHECK_EQUAL(s.NumParticles(),2);
 	s.Update(0.1, dir, pos);
 	QT_CHECK_EQUAL(s.NumParticles(),1);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),1,true);
+	QT_CHECK_EQUAL(s.NumParticles(),2);
 	s.Update(0.5, dir, pos);
+	QT_CHECK_EQUAL(s.NumParticles(),1);
+	s.Update(0.6, dir, pos);
+	QT_CHECK_EQUAL(s.NumParticles(),0);
+
+	//the most recently added particle is replaced when the limit is reached
+	s.SetMaxParticles(2);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),0,true);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),1,true);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),0,true);
+	QT_CHECK_EQUAL(s.NumParticles(),2);
+	s.Update(0.55, dir, pos);
+	QT_CHECK_EQUAL(s.NumParticles(),0);
+
+	//shrinking below a freed slot clears the particles
+	s.SetMaxParticles(3);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),1,true);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),1,true);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),0,true);
+	s.Update(0.55, dir, pos);
+	QT_CHECK_EQUAL(s.NumParticles(),2);
+	s.SetMaxParticles(2);
+	QT_CHECK_EQUAL(s.NumParticles(),0);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),1,true);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),1,true);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),0,true);
+	s.Update(0.1, dir, pos);
+	QT_CHECK_EQUAL(s.NumParticles(),2);
+	s.Update(1.0, dir, pos);
 	QT_CHECK_EQUAL(s.NumParticles(),0);
 }
+
+QT_TEST(particle_batch_test)
+{
+	std::stringstream out;
+	PARTICLE_SYSTEM s;
+	ContentManager c(out);
+	std::list <std::string> texlist;
+	texlist.push_back("smoke1.png");
+	texlist.push_back("smoke2.png");
+	s.Load(texlist, std::string(), 0, c);
+	s.SetParameters(1.0,1.0,1.0,1.0,1.0,1.0,1.0,1.0,MATHVECTOR<float,3>(0,1,0));
+
+	//particles close to the camera are not drawn, the others are drawn with one quad each
+	MATHVECTOR <float, 3> campos(0, 0, 10);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,0),0);
+	s.AddParticle(MATHVECTOR<float,3>(1,0,0),0);
+	s.AddParticle(MATHVECTOR<float,3>(0,0,9),0);
+	s.Update(0.1, QUATERNION <float>(), campos);
+	QT_CHECK_EQUAL(s.NumParticles(), 3);
+	QT_CHECK_EQUAL(s.NumVisibleParticles(), 2);
+
+	//one drawable per texture, the particles alternate between the textures
+	keyed_container <DRAWABLE> & drawlist = s.GetNode().GetDrawlist().particle;
+	QT_CHECK_EQUAL(drawlist.size(), 2);
+	int faces = 0;
+	for (keyed_container <DRAWABLE>::iterator i = drawlist.begin(); i != drawlist.end(); ++i)
+	{
+		const float * colors;
+		int colors_num;
+		i->GetVertArray()->GetColors(colors, colors_num);
+		faces += i->GetVertArray()->GetNumFaces();
+		QT_CHECK(i->GetDrawEnable());
+		QT_CHECK_EQUAL(colors_num, 16);
+	}
+	QT_CHECK_EQUAL(faces, 2 * 6);
+
+	s.Update(1.0, QUATERNION <float>(), campos);
+	QT_CHECK_EQUAL(s.NumParticles(), 0);
+	QT_CHECK_EQUAL(s.NumVisibleParticles(), 0);
+}
+
+BENCHMARK(particle_system)
+{
+	// tire smoke from a full grid of drifting cars
+	std::stringstream error;
+	PARTICLE_SYSTEM s;
+	ContentManager c(error);
+	std::list <std::string> texlist;
+	texlist.push_back("smoke1.png");
+	texlist.push_back("smoke2.png");
+	texlist.push_back("smoke3.png");
+	s.Load(texlist, std::string(), 0, c);
+	s.SetParameters(0.4,0.9, 1,2, 0.3,0.6, 0.02,0.06, MATHVECTOR<float,3>(0.4,0.2,1));
+
+	const unsigned int particles = 50000;
+	s.SetMaxParticles(particles);
+
+	// spawn the particles over a second, each frame expires and respawns some of them
+	srand(1);
+	const float dt = 1 / 90.0f;
+	const int frames = 900;
+	MATHVECTOR <float, 3> campos(0, 0, 2);
+	QUATERNION <float> camdir;
+	double update_time = 0;
+	unsigned int visible = 0;
+	benchmark::Stopwatch timer;
+	for (int f = 0; f < frames; ++f)
+	{
+		for (unsigned int i = 0; i < particles / 90; ++i)
+		{
+			MATHVECTOR <float, 3> pos(rand() % 200 - 100, rand() % 200 - 100, 0);
+			s.AddParticle(pos, (rand() % 100) * 0.01f);
+		}
+
+		timer.Reset();
+		s.Update(dt, camdir, campos);
+		update_time += timer.Seconds();
+		visible += s.NumVisibleParticles();
+	}
+
+	out << "particle_system: " << s.NumParticles() << " particles" <<
+		", " << visible / frames << " visible" <<
+		", update " << update_time / frames * 1E3 << " ms per frame" << std::endl;
+}
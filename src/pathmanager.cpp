@@ -84,6 +84,7 @@ void PATHMANAGER::Init(std::ostream & info_output, std::ostream & error_output)
 	MakeDir(GetTrackRecordsPath());
 	MakeDir(GetReplayPath());
 	MakeDir(GetScreenshotPath());
+	MakeDir(GetTrackCachePath());
 	MakeDir(GetTemporaryFolder());
 
 	// Print diagnostic info.
@@ -292,6 +293,11 @@ std::string PATHMANAGER::GetScreenshotPath() const
 	return settings_path+"/screenshots";
 }
 
+std::string PATHMANAGER::GetTrackCachePath() const
+{
+	return settings_path+"/trackcache";
+}
+
 std::string PATHMANAGER::GetStaticReflectionMap() const
 {
 	return GetDataPath()+"/textures/weather/cubereflection-nosun.png";
@@ -57,6 +57,7 @@ public:
 	std::string GetDefaultCarControlsFile() const;
 	std::string GetReplayPath() const;
 	std::string GetScreenshotPath() const;
+	std::string GetTrackCachePath() const;
 	std::string GetStaticReflectionMap() const;
 	std::string GetStaticAmbientMap() const;
 	std::string GetShaderPath() const;
@@ -21,11 +21,26 @@
 #include "dynamicsworld.h"
 #include "tracksurface.h"
 #include "carinput.h"
+#include "track.h"
+#include "contentmanager.h"
+#include "pathmanager.h"
+#include "ai/ai.h"
 #include "cfg/ptree.h"
+#include "traceprofiler.h"
+#include "benchmark.h"
+#include "jobsystem.h"
+#include "trackcache.h"
+#include "model_joe03.h"
+#include "joepack.h"
+#include "vertexarray.h"
 
 #include <vector>
+#include <list>
+#include <algorithm>
 #include <iostream>
+#include <fstream>
 #include <sstream>
+#include <cstdio>
 
 static inline float ConvertToMPH(float ms)
 {
@@ -91,6 +106,8 @@ void PERFORMANCE_TESTING::Test(
 	//else info_output << "Car state: " << statestream.str();
 	carstate = statestream.str();
 
+	TestSerialization(info_output, error_output);
+
 	// fixme
 	info_output << "Car performance test broken - exiting." << std::endl;
 	return;
@@ -102,6 +119,606 @@ void PERFORMANCE_TESTING::Test(
 	info_output << "Car performance test complete." << std::endl;
 }
 
+// scopes timed by TestTrack, ai, physics, car match the game loop scopes,
+// raycast and tire are nested inside physics, tire is summed over the
+// threads the cars are stepped on
+static const char * const track_test_blocks[] = {"ai", "physics", "car", "raycast", "tire"};
+static const int track_test_blocks_num = sizeof(track_test_blocks) / sizeof(track_test_blocks[0]);
+
+// fnv-1a
+static unsigned int Hash(unsigned int hash, const void * data, size_t size)
+{
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	for (size_t n = 0; n < size; ++n)
+	{
+		hash = (hash ^ bytes[n]) * 16777619u;
+	}
+	return hash;
+}
+
+// hash over the raw bytes of the car states, equal hashes mean bit-identical runs
+static unsigned int HashCarStates(const std::list<CAR> & cars)
+{
+	unsigned int hash = 2166136261u;
+	for (std::list<CAR>::const_iterator i = cars.begin(); i != cars.end(); ++i)
+	{
+		const btScalar state[] = {
+			i->dynamics.GetPosition()[0], i->dynamics.GetPosition()[1], i->dynamics.GetPosition()[2],
+			i->dynamics.GetOrientation()[0], i->dynamics.GetOrientation()[1],
+			i->dynamics.GetOrientation()[2], i->dynamics.GetOrientation()[3],
+			i->dynamics.GetVelocity()[0], i->dynamics.GetVelocity()[1], i->dynamics.GetVelocity()[2]};
+		hash = Hash(hash, state, sizeof(state));
+	}
+	return hash;
+}
+
+// hash over the collision objects in world order, the road patches with their
+// racing lines and the start positions, equal hashes mean identical track loads
+static unsigned int HashTrack(const TRACK & track, const btCollisionWorld & world)
+{
+	unsigned int hash = 2166136261u;
+	const btCollisionObjectArray & objects = world.getCollisionObjectArray();
+	for (int i = 0; i < objects.size(); ++i)
+	{
+		const btCollisionShape & shape = *objects[i]->getCollisionShape();
+		btVector3 min, max;
+		shape.getAabb(objects[i]->getWorldTransform(), min, max);
+		const btScalar bounds[] = {min[0], min[1], min[2], max[0], max[1], max[2]};
+		const int type = shape.getShapeType();
+		hash = Hash(hash, &type, sizeof(type));
+		hash = Hash(hash, bounds, sizeof(bounds));
+	}
+
+	const std::list<ROADSTRIP> & roads = track.GetRoadList();
+	for (std::list<ROADSTRIP>::const_iterator r = roads.begin(); r != roads.end(); ++r)
+	{
+		const std::vector<ROADPATCH> & patches = r->GetPatches();
+		for (std::vector<ROADPATCH>::const_iterator p = patches.begin(); p != patches.end(); ++p)
+		{
+			const BEZIER & patch = p->GetPatch();
+			const MATHVECTOR<float, 3> racing_line = p->GetRacingLine();
+			const float state[] = {
+				patch.GetFL()[0], patch.GetFL()[1], patch.GetFL()[2],
+				patch.GetBR()[0], patch.GetBR()[1], patch.GetBR()[2],
+				racing_line[0], racing_line[1], racing_line[2],
+				p->GetTrackCurvature(), patch.GetTrackRadius()};
+			hash = Hash(hash, state, sizeof(state));
+		}
+	}
+
+	for (int i = 0; i < track.GetNumStartPositions(); ++i)
+	{
+		const std::pair<MATHVECTOR<float, 3>, QUATERNION<float> > start = track.GetStart(i);
+		const float state[] = {
+			start.first[0], start.first[1], start.first[2],
+			start.second[0], start.second[1], start.second[2], start.second[3]};
+		hash = Hash(hash, state, sizeof(state));
+	}
+
+	const unsigned int sectors = track.GetSectors();
+	return Hash(hash, &sectors, sizeof(sectors));
+}
+
+// cast the wheel rays of the current car states as one batch and one at a
+// time into copies of the wheel contacts, which carry the patch hints
+// returns microseconds per ray and the largest contact position difference
+static void TestWheelRays(
+	const DynamicsWorld & world,
+	std::list<CAR> & cars,
+	double & batched_us,
+	double & single_us,
+	btScalar & max_difference)
+{
+	btAlignedObjectArray<DynamicsWorld::Ray> rays;
+	for (std::list<CAR>::iterator i = cars.begin(); i != cars.end(); ++i)
+	{
+		i->dynamics.QueueWheelRays(rays);
+	}
+
+	batched_us = single_us = max_difference = 0;
+	if (rays.size() == 0) return;
+
+	std::vector<COLLISION_CONTACT> batched(rays.size()), single(rays.size());
+	for (int n = 0; n < rays.size(); ++n)
+	{
+		batched[n] = single[n] = *rays[n].contact;
+		rays[n].contact = &batched[n];
+	}
+
+	const int repeats = 100;
+	benchmark::Stopwatch timer;
+	for (int r = 0; r < repeats; ++r)
+	{
+		world.castRays(rays);
+	}
+	batched_us = timer.Seconds() * 1E6 / (repeats * rays.size());
+
+	timer.Reset();
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (int n = 0; n < rays.size(); ++n)
+		{
+			const DynamicsWorld::Ray & ray = rays[n];
+			world.castRay(ray.origin, ray.direction, ray.length, ray.caster, single[n]);
+		}
+	}
+	single_us = timer.Seconds() * 1E6 / (repeats * rays.size());
+
+	for (int n = 0; n < rays.size(); ++n)
+	{
+		btScalar difference = (batched[n].GetPosition() - single[n].GetPosition()).length();
+		max_difference = std::max(max_difference, difference);
+	}
+}
+
+bool PERFORMANCE_TESTING::TestTrack(
+	const PATHMANAGER & pathmanager,
+	const std::string & trackname,
+	const std::string & carname,
+	const std::string & aitype,
+	int max_cars,
+	int max_threads,
+	int ticks,
+	float dt,
+	std::ostream & json_output,
+	std::ostream & info_output,
+	std::ostream & error_output)
+{
+	info_output << "Beginning track performance test on " << trackname << " with " << carname << std::endl;
+
+	PTree carconf;
+	file_open_basic fopen(pathmanager.GetCarPath(carname), pathmanager.GetCarPartsPath());
+	if (!read_ini(carname + ".car", fopen, carconf))
+	{
+		error_output << "Error loading car configuration file: " << carname << std::endl;
+		return false;
+	}
+
+	std::stringstream results;
+	bool success = true;
+	JobSystem jobs;
+	world.setJobSystem(&jobs);
+	bool trace_enabled = TraceProfiler::GetEnabled();
+	TraceProfiler::SetEnabled(true);
+	{
+		// destruction order: ai, cars, track, content
+		ContentManager content(error_output);
+		content.addPath(pathmanager.GetWriteableDataPath());
+		content.addPath(pathmanager.GetDataPath());
+		content.addSharedPath(pathmanager.GetCarPartsPath());
+		content.addSharedPath(pathmanager.GetTrackPartsPath());
+		content.setHeadless(true);
+
+		TRACK track;
+		std::list<CAR> cars;
+		AI ai;
+
+		std::vector<std::string> aitypes = ai.ListFactoryTypes();
+		if (std::find(aitypes.begin(), aitypes.end(), aitype) == aitypes.end())
+		{
+			error_output << "Unknown ai type: " << aitype << std::endl;
+			success = false;
+		}
+
+		// car state hash of the serial run for each car count
+		std::vector<unsigned int> serial_hash;
+
+		bool first_run = true;
+		for (int num_threads = 1; num_threads <= max_threads && success; num_threads *= 2)
+		{
+			jobs.Init(num_threads);
+			for (int num_cars = 1, run = 0; num_cars <= max_cars && success; num_cars *= 2, ++run)
+			{
+				// every run starts from a freshly loaded world
+				ai.clear_cars();
+				cars.clear();
+
+				benchmark::Stopwatch timer;
+				success = track.DeferredLoad(
+					content, world,
+					info_output, error_output,
+					pathmanager.GetTracksPath(trackname),
+					pathmanager.GetTracksDir() + "/" + trackname,
+					pathmanager.GetEffectsTextureDir(),
+					pathmanager.GetTrackPartsPath(),
+					0, false, true, false, false);
+				while (success && !track.Loaded())
+				{
+					success = track.ContinueDeferredLoad();
+				}
+				if (!success)
+				{
+					error_output << "Error loading track: " << trackname << std::endl;
+					break;
+				}
+				if (first_run)
+				{
+					info_output << "Track loaded in " << timer.Seconds() << " s" << std::endl;
+				}
+
+				for (int i = 0; i < num_cars; ++i)
+				{
+					cars.push_back(CAR());
+					CAR & car = cars.back();
+					if (!car.LoadPhysics(
+						carconf, pathmanager.GetCarsDir() + "/" + carname,
+						track.GetStart(i).first, track.GetStart(i).second,
+						true, true, false, content, world, error_output))
+					{
+						error_output << "Failed to load physics for car " << carname << std::endl;
+						success = false;
+						break;
+					}
+					ai.add_car(&car, 1.0, aitype);
+				}
+				if (!success) break;
+
+				// let the cars settle on the track before measuring
+				for (int tick = 0, settle = ticks / 10; tick < ticks + settle; ++tick)
+				{
+					if (tick == settle)
+					{
+						TraceProfiler::Clear();
+						timer.Reset();
+					}
+
+					{
+						PROFILE_SCOPE("ai");
+						ai.update(dt, cars, &jobs);
+					}
+
+					{
+						PROFILE_SCOPE("physics");
+						world.update(dt);
+					}
+
+					{
+						PROFILE_SCOPE("car");
+						for (std::list<CAR>::iterator i = cars.begin(); i != cars.end(); ++i)
+						{
+							i->Update(dt);
+							i->HandleInputs(ai.GetInputs(&*i));
+						}
+					}
+
+					track.Update();
+				}
+				double seconds = timer.Seconds();
+
+				unsigned int hash = HashCarStates(cars);
+				if (num_threads == 1) serial_hash.push_back(hash);
+				bool identical = (hash == serial_hash[run]);
+
+				// after hashing, QueueWheelRays changes the wheel contacts
+				double batched_us, single_us;
+				btScalar max_difference;
+				TestWheelRays(world, cars, batched_us, single_us, max_difference);
+
+				info_output << num_threads << " threads, " << num_cars << " cars: " << ticks / seconds << " ticks/s";
+				info_output << ", AI::update " << TraceProfiler::GetTotalMilliseconds("ai") / ticks << " ms/tick";
+				info_output << ", castRays " << batched_us << " us/ray, castRay " << single_us << " us/ray";
+				info_output << " (max difference " << max_difference << " m)";
+				if (!identical) info_output << ", differs from serial run";
+				info_output << std::endl;
+
+				if (!first_run) results << ",\n";
+				results << "    {\"threads\": " << num_threads;
+				results << ", \"cars\": " << num_cars;
+				results << ", \"seconds\": " << seconds;
+				results << ", \"ticks_per_second\": " << ticks / seconds;
+				results << ", \"state_hash\": " << hash;
+				results << ", \"matches_serial\": " << (identical ? "true" : "false");
+				results << ", \"ms_per_tick\": {";
+				for (int n = 0; n < track_test_blocks_num; ++n)
+				{
+					const char * name = track_test_blocks[n];
+					if (n) results << ", ";
+					results << "\"" << name << "\": " << TraceProfiler::GetTotalMilliseconds(name) / ticks;
+				}
+				results << "}";
+				results << ", \"us_per_wheel_ray\": {\"castRays\": " << batched_us << ", \"castRay\": " << single_us << "}";
+				results << ", \"wheel_ray_max_difference\": " << max_difference;
+				results << "}";
+				first_run = false;
+			}
+		}
+
+		ai.clear_cars();
+		cars.clear();
+	}
+	world.setJobSystem(0);
+	TraceProfiler::SetEnabled(trace_enabled);
+	world.reset();
+
+	json_output << "{\n";
+	json_output << "  \"track\": \"" << trackname << "\",\n";
+	json_output << "  \"car\": \"" << carname << "\",\n";
+	json_output << "  \"ai\": \"" << aitype << "\",\n";
+	json_output << "  \"ticks\": " << ticks << ",\n";
+	json_output << "  \"timestep\": " << dt << ",\n";
+	json_output << "  \"runs\": [\n" << results.str() << "\n  ]\n";
+	json_output << "}" << std::endl;
+
+	info_output << "Track performance test " << (success ? "complete." : "failed.") << std::endl;
+	return success;
+}
+
+bool PERFORMANCE_TESTING::LoadTrack(
+	const PATHMANAGER & pathmanager,
+	const std::string & trackname,
+	JobSystem & jobs,
+	const std::string & cachepath,
+	double & seconds,
+	unsigned int & hash,
+	std::ostream & error_output)
+{
+	// destruction order: track, content
+	// every load starts with an empty content cache
+	ContentManager content(error_output);
+	content.addPath(pathmanager.GetWriteableDataPath());
+	content.addPath(pathmanager.GetDataPath());
+	content.addSharedPath(pathmanager.GetTrackPartsPath());
+	content.setHeadless(true);
+
+	// track loading progress messages
+	std::ostringstream info_output;
+
+	TRACK track;
+	benchmark::Stopwatch timer;
+	bool success = track.DeferredLoad(
+		content, world,
+		info_output, error_output,
+		pathmanager.GetTracksPath(trackname),
+		pathmanager.GetTracksDir() + "/" + trackname,
+		pathmanager.GetEffectsTextureDir(),
+		pathmanager.GetTrackPartsPath(),
+		0, false, false, false, false,
+		&jobs, cachepath);
+	while (success && !track.Loaded())
+	{
+		success = track.ContinueDeferredLoad();
+	}
+	seconds = timer.Seconds();
+	hash = HashTrack(track, world);
+
+	if (!success)
+	{
+		error_output << "Error loading track: " << trackname << std::endl;
+	}
+	return success;
+}
+
+bool PERFORMANCE_TESTING::TestTrackLoad(
+	const PATHMANAGER & pathmanager,
+	const std::string & trackname,
+	int max_threads,
+	std::ostream & info_output,
+	std::ostream & error_output)
+{
+	std::list<std::string> tracks;
+	if (trackname.empty())
+	{
+		pathmanager.GetFileList(pathmanager.GetReadOnlyTracksPath(), tracks);
+	}
+	else
+	{
+		tracks.push_back(trackname);
+	}
+
+	info_output << "Beginning track load test with 1 to " << max_threads << " threads" << std::endl;
+
+	// cold and warm cache loads use a scratch cache
+	const std::string cachepath = pathmanager.GetTemporaryFolder() + "/trackcache";
+	PATHMANAGER::MakeDir(cachepath);
+
+	JobSystem jobs;
+	bool success = true;
+	for (std::list<std::string>::const_iterator t = tracks.begin(); t != tracks.end() && success; ++t)
+	{
+		const std::string & name = *t;
+		if (!std::ifstream((pathmanager.GetTracksPath(name) + "/track.txt").c_str()))
+		{
+			continue;
+		}
+
+		double seconds = 0, serial_seconds = 0;
+		unsigned int hash = 0, serial_hash = 0;
+		for (int num_threads = 1; num_threads <= max_threads && success; num_threads *= 2)
+		{
+			jobs.Init(num_threads);
+			success = LoadTrack(pathmanager, name, jobs, std::string(), seconds, hash, error_output);
+			if (!success) break;
+
+			if (num_threads == 1)
+			{
+				serial_hash = hash;
+				serial_seconds = seconds;
+			}
+
+			info_output << name << ", " << num_threads << " threads: " << seconds << " s";
+			if (num_threads > 1)
+			{
+				info_output << ", speedup " << serial_seconds / seconds;
+			}
+			if (hash != serial_hash)
+			{
+				info_output << ", differs from serial load";
+				success = false;
+			}
+			info_output << std::endl;
+		}
+		if (!success) break;
+
+		// serial cold load writes the cache, the warm load reads it
+		jobs.Init(1);
+		std::remove(TRACKCACHE::GetPath(cachepath, name, false).c_str());
+		double cold_seconds = 0, warm_seconds = 0;
+		unsigned int cold_hash = 0, warm_hash = 0;
+		success = LoadTrack(pathmanager, name, jobs, cachepath, cold_seconds, cold_hash, error_output) &&
+			LoadTrack(pathmanager, name, jobs, cachepath, warm_seconds, warm_hash, error_output);
+		if (!success) break;
+
+		info_output << name << ", track cache: cold " << cold_seconds << " s, warm " << warm_seconds << " s";
+		info_output << ", speedup " << cold_seconds / warm_seconds;
+		if (cold_hash != serial_hash || warm_hash != serial_hash)
+		{
+			info_output << ", differs from uncached load";
+			success = false;
+		}
+		info_output << std::endl;
+		std::remove(TRACKCACHE::GetPath(cachepath, name, false).c_str());
+	}
+	world.reset();
+
+	info_output << "Track load test " << (success ? "complete." : "failed.") << std::endl;
+	return success;
+}
+
+struct LARGEST_MESH
+{
+	LARGEST_MESH() : triangles(0) {}
+	std::string name;
+	int triangles;
+	VERTEXARRAY mesh;
+};
+
+static void FindLargestMesh(
+	const std::string & dir,
+	const std::list<std::string> & files,
+	const JOEPACK * pack,
+	LARGEST_MESH & largest,
+	std::ostream & error_output)
+{
+	for (std::list<std::string>::const_iterator i = files.begin(); i != files.end(); ++i)
+	{
+		if (i->length() < 4 || i->substr(i->length() - 4) != ".joe")
+		{
+			continue;
+		}
+
+		// keep the file order, it is what we are measuring
+		MODEL_JOE03 model;
+		const std::string path = dir + "/" + *i;
+		if (!model.LoadMesh(pack ? *i : path, error_output, pack, false))
+		{
+			continue;
+		}
+
+		const int triangles = model.GetVertexArray().GetNumFaces() / 3;
+		if (triangles > largest.triangles)
+		{
+			largest.name = path;
+			largest.triangles = triangles;
+			largest.mesh = model.GetVertexArray();
+		}
+	}
+}
+
+static void TestMesh(const LARGEST_MESH & largest, std::ostream & info_output)
+{
+	const VERTEXARRAY & mesh = largest.mesh;
+	std::vector<VERTEXARRAY::FACE> faces;
+	faces.reserve(largest.triangles);
+	for (int f = 0; f < largest.triangles; ++f)
+	{
+		VERTEXARRAY::VERTEXDATA data[3];
+		for (int v = 0; v < 3; ++v)
+		{
+			std::vector<float> vert = mesh.GetVertex(f, v);
+			std::vector<float> norm = mesh.GetNormal(f, v);
+			std::vector<float> tc = mesh.GetTextureCoordinate(f, v, 0);
+			data[v] = VERTEXARRAY::VERTEXDATA(
+				VERTEXARRAY::TRIFLOAT(vert[0], vert[1], vert[2]),
+				VERTEXARRAY::TRIFLOAT(norm[0], norm[1], norm[2]),
+				VERTEXARRAY::TWOFLOAT(tc[0], tc[1]));
+		}
+		faces.push_back(VERTEXARRAY::FACE(data[0], data[1], data[2]));
+	}
+
+	const int runs = 10;
+	VERTEXARRAY varray;
+	benchmark::Stopwatch timer;
+	for (int i = 0; i < runs; ++i)
+	{
+		varray.BuildFromFaces(faces);
+	}
+	const double weld_time = timer.Seconds() / runs;
+	const float acmr = varray.GetACMR();
+
+	VERTEXARRAY optimized;
+	timer.Reset();
+	for (int i = 0; i < runs; ++i)
+	{
+		optimized = varray;
+		optimized.OptimizeVertexCache();
+	}
+	const double optimize_time = timer.Seconds() / runs;
+
+	const float * vertices = 0;
+	int vertexnum = 0;
+	varray.GetVertices(vertices, vertexnum);
+	info_output << largest.name << ": " << largest.triangles << " triangles, " << vertexnum / 3 << " vertices";
+	info_output << ", weld " << weld_time * 1E3 << " ms, optimize " << optimize_time * 1E3 << " ms";
+	info_output << ", acmr " << acmr << " -> " << optimized.GetACMR() << std::endl;
+}
+
+bool PERFORMANCE_TESTING::TestMeshes(
+	const PATHMANAGER & pathmanager,
+	std::ostream & info_output,
+	std::ostream & error_output)
+{
+	info_output << "Beginning mesh test" << std::endl;
+
+	LARGEST_MESH car_mesh;
+	std::list<std::string> cars;
+	pathmanager.GetFileList(pathmanager.GetReadOnlyCarsPath(), cars);
+	for (std::list<std::string>::const_iterator i = cars.begin(); i != cars.end(); ++i)
+	{
+		const std::string cardir = pathmanager.GetReadOnlyCarsPath() + "/" + *i;
+		std::list<std::string> files;
+		pathmanager.GetFileList(cardir, files, ".joe");
+		FindLargestMesh(cardir, files, 0, car_mesh, error_output);
+	}
+
+	LARGEST_MESH track_mesh;
+	std::list<std::string> tracks;
+	pathmanager.GetFileList(pathmanager.GetReadOnlyTracksPath(), tracks);
+	for (std::list<std::string>::const_iterator i = tracks.begin(); i != tracks.end(); ++i)
+	{
+		const std::string objectdir = pathmanager.GetReadOnlyTracksPath() + "/" + *i + "/objects";
+		std::list<std::string> files;
+		JOEPACK pack;
+		if (pack.Load(objectdir + "/objects.jpk"))
+		{
+			pack.GetFileList(files);
+			FindLargestMesh(objectdir, files, &pack, track_mesh, error_output);
+		}
+		else
+		{
+			pathmanager.GetFileList(objectdir, files, ".joe");
+			FindLargestMesh(objectdir, files, 0, track_mesh, error_output);
+		}
+	}
+
+	if (!car_mesh.triangles && !track_mesh.triangles)
+	{
+		error_output << "No car or track meshes found" << std::endl;
+		return false;
+	}
+
+	if (car_mesh.triangles)
+	{
+		TestMesh(car_mesh, info_output);
+	}
+	if (track_mesh.triangles)
+	{
+		TestMesh(track_mesh, info_output);
+	}
+
+	info_output << "Mesh test complete." << std::endl;
+	return true;
+}
+
 void PERFORMANCE_TESTING::ResetCar()
 {
 	std::stringstream statestream(carstate);
@@ -129,6 +746,85 @@ void PERFORMANCE_TESTING::SimulateFlatRoad()
 	}*/
 }
 
+// binary output one element at a time with item names, the path containers
+// and bullet vectors took before the joeserialize array fast paths
+class ELEMENTWISE_OUTPUT_SERIALIZER : public joeserialize::BinaryOutputSerializer
+{
+public:
+	ELEMENTWISE_OUTPUT_SERIALIZER(std::ostream & out) : joeserialize::BinaryOutputSerializer(out) {}
+	virtual bool IgnoresNames() const {return false;}
+	virtual bool SerializeArray(const std::string & name, int * t, unsigned count) {return SerializeElements(name, t, count);}
+	virtual bool SerializeArray(const std::string & name, unsigned int * t, unsigned count) {return SerializeElements(name, t, count);}
+	virtual bool SerializeArray(const std::string & name, float * t, unsigned count) {return SerializeElements(name, t, count);}
+	virtual bool SerializeArray(const std::string & name, double * t, unsigned count) {return SerializeElements(name, t, count);}
+};
+
+void PERFORMANCE_TESTING::TestSerialization(std::ostream & info_output, std::ostream & error_output)
+{
+	const int runs = 10000;
+	std::vector<char> buffer(carstate.size());
+
+	// restoring the state writes the same values back, the car is unchanged
+	benchmark::Stopwatch timer;
+	std::stringstream stream;
+	for (int i = 0; i < runs; i++)
+	{
+		stream.str(std::string());
+		ELEMENTWISE_OUTPUT_SERIALIZER out(stream);
+		car.Serialize(out);
+	}
+	double element_write = timer.Seconds();
+
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+	{
+		stream.str(std::string());
+		joeserialize::BinaryOutputSerializer out(stream);
+		car.Serialize(out);
+	}
+	double stream_write = timer.Seconds();
+
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+	{
+		stream.clear();
+		stream.seekg(0);
+		joeserialize::BinaryInputSerializer in(stream);
+		car.Serialize(in);
+	}
+	double stream_read = timer.Seconds();
+
+	timer.Reset();
+	bool span_ok = true;
+	for (int i = 0; i < runs; i++)
+	{
+		joeserialize::BinarySpanOutputSerializer out(&buffer[0], buffer.size());
+		span_ok = car.Serialize(out) && span_ok;
+	}
+	double span_write = timer.Seconds();
+
+	timer.Reset();
+	for (int i = 0; i < runs; i++)
+	{
+		joeserialize::BinarySpanInputSerializer in(&buffer[0], buffer.size());
+		span_ok = car.Serialize(in) && span_ok;
+	}
+	double span_read = timer.Seconds();
+
+	if (!span_ok || std::string(&buffer[0], buffer.size()) != carstate)
+	{
+		error_output << "Span serialization doesn't match the stream serialization" << std::endl;
+	}
+
+	double mb = double(runs) * carstate.size() / (1 << 20);
+	info_output << "Car state serialization (" << carstate.size() << " bytes, MB/s):\n" <<
+		"write element by element: " << mb / element_write << "\n" <<
+		"write stream: " << mb / stream_write << "\n" <<
+		"write span: " << mb / span_write << "\n" <<
+		"read stream: " << mb / stream_read << "\n" <<
+		"read span: " << mb / span_read << std::endl;
+}
+
 void PERFORMANCE_TESTING::TestMaxSpeed(std::ostream & info_output, std::ostream & error_output)
 {
 	info_output << "Testing maximum speed" << std::endl;
@@ -26,6 +26,8 @@
 #include <ostream>
 
 class DynamicsWorld;
+class PATHMANAGER;
+class JobSystem;
 
 class PERFORMANCE_TESTING
 {
@@ -39,6 +41,42 @@ public:
 		std::ostream & info_output,
 		std::ostream & error_output);
 
+	/// Headless multi-car benchmark. Loads the track without creating GL objects,
+	/// runs ticks with 1, 2, 4 .. max_cars ai driven cars, stepping the cars on
+	/// 1, 2, 4 .. max_threads threads, and writes per-subsystem timings,
+	/// ticks per second and a car state hash per run as json.
+	bool TestTrack(
+		const PATHMANAGER & pathmanager,
+		const std::string & trackname,
+		const std::string & carname,
+		const std::string & aitype,
+		int max_cars,
+		int max_threads,
+		int ticks,
+		float dt,
+		std::ostream & json_output,
+		std::ostream & info_output,
+		std::ostream & error_output);
+
+	/// Headless track load benchmark. Loads trackname, or every bundled track
+	/// if it is empty, with 1, 2, 4 .. max_threads job threads and with a cold
+	/// and a warm track cache, reports the load times and checks the loaded
+	/// track against the serial uncached load.
+	bool TestTrackLoad(
+		const PATHMANAGER & pathmanager,
+		const std::string & trackname,
+		int max_threads,
+		std::ostream & info_output,
+		std::ostream & error_output);
+
+	/// Mesh build benchmark. Finds the largest bundled car and track meshes,
+	/// rebuilds them from their triangles and reports the weld and vertex cache
+	/// optimization times and the average cache miss ratio before and after.
+	bool TestMeshes(
+		const PATHMANAGER & pathmanager,
+		std::ostream & info_output,
+		std::ostream & error_output);
+
 private:
 	DynamicsWorld & world;
 	TRACKSURFACE surface;
@@ -49,6 +87,17 @@ private:
 
 	void ResetCar();
 
+	bool LoadTrack(
+		const PATHMANAGER & pathmanager,
+		const std::string & trackname,
+		JobSystem & jobs,
+		const std::string & cachepath,
+		double & seconds,
+		unsigned int & hash,
+		std::ostream & error_output);
+
+	void TestSerialization(std::ostream & info_output, std::ostream & error_output);
+
 	void TestMaxSpeed(std::ostream & info_output, std::ostream & error_output);
 
 	void TestStoppingDistance(bool abs, std::ostream & info_output, std::ostream & error_output);
@@ -466,10 +466,13 @@ void RENDER_INPUT_SCENE::DrawList(GLSTATEMANAGER & glstate, const std::vector <D
 	unsigned int drawcount = 0;
 	unsigned int loopcount = 0;
 
+	if (!preculled)
+		FrustumCull(drawlist);
+
 	for (std::vector <DRAWABLE*>::const_iterator ptr = drawlist.begin(); ptr != drawlist.end(); ptr++, loopcount++)
 	{
 		DRAWABLE * i = *ptr;
-		if (preculled || !FrustumCull(*i))
+		if (preculled || cull_visible[loopcount])
 		{
 			drawcount++;
 
@@ -513,6 +516,15 @@ void RENDER_INPUT_SCENE::DrawList(GLSTATEMANAGER & glstate, const std::vector <D
 							glEnableClientState(GL_NORMAL_ARRAY);
 						}
 
+						const float * colors;
+						int colorcount;
+						i->GetVertArray()->GetColors(colors, colorcount);
+						if (colorcount > 0 && colors)
+						{
+							glColorPointer(4, GL_FLOAT, 0, colors);
+							glEnableClientState(GL_COLOR_ARRAY);
+						}
+
 						const float * tc[1];
 						int tccount[1];
 						if (i->GetVertArray()->GetTexCoordSets() > 0)
@@ -529,6 +541,15 @@ void RENDER_INPUT_SCENE::DrawList(GLSTATEMANAGER & glstate, const std::vector <D
 
 						glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 						glDisableClientState(GL_NORMAL_ARRAY);
+
+						if (colorcount > 0 && colors)
+						{
+							// the current color is undefined after drawing with a color array
+							float r, g, b, a;
+							i->GetColor(r, g, b, a);
+							glDisableClientState(GL_COLOR_ARRAY);
+							glColor4f(r, g, b, a);
+						}
 					}
 					else if (i->GetLineSize() > 0)
 					{
@@ -545,43 +566,29 @@ void RENDER_INPUT_SCENE::DrawList(GLSTATEMANAGER & glstate, const std::vector <D
 	}
 }
 
-bool RENDER_INPUT_SCENE::FrustumCull(DRAWABLE & tocull)
+void RENDER_INPUT_SCENE::FrustumCull(const std::vector <DRAWABLE*> & drawlist)
 {
-	//return false;
-
-	DRAWABLE * d (&tocull);
-	//if (d->GetRadius() != 0.0 && d->parent != NULL && !d->skybox)
-	if (d->GetRadius() != 0.0 && !d->GetSkybox() && d->GetCameraTransformEnable())
+	// gather the world space bounding spheres, then cull them in batches
+	cull_spheres.Clear();
+	cull_spheres.Reserve(drawlist.size());
+	for (std::vector <DRAWABLE*>::const_iterator i = drawlist.begin(); i != drawlist.end(); ++i)
 	{
-		//do frustum culling
-		MATHVECTOR <float, 3> objpos(d->GetObjectCenter());
-		d->GetTransform().TransformVectorOut(objpos[0],objpos[1],objpos[2]);
-		float dx=objpos[0]-cam_position[0]; float dy=objpos[1]-cam_position[1]; float dz=objpos[2]-cam_position[2];
-		float rc=dx*dx+dy*dy+dz*dz;
-		float temp_lod_far = lod_far + d->GetRadius();
-		if (rc > temp_lod_far*temp_lod_far)
-			return true;
-		else if (rc < d->GetRadius()*d->GetRadius())
-			return false;
+		DRAWABLE * d = *i;
+		if (d->GetRadius() != 0.0 && !d->GetSkybox() && d->GetCameraTransformEnable())
+		{
+			MATHVECTOR <float, 3> objpos(d->GetObjectCenter());
+			d->GetTransform().TransformVectorOut(objpos[0],objpos[1],objpos[2]);
+			cull_spheres.Add(objpos, d->GetRadius());
+		}
 		else
 		{
-			float bound, rd;
-			bound = d->GetRadius();
-			for (int i=0; i<6; i++)
-			{
-				rd=frustum.frustum[i][0]*objpos[0]+
-						frustum.frustum[i][1]*objpos[1]+
-						frustum.frustum[i][2]*objpos[2]+
-						frustum.frustum[i][3];
-				if (rd <= -bound)
-				{
-					return true;
-				}
-			}
+			cull_spheres.AddUnbounded();
 		}
 	}
 
-	return false;
+	cull_visible.resize(drawlist.size());
+	if (!drawlist.empty())
+		cull_spheres.Cull(frustum, cam_position, lod_far, &cull_visible[0]);
 }
 
 void RENDER_INPUT_SCENE::SelectAppropriateShader(DRAWABLE & forme)
@@ -25,6 +25,7 @@
 #include "quaternion.h"
 #include "matrix4.h"
 #include "frustum.h"
+#include "frustumcull.h"
 #include "reseatable_reference.h"
 #include <vector>
 
@@ -103,6 +104,8 @@ private:
 	float camfov;
 	FRUSTUM frustum; //used for frustum culling
 	float lod_far; //used for distance culling
+	FRUSTUMCULL cull_spheres;
+	std::vector <unsigned char> cull_visible;
 	bool shaders;
 	bool clearcolor, cleardepth;
 	reseatable_reference <SHADER_GLSL> shader;
@@ -121,8 +124,8 @@ private:
 
 	void DrawList(GLSTATEMANAGER & glstate, const std::vector <DRAWABLE*> & drawlist, bool preculled);
 
-	/// returns true if the object was culled and should not be drawn
-	bool FrustumCull(DRAWABLE & tocull);
+	/// sets cull_visible to 0 for the drawables which were culled and should not be drawn
+	void FrustumCull(const std::vector <DRAWABLE*> & drawlist);
 
 	void SelectAppropriateShader(DRAWABLE & forme);
 
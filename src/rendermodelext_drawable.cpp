@@ -54,7 +54,17 @@ void RenderModelExternalDrawable::draw(GLWrapper & gl) const
 
 			gl.DisableVertexAttribArray(VERTEX_TANGENT);
 			gl.DisableVertexAttribArray(VERTEX_BITANGENT);
-			gl.DisableVertexAttribArray(VERTEX_COLOR);
+
+			const float * colors;
+			int colorcount;
+			vert_array->GetColors(colors, colorcount);
+			if (colors)
+			{
+				gl.VertexAttribPointer(VERTEX_COLOR, 4, GL_FLOAT, GL_FALSE, 0, colors);
+				gl.EnableVertexAttribArray(VERTEX_COLOR);
+			}
+			else
+				gl.DisableVertexAttribArray(VERTEX_COLOR);
 
 			const float * tc[1];
 			int tccount[1];
@@ -21,32 +21,321 @@
 #include "unittest.h"
 #include "cfg/ptree.h"
 #include "carinput.h"
+#include "allocationcounter.h"
+#include "lzcompressor.h"
+#include "benchmark.h"
 
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+// V15 stores the frames in chunks that start with a state keyframe, followed by
+// the chunk index and the index offset as two unsigned ints at the very end.
+// V16 chunks hold up to STATES_PER_CHUNK keyframes and are compressed.
+static const char * const v14_format_version = "VDRIFTREPLAYV14";
+static const char * const v15_format_version = "VDRIFTREPLAYV15";
+static const int index_trailer_size = 2 * sizeof(unsigned);
+
+// V16 chunk encoding: frame numbers are zigzag varint deltas, input values that
+// are exact multiples of 1/input_quantum are stored as varints and the others as
+// raw floats, so quantisation never changes what is played back
+static const float input_quantum = 1024;
+
+static void PutVarint(std::string & output, unsigned value)
+{
+	for (; value >= 128; value >>= 7)
+		output.push_back(char((value & 127) | 128));
+	output.push_back(char(value));
+}
+
+static void PutSigned(std::string & output, int value)
+{
+	PutVarint(output, (unsigned(value) << 1) ^ unsigned(value >> 31));
+}
+
+static void PutInput(std::string & output, float value)
+{
+	float scaled = value * input_quantum;
+	if (scaled > -1E6 && scaled < 1E6)
+	{
+		// bitwise compare, -0.0 has to stay a raw float
+		float quantised = int(scaled) / input_quantum;
+		if (std::memcmp(&quantised, &value, sizeof(value)) == 0)
+		{
+			PutSigned(output, int(scaled) * 2);
+			return;
+		}
+	}
+
+	unsigned bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	output.push_back(char(1));
+	for (int shift = 24; shift >= 0; shift -= 8)
+		output.push_back(char(bits >> shift));
+}
+
+// bounds checked reader for the V16 chunk encoding
+class CHUNKREADER
+{
+public:
+	CHUNKREADER(const std::string & data) :
+		p((const unsigned char *)data.data()),
+		end(p + data.size()),
+		good(true)
+	{
+		// ctor
+	}
+
+	bool Good() const {return good;}
+
+	bool AtEnd() const {return p == end;}
+
+	unsigned Varint()
+	{
+		unsigned value = 0;
+		for (unsigned shift = 0; shift < 35; shift += 7)
+		{
+			if (p == end) break;
+			unsigned char c = *p++;
+			value |= unsigned(c & 127) << shift;
+			if (!(c & 128)) return value;
+		}
+		good = false;
+		return 0;
+	}
+
+	int Signed()
+	{
+		unsigned value = Varint();
+		return int(value >> 1) ^ -int(value & 1);
+	}
+
+	float Input()
+	{
+		int code = Signed();
+		if (code != -1)
+			return (code / 2) / input_quantum;
+
+		if (end - p < 4)
+		{
+			good = false;
+			return 0;
+		}
+		unsigned bits = (unsigned(p[0]) << 24) | (unsigned(p[1]) << 16) | (unsigned(p[2]) << 8) | p[3];
+		p += 4;
+		float value;
+		std::memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	const char * Bytes(unsigned count)
+	{
+		if (unsigned(end - p) < count)
+		{
+			good = false;
+			return 0;
+		}
+		const char * bytes = (const char *)p;
+		p += count;
+		return bytes;
+	}
+
+private:
+	const unsigned char * p;
+	const unsigned char * end;
+	bool good;
+};
+
+// compare a frame number with the frame of a replay frame, for upper_bound
+struct FRAMELESS
+{
+	template <class T>
+	bool operator()(int frame, const T & t) const
+	{
+		return frame < t.GetFrame();
+	}
+};
 
 REPLAY::REPLAY(float framerate) :
-	version_info("VDRIFTREPLAYV14", CARINPUT::GAME_ONLY_INPUTS_START_HERE, framerate),
+	version_info("VDRIFTREPLAYV16", CARINPUT::GAME_ONLY_INPUTS_START_HERE, framerate),
 	frame(0),
 	replaymode(IDLE),
-	inputbuffer(CARINPUT::GAME_ONLY_INPUTS_START_HERE, 0)
+	inputbuffer(CARINPUT::GAME_ONLY_INPUTS_START_HERE, 0),
+	cur_inputframe(0),
+	cur_stateframe(0),
+	cur_chunk(0),
+	replayformat(FORMAT_V16),
+	input_records_written(0),
+	input_records_flushed(0),
+	state_records_written(0),
+	state_records_flushed(0),
+	record_quit(false),
+	record_waiting(false),
+	record_lock(SDL_CreateMutex()),
+	record_wake(SDL_CreateSemaphore(0)),
+	record_space(SDL_CreateSemaphore(0)),
+	record_writer(0),
+	record_error_log(0),
+	record_dropped_states(0),
+	record_allocations(0),
+	record_allocation_frames(0),
+	record_allocations_per_frame(0)
 {
 	// ctor
 }
 
-void REPLAY::Save(std::ostream & outstream)
+REPLAY::~REPLAY()
 {
-	joeserialize::BinaryOutputSerializer serialize_output(outstream);
+	StopRecording("");
+	SDL_DestroySemaphore(record_space);
+	SDL_DestroySemaphore(record_wake);
+	SDL_DestroyMutex(record_lock);
+}
 
-	//the convention is that input frames come first, then state frames.
+void REPLAY::SaveChunk(std::ostream & outstream)
+{
+	// chunks are found by their keyframe
+	int chunkframe = 0;
+	if (!stateframes.empty())
+		chunkframe = stateframes[0].GetFrame();
+	else if (!inputframes.empty())
+		chunkframe = inputframes[0].GetFrame();
+	keyframes.push_back(KEYFRAME(chunkframe, outstream.tellp()));
+
+	EncodeChunk(chunk_data);
+	assert(chunk_data.size() <= MAX_CHUNK_SIZE);
+	LZCOMPRESSOR::Compress(chunk_data, chunk_packed);
+
+	joeserialize::BinaryOutputSerializer serialize_output(outstream);
 	joeserialize::Serializer & s = serialize_output;
-	s.Serialize("inputframes", inputframes);
-	s.Serialize("stateframes", stateframes);
+	s.Serialize("chunk", chunk_packed);
 
 	inputframes.clear();
 	stateframes.clear();
 }
 
+void REPLAY::EncodeChunk(std::string & output) const
+{
+	output.clear();
+
+	//the convention is that input frames come first, then state frames.
+	int lastframe = 0;
+	PutVarint(output, inputframes.size());
+	for (std::vector<INPUTFRAME>::const_iterator i = inputframes.begin(); i != inputframes.end(); ++i)
+	{
+		PutSigned(output, i->GetFrame() - lastframe);
+		lastframe = i->GetFrame();
+		PutVarint(output, i->GetNumInputs());
+		for (unsigned n = 0; n < i->GetNumInputs(); n++)
+		{
+			PutVarint(output, i->GetInput(n).first);
+			PutInput(output, i->GetInput(n).second);
+		}
+	}
+
+	//state data is xored with the previous state, unchanged bytes become zeros
+	static const std::string nostate;
+	const std::string * laststate = &nostate;
+	lastframe = 0;
+	PutVarint(output, stateframes.size());
+	for (std::vector<STATEFRAME>::const_iterator i = stateframes.begin(); i != stateframes.end(); ++i)
+	{
+		PutSigned(output, i->GetFrame() - lastframe);
+		lastframe = i->GetFrame();
+
+		const std::vector<float> & snapshot = i->GetInputSnapshot();
+		PutVarint(output, snapshot.size());
+		for (unsigned n = 0; n < snapshot.size(); n++)
+		{
+			PutInput(output, snapshot[n]);
+		}
+
+		const std::string & state = i->GetBinaryStateData();
+		PutVarint(output, state.size());
+		for (unsigned n = 0; n < state.size(); n++)
+		{
+			output.push_back(n < laststate->size() ? char(state[n] ^ (*laststate)[n]) : state[n]);
+		}
+		laststate = &state;
+	}
+}
+
+bool REPLAY::DecodeChunk(const std::string & input)
+{
+	CHUNKREADER reader(input);
+
+	int lastframe = 0;
+	unsigned count = reader.Varint();
+	for (unsigned i = 0; i < count && reader.Good(); i++)
+	{
+		lastframe += reader.Signed();
+		inputframes.push_back(INPUTFRAME(lastframe));
+		unsigned inputs = reader.Varint();
+		for (unsigned n = 0; n < inputs && reader.Good(); n++)
+		{
+			//playback uses the input index unchecked
+			unsigned index = reader.Varint();
+			float value = reader.Input();
+			if (index >= (unsigned)CARINPUT::GAME_ONLY_INPUTS_START_HERE)
+				return false;
+			inputframes.back().AddInput(index, value);
+		}
+	}
+
+	std::vector<float> snapshot;
+	std::string state;
+	lastframe = 0;
+	count = reader.Varint();
+	for (unsigned i = 0; i < count && reader.Good(); i++)
+	{
+		lastframe += reader.Signed();
+		stateframes.push_back(STATEFRAME(lastframe));
+
+		//playback only copies the inputs it knows, more would just take memory
+		unsigned inputs = reader.Varint();
+		if (inputs > (unsigned)CARINPUT::GAME_ONLY_INPUTS_START_HERE)
+			return false;
+		snapshot.resize(inputs);
+		for (unsigned n = 0; n < snapshot.size() && reader.Good(); n++)
+		{
+			snapshot[n] = reader.Input();
+		}
+		stateframes.back().SetInputSnapshot(snapshot);
+
+		unsigned size = reader.Varint();
+		const char * bytes = reader.Bytes(size);
+		if (!bytes) break;
+		unsigned common = std::min(size, unsigned(state.size()));
+		state.resize(size);
+		for (unsigned n = 0; n < common; n++)
+		{
+			state[n] ^= bytes[n];
+		}
+		std::copy(bytes + common, bytes + size, state.begin() + common);
+		stateframes.back().SetBinaryStateData(state);
+	}
+
+	return reader.Good() && reader.AtEnd();
+}
+
+void REPLAY::SaveIndex(std::ostream & outstream)
+{
+	std::streamoff offset = outstream.tellp();
+	unsigned index_offset[2] = {unsigned(offset >> 32), unsigned(offset & 0xffffffff)};
+
+	joeserialize::BinaryOutputSerializer serialize_output(outstream);
+	joeserialize::Serializer & s = serialize_output;
+	s.Serialize("index", keyframes);
+	s.Serialize("index_offset_high", index_offset[0]);
+	s.Serialize("index_offset_low", index_offset[1]);
+
+	keyframes.clear();
+}
+
 void REPLAY::SaveHeader(std::ostream & outstream)
 {
 	//write the file format version data manually.  if the serialization functions were used, a variable length string would be written instead, which isn't exactly what we want
@@ -79,12 +368,129 @@ bool REPLAY::Load(std::istream & instream)
 	return true;
 }
 
+bool REPLAY::LoadIndex(std::istream & instream, std::ostream & error_output)
+{
+	// the header has been read, chunks start here
+	std::streamoff chunks_begin = instream.tellg();
+
+	instream.seekg(0, std::ios::end);
+	std::streamoff index_end = std::streamoff(instream.tellg()) - index_trailer_size;
+	if (index_end < chunks_begin)
+	{
+		error_output << "Replay chunk index is missing" << std::endl;
+		return false;
+	}
+
+	unsigned index_offset[2] = {0, 0};
+	instream.seekg(index_end);
+	joeserialize::BinaryInputSerializer serialize_input(instream);
+	joeserialize::Serializer & s = serialize_input;
+	s.Serialize("index_offset_high", index_offset[0]);
+	s.Serialize("index_offset_low", index_offset[1]);
+
+	std::streamoff index_begin = (std::streamoff(index_offset[0]) << 32) | index_offset[1];
+	if (!instream || index_begin < chunks_begin || index_begin > index_end)
+	{
+		error_output << "Replay chunk index offset is invalid" << std::endl;
+		return false;
+	}
+
+	instream.seekg(index_begin);
+	keyframes.clear();
+	if (!s.Serialize("index", keyframes) || !instream)
+	{
+		error_output << "Error loading replay chunk index" << std::endl;
+		return false;
+	}
+
+	// chunks are sorted by frame and offset, which seeking relies on
+	for (unsigned i = 0; i < keyframes.size(); i++)
+	{
+		if (keyframes[i].GetOffset() < chunks_begin || keyframes[i].GetOffset() >= index_begin ||
+			(i > 0 && (keyframes[i].GetFrame() < keyframes[i-1].GetFrame() ||
+			keyframes[i].GetOffset() <= keyframes[i-1].GetOffset())))
+		{
+			error_output << "Replay chunk index is corrupt" << std::endl;
+			keyframes.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool REPLAY::LoadChunk(unsigned chunk)
+{
+	assert(chunk < keyframes.size());
+
+	inputframes.clear();
+	stateframes.clear();
+	cur_inputframe = 0;
+	cur_stateframe = 0;
+	cur_chunk = chunk;
+
+	replaystream.clear();
+	replaystream.seekg(keyframes[chunk].GetOffset());
+	if (replayformat == FORMAT_V15)
+		return Load(replaystream);
+
+	joeserialize::BinaryInputSerializer serialize_input(replaystream);
+	joeserialize::Serializer & s = serialize_input;
+	return s.Serialize("chunk", chunk_packed) && replaystream &&
+		LZCOMPRESSOR::Decompress(chunk_packed, chunk_data, MAX_CHUNK_SIZE) &&
+		DecodeChunk(chunk_data);
+}
+
+bool REPLAY::LoadAll(const std::string & replayfilename, std::ostream & error_output)
+{
+	if (!StartPlaying(replayfilename, error_output))
+		return false;
+
+	std::vector<INPUTFRAME> allinputframes;
+	std::vector<STATEFRAME> allstateframes;
+	for (unsigned chunk = 0; chunk < keyframes.size(); chunk++)
+	{
+		if (chunk > 0 && !LoadChunk(chunk))
+		{
+			error_output << "Error loading replay chunk " << chunk << " of " << replayfilename << std::endl;
+			StopPlaying();
+			return false;
+		}
+		allinputframes.insert(allinputframes.end(), inputframes.begin(), inputframes.end());
+		allstateframes.insert(allstateframes.end(), stateframes.begin(), stateframes.end());
+	}
+
+	if (!keyframes.empty())
+	{
+		inputframes.swap(allinputframes);
+		stateframes.swap(allstateframes);
+	}
+	return true;
+}
+
 bool REPLAY::LoadHeader(std::istream & instream, std::ostream & error_output)
 {
 	VERSION stream_version;
 	stream_version.Load(instream);
 
-	if (!(stream_version == version_info))
+	// older versions differ in the frame storage only
+	VERSION v14_version = version_info;
+	v14_version.format_version = v14_format_version;
+	VERSION v15_version = version_info;
+	v15_version.format_version = v15_format_version;
+	if (stream_version == version_info)
+	{
+		replayformat = FORMAT_V16;
+	}
+	else if (stream_version == v15_version)
+	{
+		replayformat = FORMAT_V15;
+	}
+	else if (stream_version == v14_version)
+	{
+		replayformat = FORMAT_V14;
+	}
+	else
 	{
 		error_output << "Stream version " <<
 			stream_version.format_version << "/" <<
@@ -113,8 +519,19 @@ void REPLAY::GetReadyToRecord()
 	replaymode = RECORDING;
 	inputframes.clear();
 	stateframes.clear();
+	keyframes.clear();
 	inputbuffer.clear();
 	inputbuffer.resize(CARINPUT::GAME_ONLY_INPUTS_START_HERE, 0);
+
+	//records are allocated once and reused by following recordings
+	input_records.resize(INPUT_RECORDS);
+	state_records.resize(STATE_RECORDS);
+	input_records_written = input_records_flushed = 0;
+	state_records_written = state_records_flushed = 0;
+	record_allocations = 0;
+	record_allocation_frames = 0;
+	record_allocations_per_frame = 0;
+	record_dropped_states = 0;
 }
 
 void REPLAY::StartRecording(
@@ -123,18 +540,40 @@ void REPLAY::StartRecording(
 	const MATHVECTOR<float, 3> & newcarcolor,
 	const PTree & carconfig,
 	const std::string & trackname,
+	const std::string & recordingfilename,
 	std::ostream & error_log)
 {
+	StopRecording("");
+
 	track = trackname;
 	cartype = newcartype;
 	carpaint = newcarpaint;
 	carcolor = newcarcolor;
 
-	GetReadyToRecord();
-
 	std::stringstream carstream;
 	carconfig.write(carstream);
 	carfile = carstream.str();
+
+	recordfilename = recordingfilename;
+	recordfile.clear();
+	recordfile.open(recordfilename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!recordfile)
+	{
+		error_log << "Error opening replay recording file: " << recordfilename << std::endl;
+		return;
+	}
+
+	GetReadyToRecord();
+	SaveHeader(recordfile);
+
+	record_error_log = &error_log;
+	record_quit = false;
+	record_waiting = false;
+#if SDL_VERSION_ATLEAST(2,0,0)
+	record_writer = SDL_CreateThread(RecordWriter, "replay", this);
+#else
+	record_writer = SDL_CreateThread(RecordWriter, this);
+#endif
 }
 
 void REPLAY::GetReadyToPlay()
@@ -145,8 +584,12 @@ void REPLAY::GetReadyToPlay()
 	inputbuffer.resize(CARINPUT::GAME_ONLY_INPUTS_START_HERE, 0);
 
 	//set the playback position at the beginning
+	inputframes.clear();
+	stateframes.clear();
+	keyframes.clear();
 	cur_inputframe = 0;
 	cur_stateframe = 0;
+	cur_chunk = 0;
 }
 
 bool REPLAY::StartPlaying(const std::string & replayfilename, std::ostream & error_output)
@@ -154,42 +597,265 @@ bool REPLAY::StartPlaying(const std::string & replayfilename, std::ostream & err
 	GetReadyToPlay();
 
 	//open the file
-	std::ifstream replaystream(replayfilename.c_str(), std::ios::binary);
+	replaystream.close();
+	replaystream.clear();
+	replaystream.open(replayfilename.c_str(), std::ios::binary);
 	if (!replaystream)
 	{
 		error_output << "Error loading replay file: " << replayfilename << std::endl;
+		replaymode = IDLE;
 		return false;
 	}
 
 	//load the header info from the file
-	if (!LoadHeader(replaystream, error_output)) return false;
+	if (!LoadHeader(replaystream, error_output))
+	{
+		replaymode = IDLE;
+		return false;
+	}
+
+	if (replayformat == FORMAT_V14)
+	{
+		//load all of the input/state frame chunks from the file until we hit the EOF
+		while (Load(replaystream));
+		replaystream.close();
+		return true;
+	}
 
-	//load all of the input/state frame chunks from the file until we hit the EOF
-	while (Load(replaystream));
+	//only the index and the first chunk are loaded, the rest is streamed while playing
+	if (!LoadIndex(replaystream, error_output) || (!keyframes.empty() && !LoadChunk(0)))
+	{
+		error_output << "Error loading replay file: " << replayfilename << std::endl;
+		replaymode = IDLE;
+		return false;
+	}
 
 	return true;
 }
 
 void REPLAY::StopRecording(const std::string & replayfilename)
 {
-	replaymode = IDLE;
-	if (!replayfilename.empty())
+	if (replaymode == RECORDING)
+		replaymode = IDLE;
+
+	if (!record_writer)
+		return;
+
+	//the writer flushes the remaining records and finishes the file
+	SDL_mutexP(record_lock);
+	record_quit = true;
+	SDL_mutexV(record_lock);
+	SDL_SemPost(record_wake);
+	SDL_WaitThread(record_writer, NULL);
+	record_writer = 0;
+
+	// drop a wake up the game thread didn't wait for
+	while (SDL_SemTryWait(record_space) == 0) {}
+
+	if (record_dropped_states > 0)
 	{
-		std::ofstream f(replayfilename.c_str(), std::ios::binary);
-		if (f)
-		{
-			SaveHeader(f);
-			Save(f);
-		}
+		*record_error_log << "Replay recording dropped " << record_dropped_states <<
+			" keyframes, seeking falls back to the previous keyframe" << std::endl;
+	}
+
+	if (replayfilename.empty())
+	{
+		std::remove(recordfilename.c_str());
 	}
+	else
+	{
+		std::remove(replayfilename.c_str());
+		std::rename(recordfilename.c_str(), replayfilename.c_str());
+	}
+}
+
+int REPLAY::RecordWriter(void * data)
+{
+	REPLAY & replay = *static_cast<REPLAY*>(data);
+
+	bool quit = false;
+	while (!quit)
+	{
+		SDL_SemWait(replay.record_wake);
+
+		SDL_mutexP(replay.record_lock);
+		quit = replay.record_quit;
+		SDL_mutexV(replay.record_lock);
+
+		replay.FlushRecords();
+	}
+
+	if (!replay.inputframes.empty() || !replay.stateframes.empty())
+		replay.SaveChunk(replay.recordfile);
+	replay.SaveIndex(replay.recordfile);
+	replay.recordfile.close();
+
+	return 0;
+}
+
+void REPLAY::FlushRecords()
+{
+	SDL_mutexP(record_lock);
+	unsigned inputs_end = input_records_written;
+	unsigned states_end = state_records_written;
+	SDL_mutexV(record_lock);
+
+	unsigned input = input_records_flushed;
+	for (unsigned state = state_records_flushed; state != states_end; ++state)
+	{
+		const STATERECORD & record = state_records[state % STATE_RECORDS];
+
+		//input frames before the keyframe belong to the previous chunk
+		for (; input != inputs_end && input_records[input % INPUT_RECORDS].frame < record.frame; ++input)
+			FlushInputRecord(input_records[input % INPUT_RECORDS]);
+
+		if (stateframes.size() >= STATES_PER_CHUNK)
+			SaveChunk(recordfile);
+
+		stateframes.push_back(STATEFRAME(record.frame));
+		stateframes.back().SetBinaryStateData(std::string(record.data, record.size));
+		stateframes.back().SetInputSnapshot(std::vector<float>(
+			record.inputs, record.inputs + CARINPUT::GAME_ONLY_INPUTS_START_HERE));
+	}
+
+	for (; input != inputs_end; ++input)
+		FlushInputRecord(input_records[input % INPUT_RECORDS]);
+
+	SDL_mutexP(record_lock);
+	input_records_flushed = inputs_end;
+	state_records_flushed = states_end;
+	bool waiting = record_waiting;
+	record_waiting = false;
+	SDL_mutexV(record_lock);
+
+	if (waiting)
+		SDL_SemPost(record_space);
+}
+
+void REPLAY::FlushInputRecord(const INPUTRECORD & record)
+{
+	inputframes.push_back(INPUTFRAME(record.frame));
+	for (unsigned i = 0; i < CARINPUT::GAME_ONLY_INPUTS_START_HERE; i++)
+	{
+		if (record.changed & (1u << i))
+			inputframes.back().AddInput(i, record.inputs[i]);
+	}
+}
+
+void REPLAY::WaitForRecordSpace()
+{
+	SDL_mutexP(record_lock);
+	while (input_records_written - input_records_flushed >= INPUT_RECORDS ||
+		state_records_written - state_records_flushed >= STATE_RECORDS)
+	{
+		//the writer is behind, usually the disk is busy. it posts record_space
+		//after its next flush, which the wake up below makes sure happens
+		record_waiting = true;
+		SDL_mutexV(record_lock);
+		SDL_SemPost(record_wake);
+		SDL_SemWait(record_space);
+		SDL_mutexP(record_lock);
+	}
+	SDL_mutexV(record_lock);
 }
 
 void REPLAY::StopPlaying()
 {
 	replaymode = IDLE;
+	replaystream.close();
+}
+
+bool REPLAY::Convert(
+	const std::string & replayfilename,
+	const std::string & outputfilename,
+	std::ostream & info_output,
+	std::ostream & error_output)
+{
+	if (GetRecording())
+	{
+		error_output << "Can't convert replays while recording" << std::endl;
+		return false;
+	}
+
+	std::ifstream sourcefile(replayfilename.c_str(), std::ios::binary | std::ios::ate);
+	std::streamoff source_size = sourcefile.tellg();
+	sourcefile.close();
+
+	benchmark::Stopwatch timer;
+	if (!LoadAll(replayfilename, error_output))
+		return false;
+	double source_time = timer.Seconds();
+	FORMAT source_format = replayformat;
+	StopPlaying();
+
+	std::vector<INPUTFRAME> allinputframes;
+	std::vector<STATEFRAME> allstateframes;
+	allinputframes.swap(inputframes);
+	allstateframes.swap(stateframes);
+
+	std::ofstream outfile(outputfilename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!outfile)
+	{
+		error_output << "Error opening replay output file: " << outputfilename << std::endl;
+		return false;
+	}
+
+	//write chunks of STATES_PER_CHUNK keyframes with the input frames up to the next chunk
+	SaveHeader(outfile);
+	keyframes.clear();
+	unsigned input = 0;
+	unsigned state = 0;
+	do
+	{
+		unsigned state_end = std::min(state + STATES_PER_CHUNK, unsigned(allstateframes.size()));
+		int end_frame = (state_end < allstateframes.size()) ? allstateframes[state_end].GetFrame() : INT_MAX;
+		stateframes.assign(allstateframes.begin() + state, allstateframes.begin() + state_end);
+		for (; input < allinputframes.size() && allinputframes[input].GetFrame() < end_frame; input++)
+			inputframes.push_back(allinputframes[input]);
+		SaveChunk(outfile);
+		state = state_end;
+	} while (state < allstateframes.size());
+	SaveIndex(outfile);
+	std::streamoff output_size = outfile.tellp();
+	outfile.close();
+	if (!outfile)
+	{
+		error_output << "Error writing replay output file: " << outputfilename << std::endl;
+		return false;
+	}
+
+	//read it back to time decoding and to verify the conversion
+	timer.Reset();
+	if (!LoadAll(outputfilename, error_output))
+		return false;
+	double output_time = timer.Seconds();
+	bool match = (inputframes == allinputframes && stateframes == allstateframes);
+	StopPlaying();
+	inputframes.clear();
+	stateframes.clear();
+	keyframes.clear();
+
+	if (!match)
+	{
+		error_output << "Converted replay doesn't match " << replayfilename << std::endl;
+		return false;
+	}
+
+	const char * source_versions[] = {v14_format_version, v15_format_version, "VDRIFTREPLAYV16"};
+	double frames = allinputframes.size() + allstateframes.size();
+	info_output << "Converted " << replayfilename << " (" << source_versions[source_format] << ") to " <<
+		outputfilename << "\n" <<
+		"  " << allinputframes.size() << " input frames, " << allstateframes.size() << " state frames\n" <<
+		"  size " << source_size << " -> " << output_size << " bytes, ratio " <<
+		double(output_size) / std::max(source_size, std::streamoff(1)) << "\n" <<
+		"  decode " << source_time * 1E3 << " ms (" << frames / std::max(source_time, 1E-9) << " frames/s) -> " <<
+		output_time * 1E3 << " ms (" << frames / std::max(output_time, 1E-9) << " frames/s, " <<
+		source_size / std::max(output_time, 1E-9) / (1 << 20) << " MB/s of source data)" << std::endl;
+
+	return true;
 }
 
-void REPLAY::RecordFrame(const std::vector <float> & inputs, CAR & car)
+void REPLAY::RecordFrame(const std::vector <float> & inputs, StateFunction state, void * car)
 {
 	if (!GetRecording())
 		return;
@@ -197,45 +863,81 @@ void REPLAY::RecordFrame(const std::vector <float> & inputs, CAR & car)
 	if (frame > 2000000000) //enforce a maximum recording time of about 92 days
 	{
 		StopRecording("");
+		return;
 	}
 
 	assert(inputbuffer.size() == CARINPUT::GAME_ONLY_INPUTS_START_HERE);
 	assert((unsigned int) version_info.inputs_supported == CARINPUT::GAME_ONLY_INPUTS_START_HERE);
 
-	//record inputs
-	INPUTFRAME newinputframe(frame);
+	unsigned long allocations = ALLOCATION_COUNTER::GetThreadAllocations();
+
+	WaitForRecordSpace();
 
+	//record changed inputs
+	INPUTRECORD & inputrecord = input_records[input_records_written % INPUT_RECORDS];
+	inputrecord.frame = frame;
+	inputrecord.changed = 0;
 	for (unsigned i = 0; i < CARINPUT::GAME_ONLY_INPUTS_START_HERE; i++)
 	{
 		if (inputs[i] != inputbuffer[i])
 		{
 			inputbuffer[i] = inputs[i];
-			newinputframe.AddInput(i, inputs[i]);
+			inputrecord.inputs[i] = inputs[i];
+			inputrecord.changed |= 1u << i;
+		}
+	}
+
+	//record state once per second, serialized straight into the record
+	int framespersecond = 1.0/version_info.framerate;
+	bool keyframe = (frame % framespersecond == 0);
+	if (keyframe)
+	{
+		STATERECORD & staterecord = state_records[state_records_written % STATE_RECORDS];
+		staterecord.frame = frame;
+		for (unsigned i = 0; i < CARINPUT::GAME_ONLY_INPUTS_START_HERE; i++)
+		{
+			staterecord.inputs[i] = inputs[i];
+		}
+
+		joeserialize::BinarySpanOutputSerializer serialize_output(staterecord.data, STATE_RECORD_SIZE);
+		staterecord.size = state(serialize_output, car) ? serialize_output.GetSize() : 0;
+		if (staterecord.size == 0)
+		{
+			//playback restores the previous keyframe and plays the inputs from there
+			if (record_dropped_states == 0)
+			{
+				*record_error_log << "Replay keyframe " << frame << " dropped, the car state exceeds " <<
+					int(STATE_RECORD_SIZE) << " bytes" << std::endl;
+			}
+			record_dropped_states++;
+			keyframe = false;
 		}
 	}
 
-	if (newinputframe.GetNumInputs() > 0)
-		inputframes.push_back(newinputframe);
+	SDL_mutexP(record_lock);
+	if (inputrecord.changed)
+		input_records_written++;
+	if (keyframe)
+		state_records_written++;
+	SDL_mutexV(record_lock);
 
+	//the writer wakes up once per keyframe
+	if (keyframe)
+		SDL_SemPost(record_wake);
 
-	//record state
-	int framespersecond = 1.0/version_info.framerate;
-	if (frame % framespersecond == 0) //once per second
+	record_allocations += ALLOCATION_COUNTER::GetThreadAllocations() - allocations;
+	record_allocation_frames++;
+	if (keyframe)
 	{
-		std::stringstream statestream;
-		joeserialize::BinaryOutputSerializer serialize_output(statestream);
-		car.Serialize(serialize_output);
-		stateframes.push_back(STATEFRAME(frame));
-		//stateframes.push_back(STATEFRAME(11189196)); //for debugging; in hex, 11189196 is AABBCC
-		//cout << "Recording state size: " << statestream.str().length() << endl; //should be ~984
-		stateframes.back().SetBinaryStateData(statestream.str());
-		stateframes.back().SetInputSnapshot(inputs);
+		record_allocations_per_frame = float(record_allocations) / record_allocation_frames;
+		record_allocations = 0;
+		record_allocation_frames = 0;
 	}
 
 	frame++;
 }
 
-const std::vector <float> & REPLAY::PlayFrame(CAR & car)
+const std::vector <float> & REPLAY::PlayFrame(StateFunction state, void * car)
 {
 	if (!GetPlaying())
 	{
@@ -247,6 +949,16 @@ const std::vector <float> & REPLAY::PlayFrame(CAR & car)
 	assert(inputbuffer.size() == CARINPUT::GAME_ONLY_INPUTS_START_HERE);
 	assert((unsigned int) version_info.inputs_supported == CARINPUT::GAME_ONLY_INPUTS_START_HERE);
 
+	//stream in the next chunk once playback reaches its keyframe
+	while (cur_chunk + 1 < keyframes.size() && keyframes[cur_chunk + 1].GetFrame() <= frame)
+	{
+		if (!LoadChunk(cur_chunk + 1))
+		{
+			StopPlaying();
+			return inputbuffer;
+		}
+	}
+
 	//fast forward through the inputframes until we're up to date
 	while (cur_inputframe < inputframes.size() && inputframes[cur_inputframe].GetFrame() <= frame)
 	{
@@ -257,12 +969,13 @@ const std::vector <float> & REPLAY::PlayFrame(CAR & car)
 	//fast forward through the stateframes until we're up to date
 	while (cur_stateframe < stateframes.size() && stateframes[cur_stateframe].GetFrame() <= frame)
 	{
-		if (stateframes[cur_stateframe].GetFrame() == frame) ProcessPlayStateFrame(stateframes[cur_stateframe], car);
+		if (stateframes[cur_stateframe].GetFrame() == frame) ProcessPlayStateFrame(stateframes[cur_stateframe], state, car);
 		cur_stateframe++;
 	}
 
 	//detect end of input
-	if (cur_stateframe == stateframes.size() && cur_inputframe == inputframes.size())
+	if (cur_stateframe == stateframes.size() && cur_inputframe == inputframes.size() &&
+		cur_chunk + 1 >= keyframes.size())
 	{
 		StopPlaying();
 	}
@@ -270,6 +983,46 @@ const std::vector <float> & REPLAY::PlayFrame(CAR & car)
 	return inputbuffer;
 }
 
+int REPLAY::Seek(int target_frame, StateFunction state, void * car)
+{
+	if (!GetPlaying())
+	{
+		return frame;
+	}
+
+	//load the chunk of the target for indexed replays
+	if (!keyframes.empty())
+	{
+		std::vector<KEYFRAME>::const_iterator i = std::upper_bound(
+			keyframes.begin(), keyframes.end(), target_frame, FRAMELESS());
+		unsigned chunk = (i == keyframes.begin()) ? 0 : (i - keyframes.begin()) - 1;
+		if (!LoadChunk(chunk))
+		{
+			StopPlaying();
+			return frame;
+		}
+	}
+
+	//find the last keyframe at or before the target
+	std::vector<STATEFRAME>::const_iterator i = std::upper_bound(
+		stateframes.begin(), stateframes.end(), target_frame, FRAMELESS());
+	unsigned key = (i == stateframes.begin()) ? 0 : (i - stateframes.begin()) - 1;
+
+	if (key >= stateframes.size())
+	{
+		return frame;
+	}
+
+	//restore the keyframe, the following input frames are played from there
+	frame = stateframes[key].GetFrame();
+	ProcessPlayStateFrame(stateframes[key], state, car);
+	cur_stateframe = key + 1;
+	cur_inputframe = std::upper_bound(
+		inputframes.begin(), inputframes.end(), frame, FRAMELESS()) - inputframes.begin();
+
+	return frame;
+}
+
 void REPLAY::ProcessPlayInputFrame(const INPUTFRAME & frame)
 {
 	for (unsigned i = 0; i < frame.GetNumInputs(); i++)
@@ -279,7 +1032,7 @@ void REPLAY::ProcessPlayInputFrame(const INPUTFRAME & frame)
 	}
 }
 
-void REPLAY::ProcessPlayStateFrame(const STATEFRAME & frame, CAR & car)
+void REPLAY::ProcessPlayStateFrame(const STATEFRAME & frame, StateFunction state, void * car)
 {
 	//process input snapshot
 	for (unsigned i = 0; i < inputbuffer.size() && i < frame.GetInputSnapshot().size(); i++)
@@ -288,9 +1041,9 @@ void REPLAY::ProcessPlayStateFrame(const STATEFRAME & frame, CAR & car)
 	}
 
 	//process binary car state
-	std::stringstream statestream(frame.GetBinaryStateData());
-	joeserialize::BinaryInputSerializer serialize_input(statestream);
-	car.Serialize(serialize_input);
+	const std::string & data = frame.GetBinaryStateData();
+	joeserialize::BinarySpanInputSerializer serialize_input(data.data(), data.size());
+	state(serialize_input, car);
 }
 
 bool REPLAY::Serialize(joeserialize::Serializer & s)
@@ -358,13 +1111,312 @@ bool REPLAY::VERSION::operator==(const VERSION & other) const
 			framerate == other.framerate);
 }
 
+namespace
+{
+	// stands in for CAR, the replay only uses its Serialize
+	class REPLAY_TEST_CAR
+	{
+	public:
+		REPLAY_TEST_CAR() : gear(0)
+		{
+			for (int i = 0; i < BODY_SIZE; ++i)
+				body[i] = 0;
+		}
+
+		void Step(int frame)
+		{
+			for (int i = 0; i < BODY_SIZE; ++i)
+				body[i] = body[i] * 0.99f + std::sin(frame * 0.1f + i);
+			gear = (frame / 50) % 6;
+		}
+
+		bool Serialize(joeserialize::Serializer & s)
+		{
+			_SERIALIZE_(s, gear);
+			return s.SerializeArray("body", body, BODY_SIZE);
+		}
+
+		std::string GetState()
+		{
+			std::ostringstream stream;
+			joeserialize::BinaryOutputSerializer serialize_output(stream);
+			Serialize(serialize_output);
+			return stream.str();
+		}
+
+	private:
+		enum {BODY_SIZE = 64};
+		float body[BODY_SIZE];
+		int gear;
+	};
+
+	// a car state too large for the keyframe records
+	class REPLAY_TEST_TRUCK
+	{
+	public:
+		REPLAY_TEST_TRUCK() : cargo(2048, 1.0f) {}
+
+		bool Serialize(joeserialize::Serializer & s)
+		{
+			_SERIALIZE_(s, cargo);
+			return true;
+		}
+
+	private:
+		std::vector<float> cargo;
+	};
+
+	// quantised and raw input values
+	std::vector<float> GetReplayTestInputs(int frame)
+	{
+		std::vector<float> inputs(CARINPUT::GAME_ONLY_INPUTS_START_HERE, 0);
+		inputs[CARINPUT::THROTTLE] = (frame % 40) / 40.0f;
+		inputs[CARINPUT::STEER_LEFT] = std::sin(frame * 0.05f) * 0.5f + 0.5f;
+		inputs[CARINPUT::BRAKE] = (frame / 100) % 2;
+		return inputs;
+	}
+
+	std::string ReadReplayTestFile(const std::string & filename)
+	{
+		std::ifstream file(filename.c_str(), std::ios::binary);
+		std::ostringstream data;
+		data << file.rdbuf();
+		return data.str();
+	}
+
+	void WriteReplayTestFile(const std::string & filename, const std::string & data)
+	{
+		std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+		file.write(data.data(), data.size());
+	}
+
+	// file offset of a chunk, read from the index like LoadIndex does
+	unsigned GetReplayTestChunkOffset(const std::string & data, int chunk)
+	{
+		std::istringstream stream(data);
+		joeserialize::BinaryInputSerializer serialize_input(stream);
+		joeserialize::Serializer & s = serialize_input;
+		unsigned index_offset[2] = {0, 0};
+		stream.seekg(data.size() - 2 * sizeof(unsigned));
+		s.Serialize("index_offset_high", index_offset[0]);
+		s.Serialize("index_offset_low", index_offset[1]);
+
+		// the index is a list of (frame, offset high, offset low)
+		int count = 0;
+		int frame = 0;
+		unsigned offset[2] = {0, 0};
+		stream.seekg(index_offset[1]);
+		s.Serialize("size", count);
+		for (int i = 0; i <= chunk && i < count; ++i)
+		{
+			s.Serialize("frame", frame);
+			s.Serialize("offset_high", offset[0]);
+			s.Serialize("offset_low", offset[1]);
+		}
+		return offset[1];
+	}
+}
+
 QT_TEST(replay_test)
 {
-	/*//basic version validity check
+	// a keyframe every 8 frames and a chunk every 64
+	const float framerate = 0.125;
+	const int keyframe_interval = 8;
+	const int frames = 400;
+	const std::string recordname = "replay_test.tmp";
+	const std::string replayname = "replay_test.vdr";
+	const std::string brokenname = "replay_test_broken.vdr";
+	std::ostringstream errors;
+
+	// record, the state of every keyframe is kept for comparison
+	std::vector<std::string> states;
+	{
+		REPLAY replay(framerate);
+		REPLAY_TEST_CAR car;
+		replay.StartRecording("XS", "default", MATHVECTOR<float, 3>(0), PTree(), "test", recordname, errors);
+		QT_CHECK(replay.GetRecording());
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			car.Step(frame);
+			if (frame % keyframe_interval == 0)
+				states.push_back(car.GetState());
+			replay.RecordFrame(GetReplayTestInputs(frame), car);
+		}
+		replay.StopRecording(replayname);
+	}
+
+	// reload, seek into a middle chunk and play to the end
+	{
+		REPLAY replay(framerate);
+		REPLAY_TEST_CAR car;
+		QT_CHECK(replay.StartPlaying(replayname, errors));
+		QT_CHECK_EQUAL(replay.GetTrack(), "test");
+		QT_CHECK_EQUAL(replay.GetCarType(), "XS");
+
+		int keyframe = replay.Seek(203, car);
+		QT_CHECK_EQUAL(keyframe, 200);
+		QT_CHECK(car.GetState() == states[keyframe / keyframe_interval]);
+
+		int input_mismatches = 0;
+		int state_mismatches = 0;
+		for (int frame = keyframe + 1; frame < frames; ++frame)
+		{
+			if (replay.PlayFrame(car) != GetReplayTestInputs(frame))
+				input_mismatches++;
+			if (frame % keyframe_interval == 0 && car.GetState() != states[frame / keyframe_interval])
+				state_mismatches++;
+		}
+		QT_CHECK_EQUAL(input_mismatches, 0);
+		QT_CHECK_EQUAL(state_mismatches, 0);
+		QT_CHECK(!replay.GetPlaying());
+
+		// and back into the first chunk
+		QT_CHECK(replay.StartPlaying(replayname, errors));
+		QT_CHECK_EQUAL(replay.Seek(5, car), 0);
+		QT_CHECK(car.GetState() == states[0]);
+		replay.StopPlaying();
+	}
+
+	// V16 is written, converting it again keeps every frame
+	{
+		std::string data = ReadReplayTestFile(replayname);
+		QT_CHECK_EQUAL(data.substr(0, 15), "VDRIFTREPLAYV16");
+
+		REPLAY replay(framerate);
+		std::ostringstream info;
+		QT_CHECK(replay.Convert(replayname, brokenname, info, errors));
+	}
+
+	// a chunk claiming a huge decompressed size is rejected when it's seeked to
+	{
+		std::string data = ReadReplayTestFile(replayname);
+		unsigned offset = GetReplayTestChunkOffset(data, 3);
+		QT_CHECK(offset > 0 && offset + 16 < data.size());
+
+		// the chunk is a string, its length is followed by the compressed size varint
+		const char huge[] = {char(0xff), char(0xff), char(0xff), char(0xff), char(0x0f)};
+		data.replace(offset + sizeof(unsigned), sizeof(huge), huge, sizeof(huge));
+		WriteReplayTestFile(brokenname, data);
+
+		REPLAY replay(framerate);
+		REPLAY_TEST_CAR car;
+		QT_CHECK(replay.StartPlaying(brokenname, errors));
+		QT_CHECK_EQUAL(replay.Seek(20, car), 16);
+		QT_CHECK(replay.GetPlaying());
+		replay.Seek(203, car);
+		QT_CHECK(!replay.GetPlaying());
+	}
+
+	// a keyframe with more input snapshot values than there are inputs is rejected
+	{
+		std::string data = ReadReplayTestFile(replayname);
+		unsigned offset = GetReplayTestChunkOffset(data, 3);
+
+		// otherwise well formed, no input frames and one keyframe at the start of the chunk
+		const int chunk_frame = 3 * 64;
+		const unsigned inputs = CARINPUT::GAME_ONLY_INPUTS_START_HERE + 1;
+		const std::string & state = states[chunk_frame / keyframe_interval];
+		std::string chunk;
+		PutVarint(chunk, 0);
+		PutVarint(chunk, 1);
+		PutSigned(chunk, chunk_frame);
+		PutVarint(chunk, inputs);
+		for (unsigned n = 0; n < inputs; ++n)
+			PutInput(chunk, 0);
+		PutVarint(chunk, state.size());
+		chunk += state;
+
+		// it packs smaller than the original chunk, whose remaining bytes aren't read
+		std::string packed;
+		LZCOMPRESSOR::Compress(chunk, packed);
+		std::ostringstream packed_chunk;
+		joeserialize::BinaryOutputSerializer serialize_output(packed_chunk);
+		joeserialize::Serializer & s = serialize_output;
+		s.Serialize("chunk", packed);
+		QT_CHECK(offset > 0 && offset + packed_chunk.str().size() < GetReplayTestChunkOffset(data, 4));
+		data.replace(offset, packed_chunk.str().size(), packed_chunk.str());
+		WriteReplayTestFile(brokenname, data);
+
+		REPLAY replay(framerate);
+		REPLAY_TEST_CAR car;
+		QT_CHECK(replay.StartPlaying(brokenname, errors));
+		QT_CHECK_EQUAL(replay.Seek(20, car), 16);
+		replay.Seek(203, car);
+		QT_CHECK(!replay.GetPlaying());
+	}
+
+	// keyframes that don't fit are dropped with an error, the inputs are kept
+	{
+		REPLAY replay(framerate);
+		REPLAY_TEST_TRUCK truck;
+		std::ostringstream record_errors;
+		replay.StartRecording("XS", "default", MATHVECTOR<float, 3>(0), PTree(), "test", recordname, record_errors);
+		for (int frame = 0; frame < 100; ++frame)
+			replay.RecordFrame(GetReplayTestInputs(frame), truck);
+		replay.StopRecording(brokenname);
+		QT_CHECK(record_errors.str().find("dropped") != std::string::npos);
+
+		QT_CHECK(replay.StartPlaying(brokenname, errors));
+		int input_mismatches = 0;
+		for (int frame = 1; frame < 100; ++frame)
+		{
+			if (replay.PlayFrame(truck) != GetReplayTestInputs(frame))
+				input_mismatches++;
+		}
+		QT_CHECK_EQUAL(input_mismatches, 0);
+		replay.StopPlaying();
+	}
+
+	// a truncated file has lost its chunk index
+	{
+		std::string data = ReadReplayTestFile(replayname);
+		QT_CHECK(data.size() > 1024);
+		WriteReplayTestFile(brokenname, data.substr(0, data.size() / 2));
+
+		REPLAY replay(framerate);
+		std::ostringstream broken_errors;
+		QT_CHECK(!replay.StartPlaying(brokenname, broken_errors));
+		QT_CHECK(!replay.GetPlaying());
+		QT_CHECK(!broken_errors.str().empty());
+	}
+
+	std::remove(replayname.c_str());
+	std::remove(brokenname.c_str());
+}
+
+QT_TEST(replay_record_allocation_test)
+{
+	// only profiling builds count allocations
+	if (!ALLOCATION_COUNTER::IsEnabled())
+		return;
+
+	const float framerate = 0.125;
+	const int keyframe_interval = 8;
+	const int frames = 4 * keyframe_interval + 1;
+	const std::string recordname = "replay_allocation_test.tmp";
+	const std::string replayname = "replay_allocation_test.vdr";
+	std::ostringstream errors;
+
+	std::vector<std::vector<float> > inputs(frames);
+	for (int frame = 0; frame < frames; ++frame)
+		inputs[frame] = GetReplayTestInputs(frame);
+
+	// a few keyframe intervals, only RecordFrame is counted
+	REPLAY replay(framerate);
+	REPLAY_TEST_CAR car;
+	replay.StartRecording("XS", "default", MATHVECTOR<float, 3>(0), PTree(), "test", recordname, errors);
+	QT_CHECK(replay.GetRecording());
+	unsigned long allocations = 0;
+	for (int frame = 0; frame < frames; ++frame)
 	{
-		REPLAY replay(0.004);
-		stringstream teststream;
-		replay.Save(teststream);
-		QT_CHECK(replay.Load(teststream, std::cerr));
-	}*/
+		car.Step(frame);
+		unsigned long before = ALLOCATION_COUNTER::GetThreadAllocations();
+		replay.RecordFrame(inputs[frame], car);
+		allocations += ALLOCATION_COUNTER::GetThreadAllocations() - before;
+	}
+	QT_CHECK_EQUAL(allocations, 0);
+	QT_CHECK_EQUAL(replay.GetRecordAllocationsPerFrame(), 0);
+	replay.StopRecording(replayname);
+
+	std::remove(replayname.c_str());
 }
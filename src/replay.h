@@ -20,18 +20,28 @@
 #ifndef _REPLAY_H
 #define _REPLAY_H
 
-#include "car.h"
+#include "carinput.h"
 #include "joeserialize.h"
+#include "mathvector.h"
 #include "macros.h"
 
+#include <SDL/SDL_thread.h>
+
 #include <iostream>
+#include <fstream>
 #include <string>
 
+class PTree;
+
+/// records and plays back the inputs and the periodic state of a car,
+/// the car is any class with a bool Serialize(joeserialize::Serializer &) (CAR in the game)
 class REPLAY
 {
 public:
 	REPLAY(float framerate);
 
+	~REPLAY();
+
 	///< returns true on success
 	bool StartPlaying(
 		const std::string & replayfilename,
@@ -42,7 +52,30 @@ public:
 	///< returns true if the replay system is currently playing
 	bool GetPlaying() const { return (replaymode == PLAYING); }
 
-	const std::vector<float> & PlayFrame(CAR & car);
+	template <class T>
+	const std::vector<float> & PlayFrame(T & car)
+	{
+		return PlayFrame(&SerializeState<T>, &car);
+	}
+
+	///< restore car to the last keyframe at or before target_frame and return the keyframe's frame,
+	///< the caller re-simulates with PlayFrame until target_frame is reached
+	template <class T>
+	int Seek(int target_frame, T & car)
+	{
+		return Seek(target_frame, &SerializeState<T>, &car);
+	}
+
+	///< current playback or recording frame
+	int GetFrame() const { return frame; }
+
+	///< rewrite a replay file of any supported version in the current format,
+	///< reports the size ratio and decode throughput, returns true on success
+	bool Convert(
+		const std::string & replayfilename,
+		const std::string & outputfilename,
+		std::ostream & info_output,
+		std::ostream & error_output);
 
 	void StartRecording(
 		const std::string & newcartype,
@@ -50,15 +83,23 @@ public:
 		const MATHVECTOR<float, 3> & newcarcolor,
 		const PTree & carconfig,
 		const std::string & trackname,
+		const std::string & recordingfilename,
 		std::ostream & error_log);
 
-	///< if replayfilename is empty, do not save the data
+	///< the recording file is renamed to replayfilename, if replayfilename is empty the data is discarded
 	void StopRecording(const std::string & replayfilename);
 
 	///< returns true if the replay system is currently recording
 	bool GetRecording() const { return (replaymode == RECORDING); }
 
-	void RecordFrame(const std::vector <float> & inputs, CAR & car);
+	template <class T>
+	void RecordFrame(const std::vector <float> & inputs, T & car)
+	{
+		RecordFrame(inputs, &SerializeState<T>, &car);
+	}
+
+	///< heap allocations per recorded frame, averaged over the last keyframe interval
+	float GetRecordAllocationsPerFrame() const { return record_allocations_per_frame; }
 
 	bool Serialize(joeserialize::Serializer & s);
 
@@ -124,6 +165,11 @@ private:
 			return true;
 		}
 
+		bool operator==(const INPUTFRAME & other) const
+		{
+			return frame == other.frame && inputs == other.inputs;
+		}
+
 		void AddInput(int index, float value)
 		{
 			inputs.push_back(std::make_pair(index, value));
@@ -167,6 +213,13 @@ private:
 			return true;
 		}
 
+		bool operator==(const STATEFRAME & other) const
+		{
+			return frame == other.frame &&
+				binary_state_data == other.binary_state_data &&
+				input_snapshot == other.input_snapshot;
+		}
+
 		void SetBinaryStateData(const std::string & value)
 		{
 			binary_state_data = value;
@@ -177,7 +230,7 @@ private:
 			return frame;
 		}
 
-		std::string GetBinaryStateData() const
+		const std::string & GetBinaryStateData() const
 		{
 			return binary_state_data;
 		}
@@ -199,6 +252,45 @@ private:
 		std::vector<float> input_snapshot;
 	};
 
+	/// chunk index entry, every chunk starts with the state keyframe at frame
+	class KEYFRAME
+	{
+	public:
+		KEYFRAME() : frame(0), offset_high(0), offset_low(0) {}
+
+		KEYFRAME(int newframe, std::streamoff offset) :
+			frame(newframe),
+			offset_high(offset >> 32),
+			offset_low(offset & 0xffffffff)
+		{
+			// ctor
+		}
+
+		bool Serialize(joeserialize::Serializer & s)
+		{
+			_SERIALIZE_(s, frame);
+			_SERIALIZE_(s, offset_high);
+			_SERIALIZE_(s, offset_low);
+			return true;
+		}
+
+		int GetFrame() const
+		{
+			return frame;
+		}
+
+		std::streamoff GetOffset() const
+		{
+			return (std::streamoff(offset_high) << 32) | offset_low;
+		}
+
+	private:
+		friend class joeserialize::Serializer;
+		int frame;
+		unsigned offset_high;
+		unsigned offset_low;
+	};
+
 	// serialized data
 	VERSION version_info;
 	std::string track;
@@ -208,6 +300,7 @@ private:
 	MATHVECTOR<float, 3> carcolor;
 	std::vector<INPUTFRAME> inputframes;
 	std::vector<STATEFRAME> stateframes;
+	std::vector<KEYFRAME> keyframes; ///< empty for V14 replays, these are loaded completely
 
 	// not stored in the replay file
 	int frame;
@@ -219,16 +312,84 @@ private:
 	std::vector<float> inputbuffer;
 	unsigned cur_inputframe;
 	unsigned cur_stateframe;
+	unsigned cur_chunk;
+	std::ifstream replaystream; ///< open while an indexed replay is played
+
+	// V14 is a single stream of frames, V15 adds a chunk index and V16 compresses the chunks
+	enum FORMAT {FORMAT_V14, FORMAT_V15, FORMAT_V16} replayformat;
+	enum {STATES_PER_CHUNK = 8}; ///< state frames per compressed chunk, state data is xored with the previous one
+	enum {MAX_CHUNK_SIZE = 1 << 24}; ///< limit for decoded chunks, a chunk is usually a few tens of kilobytes
+	std::string chunk_data; ///< encoded chunk buffer, reused
+	std::string chunk_packed; ///< compressed chunk buffer, reused
+
+	// recording: the game thread fills preallocated fixed size records, a writer
+	// thread turns them into chunks and streams them to the recording file.
+	// inputframes, stateframes and keyframes belong to the writer while recording.
+	enum {STATE_RECORD_SIZE = 4096, INPUT_RECORDS = 4096, STATE_RECORDS = 16};
+
+	struct INPUTRECORD
+	{
+		int frame;
+		unsigned changed; ///< bit i is set if input i changed
+		float inputs[CARINPUT::GAME_ONLY_INPUTS_START_HERE];
+	};
+
+	struct STATERECORD
+	{
+		int frame;
+		unsigned size;
+		float inputs[CARINPUT::GAME_ONLY_INPUTS_START_HERE];
+		char data[STATE_RECORD_SIZE];
+	};
+
+	std::vector<INPUTRECORD> input_records;
+	std::vector<STATERECORD> state_records;
+	unsigned input_records_written; ///< ring positions are counts modulo ring size
+	unsigned input_records_flushed;
+	unsigned state_records_written;
+	unsigned state_records_flushed;
+	bool record_quit;
+	bool record_waiting; ///< the game thread waits for record_space
+	SDL_mutex * record_lock; ///< protects the record counts, record_quit and record_waiting
+	SDL_sem * record_wake;
+	SDL_sem * record_space; ///< posted by the writer after it flushed records for a waiting game thread
+	SDL_Thread * record_writer;
+	std::ostream * record_error_log;
+	unsigned record_dropped_states;
+	unsigned long record_allocations;
+	int record_allocation_frames;
+	float record_allocations_per_frame;
+	std::string recordfilename;
+	std::ofstream recordfile;
 
 	// functions
+	typedef bool (*StateFunction)(joeserialize::Serializer & s, void * car);
+	template <class T>
+	static bool SerializeState(joeserialize::Serializer & s, void * car)
+	{
+		return static_cast<T*>(car)->Serialize(s);
+	}
+	void RecordFrame(const std::vector <float> & inputs, StateFunction state, void * car);
+	const std::vector<float> & PlayFrame(StateFunction state, void * car);
+	int Seek(int target_frame, StateFunction state, void * car);
 	void ProcessPlayInputFrame(const INPUTFRAME & frame);
-	void ProcessPlayStateFrame(const STATEFRAME & frame, CAR & car);
+	void ProcessPlayStateFrame(const STATEFRAME & frame, StateFunction state, void * car);
 	bool Load(std::istream & instream); ///< load one input and state frame chunk from the stream. returns true on success, returns false for EOF
-	bool LoadHeader(std::istream & instream, std::ostream & error_output); ///< returns true on success.
-	void Save(std::ostream & outstream); ///< save all input and state frames to the stream and then clear them
+	bool LoadHeader(std::istream & instream, std::ostream & error_output); ///< sets replayformat, returns true on success.
+	bool LoadIndex(std::istream & instream, std::ostream & error_output); ///< read the chunk index from the end of the stream
+	bool LoadChunk(unsigned chunk); ///< replace the loaded frames with the given chunk of the replay stream
+	bool LoadAll(const std::string & replayfilename, std::ostream & error_output); ///< load all frames of a replay file
+	void EncodeChunk(std::string & output) const; ///< V16 encoding of the loaded frames
+	bool DecodeChunk(const std::string & input); ///< append the frames of a V16 encoded chunk
+	void SaveChunk(std::ostream & outstream); ///< save loaded frames as a chunk, add it to the chunk index and clear them
+	void SaveIndex(std::ostream & outstream); ///< save the chunk index and its offset, this ends the stream
 	void SaveHeader(std::ostream & outstream); ///< write only the header information to the stream
 	void GetReadyToPlay();
 	void GetReadyToRecord();
+	void WaitForRecordSpace(); ///< block until the writer has made room for a frame
+	void FlushRecords(); ///< turn written records into chunks, called by the writer
+	void FlushInputRecord(const INPUTRECORD & record);
+	static int RecordWriter(void * replay);
 };
 
 #endif
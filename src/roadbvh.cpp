@@ -0,0 +1,407 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "roadbvh.h"
+#include "unittest.h"
+
+#include <algorithm>
+#include <sstream>
+
+static const int MAX_LEAF_ITEMS = 4;
+static const int MAX_TREE_DEPTH = 64;
+
+// order patch ids by their bounds center along an axis
+struct CENTER_LESS
+{
+	const std::vector<MATHVECTOR <float, 3> > & centers;
+	int axis;
+
+	CENTER_LESS(const std::vector<MATHVECTOR <float, 3> > & centers, int axis) :
+		centers(centers), axis(axis)
+	{
+		// ctor
+	}
+
+	bool operator()(int a, int b) const
+	{
+		return centers[a][axis] < centers[b][axis];
+	}
+};
+
+// same segment test as AABB::Intersect(RAY), so a node passes whenever
+// one of the patch bounds it contains passes
+template <typename NODE>
+static bool IntersectSegment(const NODE & node, const AABB<float>::RAY & ray)
+{
+	MATHVECTOR <float, 3> segdir(ray.dir * (0.5f * ray.seglen));
+	MATHVECTOR <float, 3> size(node.max[0] - node.min[0], node.max[1] - node.min[1], node.max[2] - node.min[2]);
+	MATHVECTOR <float, 3> center(node.min[0] + 0.5f * size[0], node.min[1] + 0.5f * size[1], node.min[2] + 0.5f * size[2]);
+	MATHVECTOR <float, 3> diff(ray.orig + segdir - center);
+
+	MATHVECTOR <float, 3> abs_segdir(segdir);
+	abs_segdir.absify();
+	MATHVECTOR <float, 3> abs_diff(diff);
+	abs_diff.absify();
+	for (int i = 0; i < 3; ++i)
+	{
+		if (abs_diff[i] > size[i] + abs_segdir[i]) return false;
+	}
+
+	MATHVECTOR <float, 3> abs_cross(segdir.cross(diff));
+	abs_cross.absify();
+	if (abs_cross[0] > size[1] * abs_segdir[2] + size[2] * abs_segdir[1]) return false;
+	if (abs_cross[1] > size[2] * abs_segdir[0] + size[0] * abs_segdir[2]) return false;
+	if (abs_cross[2] > size[0] * abs_segdir[1] + size[1] * abs_segdir[0]) return false;
+	return true;
+}
+
+// squared distance from a point to the node bounds
+template <typename NODE>
+static float DistanceSquared(const NODE & node, const MATHVECTOR <float, 3> & p)
+{
+	float d2 = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		float d = std::max(node.min[i] - p[i], 0.0f) + std::max(p[i] - node.max[i], 0.0f);
+		d2 += d * d;
+	}
+	return d2;
+}
+
+ROADBVH::ROADBVH()
+{
+	// ctor
+}
+
+void ROADBVH::Clear()
+{
+	nodes.clear();
+	patches.clear();
+	bounds.clear();
+	items.clear();
+}
+
+void ROADBVH::Build(const std::list<ROADSTRIP> & roads)
+{
+	Clear();
+
+	for (std::list<ROADSTRIP>::const_iterator r = roads.begin(); r != roads.end(); ++r)
+	{
+		const std::vector<ROADPATCH> & strip = r->GetPatches();
+		for (std::vector<ROADPATCH>::const_iterator p = strip.begin(); p != strip.end(); ++p)
+		{
+			patches.push_back(&*p);
+		}
+	}
+
+	std::vector<MATHVECTOR <float, 3> > centers(patches.size());
+	items.resize(patches.size());
+	for (int i = 0, n = patches.size(); i < n; ++i)
+	{
+		centers[i] = patches[i]->GetPatch().GetAABB().GetCenter();
+		items[i] = i;
+	}
+
+	if (patches.empty()) return;
+
+	nodes.reserve(2 * patches.size() / MAX_LEAF_ITEMS + 1);
+	BuildNode(0, patches.size(), centers);
+
+	bounds.resize(items.size());
+	for (int i = 0, n = items.size(); i < n; ++i)
+	{
+		bounds[i] = patches[items[i]]->GetPatch().GetAABB();
+	}
+}
+
+int ROADBVH::BuildNode(int first, int count, const std::vector<MATHVECTOR <float, 3> > & centers)
+{
+	int id = nodes.size();
+	nodes.push_back(NODE());
+
+	// node bounds, padded so that float rounding can't make them tighter than the patch bounds
+	MATHVECTOR <float, 3> bmin, bmax, cmin, cmax;
+	for (int i = first; i < first + count; ++i)
+	{
+		AABB<float> box = patches[items[i]]->GetPatch().GetAABB();
+		MATHVECTOR <float, 3> pmin = box.GetPos();
+		MATHVECTOR <float, 3> pmax = box.GetPos() + box.GetSize();
+		const MATHVECTOR <float, 3> & c = centers[items[i]];
+		for (int k = 0; k < 3; ++k)
+		{
+			if (i == first || pmin[k] < bmin[k]) bmin[k] = pmin[k];
+			if (i == first || pmax[k] > bmax[k]) bmax[k] = pmax[k];
+			if (i == first || c[k] < cmin[k]) cmin[k] = c[k];
+			if (i == first || c[k] > cmax[k]) cmax[k] = c[k];
+		}
+	}
+	for (int k = 0; k < 3; ++k)
+	{
+		float pad = 1E-4f * (1 + std::abs(bmin[k]) + std::abs(bmax[k]));
+		nodes[id].min[k] = bmin[k] - pad;
+		nodes[id].max[k] = bmax[k] + pad;
+	}
+
+	if (count <= MAX_LEAF_ITEMS)
+	{
+		nodes[id].index = first;
+		nodes[id].count = count;
+		return id;
+	}
+
+	// median split along the largest extent of the patch centers
+	int axis = 0;
+	MATHVECTOR <float, 3> extent = cmax - cmin;
+	if (extent[1] > extent[axis]) axis = 1;
+	if (extent[2] > extent[axis]) axis = 2;
+
+	int mid = first + count / 2;
+	std::nth_element(items.begin() + first, items.begin() + mid, items.begin() + first + count, CENTER_LESS(centers, axis));
+
+	BuildNode(first, mid - first, centers);
+	int right = BuildNode(mid, first + count - mid, centers);
+	nodes[id].index = right;
+	nodes[id].count = 0;
+	return id;
+}
+
+bool ROADBVH::CastRay(
+	const MATHVECTOR <float, 3> & origin,
+	const MATHVECTOR <float, 3> & direction,
+	const float seglen,
+	int & patch_id,
+	MATHVECTOR <float, 3> & outtri,
+	const BEZIER * & colpatch,
+	MATHVECTOR <float, 3> & normal) const
+{
+	int best = -1;
+	float bestdist = 0;
+
+	// the previous patch is the most likely hit, it seeds the search bound
+	// (overlapping road strips may still have a nearer patch)
+	int hint = -1;
+	if (patch_id >= 0 && patch_id < (int)patches.size())
+	{
+		hint = patch_id;
+		MATHVECTOR <float, 3> coltri, colnorm;
+		if (patches[hint]->Collide(origin, direction, seglen, coltri, colnorm))
+		{
+			outtri = coltri;
+			normal = colnorm;
+			best = hint;
+			bestdist = (coltri - origin).MagnitudeSquared();
+		}
+	}
+
+	if (nodes.empty()) return false;
+
+	AABB<float>::RAY ray(origin, direction, seglen);
+
+	int stack[MAX_TREE_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		const NODE & node = nodes[stack[--top]];
+
+		// a nearer hit must lie in a nearer box (ties resolved by patch id below)
+		if (best >= 0 && DistanceSquared(node, origin) > bestdist) continue;
+		if (!IntersectSegment(node, ray)) continue;
+
+		if (node.count)
+		{
+			for (int i = node.index; i < node.index + node.count; ++i)
+			{
+				if (bounds[i].Intersect(ray) == AABB<float>::OUT) continue;
+
+				int id = items[i];
+				if (id == hint) continue;
+
+				MATHVECTOR <float, 3> coltri, colnorm;
+				if (patches[id]->Collide(origin, direction, seglen, coltri, colnorm))
+				{
+					float dist = (coltri - origin).MagnitudeSquared();
+					if (best < 0 || dist < bestdist || (dist == bestdist && id < best))
+					{
+						outtri = coltri;
+						normal = colnorm;
+						best = id;
+						bestdist = dist;
+					}
+				}
+			}
+		}
+		else
+		{
+			// visit the nearer child first
+			int left = &node - &nodes[0] + 1;
+			int right = node.index;
+			if (DistanceSquared(nodes[left], origin) > DistanceSquared(nodes[right], origin))
+				std::swap(left, right);
+			assert(top + 2 <= MAX_TREE_DEPTH);
+			stack[top++] = right;
+			stack[top++] = left;
+		}
+	}
+
+	if (best < 0) return false;
+
+	patch_id = best;
+	colpatch = &patches[best]->GetPatch();
+	return true;
+}
+
+void ROADBVH::Query(
+	const MATHVECTOR <float, 3> & origin,
+	const MATHVECTOR <float, 3> & direction,
+	const float seglen,
+	std::vector<int> & candidates) const
+{
+	if (nodes.empty()) return;
+
+	AABB<float>::RAY ray(origin, direction, seglen);
+	int stack[MAX_TREE_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0)
+	{
+		int id = stack[--top];
+		const NODE & node = nodes[id];
+		if (!IntersectSegment(node, ray)) continue;
+
+		if (node.count)
+		{
+			for (int i = node.index; i < node.index + node.count; ++i)
+			{
+				if (bounds[i].Intersect(ray) != AABB<float>::OUT)
+					candidates.push_back(items[i]);
+			}
+		}
+		else
+		{
+			assert(top + 2 <= MAX_TREE_DEPTH);
+			stack[top++] = node.index;
+			stack[top++] = id + 1;
+		}
+	}
+}
+
+// road strip of count x count patches on a wavy surface (y up)
+static void ReadTestStrip(ROADSTRIP & strip, int count, float x0, float y0)
+{
+	std::stringstream s;
+	s << count * count << "\n";
+	for (int n = 0; n < count * count; ++n)
+	{
+		float px = x0 + 4 * (n % count);
+		float pz = 4 * (n / count);
+		for (int x = 0; x < 4; ++x)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				float vx = px + y * 4 / 3.0f;
+				float vz = pz + x * 4 / 3.0f;
+				s << vx << " " << y0 + 0.3f * std::sin(0.7f * vx) * std::cos(0.5f * vz) << " " << vz << " ";
+			}
+		}
+	}
+	std::stringstream error;
+	strip.ReadFrom(s, false, error);
+}
+
+QT_TEST(roadbvh_test)
+{
+	// two overlapping levels of road
+	std::list<ROADSTRIP> roads;
+	roads.push_back(ROADSTRIP());
+	ReadTestStrip(roads.back(), 8, 0, 0);
+	roads.push_back(ROADSTRIP());
+	ReadTestStrip(roads.back(), 8, 10, -1.5f);
+
+	ROADBVH bvh;
+	bvh.Build(roads);
+	QT_CHECK_EQUAL(bvh.GetNumPatches(), 128);
+
+	int far_hints = 0;
+	unsigned seed = 42;
+	for (int n = 0; n < 500; ++n)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		float x = -2 + 48 * ((seed >> 8) / 16777216.0f);
+		seed = seed * 1664525u + 1013904223u;
+		float z = -2 + 36 * ((seed >> 8) / 16777216.0f);
+		MATHVECTOR <float, 3> origin(x, 1, z), direction(0.05f, -1, 0.02f);
+		direction = direction.Normalize();
+		float seglen = (n % 3) ? 4 : 1.5f;
+
+		// brute force nearest hit over all patches in id order
+		bool col = false;
+		int col_id = -1;
+		int far_id = -1;
+		MATHVECTOR <float, 3> col_pos;
+		for (int id = 0; id < bvh.GetNumPatches(); ++id)
+		{
+			MATHVECTOR <float, 3> pos, norm;
+			if (!bvh.GetPatch(id).Collide(origin, direction, seglen, pos, norm))
+				continue;
+
+			if (!col || (pos - origin).MagnitudeSquared() < (col_pos - origin).MagnitudeSquared())
+			{
+				if (col) far_id = col_id;
+				col = true;
+				col_id = id;
+				col_pos = pos;
+			}
+			else
+			{
+				far_id = id;
+			}
+		}
+
+		int patch_id = -1;
+		const BEZIER * patch = 0;
+		MATHVECTOR <float, 3> pos, norm;
+		bool bvh_col = bvh.CastRay(origin, direction, seglen, patch_id, pos, patch, norm);
+		QT_CHECK_EQUAL(bvh_col, col);
+		if (col && bvh_col)
+		{
+			QT_CHECK_EQUAL(patch_id, col_id);
+			QT_CHECK_EQUAL(pos, col_pos);
+			QT_CHECK(patch == &bvh.GetPatch(col_id).GetPatch());
+
+			int hint = patch_id;
+			QT_CHECK(bvh.CastRay(origin, direction, seglen, hint, pos, patch, norm));
+			QT_CHECK_EQUAL(hint, col_id);
+		}
+		if (far_id >= 0)
+		{
+			// the hint is a farther patch of the overlapping strip
+			++far_hints;
+			int hint = far_id;
+			QT_CHECK(bvh.CastRay(origin, direction, seglen, hint, pos, patch, norm));
+			QT_CHECK_EQUAL(hint, col_id);
+			QT_CHECK_EQUAL(pos, col_pos);
+		}
+
+		std::vector<int> candidates;
+		bvh.Query(origin, direction, seglen, candidates);
+		QT_CHECK(!col || std::find(candidates.begin(), candidates.end(), col_id) != candidates.end());
+	}
+	QT_CHECK(far_hints > 0);
+}
@@ -0,0 +1,86 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _ROADBVH_H
+#define _ROADBVH_H
+
+#include "roadstrip.h"
+
+#include <list>
+#include <vector>
+
+/// Track wide bounding volume hierarchy over the patches of all road strips.
+/// Nodes are stored depth first in one array, the left child of a node
+/// directly follows it, the right child index is stored in the node.
+/// Patch ids are global, numbered in road strip order.
+class ROADBVH
+{
+public:
+	ROADBVH();
+
+	void Build(const std::list<ROADSTRIP> & roads);
+
+	void Clear();
+
+	int GetNumPatches() const
+	{
+		return patches.size();
+	}
+
+	const ROADPATCH & GetPatch(int id) const
+	{
+		return *patches[id];
+	}
+
+	/// Nearest patch hit by the ray segment (bezier space).
+	/// patch_id is the previous patch hint on input, it is tried first.
+	bool CastRay(
+		const MATHVECTOR <float, 3> & origin,
+		const MATHVECTOR <float, 3> & direction,
+		const float seglen,
+		int & patch_id,
+		MATHVECTOR <float, 3> & outtri,
+		const BEZIER * & colpatch,
+		MATHVECTOR <float, 3> & normal) const;
+
+	/// Output the ids of the patches whose bounds are crossed by the ray segment.
+	void Query(
+		const MATHVECTOR <float, 3> & origin,
+		const MATHVECTOR <float, 3> & direction,
+		const float seglen,
+		std::vector<int> & candidates) const;
+
+private:
+	struct NODE
+	{
+		float min[3];
+		int index; ///< right child for inner nodes, first item for leafs
+		float max[3];
+		int count; ///< number of items, zero for inner nodes
+	};
+
+	std::vector<NODE> nodes;
+	std::vector<const ROADPATCH *> patches; ///< by patch id
+	std::vector<AABB<float> > bounds; ///< item bounds in leaf order
+	std::vector<int> items; ///< item patch ids in leaf order
+
+	int BuildNode(int first, int count, const std::vector<MATHVECTOR <float, 3> > & centers);
+};
+
+#endif // _ROADBVH_H
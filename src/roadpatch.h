@@ -24,6 +24,7 @@
 #include "mathvector.h"
 #include "vertexarray.h"
 #include "memory.h"
+#include "macros.h"
 
 class TEXTURE;
 class SCENENODE;
@@ -68,6 +69,14 @@ public:
 		patch.have_racingline = true;
 	}
 
+	bool Serialize(joeserialize::Serializer & s)
+	{
+		_SERIALIZE_(s, patch);
+		_SERIALIZE_(s, track_curvature);
+		_SERIALIZE_(s, racing_line);
+		return true;
+	}
+
 	void AddRacinglineScenenode(
 		SCENENODE & node,
 		const ROADPATCH & nextpatch,
@@ -18,7 +18,10 @@
 /************************************************************************/
 
 #include "roadstrip.h"
+#include "macros.h"
+
 #include <algorithm>
+#include <map>
 
 ROADSTRIP::ROADSTRIP() : 
 	closed(false)
@@ -87,62 +90,42 @@ bool ROADSTRIP::ReadFrom(
 		patches.back().GetPatch().Attach(patches.front().GetPatch());
 	}
 
-	GenerateSpacePartitioning();
-
 	return true;
 }
 
-void ROADSTRIP::GenerateSpacePartitioning()
-{
-	aabb_part.Clear();
-	for (unsigned i = 0; i < patches.size(); ++i)
-	{
-		aabb_part.Add(i, patches[i].GetPatch().GetAABB());
-	}
-	aabb_part.Optimize();
-}
-
-bool ROADSTRIP::Collide(
-	const MATHVECTOR <float, 3> & origin,
-	const MATHVECTOR <float, 3> & direction,
-	const float seglen,
-	int & patch_id,
-	MATHVECTOR <float, 3> & outtri,
-	const BEZIER * & colpatch,
-	MATHVECTOR <float, 3> & normal) const
+bool ROADSTRIP::Serialize(joeserialize::Serializer & s)
 {
-	if (patch_id >= 0 && patch_id < (int)patches.size())
+	// next patch links as patch indices, -1 if there is none
+	std::vector<int> next(patches.size(), -1);
+	if (s.GetIODirection() == joeserialize::Serializer::DIRECTION_OUTPUT)
 	{
-		MATHVECTOR <float, 3> coltri, colnorm;
-		if (patches[patch_id].Collide(origin, direction, seglen, coltri, colnorm))
+		std::map<const BEZIER *, int> index;
+		for (size_t i = 0; i < patches.size(); ++i)
+		{
+			index[&patches[i].GetPatch()] = i;
+		}
+		for (size_t i = 0; i < patches.size(); ++i)
 		{
-			outtri = coltri;
-			normal = colnorm;
-			colpatch = &patches[patch_id].GetPatch();
-			return true;
+			std::map<const BEZIER *, int>::const_iterator n = index.find(patches[i].GetPatch().GetNextPatch());
+			if (n != index.end()) next[i] = n->second;
 		}
 	}
 
-	bool col = false;
-	std::vector<int> candidates;
-	aabb_part.Query(AABB<float>::RAY(origin, direction, seglen), candidates);
-	for (std::vector<int>::iterator i = candidates.begin(); i != candidates.end(); ++i)
+	_SERIALIZE_(s, patches);
+	_SERIALIZE_(s, next);
+	_SERIALIZE_(s, closed);
+
+	if (s.GetIODirection() == joeserialize::Serializer::DIRECTION_INPUT)
 	{
-		MATHVECTOR <float, 3> coltri, colnorm;
-		if (patches[*i].Collide(origin, direction, seglen, coltri, colnorm))
+		if (next.size() != patches.size()) return false;
+		for (size_t i = 0; i < patches.size(); ++i)
 		{
-			if (!col || (coltri-origin).MagnitudeSquared() < (outtri-origin).MagnitudeSquared())
-			{
-				outtri = coltri;
-				normal = colnorm;
-				colpatch = &patches[*i].GetPatch();
-				patch_id = *i;
-			}
-			col = true;
+			BEZIER * patch = 0;
+			if (next[i] >= 0 && next[i] < (int)patches.size()) patch = &patches[next[i]].GetPatch();
+			patches[i].GetPatch().SetNextPatch(patch);
 		}
 	}
-
-	return col;
+	return true;
 }
 
 void ROADSTRIP::CreateRacingLine(
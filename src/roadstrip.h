@@ -21,7 +21,6 @@
 #define _ROADSTRIP_H
 
 #include "roadpatch.h"
-#include "aabb_space_partitioning.h"
 #include "optional.h"
 
 class ROADSTRIP
@@ -34,14 +33,8 @@ public:
 		bool reverse,
 		std::ostream & error_output);
 
-	bool Collide(
-		const MATHVECTOR <float, 3> & origin,
-		const MATHVECTOR <float, 3> & direction,
-		const float seglen,
-		int & patch_id,
-		MATHVECTOR <float, 3> & outtri,
-		const BEZIER * & colpatch,
-		MATHVECTOR <float, 3> & normal) const;
+	/// binary IO, restores the links between the patches on input
+	bool Serialize(joeserialize::Serializer & s);
 
 	void CreateRacingLine(
 		SCENENODE & parentnode,
@@ -64,10 +57,7 @@ public:
 
 private:
 	std::vector<ROADPATCH> patches;
-	AABB_SPACE_PARTITIONING_NODE <unsigned> aabb_part;
 	bool closed;
-
-	void GenerateSpacePartitioning();
 };
 
 #endif // _ROADSTRIP_H
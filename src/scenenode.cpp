@@ -18,11 +18,17 @@
 /************************************************************************/
 
 #include "scenenode.h"
+#include "unittest.h"
+#include "benchmark.h"
+
+#include <vector>
 
 typedef MATRIX4<float> MAT4;
 typedef MATHVECTOR<float,3> VEC3;
 typedef QUATERNION<float> QUAT;
 
+SCENENODE::STATS SCENENODE::stats;
+
 VEC3 SCENENODE::TransformIntoWorldSpace(const VEC3 & localspace) const
 {
 	VEC3 out(localspace);
@@ -39,6 +45,7 @@ VEC3 SCENENODE::TransformIntoLocalSpace(const VEC3 & worldspace) const
 
 void SCENENODE::SetChildVisibility(bool newvis)
 {
+	dirty = true;
 	drawlist.SetVisibility(newvis);
 
 	for (keyed_container <SCENENODE>::iterator i = childlist.begin(); i != childlist.end(); ++i)
@@ -49,6 +56,7 @@ void SCENENODE::SetChildVisibility(bool newvis)
 
 void SCENENODE::SetChildAlpha(float a)
 {
+	dirty = true;
 	drawlist.SetAlpha(a);
 
 	for (keyed_container <SCENENODE>::iterator i = childlist.begin(); i != childlist.end(); ++i)
@@ -68,3 +76,310 @@ void SCENENODE::DebugPrint(std::ostream & out, int curdepth) const
 		i->DebugPrint(out, curdepth+1);
 	}
 }
+
+void SCENENODE::Traverse(DRAWABLE_CONTAINER <PTRVECTOR> & drawlist_output, const MAT4 & prev_transform)
+{
+	bool prev_changed = (parent_transform != prev_transform);
+	parent_transform = prev_transform;
+
+	Update(prev_transform, prev_changed);
+
+	flattened.AppendPointersTo(drawlist_output);
+}
+
+void SCENENODE::Update(const MAT4 & prev_transform, bool prev_changed)
+{
+	stats.nodes++;
+
+	if (!dirty && !prev_changed)
+		return;
+
+	MAT4 this_transform(prev_transform);
+
+	bool identitytransform = transform.IsIdentityTransform();
+	if (!identitytransform)
+	{
+		transform.GetRotation().GetMatrix4(this_transform);
+		this_transform.Translate(transform.GetTranslation()[0], transform.GetTranslation()[1], transform.GetTranslation()[2]);
+		this_transform = this_transform.Multiply(prev_transform);
+		stats.matrices++;
+	}
+
+	bool changed = (this_transform != cached_transform);
+
+	flattened.clear();
+	if (changed)
+		drawlist.AppendTo<PTRVECTOR,true>(flattened, this_transform);
+	else
+		drawlist.AppendTo<PTRVECTOR,false>(flattened, this_transform);
+
+	for (keyed_container <SCENENODE>::iterator i = childlist.begin(); i != childlist.end(); ++i)
+	{
+		i->Update(this_transform, changed);
+		i->flattened.AppendPointersTo(flattened);
+	}
+
+	cached_transform = this_transform;
+	dirty = false;
+}
+
+QT_TEST(scenenode_traverse_test)
+{
+	SCENENODE root;
+	keyed_container <SCENENODE>::handle a = root.AddNode();
+	keyed_container <SCENENODE>::handle b = root.AddNode();
+	keyed_container <SCENENODE>::handle c = root.GetNode(b).AddNode();
+	root.GetDrawlist().normal_noblend.insert(DRAWABLE());
+	root.GetNode(a).GetDrawlist().normal_noblend.insert(DRAWABLE());
+	root.GetNode(a).GetTransform().SetTranslation(VEC3(1, 0, 0));
+	keyed_container <DRAWABLE>::handle d = root.GetNode(b).GetNode(c).GetDrawlist().normal_noblend.insert(DRAWABLE());
+
+	MAT4 identity;
+	DRAWABLE_CONTAINER <PTRVECTOR> output;
+	root.Traverse(output, identity);
+	QT_CHECK_EQUAL(output.normal_noblend.size(), 3);
+
+	// nothing changed, only the root is visited
+	SCENENODE::stats = SCENENODE::STATS();
+	output.clear();
+	root.Traverse(output, identity);
+	QT_CHECK_EQUAL(output.normal_noblend.size(), 3);
+	QT_CHECK_EQUAL(SCENENODE::stats.nodes, 1);
+	QT_CHECK_EQUAL(SCENENODE::stats.matrices, 0);
+
+	// a disabled drawable is removed, the untouched sibling subtree is not recomputed
+	SCENENODE::stats = SCENENODE::STATS();
+	root.GetNode(b).GetNode(c).GetDrawlist().normal_noblend.get(d).SetDrawEnable(false);
+	output.clear();
+	root.Traverse(output, identity);
+	QT_CHECK_EQUAL(output.normal_noblend.size(), 2);
+	QT_CHECK_EQUAL(SCENENODE::stats.nodes, 4);
+	QT_CHECK_EQUAL(SCENENODE::stats.matrices, 0);
+
+	// a transform change of a parent reaches the drawables of its clean children
+	root.GetNode(b).GetNode(c).GetDrawlist().normal_noblend.get(d).SetDrawEnable(true);
+	root.Traverse(output, identity);
+	root.GetNode(b).GetTransform().SetTranslation(VEC3(0, 2, 0));
+	SCENENODE::stats = SCENENODE::STATS();
+	output.clear();
+	root.Traverse(output, identity);
+	QT_CHECK_EQUAL(output.normal_noblend.size(), 3);
+	QT_CHECK_EQUAL(SCENENODE::stats.nodes, 4);
+	QT_CHECK_EQUAL(SCENENODE::stats.matrices, 1);
+	const MAT4 & mat = root.GetNode(b).GetNode(c).GetDrawlist().normal_noblend.get(d).GetTransform();
+	QT_CHECK_EQUAL(mat[13], 2);
+
+	// the drawables of a deleted node are gone
+	root.Delete(a);
+	output.clear();
+	root.Traverse(output, identity);
+	QT_CHECK_EQUAL(output.normal_noblend.size(), 2);
+}
+
+/// scene graph with the shape of a race, the nodes of a full race scene are
+/// stored in the same layout as in GAME
+struct RACE_SCENE
+{
+	typedef keyed_container <SCENENODE>::handle NODE;
+	typedef keyed_container <DRAWABLE>::handle DRAW;
+
+	SCENENODE debug, gui, track, hud, trackmap, particles;
+	std::vector <SCENENODE> cars;
+	std::vector <NODE> wheels;
+	std::vector <NODE> hud_nodes;
+	std::vector <DRAW> hud_draws;
+	std::vector <NODE> dots;
+	DRAW smoke;
+
+	RACE_SCENE(unsigned int car_count) : cars(car_count)
+	{
+		debug.GetDrawlist().text.insert(DRAWABLE());
+
+		// gui pages are hidden during the race
+		for (int i = 0; i < 150; ++i)
+		{
+			NODE n = gui.AddNode();
+			gui.GetNode(n).GetDrawlist().twodim.insert(DRAWABLE());
+		}
+		gui.SetChildVisibility(false);
+
+		// static track objects
+		for (int i = 0; i < 600; ++i)
+		{
+			NODE n = track.AddNode();
+			SCENENODE & obj = track.GetNode(n);
+			obj.GetTransform().SetTranslation(VEC3(i, i % 7, 0));
+			obj.GetDrawlist().normal_noblend.insert(DRAWABLE());
+			if (i % 4 == 0)
+				obj.GetDrawlist().normal_blend.insert(DRAWABLE());
+		}
+
+		for (int i = 0; i < 50; ++i)
+		{
+			NODE n = hud.AddNode();
+			hud_nodes.push_back(n);
+			hud_draws.push_back(hud.GetNode(n).GetDrawlist().text.insert(DRAWABLE()));
+		}
+
+		trackmap.GetDrawlist().twodim.insert(DRAWABLE());
+		for (unsigned int i = 0; i < car_count; ++i)
+		{
+			NODE n = trackmap.AddNode();
+			dots.push_back(n);
+			trackmap.GetNode(n).GetDrawlist().twodim.insert(DRAWABLE());
+		}
+
+		smoke = particles.GetDrawlist().particle.insert(DRAWABLE());
+
+		for (unsigned int i = 0; i < car_count; ++i)
+		{
+			SCENENODE & car = cars[i];
+			NODE body = car.AddNode();
+			for (int j = 0; j < 10; ++j)
+				car.GetNode(body).GetDrawlist().car_noblend.insert(DRAWABLE());
+			car.GetNode(body).GetDrawlist().lights_emissive.insert(DRAWABLE());
+			for (int j = 0; j < 4; ++j)
+			{
+				NODE wheel = car.AddNode();
+				wheels.push_back(wheel);
+				SCENENODE & wheelref = car.GetNode(wheel);
+				wheelref.GetTransform().SetTranslation(VEC3(j % 2, j / 2, 0));
+				wheelref.GetDrawlist().car_noblend.insert(DRAWABLE());
+				wheelref.GetDrawlist().car_noblend.insert(DRAWABLE());
+				NODE brake = wheelref.AddNode();
+				wheelref.GetNode(brake).GetDrawlist().car_noblend.insert(DRAWABLE());
+			}
+		}
+	}
+
+	/// the updates GAME does during a race tick
+	void Animate(int frame)
+	{
+		for (unsigned int i = 0; i < cars.size(); ++i)
+		{
+			SCENENODE & car = cars[i];
+			car.GetTransform().SetTranslation(VEC3(frame * 0.1f, i, 0));
+			for (int j = 0; j < 4; ++j)
+			{
+				QUAT rot;
+				rot.Rotate(frame * 0.3f, 0, 1, 0);
+				car.GetNode(wheels[i * 4 + j]).GetTransform().SetRotation(rot);
+			}
+			trackmap.GetNode(dots[i]).GetTransform().SetTranslation(VEC3(frame, i, 0));
+		}
+
+		// speedometer, tachometer, gear and lap times
+		for (int i = 0; i < 6; ++i)
+			hud.GetNode(hud_nodes[i]).GetDrawlist().text.get(hud_draws[i]).SetColor(1, 1, frame % 2);
+
+		particles.GetDrawlist().particle.get(smoke).SetDrawEnable(true);
+	}
+
+	template <bool full>
+	void Traverse(DRAWABLE_CONTAINER <PTRVECTOR> & output)
+	{
+		output.clear();
+		Traverse<full>(debug, output);
+		Traverse<full>(gui, output);
+		Traverse<full>(track, output);
+		Traverse<full>(hud, output);
+		Traverse<full>(trackmap, output);
+		Traverse<full>(particles, output);
+		for (unsigned int i = 0; i < cars.size(); ++i)
+			Traverse<full>(cars[i], output);
+	}
+
+	template <bool full>
+	void Traverse(SCENENODE & node, DRAWABLE_CONTAINER <PTRVECTOR> & output)
+	{
+		MAT4 identity;
+		if (full)
+			node.Traverse<PTRVECTOR>(output, identity);
+		else
+			node.Traverse(output, identity);
+	}
+};
+
+struct SAME_DRAWABLES
+{
+	DRAWABLE_CONTAINER <PTRVECTOR> & other;
+	bool same;
+
+	SAME_DRAWABLES(DRAWABLE_CONTAINER <PTRVECTOR> & other) : other(other), same(true) {}
+
+	void operator()(const char * name, PTRVECTOR <DRAWABLE> & container)
+	{
+		PTRVECTOR <DRAWABLE> & other_container = *other.GetByName(name);
+		if (container.size() != other_container.size())
+		{
+			same = false;
+			return;
+		}
+		for (unsigned int i = 0; i < container.size(); ++i)
+		{
+			MAT4 mat = container[i]->GetTransform();
+			if (mat != other_container[i]->GetTransform())
+				same = false;
+		}
+	}
+};
+
+QT_TEST(scenenode_race_traverse_test)
+{
+	// the incremental traversal yields the drawables and transforms of a full traversal
+	RACE_SCENE full_scene(4), scene(4);
+	DRAWABLE_CONTAINER <PTRVECTOR> full_output, output;
+	bool same = true;
+	for (int frame = 0; frame < 5; ++frame)
+	{
+		full_scene.Animate(frame);
+		full_scene.Traverse<true>(full_output);
+		scene.Animate(frame);
+		scene.Traverse<false>(output);
+
+		SAME_DRAWABLES cmp(full_output);
+		output.ForEachWithName<SAME_DRAWABLES &>(cmp);
+		same = same && cmp.same;
+	}
+	QT_CHECK(same);
+	QT_CHECK(output.size() > 0);
+}
+
+BENCHMARK(scenegraph_traversal)
+{
+	const int frames = 1000;
+	const unsigned int car_count = 8;
+	RACE_SCENE full_scene(car_count), scene(car_count);
+	DRAWABLE_CONTAINER <PTRVECTOR> output;
+	benchmark::Stopwatch timer;
+
+	SCENENODE::stats = SCENENODE::STATS();
+	double full_time = 0;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		full_scene.Animate(frame);
+		timer.Reset();
+		full_scene.Traverse<true>(output);
+		full_time += timer.Seconds();
+	}
+	SCENENODE::STATS full_stats = SCENENODE::stats;
+
+	SCENENODE::stats = SCENENODE::STATS();
+	double time = 0;
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		scene.Animate(frame);
+		timer.Reset();
+		scene.Traverse<false>(output);
+		time += timer.Seconds();
+	}
+	SCENENODE::STATS stats = SCENENODE::stats;
+
+	out << "scenegraph_traversal: " << car_count << " cars, " << output.size() << " drawables" << std::endl;
+	out << "full: " << full_stats.nodes / frames << " nodes, " <<
+		full_stats.matrices / frames << " matrices, " <<
+		full_time / frames * 1E6 << " us per frame" << std::endl;
+	out << "incremental: " << stats.nodes / frames << " nodes, " <<
+		stats.matrices / frames << " matrices, " <<
+		time / frames * 1E6 << " us per frame" << std::endl;
+}
@@ -30,22 +30,60 @@ public:
 	typedef MATRIX4<float> MAT4;
 	typedef MATHVECTOR<float,3> VEC3;
 
-	keyed_container <SCENENODE>::handle AddNode() {return childlist.insert(SCENENODE());}
-	SCENENODE & GetNode(keyed_container <SCENENODE>::handle handle) {return childlist.get(handle);}
+	/// nodes visited and matrices multiplied by scene traversals, for profiling
+	struct STATS
+	{
+		unsigned int nodes;
+		unsigned int matrices;
+		STATS() : nodes(0), matrices(0) {}
+	};
+	static STATS stats;
+
+	SCENENODE() : dirty(true) {}
+
+	/// the drawables collected by the last traversal are not copied, they belong to the other node
+	SCENENODE(const SCENENODE & other) :
+		childlist(other.childlist),
+		drawlist(other.drawlist),
+		transform(other.transform),
+		cached_transform(other.cached_transform),
+		parent_transform(other.parent_transform),
+		dirty(true)
+	{
+		// ctor
+	}
+
+	SCENENODE & operator=(const SCENENODE & other)
+	{
+		childlist = other.childlist;
+		drawlist = other.drawlist;
+		transform = other.transform;
+		cached_transform = other.cached_transform;
+		parent_transform = other.parent_transform;
+		flattened.clear();
+		dirty = true;
+		return *this;
+	}
+
+	// the non-const accessors mark the node as modified, a child can only be
+	// reached through its parent so the mark propagates up to the root
+
+	keyed_container <SCENENODE>::handle AddNode() {dirty = true; return childlist.insert(SCENENODE());}
+	SCENENODE & GetNode(keyed_container <SCENENODE>::handle handle) {dirty = true; return childlist.get(handle);}
 	const SCENENODE & GetNode(keyed_container <SCENENODE>::handle handle) const {return childlist.get(handle);}
 
-	keyed_container <SCENENODE> & GetNodelist() {return childlist;}
+	keyed_container <SCENENODE> & GetNodelist() {dirty = true; return childlist;}
 	const keyed_container <SCENENODE> & GetNodelist() const {return childlist;}
-	DRAWABLE_CONTAINER <keyed_container> & GetDrawlist() {return drawlist;}
+	DRAWABLE_CONTAINER <keyed_container> & GetDrawlist() {dirty = true; return drawlist;}
 	const DRAWABLE_CONTAINER <keyed_container> & GetDrawlist() const {return drawlist;}
 
-	TRANSFORM & GetTransform() {return transform;}
-	void SetTransform(const TRANSFORM & newtransform) {transform=newtransform;}
+	TRANSFORM & GetTransform() {dirty = true; return transform;}
+	void SetTransform(const TRANSFORM & newtransform) {dirty = true; transform=newtransform;}
 	const TRANSFORM & GetTransform() const {return transform;}
 	unsigned int Nodes() const {return childlist.size();}
 	unsigned int Drawables() const {return drawlist.size();}
-	void Clear() {drawlist.clear();childlist.clear();}
-	void Delete(keyed_container <SCENENODE>::handle handle) {childlist.erase(handle);}
+	void Clear() {dirty = true; drawlist.clear();childlist.clear();}
+	void Delete(keyed_container <SCENENODE>::handle handle) {dirty = true; childlist.erase(handle);}
 	VEC3 TransformIntoWorldSpace() const {VEC3 zero;return TransformIntoWorldSpace(zero);}
 	VEC3 TransformIntoWorldSpace(const VEC3 & localspace) const;
 	VEC3 TransformIntoLocalSpace(const VEC3 & worldspace) const;
@@ -53,9 +91,17 @@ public:
 	void SetChildAlpha(float a);
 	void DebugPrint(std::ostream & out, int curdepth = 0) const;
 
+	/// append the enabled drawables of the subtree to drawlist_output.
+	/// subtrees which have not been modified since the previous traversal and
+	/// whose parent transform did not change append the drawables collected then
+	void Traverse(DRAWABLE_CONTAINER <PTRVECTOR> & drawlist_output, const MAT4 & prev_transform);
+
+	/// visit every node of the subtree, used to fill other container types
 	template <template <typename U> class T>
 	void Traverse(DRAWABLE_CONTAINER <T> & drawlist_output, const MAT4 & prev_transform)
 	{
+		stats.nodes++;
+
 		MAT4 this_transform(prev_transform);
 
 		bool identitytransform = transform.IsIdentityTransform();
@@ -64,6 +110,7 @@ public:
 			transform.GetRotation().GetMatrix4(this_transform);
 			this_transform.Translate(transform.GetTranslation()[0], transform.GetTranslation()[1], transform.GetTranslation()[2]);
 			this_transform = this_transform.Multiply(prev_transform);
+			stats.matrices++;
 		}
 
 		if (this_transform != cached_transform)
@@ -73,10 +120,13 @@ public:
 
 		for (keyed_container <SCENENODE>::iterator i = childlist.begin(); i != childlist.end(); ++i)
 		{
-			i->Traverse(drawlist_output, this_transform);
+			i->Traverse<T>(drawlist_output, this_transform);
 		}
 
 		cached_transform = this_transform;
+
+		// the drawables collected by the incremental traversal may be stale now
+		dirty = true;
 	}
 
 	/// traverse all drawable containers applying the specified functor.
@@ -85,6 +135,7 @@ public:
 	template <typename T>
 	void ApplyDrawableContainerFunctor(T functor)
 	{
+		dirty = true;
 		functor(drawlist);
 		for (keyed_container <SCENENODE>::iterator i = childlist.begin(); i != childlist.end(); ++i)
 		{
@@ -98,6 +149,7 @@ public:
 	template <typename T>
 	void ApplyDrawableFunctor(T functor)
 	{
+		dirty = true;
 		drawlist.ForEachDrawable(functor);
 		for (keyed_container <SCENENODE>::iterator i = childlist.begin(); i != childlist.end(); ++i)
 		{
@@ -110,6 +162,14 @@ private:
 	DRAWABLE_CONTAINER <keyed_container> drawlist;
 	TRANSFORM transform;
 	MAT4 cached_transform;
+
+	// drawables of the subtree collected by the last incremental traversal
+	DRAWABLE_CONTAINER <PTRVECTOR> flattened;
+	MAT4 parent_transform; ///< transform passed to the last traversal started at this node
+	bool dirty; ///< the subtree may have been modified since the last traversal
+
+	/// refresh the flattened drawables of a modified subtree or one whose parent transform changed
+	void Update(const MAT4 & prev_transform, bool prev_changed);
 };
 
 #endif // _SCENENODE_H
@@ -72,6 +72,7 @@ SETTINGS::SETTINGS() :
 	recordreplay(false),
 	selected_replay("none"),
 	texturesize("large"),
+	content_budget(0),
 	button_ramp(5),
 	ff_device("/dev/input/event0"),
 	ff_gain(2.0),
@@ -151,6 +152,7 @@ void SETTINGS::Serialize(bool write, CONFIG & config)
 	Param(config, write, section, "view_distance", view_distance);
 	Param(config, write, section, "racingline", racingline);
 	Param(config, write, section, "texture_size", texturesize);
+	Param(config, write, section, "content_budget", content_budget);
 	Param(config, write, section, "shadows", shadows);
 	Param(config, write, section, "shadow_distance", shadow_distance);
 	Param(config, write, section, "shadow_quality", shadow_quality);
@@ -209,6 +209,12 @@ public:
 		return texturesize;
 	}
 
+	/// content cache memory budget in MB, 0 for none
+	int GetContentBudget() const
+	{
+		return content_budget;
+	}
+
 	float GetButtonRamp() const
 	{
 		return button_ramp;
@@ -416,6 +422,7 @@ private:
 	bool recordreplay;
 	std::string selected_replay;
 	std::string texturesize;
+	int content_budget;
 	float button_ramp;
 	std::string ff_device;
 	float ff_gain;
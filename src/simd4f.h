@@ -0,0 +1,140 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _SIMD4F_H
+#define _SIMD4F_H
+
+// Minimal 4-wide float type used by the batched collision, culling and
+// mixing kernels. Maps onto SSE where available, plain arrays otherwise.
+// Comparisons return lane masks (all bits set/clear) for use with Select.
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define SIMD4F_SSE
+#include <xmmintrin.h>
+#endif
+
+#include <cmath>
+#include <cstring>
+
+#ifdef _MSC_VER
+#define SIMD4F_ALIGN(x) __declspec(align(x))
+#else
+#define SIMD4F_ALIGN(x) __attribute__((aligned(x)))
+#endif
+
+struct simd4f
+{
+#ifdef SIMD4F_SSE
+	__m128 v;
+
+	simd4f() {}
+	simd4f(__m128 m) : v(m) {}
+	explicit simd4f(float f) : v(_mm_set1_ps(f)) {}
+	simd4f(float x, float y, float z, float w) : v(_mm_setr_ps(x, y, z, w)) {}
+
+	static simd4f Load(const float * p) {return simd4f(_mm_loadu_ps(p));}
+	void Store(float * p) const {_mm_storeu_ps(p, v);}
+
+	float operator[](int i) const
+	{
+		SIMD4F_ALIGN(16) float f[4];
+		_mm_store_ps(f, v);
+		return f[i];
+	}
+#else
+	float v[4];
+
+	simd4f() {}
+	explicit simd4f(float f) {v[0] = v[1] = v[2] = v[3] = f;}
+	simd4f(float x, float y, float z, float w) {v[0] = x; v[1] = y; v[2] = z; v[3] = w;}
+
+	static simd4f Load(const float * p) {return simd4f(p[0], p[1], p[2], p[3]);}
+	void Store(float * p) const {p[0] = v[0]; p[1] = v[1]; p[2] = v[2]; p[3] = v[3];}
+
+	float operator[](int i) const {return v[i];}
+#endif
+};
+
+#ifdef SIMD4F_SSE
+
+inline simd4f operator+(simd4f a, simd4f b) {return _mm_add_ps(a.v, b.v);}
+inline simd4f operator-(simd4f a, simd4f b) {return _mm_sub_ps(a.v, b.v);}
+inline simd4f operator*(simd4f a, simd4f b) {return _mm_mul_ps(a.v, b.v);}
+inline simd4f operator/(simd4f a, simd4f b) {return _mm_div_ps(a.v, b.v);}
+inline simd4f operator-(simd4f a) {return _mm_sub_ps(_mm_setzero_ps(), a.v);}
+inline simd4f Min(simd4f a, simd4f b) {return _mm_min_ps(a.v, b.v);}
+inline simd4f Max(simd4f a, simd4f b) {return _mm_max_ps(a.v, b.v);}
+inline simd4f Sqrt(simd4f a) {return _mm_sqrt_ps(a.v);}
+inline simd4f Abs(simd4f a) {return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v);}
+inline simd4f CmpLt(simd4f a, simd4f b) {return _mm_cmplt_ps(a.v, b.v);}
+inline simd4f CmpLe(simd4f a, simd4f b) {return _mm_cmple_ps(a.v, b.v);}
+inline simd4f CmpGt(simd4f a, simd4f b) {return _mm_cmpgt_ps(a.v, b.v);}
+inline simd4f CmpGe(simd4f a, simd4f b) {return _mm_cmpge_ps(a.v, b.v);}
+inline simd4f CmpEq(simd4f a, simd4f b) {return _mm_cmpeq_ps(a.v, b.v);}
+inline simd4f operator&(simd4f a, simd4f b) {return _mm_and_ps(a.v, b.v);}
+inline simd4f operator|(simd4f a, simd4f b) {return _mm_or_ps(a.v, b.v);}
+inline simd4f AndNot(simd4f a, simd4f b) {return _mm_andnot_ps(a.v, b.v);}
+inline simd4f Select(simd4f mask, simd4f a, simd4f b) {return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));}
+inline int MoveMask(simd4f a) {return _mm_movemask_ps(a.v);}
+
+#else
+
+namespace simd4f_detail
+{
+	inline unsigned Bits(float f) {unsigned u; std::memcpy(&u, &f, 4); return u;}
+	inline float Float(unsigned u) {float f; std::memcpy(&f, &u, 4); return f;}
+	inline float Mask(bool b) {return Float(b ? 0xFFFFFFFFu : 0u);}
+}
+
+#define SIMD4F_OP(expr) simd4f r; for (int i = 0; i < 4; ++i) r.v[i] = (expr); return r;
+inline simd4f operator+(simd4f a, simd4f b) {SIMD4F_OP(a.v[i] + b.v[i])}
+inline simd4f operator-(simd4f a, simd4f b) {SIMD4F_OP(a.v[i] - b.v[i])}
+inline simd4f operator*(simd4f a, simd4f b) {SIMD4F_OP(a.v[i] * b.v[i])}
+inline simd4f operator/(simd4f a, simd4f b) {SIMD4F_OP(a.v[i] / b.v[i])}
+inline simd4f operator-(simd4f a) {SIMD4F_OP(-a.v[i])}
+inline simd4f Min(simd4f a, simd4f b) {SIMD4F_OP(a.v[i] < b.v[i] ? a.v[i] : b.v[i])}
+inline simd4f Max(simd4f a, simd4f b) {SIMD4F_OP(a.v[i] > b.v[i] ? a.v[i] : b.v[i])}
+inline simd4f Sqrt(simd4f a) {SIMD4F_OP(std::sqrt(a.v[i]))}
+inline simd4f Abs(simd4f a) {SIMD4F_OP(std::fabs(a.v[i]))}
+inline simd4f CmpLt(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Mask(a.v[i] < b.v[i]))}
+inline simd4f CmpLe(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Mask(a.v[i] <= b.v[i]))}
+inline simd4f CmpGt(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Mask(a.v[i] > b.v[i]))}
+inline simd4f CmpGe(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Mask(a.v[i] >= b.v[i]))}
+inline simd4f CmpEq(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Mask(a.v[i] == b.v[i]))}
+inline simd4f operator&(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Float(simd4f_detail::Bits(a.v[i]) & simd4f_detail::Bits(b.v[i])))}
+inline simd4f operator|(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Float(simd4f_detail::Bits(a.v[i]) | simd4f_detail::Bits(b.v[i])))}
+inline simd4f AndNot(simd4f a, simd4f b) {SIMD4F_OP(simd4f_detail::Float(~simd4f_detail::Bits(a.v[i]) & simd4f_detail::Bits(b.v[i])))}
+inline simd4f Select(simd4f mask, simd4f a, simd4f b) {return (mask & a) | AndNot(mask, b);}
+inline int MoveMask(simd4f a)
+{
+	int m = 0;
+	for (int i = 0; i < 4; ++i) m |= (simd4f_detail::Bits(a.v[i]) >> 31) << i;
+	return m;
+}
+#undef SIMD4F_OP
+
+#endif // SIMD4F_SSE
+
+/// true if any lane of the mask is set
+inline bool Any(simd4f mask) {return MoveMask(mask) != 0;}
+
+/// true if all lanes of the mask are set
+inline bool All(simd4f mask) {return MoveMask(mask) == 0xF;}
+
+#endif // _SIMD4F_H
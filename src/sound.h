@@ -21,6 +21,7 @@
 #define _SOUND_H
 
 #include "soundbuffer.h"
+#include "soundstream.h"
 #include "soundfilter.h"
 #include "tripplebuffer.h"
 #include "mathvector.h"
@@ -31,10 +32,15 @@
 #include <string>
 #include <ostream>
 
+class JobSystem;
+
 struct SDL_mutex;
+struct SDL_semaphore;
+struct SDL_Thread;
 
 class SOUND
 {
+friend struct SoundMixerTest;
 public:
 	SOUND();
 
@@ -52,8 +58,8 @@ public:
 	// disable sound
 	void Disable();
 
-	// commit state changes
-	void Update(bool pause);
+	// commit state changes, source gains are computed on jobs if given
+	void Update(bool pause, JobSystem * jobs = 0);
 
 	// active sources limit can be adjusted at runtime
 	void SetMaxActiveSources(size_t value);
@@ -98,6 +104,7 @@ private:
 	struct Source
 	{
 		std::tr1::shared_ptr<SOUNDBUFFER> buffer;
+		std::tr1::shared_ptr<SOUNDSTREAM> stream;
 		MATHVECTOR<float, 3> position;
 		MATHVECTOR<float, 3> velocity;
 		float offset;
@@ -114,6 +121,9 @@ private:
 		static const int denom = 32768;
 		static const int max_gain_delta = (denom * 173) / 44100; // 256 samples from min to max gain
 		const SOUNDBUFFER * buffer;
+		SOUNDSTREAM * stream;
+		const short * data;
+		int channels;
 		int samples_per_channel;
 		int sample_pos;
 		int sample_pos_remainder;
@@ -142,6 +152,7 @@ private:
 	struct SamplerAdd
 	{
 		const SOUNDBUFFER * buffer;
+		SOUNDSTREAM * stream;
 		int offset;
 		bool loop;
 		int id;
@@ -156,8 +167,23 @@ private:
 	SDL_mutex * source_lock;
 	bool set_pause;
 
+	// streams are released once the sound thread has processed the sampler removal,
+	// the tickets count sampler changes sent by the main thread
+	std::vector<std::pair<std::tr1::shared_ptr<SOUNDSTREAM>, unsigned int> > streams_retired;
+	unsigned int sampler_ticket;
+	unsigned int samplers_ticket;
+	unsigned int source_ticket;
+
+	// stream thread state, streams protected by stream_lock
+	std::vector<std::tr1::shared_ptr<SOUNDSTREAM> > streams;
+	SDL_mutex * stream_lock;
+	SDL_semaphore * stream_wake;
+	SDL_Thread * stream_thread;
+	bool stream_quit;
+
 	// sound sources state
 	std::vector<SourceActive> sources_active;
+	std::vector<int> sources_gain;
 	std::vector<Source> sources;
 	size_t max_active_sources;
 	size_t sources_num;
@@ -165,6 +191,7 @@ private:
 
 	// sound thread state
 	std::vector<int> buffer1, buffer2;
+	std::vector<short> stream_frames;
 	std::vector<Sampler> samplers;
 	size_t samplers_num;
 	bool samplers_pause;
@@ -177,12 +204,19 @@ private:
 
 	void ProcessSourceRemove();
 
-	void ProcessSources();
+	void ProcessSources(JobSystem * jobs);
+
+	static void ProcessSourceGains(void * sound, int begin, int end);
 
 	void LimitActiveSources();
 
 	void SetSamplerChanges();
 
+	void ReleaseStreams(unsigned int ticket);
+
+	// stream thread methods
+	static int StreamThread(void * sound);
+
 	// sound thread methods
 	void GetSamplerChanges();
 
@@ -200,9 +234,25 @@ private:
 
 	static void CallbackWrapper(void *sound, unsigned char *stream, int len);
 
+	// scalar reference sampler, writes len samples per channel
 	static void SampleAndAdvanceWithPitch16bit(
 		Sampler & sampler, int * chan1, int * chan2, int len);
 
+	// block sampler, adds len samples per channel to the 32 bit mix buffers
+	// bit-exact with SampleAndAdvanceWithPitch16bit
+	static void MixWithPitch16bit(
+		Sampler & sampler, int * mix1, int * mix2, int len);
+
+	// block sampler for streamed buffers, mixes the buffered frames of the stream
+	static void MixStreamWithPitch16bit(
+		Sampler & sampler, std::vector<short> & frames, int * mix1, int * mix2, int len);
+
+	// mix a span that does not wrap around the end of the sample buffer
+	static void MixSpanWithPitch16bit(
+		const short * buf, int chan, int pitch, int & ni, int & nr,
+		int gain1, int & last_gain1, int gain2, int & last_gain2,
+		int * mix1, int * mix2, int len);
+
 	static void AdvanceWithPitch(Sampler & sampler, int len);
 };
 
@@ -31,7 +31,7 @@
 #include <cstdio>
 #include <cstring>
 
-bool SOUNDBUFFER::LoadWAV(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output)
+bool SOUNDBUFFER::LoadWAV(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output, unsigned int stream_size)
 {
 	if (loaded)
 		Unload();
@@ -40,8 +40,6 @@ bool SOUNDBUFFER::LoadWAV(const std::string & filename, const SOUNDINFO & sound_
 
 	FILE *fp;
 
-	unsigned int size;
-
 	fp = fopen(filename.c_str(), "rb");
 	if (fp)
 	{
@@ -108,14 +106,23 @@ bool SOUNDBUFFER::LoadWAV(const std::string & filename, const SOUNDINFO & sound_
 						return false;
 					}
 
-					sound_buffer = new char[size];
+					if (stream_size && size > stream_size)
+					{
+						// leave the sound data in the file, it is decoded by a SOUNDSTREAM
+						stream_offset = ftell(fp);
+						streamed = true;
+					}
+					else
+					{
+						sound_buffer = new char[size];
 
-					if (fread(sound_buffer, sizeof(char), size, fp) != size) return false; //read in our whole sound data chunk
+						if (fread(sound_buffer, sizeof(char), size, fp) != size) return false; //read in our whole sound data chunk
+					}
 
 #if SDL_BYTEORDER == SDL_BIG_ENDIAN
 					if (bits_per_sample == 16)
 					{
-						for (unsigned int i = 0; i < size/2; i++)
+						for (unsigned int i = 0; sound_buffer && i < size/2; i++)
 						{
 							//cout << "preswap i: " << sound_buffer[i] << "preswap i+1: " << sound_buffer[i+1] << std::endl;
 							//short preswap = ((short *)sound_buffer)[i];
@@ -194,7 +201,7 @@ bool SOUNDBUFFER::LoadWAV(const std::string & filename, const SOUNDINFO & sound_
 	return true;
 }
 
-bool SOUNDBUFFER::LoadOGG(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output)
+bool SOUNDBUFFER::LoadOGG(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output, unsigned int stream_size)
 {
 	if (loaded)
 		Unload();
@@ -234,7 +241,16 @@ bool SOUNDBUFFER::LoadOGG(const std::string & filename, const SOUNDINFO & sound_
 		}
 
 		//allocate space
-		unsigned int size = info.samples*info.channels*info.bytespersample;
+		size = info.samples*info.bytespersample;
+		if (stream_size && size > stream_size)
+		{
+			// leave the sound data in the file, it is decoded by a SOUNDSTREAM
+			streamed = true;
+			loaded = true;
+			ov_clear(&oggFile);
+			return true;
+		}
+
 		sound_buffer = new char[size];
 		int bitstream;
 		int endian = 0; //0 for Little-Endian, 1 for Big-Endian
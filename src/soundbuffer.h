@@ -30,7 +30,10 @@ class SOUNDBUFFER
 public:
 	SOUNDBUFFER() :
 		info(0, 0, 0, 0),
+		size(0),
+		stream_offset(0),
 		loaded(false),
+		streamed(false),
 		sound_buffer(0)
 	{
 		// ctor
@@ -41,12 +44,14 @@ public:
 		Unload();
 	}
 
-	bool Load(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output)
+	/// sounds with more than stream_size bytes of samples are not loaded into memory
+	/// but played through a SOUNDSTREAM, a stream_size of zero disables streaming
+	bool Load(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output, unsigned int stream_size = 0)
 	{
 		if (filename.find(".wav") != std::string::npos)
-			return LoadWAV(filename, sound_device_info, error_output);
+			return LoadWAV(filename, sound_device_info, error_output, stream_size);
 		else if (filename.find(".ogg") != std::string::npos)
-			return LoadOGG(filename, sound_device_info, error_output);
+			return LoadOGG(filename, sound_device_info, error_output, stream_size);
 		else
 		{
 			error_output << "Unable to determine file type from filename: " << filename << std::endl;
@@ -59,6 +64,7 @@ public:
 		if (loaded && sound_buffer)
 			delete [] sound_buffer;
 		sound_buffer = 0;
+		streamed = false;
 	}
 
 	const SOUNDINFO & GetInfo() const
@@ -86,16 +92,36 @@ public:
 		return loaded;
 	}
 
+	/// size of the sample buffer in memory in bytes
+	unsigned int GetSize() const
+	{
+		return streamed ? 0 : size;
+	}
+
+	/// samples are left in the file, GetRawBuffer returns null
+	bool GetStreamed() const
+	{
+		return streamed;
+	}
+
+	/// file offset of the samples of a streamed wav file
+	long GetStreamOffset() const
+	{
+		return stream_offset;
+	}
+
 private:
 	SOUNDINFO info;
 	unsigned int size;
+	long stream_offset;
 	bool loaded;
+	bool streamed;
 	char * sound_buffer;
 	std::string name;
 
-	bool LoadWAV(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output);
+	bool LoadWAV(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output, unsigned int stream_size);
 
-	bool LoadOGG(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output);
+	bool LoadOGG(const std::string & filename, const SOUNDINFO & sound_device_info, std::ostream & error_output, unsigned int stream_size);
 
 };
 
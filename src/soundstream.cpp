@@ -0,0 +1,282 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "soundstream.h"
+#include "soundbuffer.h"
+#include "endian_utility.h"
+
+#ifdef __APPLE__
+#define __MACOSX__
+#include <Vorbis/vorbisfile.h>
+#else
+#include <vorbis/vorbisfile.h>
+#endif
+
+#include <SDL/SDL.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+SOUNDSTREAM::SOUNDSTREAM() :
+	info(0, 0, 0, 0),
+	ring_frames(0),
+	channels(0),
+	frames(0),
+	loop(false),
+	underruns(0),
+	lock(SDL_CreateMutex()),
+	read_pos(0),
+	write_pos(0),
+	generation(0),
+	read_frame(0),
+	seek_frame(-1),
+	file(0),
+	ogg(0),
+	data_offset(0),
+	file_frame(0)
+{
+	// ctor
+}
+
+SOUNDSTREAM::~SOUNDSTREAM()
+{
+	Close();
+	SDL_DestroyMutex(lock);
+}
+
+bool SOUNDSTREAM::Open(const SOUNDBUFFER & buffer, bool newloop, std::ostream & error_output, int newring_frames)
+{
+	assert(buffer.GetStreamed());
+	assert(newring_frames > 0);
+
+	Close();
+
+	const std::string & filename = buffer.GetName();
+	if (filename.find(".ogg") != std::string::npos)
+	{
+		FILE * fp = fopen(filename.c_str(), "rb");
+		if (!fp)
+		{
+			error_output << "Can't open sound file: " << filename << std::endl;
+			return false;
+		}
+
+		ogg = new OggVorbis_File;
+		if (ov_open_callbacks(fp, ogg, NULL, 0, OV_CALLBACKS_DEFAULT) != 0)
+		{
+			error_output << "Can't stream sound file: " << filename << std::endl;
+			fclose(fp);
+			delete ogg;
+			ogg = 0;
+			return false;
+		}
+	}
+	else
+	{
+		file = fopen(filename.c_str(), "rb");
+		if (!file)
+		{
+			error_output << "Can't open sound file: " << filename << std::endl;
+			return false;
+		}
+		data_offset = buffer.GetStreamOffset();
+	}
+
+	info = buffer.GetInfo();
+	channels = info.channels;
+	frames = info.samples / info.channels;
+	loop = newloop;
+	ring_frames = newring_frames;
+	ring.resize(ring_frames * channels);
+
+	// the first fill starts decoding at the first frame
+	SDL_mutexP(lock);
+	read_pos = write_pos = 0;
+	read_frame = 0;
+	seek_frame = 0;
+	SDL_mutexV(lock);
+
+	return true;
+}
+
+int SOUNDSTREAM::Fill()
+{
+	if (!file && !ogg)
+		return 0;
+
+	SDL_mutexP(lock);
+	unsigned int fill_generation = generation;
+	unsigned int fill_pos = write_pos;
+	int count = ring_frames - int(write_pos - read_pos);
+	int seek = seek_frame;
+	seek_frame = -1;
+	SDL_mutexV(lock);
+
+	if (seek >= 0 && !Rewind(seek))
+		return 0;
+
+	if (count <= 0)
+		return 0;
+
+	// decode into the free part of the ring, it is not read before it is committed
+	int begin = fill_pos % ring_frames;
+	int count1 = std::min(count, ring_frames - begin);
+	Decode(&ring[begin * channels], count1);
+	Decode(&ring[0], count - count1);
+
+	// commit unless the reader has seeked in the meantime
+	SDL_mutexP(lock);
+	bool valid = (fill_generation == generation);
+	if (valid)
+		write_pos += count;
+	SDL_mutexV(lock);
+
+	return valid ? count : 0;
+}
+
+void SOUNDSTREAM::Seek(int frame)
+{
+	if (loop && frames > 0)
+		frame = frame % frames;
+
+	SDL_mutexP(lock);
+	++generation;
+	read_pos = write_pos;
+	read_frame = frame;
+	seek_frame = frame;
+	SDL_mutexV(lock);
+}
+
+bool SOUNDSTREAM::Read(short * out, int count)
+{
+	SDL_mutexP(lock);
+	unsigned int pos = read_pos;
+	bool buffered = int(write_pos - read_pos) >= count;
+	SDL_mutexV(lock);
+
+	if (!buffered)
+	{
+		++underruns;
+		return false;
+	}
+
+	// the buffered frames are not touched by Fill until they are consumed
+	int begin = pos % ring_frames;
+	int count1 = std::min(count, ring_frames - begin);
+	memcpy(out, &ring[begin * channels], count1 * channels * sizeof(short));
+	memcpy(out + count1 * channels, &ring[0], (count - count1) * channels * sizeof(short));
+
+	return true;
+}
+
+void SOUNDSTREAM::Consume(int count)
+{
+	SDL_mutexP(lock);
+	bool buffered = int(write_pos - read_pos) >= count;
+	int frame = read_frame + count;
+	if (loop && frames > 0)
+		frame = frame % frames;
+	else if (frame > frames)
+		frame = frames;
+	if (buffered)
+	{
+		read_pos += count;
+		read_frame = frame;
+	}
+	SDL_mutexV(lock);
+
+	// skipped past the buffered frames, restart at the new position
+	if (!buffered)
+		Seek(frame);
+}
+
+bool SOUNDSTREAM::Rewind(int frame)
+{
+	file_frame = frame;
+	if (frame >= frames)
+		return true;
+
+	if (file)
+		return fseek(file, data_offset + long(frame) * channels * sizeof(short), SEEK_SET) == 0;
+
+	return ov_pcm_seek(ogg, frame) == 0;
+}
+
+void SOUNDSTREAM::Decode(short * out, int count)
+{
+	while (count > 0)
+	{
+		if (file_frame >= frames && (!loop || !Rewind(0)))
+		{
+			// silence past the end
+			memset(out, 0, count * channels * sizeof(short));
+			return;
+		}
+
+		int n = std::min(count, frames - file_frame);
+		int decoded = 0;
+		if (file)
+		{
+			decoded = fread(out, channels * sizeof(short), n, file);
+#ifdef __BIG_ENDIAN__
+			for (int i = 0; i < decoded * channels; ++i)
+				out[i] = ENDIAN_SWAP_16(out[i]);
+#endif
+		}
+		else
+		{
+			// same output format as SOUNDBUFFER::LoadOGG
+			char * data = (char *)out;
+			int size = n * channels * sizeof(short);
+			int bytes = 0;
+			int bitstream;
+			while (bytes < size)
+			{
+				long result = ov_read(ogg, data + bytes, size - bytes, 0, 2, 1, &bitstream);
+				if (result <= 0)
+					break;
+				bytes += result;
+			}
+			decoded = bytes / (channels * sizeof(short));
+		}
+
+		// a truncated file is padded with silence
+		if (decoded < n)
+			memset(out + decoded * channels, 0, (n - decoded) * channels * sizeof(short));
+
+		file_frame += n;
+		out += n * channels;
+		count -= n;
+	}
+}
+
+void SOUNDSTREAM::Close()
+{
+	if (file)
+	{
+		fclose(file);
+		file = 0;
+	}
+	if (ogg)
+	{
+		ov_clear(ogg);
+		delete ogg;
+		ogg = 0;
+	}
+}
@@ -0,0 +1,106 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _SOUNDSTREAM_H
+#define _SOUNDSTREAM_H
+
+#include "soundinfo.h"
+
+#include <vector>
+#include <ostream>
+#include <cstdio>
+
+class SOUNDBUFFER;
+struct SDL_mutex;
+struct OggVorbis_File;
+
+/// Decodes a streamed SOUNDBUFFER into a ring buffer of frames, one stream per
+/// playing source. Fill is called by the sound stream thread, Read, Consume and
+/// Seek by the sound thread. Frames past the end of a looping sound continue
+/// from its start, past the end of a non looping sound they are silent.
+class SOUNDSTREAM
+{
+public:
+	SOUNDSTREAM();
+
+	~SOUNDSTREAM();
+
+	/// open the file of a streamed buffer, ring size in frames
+	bool Open(const SOUNDBUFFER & buffer, bool loop, std::ostream & error_output, int ring_frames = 16384);
+
+	/// decode frames into the free part of the ring, returns number of frames decoded
+	int Fill();
+
+	/// discard buffered frames and continue at frame
+	void Seek(int frame);
+
+	/// copy frames from the read position into out, false if not buffered yet
+	bool Read(short * out, int frames);
+
+	/// advance read position, seeks if the frames have not been buffered
+	void Consume(int frames);
+
+	const SOUNDINFO & GetInfo() const
+	{
+		return info;
+	}
+
+	/// number of failed reads
+	int GetUnderruns() const
+	{
+		return underruns;
+	}
+
+	/// size of the ring buffer in bytes
+	unsigned int GetSize() const
+	{
+		return ring.size() * sizeof(short);
+	}
+
+private:
+	SOUNDINFO info;
+	std::vector<short> ring;
+	int ring_frames;
+	int channels;
+	int frames;
+	bool loop;
+	int underruns;
+
+	// ring positions are wrapping frame counters, protected by lock
+	SDL_mutex * lock;
+	unsigned int read_pos;
+	unsigned int write_pos;
+	unsigned int generation;
+	int read_frame;
+	int seek_frame;
+
+	// decoder state, only used by Fill
+	FILE * file;
+	OggVorbis_File * ogg;
+	long data_offset;
+	int file_frame;
+
+	bool Rewind(int frame);
+
+	void Decode(short * out, int count);
+
+	void Close();
+};
+
+#endif // _SOUNDSTREAM_H
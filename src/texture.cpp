@@ -469,7 +469,24 @@ bool TEXTURE::Load(const std::string & path, const TEXTUREINFO & info, std::ostr
 	if (info.cube)
 	{
 		cube = true;
-		return LoadCube(path, info, error);
+		if (!LoadCube(path, info, error))
+			return false;
+
+		// cube map faces are rgb
+		size = 6 * w * h * 3;
+		return true;
+	}
+
+	return Decode(path, info, error) && Upload(info, error);
+}
+
+bool TEXTURE::Decode(const std::string & path, const TEXTUREINFO & info, std::ostream & error)
+{
+	assert(!info.cube);
+	if (id || surface)
+	{
+		error << "Tried to double load texture " << path << std::endl;
+		return false;
 	}
 
 	SDL_Surface * orig_surface = 0;
@@ -504,64 +521,75 @@ bool TEXTURE::Load(const std::string & path, const TEXTUREINFO & info, std::ostr
 	}
 
 	SDL_Surface * texture_surface = orig_surface;
-	if (orig_surface)
-	{
-		origw = texture_surface->w;
-		origh = texture_surface->h;
-
-		scale = Scale(info.maxsize, orig_surface->w, orig_surface->h);
-		float scalew = scale;
-		float scaleh = scale;
-
-		//scale to power of two if necessary
-		bool norescale = (IsPowerOfTwo(orig_surface->w) && IsPowerOfTwo(orig_surface->h)) ||
-					(info.npot && (GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two));
+	origw = texture_surface->w;
+	origh = texture_surface->h;
 
-		if (!norescale)
-		{
-			int maxsize = 2048;
-			int new_w = orig_surface->w;
-			int new_h = orig_surface->h;
+	scale = Scale(info.maxsize, orig_surface->w, orig_surface->h);
+	float scalew = scale;
+	float scaleh = scale;
 
-			if (!IsPowerOfTwo(orig_surface->w))
-			{
-				for (new_w = 1; new_w <= maxsize && new_w <= orig_surface->w * scale; new_w = new_w * 2);
-			}
+	//scale to power of two if necessary
+	bool norescale = (IsPowerOfTwo(orig_surface->w) && IsPowerOfTwo(orig_surface->h)) ||
+				(info.npot && (GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two));
 
-			if (!IsPowerOfTwo(orig_surface->h))
-			{
-				 for (new_h = 1; new_h <= maxsize && new_h <= orig_surface->h * scale; new_h = new_h * 2);
-			}
+	if (!norescale)
+	{
+		int maxsize = 2048;
+		int new_w = orig_surface->w;
+		int new_h = orig_surface->h;
 
-			scalew = ((float)new_w + 0.5) / orig_surface->w;
-			scaleh = ((float)new_h + 0.5) / orig_surface->h;
+		if (!IsPowerOfTwo(orig_surface->w))
+		{
+			for (new_w = 1; new_w <= maxsize && new_w <= orig_surface->w * scale; new_w = new_w * 2);
 		}
 
-		//scale texture down if necessary
-		if (scalew < 1.0 || scaleh < 1.0)
+		if (!IsPowerOfTwo(orig_surface->h))
 		{
-			texture_surface = zoomSurface(orig_surface, scalew, scaleh, SMOOTHING_ON);
+			 for (new_h = 1; new_h <= maxsize && new_h <= orig_surface->h * scale; new_h = new_h * 2);
 		}
 
-		//store dimensions
-		w = texture_surface->w;
-		h = texture_surface->h;
-
-		GenTexture(texture_surface, info, id, alpha, error);
+		scalew = ((float)new_w + 0.5) / orig_surface->w;
+		scaleh = ((float)new_h + 0.5) / orig_surface->h;
 	}
 
-	//free the texture surface separately if it's a scaled copy of the original
-	if (texture_surface != orig_surface && texture_surface)
+	//scale texture down if necessary
+	if (scalew < 1.0 || scaleh < 1.0)
 	{
-		SDL_FreeSurface(texture_surface);
+		texture_surface = zoomSurface(orig_surface, scalew, scaleh, SMOOTHING_ON);
 	}
 
-	//free the original surface if it's not a custom surface (used for the track map)
-	if (!info.data && orig_surface)
+	//store dimensions
+	w = texture_surface->w;
+	h = texture_surface->h;
+
+	//free the original surface if it has been replaced by a scaled copy,
+	//custom surfaces (used for the track map) only wrap the caller's data
+	if (texture_surface != orig_surface)
 	{
 		SDL_FreeSurface(orig_surface);
 	}
 
+	surface = texture_surface;
+	return true;
+}
+
+bool TEXTURE::Upload(const TEXTUREINFO & info, std::ostream & error)
+{
+	if (!surface)
+	{
+		error << "Tried to upload a texture which has not been decoded" << std::endl;
+		return false;
+	}
+
+	GenTexture(surface, info, id, alpha, error);
+
+	size = w * h * surface->format->BytesPerPixel;
+	if (info.mipmap || glGenerateMipmap)
+		size += size / 3;
+
+	SDL_FreeSurface(surface);
+	surface = 0;
+
 	return true;
 }
 
@@ -588,4 +616,7 @@ void TEXTURE::Unload()
 {
 	if (id) glDeleteTextures(1, &id);
 	id = 0;
+	if (surface) SDL_FreeSurface(surface);
+	surface = 0;
+	size = 0;
 }
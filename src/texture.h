@@ -24,6 +24,8 @@
 #include "textureinfo.h"
 #include <string>
 
+struct SDL_Surface;
+
 class TEXTURE : public TEXTURE_INTERFACE
 {
 public:
@@ -34,8 +36,10 @@ public:
 		origw(0),
 		origh(0),
 		scale(1.0),
+		size(0),
 		alpha(false),
-		cube(false)
+		cube(false),
+		surface(0)
 	{
 		// ctor
 	}
@@ -52,8 +56,18 @@ public:
 
 	bool Load(const std::string & path, const TEXTUREINFO & info, std::ostream & error);
 
+	/// read and scale the image into system memory without touching GL,
+	/// can be called from a worker thread, cube maps are not supported
+	bool Decode(const std::string & path, const TEXTUREINFO & info, std::ostream & error);
+
+	/// create the GL texture from the decoded image and release the image
+	bool Upload(const TEXTUREINFO & info, std::ostream & error);
+
 	void Unload();
 
+	/// approximate size of the texture in video memory in bytes
+	unsigned int GetSize() const {return size;}
+
 	virtual unsigned int GetW() const {return w;}
 
 	virtual unsigned int GetH() const {return h;}
@@ -73,8 +87,10 @@ private:
 	unsigned int w, h; ///< w and h are post-texture-size transform
 	unsigned int origw, origh; ///< w and h are pre-texture-size transform
 	float scale; ///< gets the amount of scaling applied by the texture-size transform, so the original w and h can be backed out
+	unsigned int size;
 	bool alpha;
 	bool cube;
+	SDL_Surface * surface; ///< decoded image waiting for upload
 
 	bool LoadCube(const std::string & path, const TEXTUREINFO & info, std::ostream & error);
 
@@ -0,0 +1,533 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "traceprofiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+	#define THREAD_LOCAL __declspec(thread)
+#else
+	#define THREAD_LOCAL __thread
+#endif
+
+#if defined(_MSC_VER)
+static inline void StoreRelease(volatile unsigned int * value, unsigned int x)
+{
+	_ReadWriteBarrier();
+	*value = x;
+}
+
+static inline unsigned int LoadAcquire(volatile unsigned int * value)
+{
+	unsigned int x = *value;
+	_ReadWriteBarrier();
+	return x;
+}
+
+static inline void FenceAcquire()
+{
+	_ReadWriteBarrier();
+}
+
+static inline unsigned int AtomicIncrement(volatile unsigned int * value)
+{
+	return _InterlockedIncrement((volatile long *)value);
+}
+
+static inline bool CompareAndSwap(void * volatile * value, void * expected, void * x)
+{
+	return _InterlockedCompareExchangePointer(value, x, expected) == expected;
+}
+
+static inline void Lock(volatile long * lock)
+{
+	while (_InterlockedExchange(lock, 1)) {}
+}
+
+static inline void Unlock(volatile long * lock)
+{
+	_InterlockedExchange(lock, 0);
+}
+#else
+static inline void StoreRelease(volatile unsigned int * value, unsigned int x)
+{
+	__atomic_store_n(value, x, __ATOMIC_RELEASE);
+}
+
+static inline unsigned int LoadAcquire(volatile unsigned int * value)
+{
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void FenceAcquire()
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static inline unsigned int AtomicIncrement(volatile unsigned int * value)
+{
+	return __sync_add_and_fetch(value, 1);
+}
+
+static inline bool CompareAndSwap(void * volatile * value, void * expected, void * x)
+{
+	return __sync_bool_compare_and_swap(value, expected, x);
+}
+
+static inline void Lock(volatile long * lock)
+{
+	while (__sync_lock_test_and_set(lock, 1)) {}
+}
+
+static inline void Unlock(volatile long * lock)
+{
+	__sync_lock_release(lock);
+}
+#endif
+
+namespace
+{
+	struct Event
+	{
+		TraceProfiler::Ticks time;
+		unsigned int id;
+		unsigned int end;
+	};
+
+	/// written by its thread only, read by the exporting thread
+	struct ThreadBuffer
+	{
+		enum {EVENTS = 1 << 16};
+
+		ThreadBuffer * next;
+		const char * name;
+		unsigned int index;
+		unsigned int current; ///< innermost open scope, 0 at the top
+		volatile unsigned int head; ///< events written so far
+		TraceProfiler::Ticks totals[TraceProfiler::MAX_SCOPES];
+		Event events[EVENTS];
+	};
+
+	// id 0 is the top of every thread, the last id collects the overflow
+	const char * names[TraceProfiler::MAX_SCOPES] = {"frame"};
+	unsigned int num_names = 1;
+	volatile long names_lock = 0;
+
+	// parent + 1 of every scope when it was first seen, 0 if not seen yet
+	volatile unsigned int parents[TraceProfiler::MAX_SCOPES];
+
+	// buffers are pushed to the front and never removed, the events of
+	// threads that have finished are kept for the export
+	void * volatile buffers = 0;
+	volatile unsigned int num_buffers = 0;
+	THREAD_LOCAL ThreadBuffer * thread_buffer = 0;
+
+	TraceProfiler::Ticks epoch_ticks = 0;
+	TraceProfiler::Ticks epoch_ns = 0;
+
+	// per frame summary, main thread only
+	TraceProfiler::Ticks frame_totals[TraceProfiler::MAX_SCOPES];
+	double frame_averages[TraceProfiler::MAX_SCOPES];
+	const double frame_smoothing = 0.05;
+}
+
+static ThreadBuffer * RegisterThread()
+{
+	ThreadBuffer * buffer = new ThreadBuffer;
+	std::memset(buffer, 0, sizeof(ThreadBuffer) - sizeof(buffer->events));
+	buffer->index = AtomicIncrement(&num_buffers);
+	void * front;
+	do
+	{
+		front = buffers;
+		buffer->next = static_cast<ThreadBuffer*>(front);
+	} while (!CompareAndSwap(&buffers, front, buffer));
+	thread_buffer = buffer;
+	return buffer;
+}
+
+static inline ThreadBuffer & GetThreadBuffer()
+{
+	ThreadBuffer * buffer = thread_buffer;
+	if (!buffer)
+		buffer = RegisterThread();
+	return *buffer;
+}
+
+static inline void Record(ThreadBuffer & buffer, TraceProfiler::Ticks time, unsigned int id, unsigned int end)
+{
+	unsigned int head = buffer.head;
+	Event & event = buffer.events[head & (ThreadBuffer::EVENTS - 1)];
+	event.time = time;
+	event.id = id;
+	event.end = end;
+	StoreRelease(&buffer.head, head + 1);
+}
+
+/// copy the events that have not been overwritten while copying
+static void CopyEvents(ThreadBuffer & buffer, std::vector<Event> & events)
+{
+	unsigned int head = LoadAcquire(&buffer.head);
+	unsigned int tail = head > ThreadBuffer::EVENTS ? head - ThreadBuffer::EVENTS : 0;
+	events.resize(head - tail);
+	for (unsigned int i = tail; i != head; ++i)
+		events[i - tail] = buffer.events[i & (ThreadBuffer::EVENTS - 1)];
+
+	// the writer is at most at the event after new_head, everything older
+	// than a full ring before that is intact
+	FenceAcquire();
+	unsigned int new_head = LoadAcquire(&buffer.head);
+	unsigned int valid = new_head + 1 > ThreadBuffer::EVENTS ? new_head + 1 - ThreadBuffer::EVENTS : 0;
+	if (valid > tail)
+		events.erase(events.begin(), events.begin() + std::min(valid - tail, head - tail));
+}
+
+static double TicksPerMicrosecond()
+{
+#if defined(TRACEPROFILER_RDTSC)
+	// wait until the interval is long enough for a stable rate
+	TraceProfiler::Ticks ns, ticks;
+	do
+	{
+		ns = TraceProfiler::MonotonicNanoseconds();
+		ticks = TraceProfiler::Now();
+	} while (ns - epoch_ns < 10000000);
+	return (ticks - epoch_ticks) * 1E3 / (ns - epoch_ns);
+#else
+	return 1E3;
+#endif
+}
+
+volatile bool TraceProfiler::enabled = false;
+
+unsigned int TraceProfiler::Intern(const char * name)
+{
+	Lock(&names_lock);
+	unsigned int id = 1;
+	while (id < num_names && std::strcmp(names[id], name) != 0)
+		++id;
+	if (id == num_names)
+	{
+		if (num_names < MAX_SCOPES - 1)
+		{
+			names[num_names++] = name;
+		}
+		else
+		{
+			id = MAX_SCOPES - 1;
+			names[id] = "other";
+		}
+	}
+	Unlock(&names_lock);
+	return id;
+}
+
+const char * TraceProfiler::GetName(unsigned int id)
+{
+	assert(id < MAX_SCOPES);
+	return names[id] ? names[id] : "";
+}
+
+void TraceProfiler::SetEnabled(bool value)
+{
+	if (value && !epoch_ns)
+	{
+		epoch_ns = MonotonicNanoseconds();
+		epoch_ticks = Now();
+	}
+	enabled = value;
+}
+
+void TraceProfiler::SetThreadName(const char * name)
+{
+	GetThreadBuffer().name = name;
+}
+
+TraceProfiler::Ticks TraceProfiler::MonotonicNanoseconds()
+{
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, count;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&count);
+	return Ticks(count.QuadPart / double(frequency.QuadPart) * 1E9);
+#else
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return Ticks(time.tv_sec) * 1000000000 + time.tv_nsec;
+#endif
+}
+
+TraceProfiler::Ticks TraceProfiler::Begin(unsigned int id, unsigned int & parent)
+{
+	ThreadBuffer & buffer = GetThreadBuffer();
+	parent = buffer.current;
+	buffer.current = id;
+	if (!parents[id])
+		parents[id] = parent + 1;
+
+	Ticks now = Now();
+	Record(buffer, now, id, 0);
+	return now;
+}
+
+void TraceProfiler::End(unsigned int id, unsigned int parent, Ticks start)
+{
+	Ticks now = Now();
+	ThreadBuffer & buffer = GetThreadBuffer();
+	Record(buffer, now, id, 1);
+	buffer.totals[id] += now - start;
+	buffer.current = parent;
+}
+
+void TraceProfiler::EndFrame()
+{
+	if (!epoch_ns)
+		return;
+
+	// totals of other threads may be a scope behind, good enough for display
+	Ticks totals[MAX_SCOPES] = {0};
+	for (ThreadBuffer * b = static_cast<ThreadBuffer*>(buffers); b; b = b->next)
+	{
+		for (unsigned int i = 0; i < MAX_SCOPES; ++i)
+			totals[i] += b->totals[i];
+	}
+
+	double us_per_tick = 1 / TicksPerMicrosecond();
+	for (unsigned int i = 0; i < MAX_SCOPES; ++i)
+	{
+		double frame_us = (totals[i] - frame_totals[i]) * us_per_tick;
+		frame_averages[i] += (frame_us - frame_averages[i]) * frame_smoothing;
+		frame_totals[i] = totals[i];
+	}
+}
+
+static void WriteSummary(std::ostream & out, unsigned int parent, int depth)
+{
+	for (unsigned int i = 1; i < TraceProfiler::MAX_SCOPES; ++i)
+	{
+		if (parents[i] != parent + 1)
+			continue;
+
+		out << std::string(depth * 2, ' ') << names[i] << ": " << (long)(frame_averages[i] + 0.5) << " us\n";
+		if (depth < 8)
+			WriteSummary(out, i, depth + 1);
+	}
+}
+
+void TraceProfiler::WriteSummary(std::ostream & out)
+{
+	::WriteSummary(out, 0, 0);
+}
+
+double TraceProfiler::GetTotalMilliseconds(const char * name)
+{
+	if (!epoch_ns)
+		return 0;
+
+	Lock(&names_lock);
+	unsigned int id = 1;
+	while (id < num_names && std::strcmp(names[id], name) != 0)
+		++id;
+	Unlock(&names_lock);
+	if (id == num_names)
+		return 0;
+
+	Ticks total = 0;
+	for (ThreadBuffer * b = static_cast<ThreadBuffer*>(buffers); b; b = b->next)
+		total += b->totals[id];
+	return total / TicksPerMicrosecond() * 1E-3;
+}
+
+void TraceProfiler::WriteChromeTrace(std::ostream & out)
+{
+	std::ios_base::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed << std::setprecision(3);
+
+	double us_per_tick = epoch_ns ? 1 / TicksPerMicrosecond() : 0;
+	const char * separator = "\n";
+	std::vector<Event> events;
+	out << "{\"traceEvents\":[";
+	for (ThreadBuffer * b = static_cast<ThreadBuffer*>(buffers); b; b = b->next)
+	{
+		if (b->name)
+		{
+			out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->index
+				<< ",\"args\":{\"name\":\"" << b->name << "\"}}";
+			separator = ",\n";
+		}
+
+		// scopes that began before the oldest kept event are left out
+		CopyEvents(*b, events);
+		int depth = 0;
+		for (std::vector<Event>::const_iterator e = events.begin(); e != events.end(); ++e)
+		{
+			if (e->end && depth == 0)
+				continue;
+
+			depth += e->end ? -1 : 1;
+			double ts = e->time > epoch_ticks ? (e->time - epoch_ticks) * us_per_tick : 0;
+			out << separator << "{\"name\":\"" << names[e->id] << "\",\"ph\":\"" << (e->end ? 'E' : 'B')
+				<< "\",\"pid\":1,\"tid\":" << b->index << ",\"ts\":" << ts << "}";
+			separator = ",\n";
+		}
+	}
+	out << "\n]}\n";
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+void TraceProfiler::Clear()
+{
+	for (ThreadBuffer * b = static_cast<ThreadBuffer*>(buffers); b; b = b->next)
+	{
+		b->head = 0;
+		b->current = 0;
+		std::memset(b->totals, 0, sizeof(b->totals));
+	}
+	std::memset(frame_totals, 0, sizeof(frame_totals));
+	std::memset(frame_averages, 0, sizeof(frame_averages));
+}
+
+#include "unittest.h"
+#include "benchmark.h"
+
+#include <sstream>
+
+QT_TEST(traceprofiler_test)
+{
+	unsigned int outer = TraceProfiler::Intern("traceprofiler_test_outer");
+	unsigned int inner = TraceProfiler::Intern("traceprofiler_test_inner");
+	QT_CHECK(outer != inner);
+	QT_CHECK_EQUAL(TraceProfiler::Intern("traceprofiler_test_outer"), outer);
+	QT_CHECK_EQUAL(std::string(TraceProfiler::GetName(inner)), "traceprofiler_test_inner");
+
+	bool was_enabled = TraceProfiler::GetEnabled();
+	TraceProfiler::SetEnabled(false);
+	TraceProfiler::Clear();
+	{
+		TraceProfiler::Scope scope(outer);
+	}
+
+	TraceProfiler::SetEnabled(true);
+	TraceProfiler::SetThreadName("test");
+	for (int i = 0; i < 2; ++i)
+	{
+		TraceProfiler::Scope a(outer);
+		TraceProfiler::Scope b(inner);
+	}
+	TraceProfiler::SetEnabled(was_enabled);
+
+	// events are nested and only the enabled ones are recorded
+	std::stringstream trace;
+	TraceProfiler::WriteChromeTrace(trace);
+	std::string json = trace.str();
+	std::string expected[] =
+	{
+		"\"thread_name\"",
+		"\"traceprofiler_test_outer\",\"ph\":\"B\"",
+		"\"traceprofiler_test_inner\",\"ph\":\"B\"",
+		"\"traceprofiler_test_inner\",\"ph\":\"E\"",
+		"\"traceprofiler_test_outer\",\"ph\":\"E\"",
+		"\"traceprofiler_test_outer\",\"ph\":\"B\"",
+		"\"traceprofiler_test_inner\",\"ph\":\"B\"",
+		"\"traceprofiler_test_inner\",\"ph\":\"E\"",
+		"\"traceprofiler_test_outer\",\"ph\":\"E\"",
+		"]}",
+	};
+	size_t pos = 0;
+	for (unsigned int i = 0; i < sizeof(expected) / sizeof(expected[0]); ++i)
+	{
+		pos = json.find(expected[i], pos);
+		QT_CHECK(pos != std::string::npos);
+		if (pos == std::string::npos)
+			break;
+		pos += expected[i].size();
+	}
+	QT_CHECK_EQUAL(json.find("traceprofiler_test", pos), std::string::npos);
+
+	// inner is summarized below outer
+	TraceProfiler::EndFrame();
+	std::stringstream summary;
+	TraceProfiler::WriteSummary(summary);
+	QT_CHECK(summary.str().find("traceprofiler_test_outer: ") != std::string::npos);
+	QT_CHECK(summary.str().find("  traceprofiler_test_inner: ") != std::string::npos);
+
+	// totals are kept until cleared, names that were never interned have none
+	double outer_ms = TraceProfiler::GetTotalMilliseconds("traceprofiler_test_outer");
+	double inner_ms = TraceProfiler::GetTotalMilliseconds("traceprofiler_test_inner");
+	QT_CHECK(inner_ms > 0);
+	QT_CHECK(outer_ms >= inner_ms);
+	QT_CHECK_EQUAL(TraceProfiler::GetTotalMilliseconds("traceprofiler_test_unknown"), 0);
+
+	TraceProfiler::Clear();
+	QT_CHECK_EQUAL(TraceProfiler::GetTotalMilliseconds("traceprofiler_test_inner"), 0);
+}
+
+BENCHMARK(trace_profiler)
+{
+	const int scopes = 1000000;
+	bool was_enabled = TraceProfiler::GetEnabled();
+	benchmark::Stopwatch timer;
+
+	TraceProfiler::SetEnabled(false);
+	timer.Reset();
+	for (int i = 0; i < scopes; ++i)
+	{
+		PROFILE_SCOPE("trace_profiler_benchmark");
+		benchmark::DoNotOptimize(i);
+	}
+	double disabled = timer.Seconds();
+
+	TraceProfiler::SetEnabled(true);
+	timer.Reset();
+	for (int i = 0; i < scopes; ++i)
+	{
+		PROFILE_SCOPE("trace_profiler_benchmark");
+		benchmark::DoNotOptimize(i);
+	}
+	double enabled = timer.Seconds();
+
+	timer.Reset();
+	for (int i = 0; i < scopes / 2; ++i)
+	{
+		PROFILE_SCOPE("trace_profiler_benchmark_outer");
+		PROFILE_SCOPE("trace_profiler_benchmark_inner");
+		benchmark::DoNotOptimize(i);
+	}
+	double nested = timer.Seconds();
+	TraceProfiler::SetEnabled(was_enabled);
+
+	out << "trace_profiler: " << disabled * 1E9 / scopes << " ns per scope disabled, "
+		<< enabled * 1E9 / scopes << " ns enabled, "
+		<< nested * 1E9 / scopes << " ns nested" << std::endl;
+}
@@ -0,0 +1,137 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _TRACEPROFILER_H
+#define _TRACEPROFILER_H
+
+#include <iosfwd>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define TRACEPROFILER_RDTSC
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define TRACEPROFILER_RDTSC
+#endif
+
+/// Hierarchical scope profiler for release builds. Every thread records
+/// begin and end events of its scopes into a ring buffer of its own, the
+/// hot path takes no lock and makes no allocation. The recorded events can
+/// be exported as Chrome trace event JSON (chrome://tracing, Perfetto) and
+/// the per scope times are averaged per frame for the on-screen summary.
+///
+/// void GAME::AdvanceGameLogic()
+/// {
+///     PROFILE_SCOPE("physics");
+///     ...
+/// }
+///
+/// Scope names have to be string literals, they are interned once per call
+/// site. Nothing is recorded until SetEnabled(true) is called.
+class TraceProfiler
+{
+public:
+	typedef unsigned long long Ticks;
+
+	enum {MAX_SCOPES = 256};
+
+	/// records the lifetime of the object as one scope of the calling thread
+	class Scope
+	{
+	public:
+		Scope(unsigned int id) : id(id), start(0)
+		{
+			if (enabled)
+				start = TraceProfiler::Begin(id, parent);
+		}
+
+		~Scope()
+		{
+			if (start)
+				TraceProfiler::End(id, parent, start);
+		}
+
+	private:
+		unsigned int id;
+		unsigned int parent;
+		Ticks start;
+	};
+
+	/// id of name, the same name always gets the same id, all names past
+	/// MAX_SCOPES share the last id
+	static unsigned int Intern(const char * name);
+
+	static const char * GetName(unsigned int id);
+
+	static void SetEnabled(bool value);
+
+	static bool GetEnabled() {return enabled;}
+
+	/// name of the calling thread in the trace, has to stay valid
+	static void SetThreadName(const char * name);
+
+	/// time stamp counter, the unit is calibrated against the monotonic clock
+	static Ticks Now()
+	{
+#if defined(TRACEPROFILER_RDTSC)
+		return __rdtsc();
+#else
+		return MonotonicNanoseconds();
+#endif
+	}
+
+	static Ticks MonotonicNanoseconds();
+
+	/// called once per displayed frame to update the per frame averages
+	static void EndFrame();
+
+	/// average time per frame of every scope seen so far, children indented
+	/// below the scope they were first seen in
+	static void WriteSummary(std::ostream & out);
+
+	/// time spent in the scope name since the last Clear, summed over all
+	/// threads, 0 for names that were never interned
+	static double GetTotalMilliseconds(const char * name);
+
+	/// write the events still held by the ring buffers as trace event JSON,
+	/// safe to call while other threads are recording
+	static void WriteChromeTrace(std::ostream & out);
+
+	/// drop all recorded events and totals, no other thread may be recording
+	static void Clear();
+
+private:
+	friend class Scope;
+
+	static volatile bool enabled;
+
+	static Ticks Begin(unsigned int id, unsigned int & parent);
+
+	static void End(unsigned int id, unsigned int parent, Ticks start);
+};
+
+#define PROFILE_SCOPE_CONCAT2(a, b) a##b
+#define PROFILE_SCOPE_CONCAT(a, b) PROFILE_SCOPE_CONCAT2(a, b)
+
+/// time the rest of the enclosing block as name, a string literal
+#define PROFILE_SCOPE(name) \
+	static const unsigned int PROFILE_SCOPE_CONCAT(profile_scope_id_, __LINE__) = TraceProfiler::Intern(name); \
+	TraceProfiler::Scope PROFILE_SCOPE_CONCAT(profile_scope_, __LINE__)(PROFILE_SCOPE_CONCAT(profile_scope_id_, __LINE__))
+
+#endif // _TRACEPROFILER_H
@@ -55,7 +55,9 @@ bool TRACK::DeferredLoad(
 	const bool reverse,
 	const bool dynamicobjects,
 	const bool dynamicshadows,
-	const bool agressivecombine)
+	const bool agressivecombine,
+	JobSystem * jobs,
+	const std::string & cachepath)
 {
 	Clear();
 
@@ -71,7 +73,9 @@ bool TRACK::DeferredLoad(
 			anisotropy, reverse,
 			dynamicobjects,
 			dynamicshadows,
-			agressivecombine));
+			agressivecombine,
+			jobs,
+			cachepath));
 
 	return loader->BeginLoad();
 }
@@ -127,6 +131,7 @@ void TRACK::Clear()
 	data.body_transforms.clear();
 	data.lap.clear();
 	data.roads.clear();
+	data.road_bvh.Clear();
 	data.start_positions.clear();
 	data.racingline_node.Clear();
 	data.loaded = false;
@@ -145,28 +150,160 @@ bool TRACK::CastRay(
 	MATHVECTOR<float, 3> borigin(origin[1], origin[2], origin[0]);
 	MATHVECTOR<float, 3> bdirection(direction[1], direction[2], direction[0]);
 
-	bool col = false;
-	for (std::list <ROADSTRIP>::const_iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	bool col = data.road_bvh.CastRay(borigin, bdirection, seglen, patch_id, outtri, colpatch, normal);
+
+	// transform into world space
+	outtri = MATHVECTOR<float, 3>(outtri[2], outtri[0], outtri[1]);
+	normal = MATHVECTOR<float, 3>(normal[2], normal[0], normal[1]);
+
+	return col;
+}
+
+namespace
+{
+	// ray vs patch test of the batched road ray cast
+	struct RAYPATCH
+	{
+		int ray;
+		int patch_id;
+		const ROADPATCH * patch;
+		bool hit;
+		MATHVECTOR <float, 3> coltri;
+		MATHVECTOR <float, 3> colnorm;
+
+		RAYPATCH(int ray, int patch_id, const ROADPATCH & patch) :
+			ray(ray), patch_id(patch_id), patch(&patch), hit(false)
+		{
+			// ctor
+		}
+	};
+
+	// run the ray patch tests 4 at a time, equivalent to ROADPATCH::Collide
+	void CollideRayPatches(
+		std::vector<RAYPATCH> & tests,
+		const std::vector<MATHVECTOR <float, 3> > & origins,
+		const std::vector<MATHVECTOR <float, 3> > & directions,
+		const TRACK::RAYCAST rays[])
 	{
-		MATHVECTOR <float, 3> coltri, colnorm;
-		const BEZIER * colbez = NULL;
-		if (i->Collide(borigin, bdirection, seglen, patch_id, coltri, colbez, colnorm))
+		for (size_t i = 0; i < tests.size(); i += 4)
 		{
-			if (!col || (coltri - borigin).MagnitudeSquared() < (outtri - borigin).MagnitudeSquared())
+			const BEZIER * patch[4] = {0, 0, 0, 0};
+			MATHVECTOR <float, 3> origin[4], direction[4], coltri[4], colnorm[4];
+			size_t n = std::min(tests.size() - i, size_t(4));
+			for (size_t j = 0; j < n; ++j)
 			{
-				outtri = coltri;
-				normal = colnorm;
-				colpatch = colbez;
+				const RAYPATCH & t = tests[i + j];
+				patch[j] = &t.patch->GetPatch();
+				origin[j] = origins[t.ray];
+				direction[j] = directions[t.ray];
+			}
+
+			int mask = BEZIER::CollideSubDivQuadSimpleNorm4(patch, origin, direction, coltri, colnorm);
+			for (size_t j = 0; j < n; ++j)
+			{
+				RAYPATCH & t = tests[i + j];
+				t.coltri = coltri[j];
+				t.colnorm = colnorm[j];
+				t.hit = (mask & (1 << j)) && (coltri[j] - origin[j]).Magnitude() <= rays[t.ray].seglen;
 			}
-			col = true;
 		}
 	}
+}
 
-	// transform into world space
-	outtri = MATHVECTOR<float, 3>(outtri[2], outtri[0], outtri[1]);
-	normal = MATHVECTOR<float, 3>(normal[2], normal[0], normal[1]);
-	
-	return col;
+int TRACK::CastRays(RAYCAST rays[], int count) const
+{
+	const ROADBVH & bvh = data.road_bvh;
+
+	// transform into bezier space
+	std::vector<MATHVECTOR <float, 3> > borigin(count), bdirection(count);
+	for (int i = 0; i < count; ++i)
+	{
+		borigin[i].Set(rays[i].origin[1], rays[i].origin[2], rays[i].origin[0]);
+		bdirection[i].Set(rays[i].direction[1], rays[i].direction[2], rays[i].direction[0]);
+	}
+
+	// first pass: test the patch hints
+	std::vector<RAYPATCH> hints;
+	std::vector<int> hint_test(count, -1);
+	for (int i = 0; i < count; ++i)
+	{
+		int id = rays[i].patch_id;
+		if (id >= 0 && id < bvh.GetNumPatches())
+		{
+			hint_test[i] = hints.size();
+			hints.push_back(RAYPATCH(i, id, bvh.GetPatch(id)));
+		}
+	}
+	CollideRayPatches(hints, borigin, bdirection, rays);
+
+	// second pass: test the candidate patches, a hint hit only shortens the query
+	// segment as overlapping road strips may still have a nearer patch
+	std::vector<RAYPATCH> tests;
+	std::vector<int> test_begin(count + 1, 0);
+	std::vector<int> candidates;
+	for (int i = 0; i < count; ++i)
+	{
+		test_begin[i] = tests.size();
+		float seglen = rays[i].seglen;
+		int hint = -1;
+		if (hint_test[i] >= 0)
+		{
+			const RAYPATCH & h = hints[hint_test[i]];
+			hint = h.patch_id;
+			if (h.hit)
+			{
+				// pad to keep equally distant patches for the tie break
+				float dist = (h.coltri - borigin[i]).Magnitude();
+				seglen = std::min(seglen, dist * (1 + 1E-4f) + 1E-4f);
+			}
+		}
+
+		candidates.clear();
+		bvh.Query(borigin[i], bdirection[i], seglen, candidates);
+		for (std::vector<int>::const_iterator c = candidates.begin(); c != candidates.end(); ++c)
+		{
+			if (*c == hint) continue;
+			tests.push_back(RAYPATCH(i, *c, bvh.GetPatch(*c)));
+		}
+	}
+	test_begin[count] = tests.size();
+	CollideRayPatches(tests, borigin, bdirection, rays);
+
+	// pick the nearest hit, ties go to the lower patch id like ROADBVH::CastRay
+	int hitcount = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		RAYCAST & ray = rays[i];
+		const RAYPATCH * best = 0;
+		float bestdist = 0;
+		if (hint_test[i] >= 0 && hints[hint_test[i]].hit)
+		{
+			best = &hints[hint_test[i]];
+			bestdist = (best->coltri - borigin[i]).MagnitudeSquared();
+		}
+		for (int t = test_begin[i]; t < test_begin[i + 1]; ++t)
+		{
+			if (!tests[t].hit) continue;
+			float dist = (tests[t].coltri - borigin[i]).MagnitudeSquared();
+			if (!best || dist < bestdist || (dist == bestdist && tests[t].patch_id < best->patch_id))
+			{
+				best = &tests[t];
+				bestdist = dist;
+			}
+		}
+
+		ray.hit = (best != 0);
+		if (!ray.hit) continue;
+
+		// transform into world space
+		ray.patch_id = best->patch_id;
+		ray.colpatch = &best->patch->GetPatch();
+		ray.outtri.Set(best->coltri[2], best->coltri[0], best->coltri[1]);
+		ray.normal.Set(best->colnorm[2], best->colnorm[0], best->colnorm[1]);
+		++hitcount;
+	}
+
+	return hitcount;
 }
 
 void TRACK::Update()
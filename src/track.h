@@ -23,6 +23,7 @@
 #include "scenenode.h"
 #include "tracksurface.h"
 #include "roadstrip.h"
+#include "roadbvh.h"
 #include "mathvector.h"
 #include "quaternion.h"
 #include "motionstate.h"
@@ -40,6 +41,7 @@ class OBJECTLOADER;
 class ROADSTRIP;
 class DynamicsWorld;
 class ContentManager;
+class JobSystem;
 class btStridingMeshInterface;
 class btCollisionShape;
 class btCollisionObject;
@@ -53,6 +55,9 @@ public:
 	/// Only begins loading the track.
     /// The track won't be loaded until more calls to ContinueDeferredLoad().
     /// Use Loaded() to see if loading is complete yet.
+    /// Object models and static collision shapes are prepared on the
+    /// job system threads if there are any.
+    /// Parsed track data is cached in cachepath if it isn't empty.
     /// Returns true if successful.
 	bool DeferredLoad(
                       ContentManager & content,
@@ -67,7 +72,9 @@ public:
                       const bool reverse,
                       const bool dynamicobjects,
                       const bool dynamicshadowsenabled,
-                      const bool doagressivecombining);
+                      const bool doagressivecombining,
+                      JobSystem * jobs = 0,
+                      const std::string & cachepath = std::string());
 
 	bool ContinueDeferredLoad();
 
@@ -94,6 +101,25 @@ public:
 		const BEZIER * & colpatch,
 		MATHVECTOR <float, 3> & normal) const;
 
+	/// Batched road ray query, see CastRays.
+	struct RAYCAST
+	{
+		MATHVECTOR <float, 3> origin;
+		MATHVECTOR <float, 3> direction;
+		float seglen;
+		int patch_id; ///< previous patch hint on input, patch id on output
+		MATHVECTOR <float, 3> outtri;
+		MATHVECTOR <float, 3> normal;
+		const BEZIER * colpatch;
+		bool hit;
+	};
+
+	/// Cast a batch of rays against the road, equivalent to calling CastRay for each of them.
+	/// The bezier patch tests of all rays are packed and run 4 at a time.
+	/// Patch ids are global, see ROADBVH.
+	/// Returns the number of rays that hit the road.
+	int CastRays(RAYCAST rays[], int count) const;
+
 	/// Synchronize graphics and physics.
 	void Update();
 
@@ -174,6 +200,7 @@ private:
 		// road information
 		std::vector<const BEZIER*> lap;
 		std::list<ROADSTRIP> roads;
+		ROADBVH road_bvh;
 		std::vector<std::pair<MATHVECTOR<float, 3>, QUATERNION<float> > > start_positions;
 
 		// racing line data
@@ -0,0 +1,396 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#include "trackcache.h"
+#include "macros.h"
+#include "unittest.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const std::string file_magic = "VDRIFTTRACKCACHEV01";
+
+// read only view of a whole file, memory mapped where available
+class FILEVIEW
+{
+public:
+	FILEVIEW(const std::string & path) : data(0), size(0)
+	{
+#ifndef _WIN32
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
+
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0)
+		{
+			void * map = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED)
+			{
+				data = static_cast<const char *>(map);
+				size = info.st_size;
+			}
+		}
+		close(fd);
+#else
+		std::ifstream file(path.c_str(), std::ios::binary);
+		buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		if (!buffer.empty())
+		{
+			data = &buffer[0];
+			size = buffer.size();
+		}
+#endif
+	}
+
+	~FILEVIEW()
+	{
+#ifndef _WIN32
+		if (data)
+			munmap(const_cast<char *>(data), size);
+#endif
+	}
+
+	const char * data;
+	size_t size;
+
+private:
+#ifdef _WIN32
+	std::vector<char> buffer;
+#endif
+	FILEVIEW(const FILEVIEW & other);
+	FILEVIEW & operator=(const FILEVIEW & other);
+};
+
+static void FlattenTree(
+	const std::string & key,
+	const PTree & node,
+	std::vector<std::string> & keys,
+	std::vector<std::string> & values,
+	std::vector<int> & children)
+{
+	keys.push_back(key);
+	values.push_back(node.value());
+	children.push_back(node.size());
+	for (PTree::const_iterator i = node.begin(); i != node.end(); ++i)
+	{
+		FlattenTree(i->first, i->second, keys, values, children);
+	}
+}
+
+static bool BuildTree(
+	PTree & node,
+	const std::vector<std::string> & keys,
+	const std::vector<std::string> & values,
+	const std::vector<int> & children,
+	size_t & index)
+{
+	node.value() = values[index];
+	int count = children[index];
+	++index;
+	for (int i = 0; i < count; ++i)
+	{
+		if (index >= keys.size())
+			return false;
+
+		// inserting through set sets the parent and node key like read_ini does
+		PTree & child = node.set(keys[index], PTree());
+		if (!BuildTree(child, keys, values, children, index))
+			return false;
+	}
+	return true;
+}
+
+TRACKCACHE::SOURCE::SOURCE() :
+	size(-1),
+	mtime(0),
+	hash(0)
+{
+	// ctor
+}
+
+bool TRACKCACHE::SOURCE::Serialize(joeserialize::Serializer & s)
+{
+	_SERIALIZE_(s, path);
+	_SERIALIZE_(s, size);
+	_SERIALIZE_(s, mtime);
+	_SERIALIZE_(s, hash);
+	return true;
+}
+
+TRACKCACHE::TRACKCACHE() :
+	vertical_tracking_skyboxes(false),
+	cull(false)
+{
+	// ctor
+}
+
+std::string TRACKCACHE::GetPath(const std::string & cachepath, const std::string & trackname, bool reverse)
+{
+	return cachepath + "/" + trackname + (reverse ? "-reverse" : "") + ".cache";
+}
+
+void TRACKCACHE::AddSource(const std::string & path)
+{
+	sources.push_back(SOURCE());
+	sources.back().path = path;
+	GetFileInfo(path, sources.back(), true);
+}
+
+bool TRACKCACHE::Read(const std::string & cachefile)
+{
+	FILEVIEW file(cachefile);
+	if (file.size < file_magic.size() ||
+		file_magic.compare(0, file_magic.size(), file.data, file_magic.size()) != 0)
+	{
+		return false;
+	}
+
+	joeserialize::BinarySpanInputSerializer s(file.data + file_magic.size(), file.size - file_magic.size());
+	if (!SerializeSources(s))
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < sources.size(); ++i)
+	{
+		const SOURCE & cached = sources[i];
+		SOURCE current;
+		bool exists = GetFileInfo(cached.path, current, false);
+		if (current.size != cached.size)
+		{
+			return false;
+		}
+		if (exists && current.mtime != cached.mtime)
+		{
+			// touched, compare the content
+			GetFileInfo(cached.path, current, true);
+			if (current.hash != cached.hash)
+			{
+				return false;
+			}
+		}
+	}
+
+	return Serialize(s) && s.GetRemaining() == 0;
+}
+
+bool TRACKCACHE::Write(const std::string & cachefile, std::ostream & error_output)
+{
+	// a partially written cache must never be read
+	const std::string tempfile = cachefile + ".tmp";
+	bool success = false;
+	{
+		std::ofstream file(tempfile.c_str(), std::ios::binary);
+		if (file)
+		{
+			file.write(file_magic.data(), file_magic.size());
+			joeserialize::BinaryOutputSerializer s(file);
+			success = SerializeSources(s) && Serialize(s) && file.good();
+		}
+	}
+
+	if (success)
+	{
+		std::remove(cachefile.c_str());
+		success = (std::rename(tempfile.c_str(), cachefile.c_str()) == 0);
+	}
+
+	if (!success)
+	{
+		std::remove(tempfile.c_str());
+		error_output << "Failed to write track cache " << cachefile << std::endl;
+	}
+	return success;
+}
+
+bool TRACKCACHE::Serialize(joeserialize::Serializer & s)
+{
+	_SERIALIZE_(s, surfaces);
+	_SERIALIZE_(s, roads);
+	_SERIALIZE_(s, start_positions);
+	_SERIALIZE_(s, lap);
+	_SERIALIZE_(s, vertical_tracking_skyboxes);
+	_SERIALIZE_(s, cull);
+	_SERIALIZE_(s, object_keys);
+	_SERIALIZE_(s, object_values);
+	_SERIALIZE_(s, object_children);
+	return true;
+}
+
+bool TRACKCACHE::SerializeSources(joeserialize::Serializer & s)
+{
+	_SERIALIZE_(s, sources);
+	return true;
+}
+
+void TRACKCACHE::SetObjects(const PTree & tree)
+{
+	object_keys.clear();
+	object_values.clear();
+	object_children.clear();
+	FlattenTree(std::string(), tree, object_keys, object_values, object_children);
+}
+
+bool TRACKCACHE::GetObjects(PTree & tree) const
+{
+	if (object_keys.empty() ||
+		object_values.size() != object_keys.size() ||
+		object_children.size() != object_keys.size())
+	{
+		return false;
+	}
+
+	tree.clear();
+	size_t index = 0;
+	return BuildTree(tree, object_keys, object_values, object_children, index);
+}
+
+bool TRACKCACHE::GetFileInfo(const std::string & path, SOURCE & source, bool hash)
+{
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		source.size = -1;
+		source.mtime = 0;
+		source.hash = 0;
+		return false;
+	}
+
+	source.size = info.st_size;
+	source.mtime = info.st_mtime;
+	source.hash = 0;
+	if (hash)
+	{
+		// fnv-1a
+		FILEVIEW file(path);
+		unsigned int h = 2166136261u;
+		for (size_t i = 0; i < file.size; ++i)
+		{
+			h = (h ^ (unsigned char)file.data[i]) * 16777619u;
+		}
+		source.hash = h;
+	}
+	return true;
+}
+
+QT_TEST(trackcache_test)
+{
+	const std::string sourcefile = "trackcache_test.txt";
+	const std::string cachefile = "trackcache_test.cache";
+	{
+		std::ofstream source(sourcefile.c_str());
+		source << "[object.foo.body]\nmodel = foo.joe\n";
+	}
+
+	// two flat patches
+	std::stringstream roadfile;
+	roadfile << 2 << "\n";
+	for (int i = 0; i < 2; ++i)
+	{
+		for (int x = 0; x < 4; ++x)
+		{
+			for (int y = 0; y < 4; ++y)
+			{
+				roadfile << y << " " << 0 << " " << 3 * i + x << "\n";
+			}
+		}
+	}
+
+	TRACKCACHE cache;
+	cache.roads.push_back(ROADSTRIP());
+	std::stringstream error;
+	cache.roads.back().ReadFrom(roadfile, false, error);
+	cache.roads.back().GetPatches()[0].SetRacingLine(MATHVECTOR<float, 3>(1, 2, 3));
+	cache.surfaces.resize(2);
+	cache.surfaces[1].setType("gravel");
+	cache.surfaces[1].frictionTread = 0.7;
+	cache.lap.push_back(std::make_pair(0, 1));
+	cache.cull = true;
+
+	PTree objects;
+	{
+		file_open_basic fopen(".", ".");
+		QT_CHECK(read_ini(sourcefile, fopen, objects));
+	}
+	cache.SetObjects(objects);
+	cache.AddSource(sourcefile);
+	cache.AddSource("trackcache_test_missing.txt");
+	QT_CHECK(cache.Write(cachefile, error));
+
+	TRACKCACHE warm;
+	QT_CHECK(warm.Read(cachefile));
+	QT_CHECK(warm.cull);
+	QT_CHECK_EQUAL(warm.lap.size(), 1);
+	QT_CHECK_EQUAL(warm.surfaces.size(), 2);
+	QT_CHECK_EQUAL(warm.surfaces[1].type, TRACKSURFACE::GRAVEL);
+	QT_CHECK_EQUAL(warm.surfaces[1].frictionTread, 0.7f);
+	QT_CHECK_EQUAL(warm.roads.size(), 1);
+	if (warm.roads.size() == 1)
+	{
+		const std::vector<ROADPATCH> & patches = warm.roads.front().GetPatches();
+		QT_CHECK_EQUAL(patches.size(), 2);
+		if (patches.size() == 2)
+		{
+			QT_CHECK(patches[0].GetPatch().GetNextPatch() == &patches[1].GetPatch());
+			QT_CHECK(patches[0].GetPatch().HasRacingline());
+			QT_CHECK_EQUAL(patches[0].GetRacingLine()[2], 3.0f);
+			QT_CHECK_EQUAL(patches[1].GetPatch().GetBR()[2], 6.0f);
+		}
+	}
+
+	PTree warm_objects;
+	QT_CHECK(warm.GetObjects(warm_objects));
+	const PTree * body = 0;
+	std::string model;
+	QT_CHECK(warm_objects.get("object.foo.body", body));
+	QT_CHECK(body && body->get("model", model));
+	QT_CHECK_EQUAL(model, "foo.joe");
+	QT_CHECK(body && body->parent() && body->parent()->value() == "foo");
+	QT_CHECK_EQUAL(warm_objects.value(), sourcefile);
+
+	// changed source invalidates the cache
+	{
+		std::ofstream source(sourcefile.c_str());
+		source << "[object.foo.body]\nmodel = foobar.joe\n";
+	}
+	TRACKCACHE stale;
+	QT_CHECK(!stale.Read(cachefile));
+
+	// a corrupt item count fails before the surfaces are allocated
+	char corrupt[2 * sizeof(int)];
+	int counts[2] = {0x7fffffff, 0};
+	joeserialize::BinarySpanOutputSerializer out(corrupt, sizeof(corrupt));
+	QT_CHECK(out.SerializeArray("counts", counts, 2));
+	joeserialize::BinarySpanInputSerializer in(corrupt, sizeof(corrupt));
+	TRACKCACHE broken;
+	QT_CHECK(!broken.Serialize(in));
+	QT_CHECK(broken.surfaces.empty());
+
+	std::remove(sourcefile.c_str());
+	std::remove(cachefile.c_str());
+}
@@ -0,0 +1,95 @@
+/************************************************************************/
+/*                                                                      */
+/* This file is part of VDrift.                                         */
+/*                                                                      */
+/* VDrift is free software: you can redistribute it and/or modify       */
+/* it under the terms of the GNU General Public License as published by */
+/* the Free Software Foundation, either version 3 of the License, or    */
+/* (at your option) any later version.                                  */
+/*                                                                      */
+/* VDrift is distributed in the hope that it will be useful,            */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of       */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the        */
+/* GNU General Public License for more details.                         */
+/*                                                                      */
+/* You should have received a copy of the GNU General Public License    */
+/* along with VDrift.  If not, see <http://www.gnu.org/licenses/>.      */
+/*                                                                      */
+/************************************************************************/
+
+#ifndef _TRACKCACHE_H
+#define _TRACKCACHE_H
+
+#include "roadstrip.h"
+#include "tracksurface.h"
+#include "mathvector.h"
+#include "quaternion.h"
+#include "joeserialize.h"
+#include "cfg/ptree.h"
+
+#include <list>
+#include <string>
+#include <vector>
+
+/// Binary snapshot of the track data which is expensive to rebuild on every
+/// load: surfaces, roads with their K1999 racing lines, start positions, lap
+/// sections and the object list. The file is memory mapped for reading and
+/// only accepted if its version matches and every source file it was built
+/// from still has the same size and modification time or content hash.
+class TRACKCACHE
+{
+public:
+	TRACKCACHE();
+
+	/// cache file of a track and direction in cachepath
+	static std::string GetPath(const std::string & cachepath, const std::string & trackname, bool reverse);
+
+	/// record a file the cached data has been built from, missing files
+	/// are recorded too, the cache is invalid once they appear
+	void AddSource(const std::string & path);
+
+	/// read the cache, false if it doesn't exist, is outdated or broken
+	bool Read(const std::string & cachefile);
+
+	/// write the cache and all recorded sources
+	bool Write(const std::string & cachefile, std::ostream & error_output);
+
+	bool Serialize(joeserialize::Serializer & s);
+
+	/// store the tree, keys and values only
+	void SetObjects(const PTree & tree);
+
+	/// rebuild the stored tree, false if there is none
+	bool GetObjects(PTree & tree) const;
+
+	std::vector<TRACKSURFACE> surfaces;
+	std::list<ROADSTRIP> roads;
+	std::vector<std::pair<MATHVECTOR<float, 3>, QUATERNION<float> > > start_positions;
+	std::vector<std::pair<int, int> > lap; ///< road and patch index of the lap sections
+	bool vertical_tracking_skyboxes;
+	bool cull;
+
+private:
+	struct SOURCE
+	{
+		std::string path;
+		unsigned int size; ///< -1 if the file doesn't exist
+		unsigned int mtime;
+		unsigned int hash;
+
+		SOURCE();
+		bool Serialize(joeserialize::Serializer & s);
+	};
+	std::vector<SOURCE> sources;
+
+	// object tree in depth first order
+	std::vector<std::string> object_keys;
+	std::vector<std::string> object_values;
+	std::vector<int> object_children;
+
+	bool SerializeSources(joeserialize::Serializer & s);
+
+	static bool GetFileInfo(const std::string & path, SOURCE & source, bool hash);
+};
+
+#endif // _TRACKCACHE_H
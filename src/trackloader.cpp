@@ -21,6 +21,8 @@
 #include "dynamicsworld.h"
 #include "loadcollisionshape.h"
 #include "contentmanager.h"
+#include "model_joe03.h"
+#include "trackcache.h"
 #include "textureinfo.h"
 #include "coordinatesystem.h"
 #include "tobullet.h"
@@ -74,6 +76,84 @@ static btIndexedMesh GetIndexedMesh(const MODEL & model)
 	return mesh;
 }
 
+// static triangle mesh collision shape, called from worker threads too
+static void CreateMeshShape(
+	const PTree & cfg,
+	const MODEL & model,
+	std::vector<TRACKSURFACE> & surfaces,
+	btStridingMeshInterface *& mesh_out,
+	btCollisionShape *& shape_out)
+{
+	btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
+	mesh->addIndexedMesh(GetIndexedMesh(model));
+
+	int surface = 0;
+	cfg.get("surface", surface);
+	if (surface >= (int)surfaces.size())
+	{
+		surface = 0;
+	}
+
+	btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
+	shape->setUserPointer((void*)&surfaces[surface]);
+
+	mesh_out = mesh;
+	shape_out = shape;
+}
+
+// set relative path for models and textures, ugly hack
+// need to identify body references
+static std::string GetBodyName(
+	const PTree & cfg,
+	std::string & model_name,
+	std::vector<std::string> & texture_names)
+{
+	if (cfg.value() == "body" && cfg.parent())
+	{
+		return cfg.parent()->value();
+	}
+
+	std::string name = cfg.value();
+	size_t npos = name.rfind("/");
+	if (npos < name.length())
+	{
+		std::string rel_path = name.substr(0, npos+1);
+		model_name = rel_path + model_name;
+		texture_names[0] = rel_path + texture_names[0];
+		if (!texture_names[1].empty()) texture_names[1] = rel_path + texture_names[1];
+		if (!texture_names[2].empty()) texture_names[2] = rel_path + texture_names[2];
+	}
+	return name;
+}
+
+// file_open_basic remembering the files it has been asked for
+struct file_open_record : file_open_basic
+{
+	std::vector<std::string> & files;
+
+	file_open_record(const std::string & path, const std::string & path_alt, std::vector<std::string> & files) :
+		file_open_basic(path, path_alt),
+		files(files)
+	{
+		// ctor
+	}
+
+	std::istream * operator()(const std::string & name) const
+	{
+		std::string file_path = path + "/" + name;
+		if (!std::ifstream(file_path.c_str()))
+		{
+			std::string file_path_alt = path_alt + "/" + name;
+			if (std::ifstream(file_path_alt.c_str()))
+			{
+				file_path = file_path_alt;
+			}
+		}
+		files.push_back(file_path);
+		return file_open_basic::operator()(name);
+	}
+};
+
 TRACK::LOADER::LOADER(
 	ContentManager & content,
 	DynamicsWorld & world,
@@ -88,7 +168,9 @@ TRACK::LOADER::LOADER(
 	const bool reverse,
 	const bool dynamic_objects,
 	const bool dynamic_shadows,
-	const bool agressive_combining) :
+	const bool agressive_combining,
+	JobSystem * jobs,
+	const std::string & cachepath) :
 	content(content),
 	world(world),
 	data(data),
@@ -102,6 +184,8 @@ TRACK::LOADER::LOADER(
 	dynamic_objects(dynamic_objects),
 	dynamic_shadows(dynamic_shadows),
 	agressive_combining(agressive_combining),
+	jobs(jobs),
+	cached_objects(false),
 	packload(false),
 	numobjects(0),
 	numloaded(0),
@@ -110,11 +194,19 @@ TRACK::LOADER::LOADER(
 	min_params(14),
 	error(false),
 	list(false),
-	track_shape(0)
+	track_shape(0),
+	nodes(0),
+	node_index(0),
+	current(0)
 {
 	objectpath = trackpath + "/objects";
 	objectdir = trackdir + "/objects";
 	data.reverse = reverse;
+	if (!cachepath.empty())
+	{
+		std::string trackname = trackpath.substr(trackpath.rfind('/') + 1);
+		cachefile = TRACKCACHE::GetPath(cachepath, trackname, reverse);
+	}
 }
 
 TRACK::LOADER::~LOADER()
@@ -124,9 +216,27 @@ TRACK::LOADER::~LOADER()
 
 void TRACK::LOADER::Clear()
 {
+	// workers reference the track config and pack, let them finish first
+	for (size_t i = 0; i < prefetch.size(); ++i)
+	{
+		jobs->Wait(prefetch[i].job);
+		delete prefetch[i].shape;
+		delete prefetch[i].mesh;
+	}
+	prefetch.clear();
+	current = 0;
+
+	for (size_t i = 0; i < thread_packs.size(); ++i)
+	{
+		delete thread_packs[i];
+	}
+	thread_packs.clear();
+
 	bodies.clear();
 	combined.clear();
 	track_config.clear();
+	cache_sources.clear();
+	cached_objects = false;
 	objectfile.close();
 	pack.Close();
 }
@@ -137,6 +247,12 @@ bool TRACK::LOADER::BeginLoad()
 
 	info_output << "Loading track from path: " << trackpath << std::endl;
 
+	if (LoadCache())
+	{
+		info_output << "Loaded track cache: " << cachefile << std::endl;
+		return CreateRacingLines(false) && BeginObjectLoad();
+	}
+
 	if (!LoadSurfaces())
 	{
 		info_output << "No Surfaces File. Continuing with standard surfaces" << std::endl;
@@ -146,15 +262,17 @@ bool TRACK::LOADER::BeginLoad()
 	{
 		error_output << "Error during road loading; continuing with an unsmoothed track" << std::endl;
 		data.roads.clear();
+		data.road_bvh.Clear();
 	}
 
-	if (!CreateRacingLines())
+	if (!CreateRacingLines(true))
 	{
 		return false;
 	}
 
 	// load info
 	std::string info_path = trackpath + "/track.txt";
+	cache_sources.push_back(info_path);
 	std::ifstream file(info_path.c_str());
 	if (!file.good())
 	{
@@ -184,6 +302,8 @@ bool TRACK::LOADER::BeginLoad()
 		return false;
 	}
 
+	WriteCache();
+
 	return true;
 }
 
@@ -274,17 +394,22 @@ std::pair<bool, bool> TRACK::LOADER::ContinueObjectLoad()
 
 bool TRACK::LOADER::Begin()
 {
-	file_open_basic fopen(objectpath, sharedobjectpath);
-	if (read_ini("objects.txt", fopen, track_config))
+	file_open_record fopen(objectpath, sharedobjectpath, cache_sources);
+	if (cached_objects || read_ini("objects.txt", fopen, track_config))
 	{
 		//write_inf(track_config, std::cerr);
 		nodes = 0;
 		if (track_config.get("object", nodes))
 		{
 			node_it = nodes->begin();
+			node_index = 0;
 			numobjects = nodes->size();
 			data.models.reserve(numobjects);
 			data.meshes.reserve(numobjects);
+			if (jobs && jobs->GetNumThreads() > 1)
+			{
+				BeginPrefetch();
+			}
 			return true;
 		}
 	}
@@ -298,18 +423,152 @@ std::pair<bool, bool> TRACK::LOADER::Continue()
 		return std::make_pair(false, false);
 	}
 
-	if (!LoadNode(node_it->second))
+	if (!prefetch.empty())
+	{
+		current = &prefetch[node_index];
+		jobs->Wait(current->job);
+	}
+
+	bool loaded = LoadNode(node_it->second);
+	current = 0;
+	if (!loaded)
 	{
 		return std::make_pair(true, false);
 	}
 
 	node_it++;
+	node_index++;
 
 	return std::make_pair(false, true);
 }
 
+void TRACK::LOADER::BeginPrefetch()
+{
+	// plan in node order, the first node using a model loads it,
+	// nodes sharing the model wait for that one
+	prefetch.resize(numobjects);
+	thread_packs.resize(jobs->GetNumThreads(), 0);
+	std::map<std::string, PREFETCH*> model_owners;
+	int i = 0;
+	for (PTree::const_iterator n = nodes->begin(); n != nodes->end(); ++n, ++i)
+	{
+		PREFETCH & node = prefetch[i];
+		node.job.function = &Prefetch;
+		node.job.data = &node;
+		node.loader = this;
+
+		const PTree * cfg;
+		if (!n->second.get("body", cfg))
+		{
+			continue;
+		}
+
+		bool isashadow = false;
+		cfg->get("isashadow", isashadow);
+		if (dynamic_shadows && isashadow)
+		{
+			continue;
+		}
+
+		std::vector<std::string> texture_names(3);
+		cfg->get("model", node.model_name);
+		GetBodyName(*cfg, node.model_name, texture_names);
+
+		float mass;
+		node.buildshape = cfg->get("mass", mass) && mass < 1E-3;
+		node.cfg = cfg;
+
+		if (content.get(objectdir, node.model_name, node.model))
+		{
+			continue;
+		}
+
+		std::map<std::string, PREFETCH*>::iterator owner = model_owners.find(node.model_name);
+		if (owner != model_owners.end())
+		{
+			node.owner = owner->second;
+			jobs->AddDependency(node.job, owner->second->job);
+		}
+		else
+		{
+			node.loadmodel = true;
+			model_owners[node.model_name] = &node;
+		}
+	}
+
+	for (size_t i = 0; i < prefetch.size(); ++i)
+	{
+		jobs->Submit(prefetch[i].job);
+	}
+}
+
+void TRACK::LOADER::Prefetch(void * data)
+{
+	PREFETCH & node = *static_cast<PREFETCH*>(data);
+	if (node.cfg)
+	{
+		node.loader->PrefetchNode(node);
+	}
+}
+
+void TRACK::LOADER::PrefetchNode(PREFETCH & node)
+{
+	// errors are reported by the serial fallback in LoadModel
+	std::ostringstream error;
+
+	if (node.loadmodel)
+	{
+		std::tr1::shared_ptr<MODEL_JOE03> model(new MODEL_JOE03());
+		bool loaded = false;
+		if (packload)
+		{
+			JOEPACK *& thread_pack = thread_packs[jobs->GetThreadIndex()];
+			if (!thread_pack)
+			{
+				thread_pack = new JOEPACK();
+				thread_pack->Load(pack.GetPath());
+			}
+			std::string name = node.model_name.substr(node.model_name.rfind('/') + 1);
+			loaded = model->LoadMesh(name, error, thread_pack);
+
+			// pack content is cached under the first candidate path
+			node.model_key = objectdir + '/' + node.model_name;
+		}
+		if (!loaded)
+		{
+			std::string abspath;
+			content.find(objectdir, node.model_name, abspath, node.model_key);
+			loaded = !abspath.empty() && model->LoadMesh(abspath, error);
+		}
+		if (loaded)
+		{
+			node.model = model;
+		}
+	}
+	else if (node.owner)
+	{
+		node.model = node.owner->model;
+	}
+
+	if (node.buildshape && node.model)
+	{
+		CreateMeshShape(*node.cfg, *node.model, data.surfaces, node.mesh, node.shape);
+	}
+}
+
 bool TRACK::LOADER::LoadModel(const std::string & name)
 {
+	if (current && current->model && current->model_name == name)
+	{
+		// prefetched, cache it if this is the node that loaded it
+		if (current->loadmodel)
+		{
+			content.add(current->model_key, current->model);
+		}
+		data.models.push_back(current->model);
+		return true;
+	}
+
 	std::tr1::shared_ptr<MODEL> model;
 	if ((packload && content.load(objectdir, name, pack, model)) ||
 		content.load(objectdir, name, model))
@@ -324,22 +583,19 @@ bool TRACK::LOADER::LoadShape(const PTree & cfg, const MODEL & model, BODY & bod
 {
 	if (body.mass < 1E-3)
 	{
-		btTriangleIndexVertexArray * mesh = new btTriangleIndexVertexArray();
-		mesh->addIndexedMesh(GetIndexedMesh(model));
-		data.meshes.push_back(mesh);
-		body.mesh = mesh;
-
-		int surface = 0;
-		cfg.get("surface", surface);
-		if (surface >= (int)data.surfaces.size())
+		if (current && current->shape && current->model.get() == &model)
 		{
-			surface = 0;
+			body.mesh = current->mesh;
+			body.shape = current->shape;
+			current->mesh = 0;
+			current->shape = 0;
 		}
-
-		btBvhTriangleMeshShape * shape = new btBvhTriangleMeshShape(mesh, true);
-		shape->setUserPointer((void*)&data.surfaces[surface]);
-		data.shapes.push_back(shape);
-		body.shape = shape;
+		else
+		{
+			CreateMeshShape(cfg, model, data.surfaces, body.mesh, body.shape);
+		}
+		data.meshes.push_back(body.mesh);
+		data.shapes.push_back(body.shape);
 	}
 	else
 	{
@@ -399,26 +655,7 @@ TRACK::LOADER::body_iterator TRACK::LOADER::LoadBody(const PTree & cfg)
 	std::stringstream s(texture_name);
 	s >> texture_names;
 
-	// set relative path for models and textures, ugly hack
-	// need to identify body references
-	std::string name;
-	if (cfg.value() == "body" && cfg.parent())
-	{
-		name = cfg.parent()->value();
-	}
-	else
-	{
-		name = cfg.value();
-		size_t npos = name.rfind("/");
-		if (npos < name.length())
-		{
-			std::string rel_path = name.substr(0, npos+1);
-			model_name = rel_path + model_name;
-			texture_names[0] = rel_path + texture_names[0];
-			if (!texture_names[1].empty()) texture_names[1] = rel_path + texture_names[1];
-			if (!texture_names[2].empty()) texture_names[2] = rel_path + texture_names[2];
-		}
-	}
+	std::string name = GetBodyName(cfg, model_name, texture_names);
 
 	if (dynamic_shadows && isashadow)
 	{
@@ -861,9 +1098,93 @@ std::pair<bool, bool> TRACK::LOADER::ContinueOld()
 	return std::make_pair(false, true);
 }
 
+bool TRACK::LOADER::LoadCache()
+{
+	TRACKCACHE cache;
+	if (cachefile.empty() || !cache.Read(cachefile))
+	{
+		return false;
+	}
+
+	data.surfaces.swap(cache.surfaces);
+	data.roads.swap(cache.roads);
+	data.road_bvh.Build(data.roads);
+	data.start_positions.swap(cache.start_positions);
+	data.vertical_tracking_skyboxes = cache.vertical_tracking_skyboxes;
+	data.cull = cache.cull;
+
+	// lap sections by road and patch index
+	std::vector<std::list<ROADSTRIP>::iterator> roads;
+	for (std::list<ROADSTRIP>::iterator i = data.roads.begin(); i != data.roads.end(); ++i)
+	{
+		roads.push_back(i);
+	}
+	for (size_t i = 0; i < cache.lap.size(); ++i)
+	{
+		size_t road = cache.lap[i].first;
+		size_t patch = cache.lap[i].second;
+		if (road >= roads.size() || patch >= roads[road]->GetPatches().size())
+		{
+			error_output << "Invalid lap section in track cache " << cachefile << std::endl;
+			data.lap.clear();
+			break;
+		}
+		data.lap.push_back(&roads[road]->GetPatches()[patch].GetPatch());
+	}
+
+	cached_objects = cache.GetObjects(track_config);
+
+	return true;
+}
+
+void TRACK::LOADER::WriteCache()
+{
+	if (cachefile.empty())
+	{
+		return;
+	}
+
+	TRACKCACHE cache;
+	for (size_t i = 0; i < cache_sources.size(); ++i)
+	{
+		cache.AddSource(cache_sources[i]);
+	}
+
+	// lap sections by road and patch index
+	std::map<const BEZIER *, std::pair<int, int> > patch_index;
+	int road_index = 0;
+	for (std::list<ROADSTRIP>::const_iterator r = data.roads.begin(); r != data.roads.end(); ++r, ++road_index)
+	{
+		const std::vector<ROADPATCH> & patches = r->GetPatches();
+		for (size_t i = 0; i < patches.size(); ++i)
+		{
+			patch_index[&patches[i].GetPatch()] = std::make_pair(road_index, int(i));
+		}
+	}
+	for (size_t i = 0; i < data.lap.size(); ++i)
+	{
+		cache.lap.push_back(patch_index[data.lap[i]]);
+	}
+
+	cache.surfaces = data.surfaces;
+	cache.start_positions = data.start_positions;
+	cache.vertical_tracking_skyboxes = data.vertical_tracking_skyboxes;
+	cache.cull = data.cull;
+	if (!list)
+	{
+		cache.SetObjects(track_config);
+	}
+
+	// lend the roads to the cache, the list nodes and patch links stay valid
+	cache.roads.swap(data.roads);
+	cache.Write(cachefile, error_output);
+	cache.roads.swap(data.roads);
+}
+
 bool TRACK::LOADER::LoadSurfaces()
 {
 	std::string path = trackpath + "/surfaces.txt";
+	cache_sources.push_back(path);
 	std::ifstream file(path.c_str());
 	if (!file.good())
 	{
@@ -922,6 +1243,7 @@ bool TRACK::LOADER::LoadRoads()
 	data.roads.clear();
 
 	std::string roadpath = trackpath + "/roads.trk";
+	cache_sources.push_back(roadpath);
 	std::ifstream trackfile(roadpath.c_str());
 	if (!trackfile.good())
 	{
@@ -937,10 +1259,12 @@ bool TRACK::LOADER::LoadRoads()
 		data.roads.back().ReadFrom(trackfile, data.reverse, error_output);
 	}
 
+	data.road_bvh.Build(data.roads);
+
 	return true;
 }
 
-bool TRACK::LOADER::CreateRacingLines()
+bool TRACK::LOADER::CreateRacingLines(bool calculate)
 {
 	TEXTUREINFO texinfo;
 	if (!content.load(texturedir, "racingline.png", texinfo, data.racingline_texture))
@@ -951,7 +1275,7 @@ bool TRACK::LOADER::CreateRacingLines()
 	K1999 k1999data;
 	for (std::list <ROADSTRIP>::iterator i = data.roads.begin(); i != data.roads.end(); ++i)
 	{
-		if (k1999data.LoadData(*i))
+		if (calculate && k1999data.LoadData(*i))
 		{
 			k1999data.CalcRaceLine();
 			k1999data.UpdateRoadStrip(*i);
@@ -23,9 +23,11 @@
 #include "track.h"
 #include "cfg/ptree.h"
 #include "joepack.h"
+#include "jobsystem.h"
 
 #include <ostream>
 #include <string>
+#include <vector>
 
 /*
 [object.foo]
@@ -71,7 +73,9 @@ public:
 		const bool reverse,
 		const bool dynamic_shadows,
 		const bool dynamic_objects,
-		const bool agressive_combining);
+		const bool agressive_combining,
+		JobSystem * jobs = 0,
+		const std::string & cachepath = std::string());
 
 	~LOADER();
 
@@ -98,6 +102,12 @@ private:
 	const bool dynamic_objects;
 	const bool dynamic_shadows;
 	const bool agressive_combining;
+	JobSystem * jobs;
+
+	// binary cache of the parsed track data and the files it depends on
+	std::string cachefile;
+	std::vector<std::string> cache_sources;
+	bool cached_objects;
 
 	std::string objectpath;
 	std::string objectdir;
@@ -156,12 +166,42 @@ private:
 	PTree track_config;
 	const PTree * nodes;
 	PTree::const_iterator node_it;
+	int node_index;
+
+	// object models and static collision shapes prepared by worker threads,
+	// one per node, the main thread waits for them in node order
+	struct PREFETCH
+	{
+		PREFETCH() : loader(0), cfg(0), owner(0), mesh(0), shape(0),
+			loadmodel(false), buildshape(false)
+		{
+			// ctor
+		}
+		JobSystem::Job job;
+		LOADER * loader;
+		const PTree * cfg; ///< body config, null if there is nothing to prepare
+		const PREFETCH * owner; ///< node loading the model if it isn't this one
+		std::string model_name;
+		std::string model_key; ///< content cache key for loaded models
+		std::tr1::shared_ptr<MODEL> model;
+		btStridingMeshInterface * mesh; ///< owned until taken by LoadShape
+		btCollisionShape * shape; ///< owned until taken by LoadShape
+		bool loadmodel;
+		bool buildshape;
+	};
+	std::vector<PREFETCH> prefetch;
+	std::vector<JOEPACK*> thread_packs; ///< JOEPACK has a single read cursor
+	PREFETCH * current;
+
+	bool LoadCache();
+
+	void WriteCache();
 
 	bool LoadSurfaces();
 
 	bool LoadRoads();
 
-	bool CreateRacingLines();
+	bool CreateRacingLines(bool calculate);
 
 	bool LoadStartPositions(const PTree & info);
 
@@ -169,6 +209,12 @@ private:
 
 	bool BeginObjectLoad();
 
+	void BeginPrefetch();
+
+	static void Prefetch(void * data);
+
+	void PrefetchNode(PREFETCH & node);
+
 	std::pair<bool, bool> ContinueObjectLoad();
 
 	bool Begin();
@@ -20,6 +20,9 @@
 #ifndef _TRACKSURFACE_H
 #define _TRACKSURFACE_H
 
+#include "joeserialize.h"
+#include "macros.h"
+
 #include <string>
 
 class TRACKSURFACE
@@ -66,6 +69,18 @@ public:
 
 	}
 
+	bool Serialize(joeserialize::Serializer & s)
+	{
+		_SERIALIZEENUM_(s, type, TYPE);
+		_SERIALIZE_(s, bumpWaveLength);
+		_SERIALIZE_(s, bumpAmplitude);
+		_SERIALIZE_(s, frictionNonTread);
+		_SERIALIZE_(s, frictionTread);
+		_SERIALIZE_(s, rollResistanceCoefficient);
+		_SERIALIZE_(s, rollingDrag);
+		return true;
+	}
+
 	TYPE type;
 	float bumpWaveLength;
 	float bumpAmplitude;
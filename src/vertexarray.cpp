@@ -21,8 +21,13 @@
 #include "unittest.h"
 #include "mathvector.h"
 #include "quaternion.h"
+#include "benchmark.h"
 
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <map>
 
 QT_TEST(vertexarray_test)
 {
@@ -141,6 +146,22 @@ void VERTEXARRAY::SetVertices(float * array, size_t count, size_t offset)
 	}
 }
 
+void VERTEXARRAY::SetColors(float * array, size_t count, size_t offset)
+{
+	size_t size = offset + count;
+
+	// Tried to assign values that aren't in sets of 4
+	assert(size % 4 == 0);
+
+	if (size != colors.size())
+	{
+		colors.resize(size);
+	}
+
+	if (count > 0)
+		memcpy(&colors[offset], array, count * sizeof(float));
+}
+
 void VERTEXARRAY::SetFaces(int * newarray, size_t newarraycount)
 {
 	//Tried to assign values that aren't in sets of 3
@@ -204,6 +225,12 @@ void VERTEXARRAY::GetVertices(const float * & output_array_pointer, int & output
 	output_array_pointer = vertices.empty() ? NULL : &vertices[0];
 }
 
+void VERTEXARRAY::GetColors(const float * & output_array_pointer, int & output_array_num) const
+{
+	output_array_num = colors.size();
+	output_array_pointer = colors.empty() ? NULL : &colors[0];
+}
+
 void VERTEXARRAY::GetFaces(const int * & output_array_pointer, int & output_array_num) const
 {
 	output_array_num = faces.size();
@@ -589,22 +616,72 @@ void VERTEXARRAY::SetTo2DBox(float x, float y, float w, float h, float marginwid
 	SetTexCoords(0, uvs, 8*quads);
 }
 
-void VERTEXARRAY::BuildFromFaces(const std::vector <FACE> & newfaces)
+// fnv-1a over the attribute bits followed by a final avalanche, the weld table
+// is indexed by the low bits and exact values like 0.5 have all low bits clear
+static inline unsigned int HashFloat(unsigned int hash, float f)
+{
+	// +0 and -0 compare equal, hash them alike
+	if (f == 0) f = 0;
+	unsigned int bits;
+	std::memcpy(&bits, &f, sizeof(bits));
+	return (hash ^ bits) * 16777619u;
+}
+
+static inline unsigned int HashVertexData(const VERTEXARRAY::VERTEXDATA & v)
+{
+	unsigned int hash = 2166136261u;
+	hash = HashFloat(hash, v.vertex.x);
+	hash = HashFloat(hash, v.vertex.y);
+	hash = HashFloat(hash, v.vertex.z);
+	hash = HashFloat(hash, v.normal.x);
+	hash = HashFloat(hash, v.normal.y);
+	hash = HashFloat(hash, v.normal.z);
+	hash = HashFloat(hash, v.texcoord.u);
+	hash = HashFloat(hash, v.texcoord.v);
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+void VERTEXARRAY::BuildFromFaces(const std::vector <FACE> & newfaces, bool optimize)
 {
-	std::map <VERTEXDATA, unsigned int> indexmap;
 	Clear();
 	texcoords.resize(1);
+	faces.reserve(newfaces.size() * 3);
+
+	// open addressing table of vertex index + 1, at most half full
+	unsigned int tablesize = 16;
+	while (tablesize < newfaces.size() * 6)
+		tablesize *= 2;
+	const unsigned int mask = tablesize - 1;
+	std::vector <unsigned int> table(tablesize, 0);
 
 	for (std::vector <FACE>::const_iterator i = newfaces.begin(); i != newfaces.end(); ++i) //loop through input triangles
 	{
 		for (int v = 0; v < 3; v++) //loop through vertices in triangle
 		{
 			const VERTEXDATA & curvertdata = i->GetVertexData(v); //grab vertex
-			std::map <VERTEXDATA, unsigned int>::iterator result = indexmap.find(curvertdata);
-			if (result == indexmap.end()) //new vertex
+			unsigned int slot = HashVertexData(curvertdata) & mask;
+			while (table[slot])
 			{
-				unsigned int newidx = indexmap.size();
-				indexmap[curvertdata] = newidx;
+				const unsigned int idx = table[slot] - 1;
+				const float * vert = &vertices[idx * 3];
+				const float * norm = &normals[idx * 3];
+				const float * tc = &texcoords[0][idx * 2];
+				if (vert[0] == curvertdata.vertex.x && vert[1] == curvertdata.vertex.y && vert[2] == curvertdata.vertex.z &&
+					norm[0] == curvertdata.normal.x && norm[1] == curvertdata.normal.y && norm[2] == curvertdata.normal.z &&
+					tc[0] == curvertdata.texcoord.u && tc[1] == curvertdata.texcoord.v)
+					break;
+				slot = (slot + 1) & mask;
+			}
+
+			if (!table[slot]) //new vertex
+			{
+				unsigned int newidx = vertices.size() / 3;
+				table[slot] = newidx + 1;
 
 				vertices.push_back(curvertdata.vertex.x);
 				vertices.push_back(curvertdata.vertex.y);
@@ -616,19 +693,167 @@ void VERTEXARRAY::BuildFromFaces(const std::vector <FACE> & newfaces)
 
 				texcoords[0].push_back(curvertdata.texcoord.u);
 				texcoords[0].push_back(curvertdata.texcoord.v);
-
-				faces.push_back(newidx);
 			}
-			else //non-unique vertex
-				faces.push_back(result->second);
+			faces.push_back(table[slot] - 1);
 		}
 	}
 
-	//std::cout << faces.size() << ", " << newfaces.size() << ", " << vertices.size() << ", " << normals.size() << ", " << texcoords[0].size() << std::endl;
-
 	assert(faces.size()/3 == newfaces.size());
 	assert(vertices.size()/3 == normals.size()/3 && normals.size()/3 == texcoords[0].size()/2);
 	assert(vertices.size()/3 <= faces.size());
+
+	if (optimize)
+		OptimizeVertexCache();
+}
+
+static void ReorderVertexAttribute(std::vector <float> & attribute, const std::vector <int> & remap, unsigned int components)
+{
+	if (attribute.size() != remap.size() * components)
+		return;
+
+	std::vector <float> reordered(attribute.size());
+	for (unsigned int i = 0; i < remap.size(); ++i)
+	{
+		for (unsigned int c = 0; c < components; ++c)
+			reordered[remap[i] * components + c] = attribute[i * components + c];
+	}
+	attribute.swap(reordered);
+}
+
+void VERTEXARRAY::OptimizeVertexCache(unsigned int cachesize)
+{
+	assert(faces.size() % 3 == 0);
+	const int numverts = vertices.size() / 3;
+	const int numtris = faces.size() / 3;
+	const int cache = cachesize;
+	if (numtris == 0)
+		return;
+
+	// live triangle count and adjacent triangles of each vertex
+	std::vector <int> live(numverts, 0);
+	for (unsigned int i = 0; i < faces.size(); ++i)
+	{
+		assert(faces[i] >= 0 && faces[i] < numverts);
+		live[faces[i]]++;
+	}
+	std::vector <int> offset(numverts + 1, 0);
+	for (int v = 0; v < numverts; ++v)
+		offset[v + 1] = offset[v] + live[v];
+	std::vector <int> adjacency(faces.size());
+	std::vector <int> fill(offset.begin(), offset.end() - 1);
+	for (unsigned int i = 0; i < faces.size(); ++i)
+		adjacency[fill[faces[i]]++] = i / 3;
+
+	// tipsify (Sander, Nehab, Barczak 2007): fan around the current vertex, then continue
+	// with the candidate that stays in the fifo cache longest, fall back to recently used
+	// vertices on dead ends and finally to the next vertex with live triangles
+	std::vector <int> newfaces;
+	newfaces.reserve(faces.size());
+	std::vector <int> cachetime(numverts, 0);
+	std::vector <char> emitted(numtris, 0);
+	std::vector <int> deadend;
+	std::vector <int> candidates;
+	int time = cache + 1;
+	int cursor = 0;
+	int fanning = faces[0];
+	while (fanning >= 0)
+	{
+		candidates.clear();
+		for (int a = offset[fanning]; a < offset[fanning + 1]; ++a)
+		{
+			const int t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (int k = 0; k < 3; ++k)
+			{
+				const int v = faces[t * 3 + k];
+				newfaces.push_back(v);
+				deadend.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time - cachetime[v] > cache)
+					cachetime[v] = time++;
+			}
+			emitted[t] = 1;
+		}
+
+		int best = -1;
+		int bestpriority = -1;
+		for (std::vector <int>::const_iterator i = candidates.begin(); i != candidates.end(); ++i)
+		{
+			const int v = *i;
+			if (live[v] <= 0)
+				continue;
+
+			int priority = 0;
+			if (time - cachetime[v] + 2 * live[v] <= cache)
+				priority = time - cachetime[v];
+			if (priority > bestpriority)
+			{
+				bestpriority = priority;
+				best = v;
+			}
+		}
+
+		while (best < 0 && !deadend.empty())
+		{
+			const int v = deadend.back();
+			deadend.pop_back();
+			if (live[v] > 0)
+				best = v;
+		}
+
+		while (best < 0 && cursor < numverts)
+		{
+			if (live[cursor] > 0)
+				best = cursor;
+			++cursor;
+		}
+
+		fanning = best;
+	}
+	assert(newfaces.size() == faces.size());
+
+	// number the vertices in order of first use, unreferenced vertices go last
+	std::vector <int> remap(numverts, -1);
+	int next = 0;
+	for (unsigned int i = 0; i < newfaces.size(); ++i)
+	{
+		if (remap[newfaces[i]] < 0)
+			remap[newfaces[i]] = next++;
+		newfaces[i] = remap[newfaces[i]];
+	}
+	for (int v = 0; v < numverts; ++v)
+	{
+		if (remap[v] < 0)
+			remap[v] = next++;
+	}
+
+	faces.swap(newfaces);
+	ReorderVertexAttribute(vertices, remap, 3);
+	ReorderVertexAttribute(normals, remap, 3);
+	ReorderVertexAttribute(colors, remap, 4);
+	for (unsigned int i = 0; i < texcoords.size(); ++i)
+		ReorderVertexAttribute(texcoords[i], remap, 2);
+}
+
+float VERTEXARRAY::GetACMR(unsigned int cachesize) const
+{
+	if (faces.empty())
+		return 0;
+
+	// a vertex is in the fifo cache if it was loaded at most cachesize misses ago
+	const int cache = cachesize;
+	std::vector <int> loaded(vertices.size() / 3, -cache - 1);
+	int misses = 0;
+	for (unsigned int i = 0; i < faces.size(); ++i)
+	{
+		assert(faces[i] >= 0 && faces[i] < (int)loaded.size());
+		if (misses - loaded[faces[i]] > cache)
+			loaded[faces[i]] = misses++;
+	}
+	return misses / (faces.size() / 3.0f);
 }
 
 void VERTEXARRAY::Translate(float x, float y, float z)
@@ -812,3 +1037,181 @@ QT_TEST(vertexarray_buldfromfaces_test)
 	QT_CHECK_EQUAL(tempnum,36);
 }
 
+
+// smooth grid of n by n quads with a texture seam in the middle, optionally in random triangle order
+static void BuildTestGrid(int n, bool shuffle, std::vector <VERTEXARRAY::FACE> & faces)
+{
+	std::vector <VERTEXARRAY::VERTEXDATA> grid((n + 1) * (n + 1));
+	for (int y = 0; y <= n; ++y)
+	{
+		for (int x = 0; x <= n; ++x)
+		{
+			VERTEXARRAY::VERTEXDATA & v = grid[y * (n + 1) + x];
+			v.vertex = VERTEXARRAY::TRIFLOAT(x, 0.01f * ((x * 7 + y * 3) % 11), y);
+			v.normal = VERTEXARRAY::TRIFLOAT(0, 1, 0);
+			v.texcoord = VERTEXARRAY::TWOFLOAT(x / float(n), y / float(n));
+		}
+	}
+
+	faces.clear();
+	for (int y = 0; y < n; ++y)
+	{
+		for (int x = 0; x < n; ++x)
+		{
+			VERTEXARRAY::VERTEXDATA v00 = grid[y * (n + 1) + x];
+			VERTEXARRAY::VERTEXDATA v10 = grid[y * (n + 1) + x + 1];
+			VERTEXARRAY::VERTEXDATA v01 = grid[(y + 1) * (n + 1) + x];
+			VERTEXARRAY::VERTEXDATA v11 = grid[(y + 1) * (n + 1) + x + 1];
+			if (x == n / 2)
+			{
+				v10.texcoord.u = v11.texcoord.u = 0;
+			}
+			faces.push_back(VERTEXARRAY::FACE(v00, v01, v10));
+
+			// -0 and +0 weld like they compare
+			v10.normal.x = v01.normal.x = v11.normal.x = -0.0f;
+			faces.push_back(VERTEXARRAY::FACE(v10, v01, v11));
+		}
+	}
+
+	if (shuffle)
+	{
+		srand(1);
+		for (int i = faces.size() - 1; i > 0; --i)
+			std::swap(faces[i], faces[rand() % (i + 1)]);
+	}
+}
+
+// reference weld using an ordered map
+static void MapWeld(
+	const std::vector <VERTEXARRAY::FACE> & faces,
+	std::vector <float> & vertices,
+	std::vector <int> & indices)
+{
+	std::map <VERTEXARRAY::VERTEXDATA, unsigned int> indexmap;
+	for (std::vector <VERTEXARRAY::FACE>::const_iterator i = faces.begin(); i != faces.end(); ++i)
+	{
+		for (int v = 0; v < 3; v++)
+		{
+			const VERTEXARRAY::VERTEXDATA & data = i->GetVertexData(v);
+			std::map <VERTEXARRAY::VERTEXDATA, unsigned int>::iterator result = indexmap.find(data);
+			if (result == indexmap.end())
+			{
+				unsigned int newidx = indexmap.size();
+				indexmap[data] = newidx;
+				vertices.push_back(data.vertex.x);
+				vertices.push_back(data.vertex.y);
+				vertices.push_back(data.vertex.z);
+				indices.push_back(newidx);
+			}
+			else
+				indices.push_back(result->second);
+		}
+	}
+}
+
+// triangles as sorted attribute tuples, independent of face and vertex order
+static void GetTriangles(const VERTEXARRAY & varray, std::vector <std::vector <float> > & triangles)
+{
+	for (int f = 0; f < varray.GetNumFaces() / 3; ++f)
+	{
+		std::vector <float> tri;
+		for (int v = 0; v < 3; ++v)
+		{
+			std::vector <float> vert = varray.GetVertex(f, v);
+			std::vector <float> norm = varray.GetNormal(f, v);
+			std::vector <float> tc = varray.GetTextureCoordinate(f, v, 0);
+			tri.insert(tri.end(), vert.begin(), vert.end());
+			tri.insert(tri.end(), norm.begin(), norm.end());
+			tri.insert(tri.end(), tc.begin(), tc.end());
+		}
+		triangles.push_back(tri);
+	}
+	std::sort(triangles.begin(), triangles.end());
+}
+
+QT_TEST(vertexarray_weld_test)
+{
+	std::vector <VERTEXARRAY::FACE> grid;
+	BuildTestGrid(32, true, grid);
+
+	VERTEXARRAY varray;
+	varray.BuildFromFaces(grid);
+
+	// same vertices and indices as the ordered map weld
+	std::vector <float> mapvertices;
+	std::vector <int> mapindices;
+	MapWeld(grid, mapvertices, mapindices);
+
+	const float * vertices(NULL);
+	const int * indices(NULL);
+	int vertexnum, indexnum;
+	varray.GetVertices(vertices, vertexnum);
+	varray.GetFaces(indices, indexnum);
+	QT_CHECK_EQUAL(vertexnum, (int)mapvertices.size());
+	QT_CHECK_EQUAL(indexnum, (int)mapindices.size());
+	QT_CHECK_EQUAL(vertexnum, 33 * 34 * 3);
+	QT_CHECK(vertexnum == (int)mapvertices.size() && std::equal(mapvertices.begin(), mapvertices.end(), vertices));
+	QT_CHECK(indexnum == (int)mapindices.size() && std::equal(mapindices.begin(), mapindices.end(), indices));
+
+	// optimization keeps the triangles and their winding
+	std::vector <std::vector <float> > triangles, optimized_triangles;
+	GetTriangles(varray, triangles);
+
+	float acmr = varray.GetACMR();
+	VERTEXARRAY optimized = varray;
+	optimized.OptimizeVertexCache();
+	GetTriangles(optimized, optimized_triangles);
+
+	optimized.GetVertices(vertices, vertexnum);
+	QT_CHECK_EQUAL(vertexnum, 33 * 34 * 3);
+	QT_CHECK(triangles == optimized_triangles);
+	QT_CHECK(optimized.GetACMR() < acmr);
+	QT_CHECK(optimized.GetACMR() < 1.0f);
+
+	// vertices are numbered in order of first use
+	optimized.GetFaces(indices, indexnum);
+	int maxindex = -1;
+	bool ordered = true;
+	for (int i = 0; i < indexnum; ++i)
+	{
+		ordered = ordered && indices[i] <= maxindex + 1;
+		maxindex = std::max(maxindex, indices[i]);
+	}
+	QT_CHECK(ordered);
+}
+
+BENCHMARK(vertexarray_weld)
+{
+	// 128k triangles in random order, like a track mesh exported without care for locality
+	std::vector <VERTEXARRAY::FACE> grid;
+	BuildTestGrid(256, true, grid);
+
+	const int runs = 5;
+	benchmark::Stopwatch timer;
+	for (int i = 0; i < runs; ++i)
+	{
+		std::vector <float> vertices;
+		std::vector <int> indices;
+		MapWeld(grid, vertices, indices);
+		benchmark::DoNotOptimize(indices);
+	}
+	double map_time = timer.Seconds() / runs;
+
+	VERTEXARRAY varray;
+	timer.Reset();
+	for (int i = 0; i < runs; ++i)
+		varray.BuildFromFaces(grid);
+	double hash_time = timer.Seconds() / runs;
+
+	float acmr = varray.GetACMR();
+	timer.Reset();
+	varray.OptimizeVertexCache();
+	double optimize_time = timer.Seconds();
+
+	out << "vertexarray_weld: " << grid.size() << " triangles" <<
+		", map weld " << map_time * 1E3 << " ms" <<
+		", hash weld " << hash_time * 1E3 << " ms" <<
+		", optimize " << optimize_time * 1E3 << " ms" <<
+		", acmr " << acmr << " -> " << varray.GetACMR() << std::endl;
+}
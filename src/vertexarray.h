@@ -37,6 +37,7 @@ private:
 	std::vector < std::vector <float> > texcoords;
 	std::vector <float> normals;
 	std::vector <float> vertices;
+	std::vector <float> colors;
 	std::vector <int> faces;
 
 public:
@@ -45,10 +46,11 @@ public:
 
 	VERTEXARRAY operator+ (const VERTEXARRAY & v) const;
 
-	void Clear() {texcoords.clear();normals.clear();vertices.clear();faces.clear();}
+	void Clear() {texcoords.clear();normals.clear();vertices.clear();colors.clear();faces.clear();}
 
 	void SetNormals(float * array, size_t count, size_t offset = 0);
 	void SetVertices(float * array, size_t count, size_t offset = 0);
+	void SetColors(float * array, size_t count, size_t offset = 0); ///< optional rgba per vertex, not serialized or combined
 	void SetFaces(int * newarray, size_t newarraycount);
 	void SetTexCoordSets(int newtcsets);
 	void SetTexCoords(size_t set, float * newarray, size_t newarraycount); ///<set is zero indexed
@@ -59,6 +61,7 @@ public:
 	//C style interface functions
 	void GetNormals(const float * & output_array_pointer, int & output_array_num) const;
 	void GetVertices(const float * & output_array_pointer, int & output_array_num) const;
+	void GetColors(const float * & output_array_pointer, int & output_array_num) const;
 	void GetFaces(const int * & output_array_pointer, int & output_array_num) const;
 	inline int GetTexCoordSets() const {return texcoords.size();}
 	void GetTexCoords(size_t set, const float * & output_array_pointer, int & output_array_num) const;
@@ -190,7 +193,16 @@ public:
 				}
 			}
 	};
-	void BuildFromFaces(const std::vector <FACE> & faces);
+	///weld identical vertices, optionally followed by OptimizeVertexCache
+	void BuildFromFaces(const std::vector <FACE> & faces, bool optimize = false);
+
+	///reorder the faces for post-transform vertex cache locality (tipsify) and the vertices
+	///in order of first use for pre-transform fetch locality, the triangles are unchanged
+	void OptimizeVertexCache(unsigned int cachesize = 16);
+
+	///average number of vertex cache misses per triangle for a fifo cache of cachesize entries
+	float GetACMR(unsigned int cachesize = 16) const;
+
 	void Translate(float x, float y, float z);
 	void Rotate(float a, float x, float y, float z);
 	void Scale(float x, float y, float z);